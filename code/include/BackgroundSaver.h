@@ -0,0 +1,184 @@
+#ifndef BACKGROUND_SAVER_H
+#define BACKGROUND_SAVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "fatfs.h"
+#include "LoopCodec.h"
+#include "SdIo.h"
+#include "SnapshotGuard.h"
+
+/** Saves the loop to SD (compressed .LPK, optionally a WAV too) while it
+ ** keeps playing.
+ **
+ ** Begin() opens the files and takes a snapshot of the loop through a
+ ** SnapshotGuard; Step() is then called once per main-loop iteration and
+ ** converts/writes one chunk, so controls and the UI keep running between
+ ** chunks. Each chunk is converted to 16-bit once, written to the WAV and
+ ** encoded as .LPK frames (see LoopCodec.h); with int16 loop storage the
+ ** conversion is a memcpy.
+ **
+ ** The WAV is 16-bit PCM by default, written straight from that chunk. A
+ ** 24-bit or float WAV is converted from the region's float mix by the
+ ** WavWriter format kernels (see WavWriter.h) instead, kWavBlock bytes at
+ ** a time, and gets that format's header; the float one keeps a mix that
+ ** goes over full scale.
+ **
+ ** Regions are written in ring order starting at the record head (see
+ ** SnapshotGuard). The WAV data is therefore written in two runs with an
+ ** f_lseek() in between; .LPK frames carry their position, so that file is
+ ** a plain append. Headers are written up front since the length is known
+ ** at Begin().
+ **
+ ** Every write is whole sectors at a sector-aligned offset, which FatFs
+ ** hands to the card as one multi-block transfer (see SdIo.h): the WAV
+ ** header is padded to a sector with a JUNK chunk, and .LPK frames are
+ ** collected and written out kPackBlock bytes at a time. Both files are
+ ** preallocated (the .LPK at its worst case, trimmed when done). The .LPK
+ ** header is written once more at the end, with the offset of the frame
+ ** at position 0 (see LoopCodec.h).
+ **
+ ** A stereo loop is saved as it's kept, interleaved: a stereo WAV, and
+ ** .LPK frames marked stereo (see LoopCodec.h). Lengths and positions
+ ** here are in buffer samples either way; regions and chunks hold whole
+ ** frames.
+ **
+ ** A multi-track loop is saved as its mix: each region is read from every
+ ** track's plane and summed at the track levels taken at Begin(). A single
+ ** track at full level is copied as is.
+ */
+class BackgroundSaver
+{
+  public:
+    enum class State
+    {
+        IDLE,
+        RUNNING,
+        DONE,
+        FAILED,
+    };
+
+    /** Sample format of the WAV export. */
+    enum class WavExport
+    {
+        S16,
+        S24,
+        F32,
+    };
+
+    /** Regions converted and written per Step() (32 x 512 samples = 32 KB). */
+    static constexpr size_t kChunkRegions = 32;
+
+    /** Most planes a save mixes down. */
+    static constexpr size_t kMaxPlanes = 8;
+
+    /** Planes of the buffer to save, 'stride' samples apart, and the level
+     ** of each in the mix. Muted tracks are saved at level 0. */
+    struct Mixdown
+    {
+        size_t planes;
+        size_t stride;
+        float  level[kMaxPlanes];
+    };
+
+    void Init(SnapshotGuard *guard, float samplerate);
+
+    /** Open the files and snapshot 'length' samples of 'channels'
+     ** interleaved channels, walking from the region that holds 'head'.
+     ** 'wav_name' may be nullptr (.LPK only). Without 'mix' the first plane
+     ** is saved as is. */
+    bool Begin(const char    *pack_name,
+               const char    *wav_name,
+               size_t         length,
+               size_t         head,
+               size_t         channels,
+               const Mixdown *mix    = nullptr,
+               WavExport      format = WavExport::S16);
+
+    /** Write one chunk. 'head' is the current record head, used to restart
+     ** the snapshot if it got torn. */
+    State Step(size_t head);
+
+    /** Stop, close and delete the files (reset/load while saving). */
+    void Abort();
+
+    /** Clear DONE/FAILED back to IDLE once reported. */
+    void Acknowledge()
+    {
+        if(state_ != State::RUNNING)
+            state_ = State::IDLE;
+    }
+
+    inline bool     Active() const { return state_ == State::RUNNING; }
+    inline State    GetState() const { return state_; }
+    inline uint32_t Restarts() const { return restarts_; }
+
+    /** Progress in percent. */
+    int Progress() const;
+
+    /** Size of the .LPK so far, relative to raw 16-bit, in percent. */
+    int Ratio() const;
+
+    /** Largest |sample| written so far, as 16-bit (for the catalog). */
+    inline uint16_t Peak() const { return peak_; }
+
+  private:
+    static constexpr size_t kChunkSamples = kChunkRegions * kSnapshotRegionSize;
+    static constexpr size_t kWavHeaderSize = SdIo::kSector;
+
+    /** .LPK bytes per write. */
+    static constexpr size_t kPackBlock = 32768;
+
+    /** 24-bit/float WAV bytes per write: whole sectors, and whole regions
+     ** at 2, 3 or 4 bytes per sample. */
+    static constexpr size_t kWavBlock = 12288;
+
+    static_assert(kChunkSamples % kCodecFrameSize == 0, "whole frames per chunk");
+    static_assert(kSnapshotRegionSize % 2 == 0 && kCodecFrameSize % 2 == 0,
+                  "stereo pairs aren't split");
+    static_assert(kWavBlock % SdIo::kSector == 0
+                      && kWavBlock % (kSnapshotRegionSize * 2) == 0
+                      && kWavBlock % (kSnapshotRegionSize * 3) == 0
+                      && kWavBlock % (kSnapshotRegionSize * 4) == 0,
+                  "WAV writes are whole sectors and whole regions");
+
+    bool BeginWav(const char *wav_name, size_t length);
+    void ReadRegion(size_t r, int16_t *dst);
+    void MixRegion(size_t r, int16_t *dst, float *wide);
+    bool AddWav(const float *src, size_t n);
+    bool FlushWav();
+    void StartPack();
+    LoopFileHeader PackHeader() const;
+    bool AddFrame(const int16_t *src, size_t n, size_t pos);
+    bool EndPack();
+    bool WriteAt(FIL *f, FSIZE_t offset, const void *data, UINT bytes);
+    void Finish(State result);
+
+    SnapshotGuard *guard_;
+    float          samplerate_;
+    Mixdown        mix_;
+    bool           copy_; // one plane at full level: no mixing
+    size_t         channels_;
+    WavExport      format_;
+
+    FIL      wav_, pack_;
+    char     wav_name_[16], pack_name_[16];
+    bool     wav_open_;
+    FSIZE_t  wav_at_;   // file offset of wav_buf_[0]
+    size_t   wav_fill_; // 24-bit/float WAV bytes in wav_buf_
+    State    state_;
+    size_t   length_;
+    size_t   done_;         // regions written
+    size_t   raw_bytes_;    // ... as 16-bit PCM
+    FSIZE_t  pack_written_; // .LPK bytes on the card
+    size_t   pack_fill_;    // ... and in pack_buf_
+    FSIZE_t  pack_zero_;    // offset of the frame at loop position 0
+    uint16_t peak_;
+    uint32_t restarts_;
+
+    int16_t staging_[kChunkSamples] __attribute__((aligned(32)));
+    uint8_t pack_buf_[kPackBlock + kCodecMaxFrameBytes] __attribute__((aligned(32)));
+    uint8_t wav_buf_[kWavBlock] __attribute__((aligned(32)));
+};
+
+#endif // BACKGROUND_SAVER_H
@@ -0,0 +1,183 @@
+#ifndef CALLBACK_PROFILER_H
+#define CALLBACK_PROFILER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "CycleCounter.h"
+#include "Seqlock.h"
+
+/** Time base for the profiler.
+ **
+ ** On the Daisy this is the DWT cycle counter (480 ticks per us). Off the
+ ** board it's a stand-in on the steady clock in nanoseconds, so budgets
+ ** and overruns are still in real time; the TSC that CycleCounterRead()
+ ** uses there has no known rate. The simulator (sim/, LOOPER_SIM) has its
+ ** own: nanoseconds in the callback, its audio clock in the main loop (see
+ ** SimHal.h).
+ */
+#if defined(__arm__)
+inline uint32_t ProfileTicks()
+{
+    return CycleCounterRead();
+}
+
+inline uint32_t ProfileTicksPerUs()
+{
+    return SystemCoreClock / 1000000;
+}
+#elif defined(LOOPER_SIM)
+#include "SimHal.h"
+
+inline uint32_t ProfileTicks()
+{
+    return SimProfileTicks();
+}
+
+inline uint32_t ProfileTicksPerUs()
+{
+    return 1000;
+}
+#else
+#include <chrono>
+
+inline uint32_t ProfileTicks()
+{
+    using namespace std::chrono;
+    return static_cast<uint32_t>(
+        duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+            .count());
+}
+
+inline uint32_t ProfileTicksPerUs()
+{
+    return 1000;
+}
+#endif
+
+/** Always-on audio callback profiler.
+ **
+ ** The callback is bracketed with BeginBlock()/EndBlock(), and the engine
+ ** times its stages (record, mix, clamp, stretch) with ProfileScope. Per stage it
+ ** keeps min/max/mean time per block and a histogram with power-of-two
+ ** buckets; a block whose total time exceeds its budget (frames at the
+ ** sample rate) counts as an overrun.
+ **
+ ** Cost per block is a couple of timer reads per stage plus a few adds;
+ ** every kPublishBlocks blocks the stats are copied to a Seqlock for the
+ ** main loop to Read(). Reset() is a request the callback picks up at the
+ ** end of its next block, so the two sides never write the same stats.
+ */
+class CallbackProfiler
+{
+  public:
+    enum class Stage : uint8_t
+    {
+        RECORD,  // overdub/first take, incl. undo capture
+        MIX,     // loop + dry to the output
+        CLAMP,   // dry pass-through while stopped
+        STRETCH, // time-stretched playback (search and overlap-add)
+        TOTAL,   // whole callback
+    };
+
+    static constexpr size_t kStages = 5;
+
+    /** Histogram bucket b counts blocks that took [2^(b+kFirstBucket),
+     ** 2^(b+kFirstBucket+1)) ticks; the first and last are open-ended. */
+    static constexpr size_t kBuckets     = 16;
+    static constexpr int    kFirstBucket = 6;
+
+    /** About 20 ms at 4-frame blocks. */
+    static constexpr uint32_t kPublishBlocks = 256;
+
+    struct StageStats
+    {
+        uint32_t min;   // ticks
+        uint32_t max;   // ticks
+        uint64_t sum;   // ticks
+        uint32_t count; // blocks in which the stage ran
+        uint32_t hist[kBuckets];
+    };
+
+    struct Stats
+    {
+        StageStats stage[kStages];
+        uint32_t   blocks;       // callbacks since the last reset
+        uint32_t   overruns;     // callbacks over budget
+        uint32_t   budget;       // ticks per callback, last block size
+        uint32_t   ticks_per_us; // to convert the above
+    };
+
+    void Init(float samplerate);
+
+    // Audio callback
+    inline void BeginBlock()
+    {
+        start_   = ProfileTicks();
+        touched_ = 0;
+    }
+
+    /** Charge the time since 't0' to 'stage' (may be called several times
+     ** per block; the sum is recorded). */
+    inline void Add(Stage stage, uint32_t t0)
+    {
+        const size_t   s = static_cast<size_t>(stage);
+        const uint32_t t = ProfileTicks() - t0;
+        pending_[s] = (touched_ & (1u << s)) ? pending_[s] + t : t;
+        touched_ |= 1u << s;
+    }
+
+    void EndBlock(size_t frames);
+
+    // Main loop
+    inline Stats Read() const { return published_.Read(); }
+    void         Reset() { reset_.store(true, std::memory_order_relaxed); }
+
+    /** Mean of a stage in ticks (0 if it never ran). */
+    static uint32_t Mean(const StageStats &st)
+    {
+        return st.count ? static_cast<uint32_t>(st.sum / st.count) : 0;
+    }
+
+    /** Ticks to tenths of a microsecond, for display. */
+    static uint32_t TenthsUs(uint32_t ticks, uint32_t ticks_per_us)
+    {
+        return static_cast<uint32_t>((static_cast<uint64_t>(ticks) * 10)
+                                     / ticks_per_us);
+    }
+
+  private:
+    void Clear();
+    void Record(size_t stage, uint32_t ticks);
+
+    uint32_t ticks_per_frame_;
+    uint32_t start_;
+    uint32_t touched_; // stages run this block, one bit each
+    uint32_t pending_[kStages];
+
+    Stats             stats_; // audio callback only
+    std::atomic<bool> reset_;
+    Seqlock<Stats>    published_;
+};
+
+/** Times a scope as one stage; does nothing without a profiler. */
+class ProfileScope
+{
+  public:
+    ProfileScope(CallbackProfiler *profiler, CallbackProfiler::Stage stage)
+    : profiler_(profiler), stage_(stage), t0_(profiler ? ProfileTicks() : 0)
+    {
+    }
+    ~ProfileScope()
+    {
+        if(profiler_)
+            profiler_->Add(stage_, t0_);
+    }
+
+  private:
+    CallbackProfiler       *profiler_;
+    CallbackProfiler::Stage stage_;
+    uint32_t                t0_;
+};
+
+#endif // CALLBACK_PROFILER_H
@@ -0,0 +1,34 @@
+#ifndef CONST_MATH_H
+#define CONST_MATH_H
+
+/** Math for tables built at compile time: <cmath> isn't constexpr before
+ ** C++26, and the firmware builds as C++14. Double precision throughout;
+ ** the callers round to float once, when the table is stored.
+ */
+namespace const_math
+{
+static constexpr double kPi = 3.14159265358979323846;
+
+constexpr double Sin(double x)
+{
+    // Down to [-pi, pi], then a Taylor series well past double precision
+    while(x > kPi)
+        x -= 2.0 * kPi;
+    while(x < -kPi)
+        x += 2.0 * kPi;
+    double term = x, sum = x;
+    for(int k = 1; k < 14; k++)
+    {
+        term *= -x * x / ((2 * k) * (2 * k + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double Cos(double x)
+{
+    return Sin(kPi / 2.0 - (x < 0.0 ? -x : x)); // even to the last bit
+}
+} // namespace const_math
+
+#endif // CONST_MATH_H
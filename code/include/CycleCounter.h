@@ -0,0 +1,54 @@
+#ifndef CYCLE_COUNTER_H
+#define CYCLE_COUNTER_H
+
+#include <cstdint>
+
+/** Free-running cycle counter used for profiling.
+ **
+ ** On the Daisy (Cortex-M7 @ 480 MHz) this reads the DWT CYCCNT register,
+ ** which wraps every ~8.9 s; differences taken with unsigned arithmetic are
+ ** therefore valid for any interval shorter than that. CycleCounterInit()
+ ** is called once at boot (CallbackProfiler::Init()) and only starts the
+ ** counter: the callback profiler and the task scheduler time against it
+ ** all the time, so it's never reset (that would turn their intervals in
+ ** flight into ~2^32 ticks).
+ ** On a host build it falls back to the TSC (x86) or a nanosecond clock, so
+ ** the same benchmarking code can be compiled and run off the board.
+ */
+#if defined(__arm__)
+#include "stm32h7xx.h"
+
+inline void CycleCounterInit()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+inline uint32_t CycleCounterRead()
+{
+    return DWT->CYCCNT;
+}
+
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+inline void     CycleCounterInit() {}
+inline uint32_t CycleCounterRead()
+{
+    return static_cast<uint32_t>(__rdtsc());
+}
+
+#else
+#include <chrono>
+
+inline void     CycleCounterInit() {}
+inline uint32_t CycleCounterRead()
+{
+    using namespace std::chrono;
+    return static_cast<uint32_t>(
+        duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+            .count());
+}
+#endif
+
+#endif // CYCLE_COUNTER_H
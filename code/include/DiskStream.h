@@ -0,0 +1,180 @@
+#ifndef DISK_STREAM_H
+#define DISK_STREAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "fatfs.h"
+#include "LoopSample.h"
+#include "Seqlock.h"
+
+/** Samples per stream chunk (32 KB on the card). */
+constexpr size_t kStreamChunkSize = 16384;
+
+/** Ring slots for streamed chunks: 16 x 16384 samples is ~5.5 s at 48 kHz
+ ** of read-ahead, enough to ride out the longest blocking ShowMessage(). */
+constexpr size_t kStreamSlots = 16;
+
+/** Chunks at the start of the loop that stay in SDRAM (~680 ms). They let
+ ** the head jump back to 0 (loop wrap, end of the first take) without
+ ** waiting for the card. */
+constexpr size_t kStreamPinnedChunks = 2;
+
+/** SDRAM for a DiskStream. Place in DSY_SDRAM_BSS. */
+struct DiskStreamStorage
+{
+    loop_sample_t pinned[kStreamPinnedChunks * kStreamChunkSize];
+    loop_sample_t ring[kStreamSlots * kStreamChunkSize];
+};
+
+/** Loop that lives on the SD card, for loops longer than buf[].
+ **
+ ** The loop is a raw 16-bit file (same layout as the .BIN files) cut into
+ ** chunks of kStreamChunkSize samples. The first kStreamPinnedChunks are
+ ** always resident; the rest pass through a ring of kStreamSlots in SDRAM.
+ ** It's WavWriter's two-half buffer generalized to a ring: the audio
+ ** callback plays and overdubs in one slot while the main loop reads the
+ ** chunks ahead of it (read-ahead) and writes overdubbed chunks behind it
+ ** back to the card (write-behind).
+ **
+ ** Every chunk the head enters gets the next sequence number, and a ring
+ ** slot holds sequence s in slot s % kStreamSlots. The audio side only ever
+ ** publishes the sequence it's in (everything before it is released); the
+ ** main side publishes, per slot, the sequence it has loaded. Neither side
+ ** waits: a chunk that isn't loaded by the time the head gets there plays
+ ** as silence and counts as an underrun.
+ **
+ ** Service() (main loop) does one card access per call in deadline order:
+ ** released chunks are written back before a slot is reused, then the
+ ** next chunk ahead is read. When the lead over the head drops below
+ ** kUrgentLead it catches up with several accesses in one call. The
+ ** read-ahead never runs a full loop ahead, so a chunk is always written
+ ** back before its next pass is read.
+ **
+ ** Starting a new first take or closing one changes which chunk the next
+ ** sequences map to; the audio side then skips ahead kStreamSlots sequence
+ ** numbers, so nothing loaded for the old layout is ever taken for the new
+ ** one.
+ */
+class DiskStream
+{
+  public:
+    /** Below this much audio queued ahead of the head, Service() keeps
+     ** going instead of returning after one access. */
+    static constexpr size_t kUrgentLead = 4 * kStreamChunkSize;
+
+    struct Stats
+    {
+        uint32_t underruns;    // chunks the head reached before they loaded
+        uint32_t reads;        // chunks read from the card
+        uint32_t writes;       // chunks written back
+        uint32_t errors;       // failed card accesses
+        uint32_t read_us_max;  // slowest read
+        uint32_t write_us_max; // slowest write
+        uint32_t lead;         // samples loaded ahead of the head, now
+        uint32_t lead_min;     // ... lowest seen while the head moved
+    };
+
+    void Init(DiskStreamStorage *mem);
+
+    /** Open (or create) the stream file and make sure it can hold
+     ** 'capacity' samples (rounded down to whole chunks). Slow the first
+     ** time: the file is preallocated. */
+    bool Open(const char *path, size_t capacity);
+    void Close();
+
+    inline bool   IsOpen() const { return open_; }
+    inline size_t Capacity() const { return capacity_; }
+
+    // Audio callback
+
+    /** Start an empty first take at position 0. */
+    void Restart();
+
+    /** First take finished with 'length' samples; the head goes to 0. */
+    void CloseTake(size_t length);
+
+    /** End of the chunk holding 'pos': a segment must not cross it. */
+    static inline size_t ChunkEnd(size_t pos)
+    {
+        return (pos / kStreamChunkSize + 1) * kStreamChunkSize;
+    }
+
+    /** Loop memory for [pos, pos + n) (within one chunk), or nullptr if
+     ** it isn't loaded yet. 'record' marks it for write-back. */
+    loop_sample_t *Map(size_t pos, size_t n, bool record);
+
+    // Main loop
+
+    /** Read-ahead / write-behind. Returns false if there was nothing to do. */
+    bool Service();
+
+    /** Write back everything overdubbed so far, incl. the chunk being
+     ** played, so the file holds the loop as it sounds now. */
+    bool Flush();
+
+    Stats GetStats() const;
+
+  private:
+    struct Layout
+    {
+        uint32_t generation; // bumped on Restart()/CloseTake()
+        uint32_t base;       // first sequence of this layout
+        uint32_t chunks;     // streamed chunks per pass (after the pinned ones)
+        bool     first_take; // chunks ahead are still silence
+    };
+
+    static constexpr size_t kNone = SIZE_MAX;
+
+    static inline bool Before(uint32_t a, uint32_t b)
+    {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+
+    size_t ChunkOf(uint32_t seq) const;
+    void   NewLayout(uint32_t chunks, bool first_take);
+    bool   Step();
+    void   UpdateLead(uint32_t head);
+    bool   ReadSlot(uint32_t seq);
+    bool   WriteSlot(uint32_t seq);
+    bool   WritePinned();
+    bool   Transfer(size_t chunk, bool write, loop_sample_t *mem, size_t n);
+
+    DiskStreamStorage *mem_;
+    FIL                file_;
+    bool               open_;
+    size_t             capacity_;
+
+    // Audio callback only
+    uint32_t next_seq_;     // sequence for the next streamed chunk entered
+    uint32_t cur_seq_;      // sequence of cur_chunk_
+    uint32_t starved_seq_;  // last sequence counted as an underrun
+    size_t   cur_chunk_;    // streamed chunk the head is in, or kNone
+    size_t   pinned_clean_; // first take: pinned[0, pinned_clean_) zeroed
+    bool     first_take_;
+    uint32_t generation_;
+
+    // Audio callback -> main loop
+    std::atomic<uint32_t> head_seq_; // sequences before this are released
+    std::atomic<uint32_t> head_pos_;
+    std::atomic<bool>     in_pinned_;
+    std::atomic<bool>     pinned_dirty_;
+    std::atomic<bool>     dirty_[kStreamSlots];
+    std::atomic<uint32_t> underruns_;
+    Seqlock<Layout>       layout_;
+
+    // Main loop -> audio callback
+    std::atomic<uint32_t> ready_seq_[kStreamSlots]; // sequence loaded per slot
+
+    // Main loop only
+    Layout   main_layout_;
+    uint32_t filled_;  // next sequence to read ahead
+    uint32_t flushed_; // next sequence to write back
+    size_t   slot_chunk_[kStreamSlots];
+    uint32_t last_head_pos_;
+    Stats    stats_;
+
+    int16_t staging_[kStreamChunkSize] __attribute__((aligned(32)));
+};
+
+#endif // DISK_STREAM_H
@@ -0,0 +1,125 @@
+#ifndef INTERPOLATION_H
+#define INTERPOLATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include "ConstMath.h"
+
+/** Fractional read head kernels (varispeed, see LoopEngine "Speed").
+ **
+ ** The head's position is fixed point: frames in the upper bits, the
+ ** fraction in the low kInterpFracBits. Each call renders a block: output
+ ** frame i is the source read at phase + i * step, so a block is one pass
+ ** with no per-sample wrap or bounds checks. The caller gathers the frames
+ ** the head passes over into a flat window first (the loop wrap, the tracks
+ ** and the storage type are dealt with there), with kInterpBefore frames
+ ** of margin before the first position and kInterpAfter after the last.
+ **
+ ** The kernels, cheapest first:
+ **  - LINEAR:  two taps.
+ **  - HERMITE: four-point cubic Hermite (Catmull-Rom): much less dulling
+ **             and imaging than linear, for about twice the cost.
+ **  - SINC:    eight-tap Blackman-windowed sinc, polyphase: the coefficients
+ **             for kSincPhases + 1 fractions are a table, and a frame blends
+ **             the two rows around its fraction, then takes eight
+ **             multiply-adds per channel. The table is built by a constexpr
+ **             function at compile time and lives in flash; there is no
+ **             setup at boot.
+ **
+ ** All three reproduce the source exactly at whole-frame positions (the
+ ** sinc's cutoff is Nyquist), so 1x and reverse at -1x are bit-exact.
+ ** Above 1x nothing is filtered: like a tape, the top octave folds back.
+ **
+ ** Windows hold 'channels' interleaved samples per frame, like the loop.
+ */
+
+enum class Interp : uint8_t
+{
+    LINEAR,
+    HERMITE,
+    SINC,
+};
+
+static constexpr size_t kInterpKinds = 3;
+
+/** Head positions and steps: 1 << kInterpFracBits is one frame. */
+static constexpr int      kInterpFracBits = 16;
+static constexpr int32_t  kInterpOne      = 1 << kInterpFracBits;
+static constexpr uint32_t kInterpFracMask = kInterpOne - 1;
+
+/** Window margin around the head's path, enough for every kernel. */
+static constexpr size_t kInterpBefore = 3;
+static constexpr size_t kInterpAfter  = 4;
+
+/** Polyphase sinc: taps, and fractions a frame is cut into. */
+static constexpr size_t kSincTaps      = kInterpBefore + kInterpAfter + 1;
+static constexpr int    kSincPhaseBits = 7;
+static constexpr size_t kSincPhases    = 1 << kSincPhaseBits;
+
+struct SincTable
+{
+    // Row p: fraction p / kSincPhases. Tap k weighs frame k - kInterpBefore.
+    float c[kSincPhases + 1][kSincTaps];
+};
+
+namespace interp_detail
+{
+/** Windowed sinc at 't' frames from the head, zero beyond half the taps. */
+constexpr double Tap(double t)
+{
+    constexpr double half = kSincTaps / 2.0;
+    if(t <= -half || t >= half)
+        return 0.0;
+    if(t == static_cast<double>(static_cast<long>(t)))
+        return t == 0.0 ? 1.0 : 0.0; // the sinc's zeros, exactly
+    using namespace const_math;
+    const double w = 0.42 + 0.5 * Cos(kPi * t / half) + 0.08 * Cos(2.0 * kPi * t / half);
+    const double s = Sin(kPi * t) / (kPi * t);
+    return s * w;
+}
+} // namespace interp_detail
+
+/** Coefficients of every phase, each row scaled to unity gain at DC. */
+constexpr SincTable MakeSincTable()
+{
+    SincTable table = {};
+    for(size_t p = 0; p <= kSincPhases; p++)
+    {
+        const double frac = static_cast<double>(p) / kSincPhases;
+        double       row[kSincTaps] = {};
+        double       sum            = 0.0;
+        for(size_t k = 0; k < kSincTaps; k++)
+        {
+            row[k] = interp_detail::Tap(static_cast<double>(k) - kInterpBefore - frac);
+            sum += row[k];
+        }
+        for(size_t k = 0; k < kSincTaps; k++)
+            table.c[p][k] = static_cast<float>(row[k] / sum);
+    }
+    return table;
+}
+
+/** Built at compile time (Interpolation.cpp). */
+extern const SincTable kSincTable;
+
+/** Frames a window needs for 'n' output frames at up to 'max_step' (in
+ ** kInterpOne units) per frame. */
+constexpr size_t InterpWindowFrames(size_t n, int32_t max_step)
+{
+    return (n * static_cast<size_t>(max_step) + kInterpOne - 1) / kInterpOne + 1 + kInterpBefore
+           + kInterpAfter;
+}
+
+/** Render 'n' frames of 'channels' (1 or 2) interleaved samples into 'out':
+ ** frame i is 'win' read at (phase + i * step) / kInterpOne frames, phase
+ ** counted from win[0]. Every position must be at least kInterpBefore
+ ** frames into the window, and kInterpAfter frames from its end. */
+void Interpolate(Interp       kind,
+                 float       *out,
+                 const float *win,
+                 uint32_t     phase,
+                 int32_t      step,
+                 size_t       n,
+                 size_t       channels);
+
+#endif // INTERPOLATION_H
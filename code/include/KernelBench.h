@@ -0,0 +1,248 @@
+#ifndef KERNEL_BENCH_H
+#define KERNEL_BENCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include "CycleCounter.h"
+#include "Interpolation.h"
+#include "LoopKernels.h"
+
+/** Micro-benchmark for the loop engine kernels.
+ **
+ ** Runs one overdub + mix pass per block, walking through a caller supplied
+ ** scratch loop so the loads hit the same memory (SDRAM on the pod) as the
+ ** real engine, and reports the mean cycles per block for the scalar and
+ ** vectorised kernels of the configured loop storage type.
+ **
+ ** Only depends on LoopKernels.h, Interpolation.h and CycleCounter.h, so it
+ ** builds unchanged on the pod (Settings menu) and on a host (make -C
+ ** code/sim bench, sim/SimBench.cpp). The cycle counter has to be running
+ ** already (CycleCounterInit() at boot):
+ **
+ **     static loop_sample_t scratch[1 << 16];
+ **     KernelBenchResult r = RunKernelBench(scratch, 1 << 16, 4, 10000);
+ **     printf("%u frames: scalar %.1f  vec %.1f\n",
+ **            (unsigned)r.block_frames, r.scalar_cycles, r.vector_cycles);
+ */
+struct KernelBenchResult
+{
+    size_t block_frames;
+    float  scalar_cycles; // mean cycles per block, scalar kernels
+    float  vector_cycles; // mean cycles per block, vector kernels
+};
+
+inline KernelBenchResult RunKernelBench(loop_sample_t *scratch,
+                                        size_t scratch_len,
+                                        size_t block_frames,
+                                        int    iterations)
+{
+    static constexpr size_t kMaxBenchBlock = 256;
+    float                   dry[kMaxBenchBlock];
+    float                   out[kMaxBenchBlock];
+    volatile float          sink; // keeps the mix output observable
+
+    KernelBenchResult res = {block_frames, 0.0f, 0.0f};
+    if(block_frames == 0 || block_frames > kMaxBenchBlock
+       || scratch_len < block_frames || iterations <= 0)
+    {
+        return res;
+    }
+
+    for(size_t i = 0; i < block_frames; i++)
+    {
+        dry[i] = 0.25f * static_cast<float>(i % 7) - 0.75f;
+    }
+    for(size_t i = 0; i < scratch_len; i++)
+    {
+        scratch[i] = 0;
+    }
+
+    // Scalar reference
+    size_t   pos   = 0;
+    uint64_t total = 0;
+    for(int it = 0; it < iterations; it++)
+    {
+        if(pos + block_frames > scratch_len)
+            pos = 0;
+        const uint32_t t0 = CycleCounterRead();
+        OverdubScalar(scratch + pos, dry, block_frames);
+        MixScalar(out, dry, scratch + pos, 0.75f, block_frames);
+        total += static_cast<uint32_t>(CycleCounterRead() - t0);
+        sink = out[block_frames - 1];
+        pos += block_frames;
+    }
+    res.scalar_cycles = static_cast<float>(total) / iterations;
+
+    // Vectorised
+    pos   = 0;
+    total = 0;
+    for(int it = 0; it < iterations; it++)
+    {
+        if(pos + block_frames > scratch_len)
+            pos = 0;
+        const uint32_t t0 = CycleCounterRead();
+        OverdubVec(scratch + pos, dry, block_frames);
+        MixVec(out, dry, scratch + pos, 0.75f, block_frames);
+        total += static_cast<uint32_t>(CycleCounterRead() - t0);
+        sink = out[block_frames - 1];
+        pos += block_frames;
+    }
+    res.vector_cycles = static_cast<float>(total) / iterations;
+    (void)sink;
+
+    return res;
+}
+
+/** Cost of the multi-track mix as tracks are added.
+ **
+ ** Mixes 'tracks' planes of the scratch loop (scratch_len / tracks samples
+ ** apart) into one block: fused is MixTracksVec(), one pass for all of
+ ** them; separate is one MixVec() pass per track, each adding to the
+ ** previous one's output, for comparison. Mean cycles per block:
+ **
+ **     for(size_t t = 1; t <= kMaxTracks; t++)
+ **         RunTrackBench(scratch, 1 << 16, 48, t, 10000);
+ */
+struct TrackBenchResult
+{
+    size_t tracks;
+    float  fused_cycles;    // mean cycles per block, MixTracksVec()
+    float  separate_cycles; // mean cycles per block, a MixVec() per track
+};
+
+inline TrackBenchResult RunTrackBench(loop_sample_t *scratch,
+                                      size_t         scratch_len,
+                                      size_t         block_frames,
+                                      size_t         tracks,
+                                      int            iterations)
+{
+    static constexpr size_t kMaxBenchBlock = 256;
+    float                   dry[kMaxBenchBlock];
+    float                   out[2][kMaxBenchBlock];
+    volatile float          sink;
+
+    TrackBenchResult res = {tracks, 0.0f, 0.0f};
+    if(tracks == 0 || tracks > loop_kernels::kMaxMixTracks || block_frames == 0
+       || block_frames > kMaxBenchBlock || scratch_len / tracks < block_frames
+       || iterations <= 0)
+    {
+        return res;
+    }
+
+    const size_t plane = scratch_len / tracks;
+    for(size_t i = 0; i < block_frames; i++)
+    {
+        dry[i] = 0.25f * static_cast<float>(i % 7) - 0.75f;
+    }
+    for(size_t i = 0; i < scratch_len; i++)
+    {
+        scratch[i] = static_cast<loop_sample_t>(i % 5);
+    }
+
+    const loop_sample_t *loops[loop_kernels::kMaxMixTracks];
+    float                gains[loop_kernels::kMaxMixTracks];
+    for(size_t t = 0; t < tracks; t++)
+    {
+        gains[t] = 0.75f;
+    }
+
+    // Fused
+    size_t   pos   = 0;
+    uint64_t total = 0;
+    for(int it = 0; it < iterations; it++)
+    {
+        if(pos + block_frames > plane)
+            pos = 0;
+        for(size_t t = 0; t < tracks; t++)
+            loops[t] = scratch + t * plane + pos;
+        const uint32_t t0 = CycleCounterRead();
+        MixTracksVec(out[0], dry, loops, gains, tracks, block_frames);
+        total += static_cast<uint32_t>(CycleCounterRead() - t0);
+        sink = out[0][block_frames - 1];
+        pos += block_frames;
+    }
+    res.fused_cycles = static_cast<float>(total) / iterations;
+
+    // A pass per track
+    pos   = 0;
+    total = 0;
+    for(int it = 0; it < iterations; it++)
+    {
+        if(pos + block_frames > plane)
+            pos = 0;
+        const uint32_t t0 = CycleCounterRead();
+        MixVec(out[0], dry, scratch + pos, gains[0], block_frames);
+        for(size_t t = 1; t < tracks; t++)
+            MixVec(out[t & 1], out[(t - 1) & 1], scratch + t * plane + pos, gains[t], block_frames);
+        total += static_cast<uint32_t>(CycleCounterRead() - t0);
+        sink = out[(tracks - 1) & 1][block_frames - 1];
+        pos += block_frames;
+    }
+    res.separate_cycles = static_cast<float>(total) / iterations;
+    (void)sink;
+
+    return res;
+}
+
+/** Cost of the varispeed read head per kernel.
+ **
+ ** Renders blocks of 'block_frames' with each Interpolate() kernel at a
+ ** speed that keeps the fraction moving (1.37x), from a window the size
+ ** the engine gathers, for 'channels' (1 or 2). Mean cycles per block,
+ ** indexed by Interp:
+ **
+ **     InterpBenchResult r = RunInterpBench(48, 2, 10000);
+ **     r.cycles[static_cast<size_t>(Interp::SINC)]
+ */
+struct InterpBenchResult
+{
+    size_t block_frames;
+    size_t channels;
+    float  cycles[kInterpKinds]; // mean cycles per block
+};
+
+inline InterpBenchResult RunInterpBench(size_t block_frames,
+                                        size_t channels,
+                                        int    iterations)
+{
+    static constexpr size_t  kMaxBenchBlock = 64;
+    static constexpr int32_t kStep          = kInterpOne * 137 / 100;
+    static constexpr size_t  kWindow        = InterpWindowFrames(kMaxBenchBlock, kStep);
+    float                    win[kWindow * 2];
+    float                    out[kMaxBenchBlock * 2];
+    volatile float           sink;
+
+    InterpBenchResult res = {block_frames, channels, {}};
+    if(block_frames == 0 || block_frames > kMaxBenchBlock || channels == 0
+       || channels > 2 || iterations <= 0)
+    {
+        return res;
+    }
+
+    for(size_t i = 0; i < kWindow * 2; i++)
+    {
+        win[i] = 0.25f * static_cast<float>(i % 7) - 0.75f;
+    }
+
+    for(size_t k = 0; k < kInterpKinds; k++)
+    {
+        // The fraction walks on from block to block, like the engine's
+        uint32_t frac  = 0;
+        uint64_t total = 0;
+        for(int it = 0; it < iterations; it++)
+        {
+            const uint32_t phase = (kInterpBefore << kInterpFracBits) + frac;
+            const uint32_t t0    = CycleCounterRead();
+            Interpolate(static_cast<Interp>(k), out, win, phase, kStep, block_frames, channels);
+            total += static_cast<uint32_t>(CycleCounterRead() - t0);
+            sink = out[block_frames * channels - 1];
+            frac = (frac + kStep * static_cast<uint32_t>(block_frames)) & kInterpFracMask;
+        }
+        res.cycles[k] = static_cast<float>(total) / iterations;
+    }
+    (void)sink;
+
+    return res;
+}
+
+#endif // KERNEL_BENCH_H
@@ -0,0 +1,55 @@
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <cstddef>
+#include <cstdint>
+
+/** Round-trip latency measurement (Settings > Latency).
+ **
+ ** An overdub is played along to what comes out of the pod, and what the
+ ** player does reaches the input again after the codec's output and input
+ ** latency plus whatever is in between (amp, effects, converters). The
+ ** engine writes overdubs that far behind the play head; this measures
+ ** how far.
+ **
+ ** The output has to get back to the input for it: a cable, or the amp's
+ ** send/return. kPings clicks go out kInterval samples apart, and each is
+ ** timed from the sample it started on to the first input sample above
+ ** kThreshold. The result is the median of the pings that came back, or
+ ** -1 if fewer than half of them did (nothing patched, level too low).
+ **
+ ** Audio callback only: the engine runs it in place of the loop while a
+ ** calibration is on (see LoopEngine::Calibrate()).
+ */
+class LatencyProbe
+{
+  public:
+    static constexpr size_t kPings     = 8;
+    static constexpr size_t kInterval  = 9600; // 200 ms: the last click has died down
+    static constexpr size_t kClick     = 8;    // samples per click
+    static constexpr float  kLevel     = 0.5f;
+    static constexpr float  kThreshold = 0.1f;
+
+    void Start();
+
+    inline bool Active() const { return active_; }
+
+    /** One mono block: clicks out, the input watched. */
+    void Process(const float *in, float *out, size_t n);
+
+    /** Round trip in samples, or -1 (see above). */
+    inline int32_t Result() const { return result_; }
+
+  private:
+    void Finish();
+
+    bool     active_ = false;
+    size_t   ping_;  // clicks sent
+    size_t   t_;     // samples since the current click started
+    bool     heard_; // the current click came back
+    size_t   got_;   // pings that came back
+    uint32_t times_[kPings];
+    int32_t  result_ = -1;
+};
+
+#endif // LATENCY_PROBE_H
@@ -0,0 +1,182 @@
+#ifndef LAYER_MANAGER_H
+#define LAYER_MANAGER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "LoopSample.h"
+
+class SessionJournal;
+class WaveOverview;
+
+/** Size of one undo region in samples. Overdub passes are tracked at this
+ ** granularity: the first time a pass writes into a region, the region's
+ ** previous contents are copied into the undo pool. */
+static constexpr size_t kLayerRegionSize = 512;
+
+/** Backing memory for the LayerManager, meant to be placed in SDRAM:
+ **
+ **     static LayerStorage<MAX_SIZE, UNDO_POOL_SLOTS> DSY_SDRAM_BSS undo_mem;
+ **
+ ** Must stay trivially constructible (SDRAM is not up during static init).
+ */
+template <size_t loop_size, size_t pool_slots>
+struct LayerStorage
+{
+    static constexpr size_t kRegions
+        = (loop_size + kLayerRegionSize - 1) / kLayerRegionSize;
+    static constexpr size_t kSlots = pool_slots;
+
+    loop_sample_t pool[pool_slots * kLayerRegionSize]; // region images
+    uint32_t      slot_region[pool_slots];             // slot -> region index
+    uint16_t      region_stamp[kRegions];              // last layer that captured
+    uint32_t      region_slot[kRegions];               // redirect during undo/redo
+};
+
+/** Overdub undo/redo stack with sparse delta storage.
+ **
+ ** Each overdub pass is one layer. A layer only stores the regions the pass
+ ** actually touched, as copies of their contents from before the pass. The
+ ** pool is used as a ring of region slots, layers are contiguous runs of
+ ** slots in creation order, so evicting the oldest layer is O(1).
+ **
+ ** Undo and redo are the same operation: the layer's slots are swapped with
+ ** the loop buffer. The swap is spread over several audio blocks by
+ ** Service(), but becomes audible all at once: while it is in flight the
+ ** read path uses Resolve(), which redirects reads of not-yet-swapped
+ ** regions into the pool. Listeners hear the switch at a block boundary,
+ ** and a full 5-minute buffer is never copied.
+ **
+ ** The first take is the base and cannot be undone. Limits:
+ ** - at most kMaxLayers layers (oldest is dropped when exceeded)
+ ** - pool full: older layers are dropped to make room; if the active pass
+ **   alone overflows the pool it is discarded when it closes (counted in
+ **   Stats::dropped), so a long session can never run SDRAM dry.
+ **
+ ** With an optional WaveOverview, each region is rescanned into it once
+ ** its swap is complete, and an optional SessionJournal is told it changed.
+ **
+ ** Threading: apart from Init(), everything runs in the audio callback;
+ ** the main loop reaches it through LoopEngine's command queue and reads
+ ** Stats from its status snapshot.
+ */
+class LayerManager
+{
+  public:
+    static constexpr size_t kMaxLayers = 16;
+
+    struct Stats
+    {
+        size_t   undoable;       // layers that can be undone
+        size_t   redoable;       // layers that can be redone
+        size_t   used_bytes;     // pool bytes holding layer data
+        size_t   capacity_bytes; // pool size
+        uint32_t dropped;        // layers lost to pool overflow
+    };
+
+    template <typename Storage>
+    void Init(loop_sample_t  *loop,
+              size_t          loop_size,
+              Storage        &mem,
+              WaveOverview   *overview = nullptr,
+              SessionJournal *journal  = nullptr)
+    {
+        Init(loop,
+             loop_size,
+             mem.pool,
+             mem.slot_region,
+             Storage::kSlots,
+             mem.region_stamp,
+             mem.region_slot,
+             Storage::kRegions,
+             overview,
+             journal);
+    }
+
+    /** Forget all layers (reset / load). Cheap enough for the callback. */
+    void Clear();
+
+    /** Start / finish recording an overdub pass. */
+    void OpenLayer();
+    void CloseLayer();
+
+    /** Save the previous contents of any regions in [pos, pos + n) not yet
+     ** captured by the open layer. Call before overdubbing that range. */
+    void Capture(size_t pos, size_t n);
+
+    /** Queue an undo/redo. Fails while recording or while another
+     ** operation is still being applied. */
+    bool RequestUndo();
+    bool RequestRedo();
+
+    /** Advance a pending undo/redo by up to 'budget' samples. */
+    void Service(size_t budget);
+
+    /** True while an undo/redo is being applied. */
+    inline bool Busy() const { return busy_; }
+
+    /** Read pointer for the loop at 'pos' while Busy(). Shrinks 'n' to the
+     ** number of samples that may be read contiguously from it. */
+    const loop_sample_t *Resolve(size_t pos, size_t &n) const;
+
+    Stats GetStats() const;
+
+  private:
+    struct Layer
+    {
+        uint32_t first_slot;
+        uint32_t count;
+    };
+
+    static constexpr uint32_t kNoSlot = 0xFFFFFFFFu;
+
+    void Init(loop_sample_t  *loop,
+              size_t          loop_size,
+              loop_sample_t  *pool,
+              uint32_t       *slot_region,
+              size_t          pool_slots,
+              uint16_t       *region_stamp,
+              uint32_t       *region_slot,
+              size_t          regions,
+              WaveOverview   *overview,
+              SessionJournal *journal);
+
+    bool   StartOp(size_t layer_index);
+    void   DropOldest();
+    Layer &LayerAt(size_t i) { return layers_[(base_ + i) % kMaxLayers]; }
+    size_t RegionLength(size_t region) const;
+
+    loop_sample_t  *loop_;
+    size_t          loop_size_;
+    loop_sample_t  *pool_;
+    uint32_t       *slot_region_;
+    size_t          slots_;
+    uint16_t       *region_stamp_;
+    uint32_t       *region_slot_;
+    size_t          regions_;
+    WaveOverview   *overview_;
+    SessionJournal *journal_;
+
+    // Slot ring
+    size_t head_; // oldest used slot
+    size_t used_; // used slots
+
+    // Layer stack: [0, top_) applied, [top_, total_) redoable
+    Layer  layers_[kMaxLayers];
+    size_t base_;
+    size_t top_;
+    size_t total_;
+
+    // Open overdub pass
+    bool     open_;
+    bool     overflow_;
+    uint16_t serial_;
+    uint32_t dropped_;
+
+    // Pending undo/redo
+    volatile bool busy_;
+    bool          op_undo_;
+    Layer         op_layer_;
+    size_t        op_cursor_; // samples swapped so far
+};
+
+#endif // LAYER_MANAGER_H
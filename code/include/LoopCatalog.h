@@ -0,0 +1,152 @@
+#ifndef LOOP_CATALOG_H
+#define LOOP_CATALOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include "fatfs.h"
+#include "WaveOverview.h"
+
+/** Thumbnail columns per catalog entry. */
+static constexpr size_t kCatalogThumbSize = 32;
+
+/** LoopCatalogEntry::peak when it isn't known (file found by a scan). */
+static constexpr uint16_t kCatalogNoPeak = 0xFFFF;
+
+/** One loop on the card: a fixed-size record of the catalog file. */
+struct LoopCatalogEntry
+{
+    uint32_t id;          // n of LOOPn (creation order), 0 for other files
+    uint32_t length;      // samples
+    uint32_t sample_rate; // Hz
+    uint16_t peak;        // largest |sample| as 16-bit, or kCatalogNoPeak
+    uint16_t reserved0;
+    char     name[16];    // file to load (8.3)
+    WavePeak thumb[kCatalogThumbSize]; // all zero if not known
+    uint8_t  reserved[32];
+};
+
+/** Index of the loops on the SD card (LOOPS.CAT).
+ **
+ ** Recall used to walk the root directory each time, matching names and
+ ** stopping at ten, and save names came from a counter that started over
+ ** at boot. The catalog keeps one record per loop instead, so:
+ **  - Open() reads the header at boot; the directory is only scanned if
+ **    the file is missing or damaged (or on Rescan()).
+ **  - Entry i is at a known offset. Read() pages kPageEntries records in
+ **    with one sector-aligned transfer, so paging through thousands of
+ **    loops is a read per page.
+ **  - Add() appends the record of a finished save, then rewrites the
+ **    header; a record past the header's count (power lost in between) is
+ **    simply not there yet.
+ **  - NewName() hands out LOOPn names from a counter kept in the header,
+ **    skipping any that exist on the card.
+ **
+ ** File layout (little endian): a one-sector Header, then the 128-byte
+ ** records in the order they were added. Read(0) is the newest.
+ **
+ ** Entries don't follow files deleted or copied on a PC: loading a missing
+ ** one fails, and Rescan() rebuilds the list from the directory, keeping
+ ** the peak and thumbnail of loops it already had.
+ **
+ ** Main loop only.
+ */
+class LoopCatalog
+{
+  public:
+    /** Reads a WAV's rate and length (frames) for a scan. */
+    typedef bool (*WavProbe)(const char *name, uint32_t *rate, uint32_t *frames);
+
+    enum class Scan
+    {
+        RUNNING,
+        DONE,
+        FAILED,
+    };
+
+    /** Records per page read (2 KB, four sectors). */
+    static constexpr size_t kPageEntries = 16;
+
+    /** Highest LOOPn: the name has to stay 8.3. */
+    static constexpr uint32_t kMaxId = 9999;
+
+    /** Boot: open the catalog, or build it if there's none. 'bin_rate' is
+     ** the rate raw .BIN files are taken at. */
+    bool Open(WavProbe probe, uint32_t bin_rate);
+
+    /** Rebuild from the directory. Returns false if the card failed. */
+    bool Rescan();
+
+    /** Rescan() in steps of one directory entry, for a background job:
+     ** BeginRescan(), then StepRescan() until it stops RUNNING. Add() and
+     ** NewName() must wait until then (the new file replaces the old). */
+    bool BeginRescan();
+    Scan StepRescan();
+    inline bool Scanning() const { return scanning_; }
+
+    inline size_t Count() const { return open_ ? hdr_.count : 0; }
+
+    /** Entry 'index', newest first. */
+    bool Read(size_t index, LoopCatalogEntry *e);
+
+    /** Next free LOOPn: writes "LOOPn.LPK" and "LOOPn.WAV" (16 bytes each)
+     ** and its id. False if the catalog is full or not open. */
+    bool NewName(uint32_t *id, char *pack_name, char *wav_name);
+
+    /** Append a saved loop. */
+    bool Add(const LoopCatalogEntry &e);
+
+  private:
+    struct Header
+    {
+        uint32_t magic;   // kMagic
+        uint32_t count;   // records
+        uint32_t next_id; // NewName() starts here
+        uint8_t  reserved[500];
+    };
+
+    static constexpr uint32_t kMagic = 0x3154434C; // 'LCT1'
+
+    // The header fills a sector, so pages of records are sector aligned
+    static_assert(sizeof(LoopCatalogEntry) == 128, "record size");
+    static_assert(sizeof(Header) == 512, "header size");
+
+    static FSIZE_t Offset(size_t record)
+    {
+        return sizeof(Header) + static_cast<FSIZE_t>(record) * sizeof(LoopCatalogEntry);
+    }
+
+    bool OpenFile();
+    bool EndRescan();
+    const LoopCatalogEntry *Record(size_t record);
+    bool Describe(const FILINFO &fno, LoopCatalogEntry *e) const;
+    void FindOld(LoopCatalogEntry *e);
+    static bool WriteHeader(FIL *f, const Header &hdr);
+
+    WavProbe probe_    = nullptr;
+    uint32_t bin_rate_ = 0;
+    bool     open_     = false;
+    FIL      file_;
+    Header   hdr_;
+
+    // Page cache (records [page_first_, page_first_ + page_count_))
+    LoopCatalogEntry page_[kPageEntries];
+    size_t           page_first_ = 0;
+    size_t           page_count_ = 0;
+
+    // Rescan: the old catalog is searched from just after the last match
+    size_t old_cursor_ = 0;
+    size_t old_count_  = 0;
+
+    // Rescan in progress: output file, directory, and the records not
+    // written yet
+    bool             scanning_ = false;
+    bool             scan_ok_  = false;
+    bool             dir_open_ = false;
+    FIL              scan_out_;
+    DIR              scan_dir_;
+    Header           scan_hdr_;
+    size_t           scan_fill_ = 0;
+    LoopCatalogEntry batch_[kPageEntries];
+};
+
+#endif // LOOP_CATALOG_H
@@ -0,0 +1,114 @@
+#ifndef LOOP_CODEC_H
+#define LOOP_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+
+/** Lossless compressed loop files (.LPK).
+ **
+ ** 16-bit PCM cut into frames of up to kCodecFrameSize samples. Each
+ ** frame is predicted with one of FLAC's fixed polynomial predictors
+ ** (order 0-4, whichever leaves the smallest residual) and the residual is
+ ** Rice coded in partitions of kCodecPartition samples, each with its own
+ ** parameter. A frame that wouldn't get smaller is stored verbatim.
+ **
+ ** There's no inter-frame state: a frame carries the loop position it
+ ** belongs at, its warm-up samples and a checksum of the decoded samples,
+ ** so frames decode on their own and may come in any order. The saver
+ ** uses that to write them in snapshot order (starting at the record
+ ** head) as one sequential append, where the raw formats need a seek.
+ ** The header points at the frame that holds sample 0, so a loader can
+ ** still read the loop from its start: from there to the end of the file,
+ ** then from the first frame up to it.
+ **
+ ** File layout (little endian, like the WAV header):
+ **
+ **     LoopFileHeader
+ **     LoopFrameHeader, 'bytes' of payload
+ **     LoopFrameHeader, 'bytes' of payload
+ **     ...
+ **
+ ** Stereo loops are interleaved like a stereo WAV; positions and counts
+ ** are in samples, not pairs. A stereo frame is coded as its left samples
+ ** followed by its right ones, so the predictor runs along each channel
+ ** (the one jump between them costs a few residuals).
+ **
+ ** Payload bits are MSB first: 'order' warm-up samples (16 bits each),
+ ** then per partition a 5-bit Rice parameter k and its residuals, each as
+ ** (zigzag(e) >> k) zeros, a one and the low k bits. Padded to a byte.
+ **
+ ** Encoding costs a few passes over a frame that's already in cache, so it
+ ** runs between the SD writes of the background saver. Band-limited
+ ** material like guitar shrinks a lot; a frame of noise costs its 16-byte
+ ** header over raw.
+ */
+
+/** Samples per frame, at most (the saver's chunk). */
+static constexpr size_t kCodecFrameSize = 4096;
+
+/** Residuals per Rice parameter. */
+static constexpr size_t kCodecPartition = 256;
+
+/** 'LPK2' */
+static constexpr uint32_t kLoopFileMagic = 0x324B504C;
+
+/** 'LPK1': the same frames after a 16-byte header without zero_offset
+ ** (whole-file loads only). */
+static constexpr uint32_t kLoopFileMagicV1  = 0x314B504C;
+static constexpr size_t   kLoopFileHeaderV1 = 16;
+
+/** Frame start marker, checked by the decoder. */
+static constexpr uint16_t kLoopFrameSync = 0xF7A5;
+
+/** LoopFrameHeader::order of a frame stored as raw 16-bit samples. */
+static constexpr uint8_t kCodecVerbatim = 0xFF;
+
+struct LoopFileHeader
+{
+    uint32_t magic;       // kLoopFileMagic
+    uint32_t sample_rate; // Hz
+    uint32_t length;      // loop samples
+    uint32_t frame_size;  // max samples per frame
+    uint32_t zero_offset; // file offset of the frame at loop position 0
+    uint32_t channels;    // 1 or 2 (0 in files from before stereo: 1)
+    uint32_t reserved[2];
+};
+
+struct LoopFrameHeader
+{
+    uint16_t sync;     // kLoopFrameSync
+    uint8_t  order;    // predictor order 0-4, or kCodecVerbatim
+    uint8_t  channels; // 2: stereo pairs, coded left then right (0: mono)
+    uint32_t position; // first loop sample of the frame
+    uint16_t count;    // samples in the frame
+    uint16_t check;    // sum of the samples, mod 2^16
+    uint32_t bytes;    // payload after this header
+};
+
+/** Largest encoded frame, header included (a verbatim one). */
+static constexpr size_t kCodecMaxFrameBytes
+    = sizeof(LoopFrameHeader) + kCodecFrameSize * sizeof(int16_t);
+
+namespace loop_codec
+{
+/** Encode 'n' (<= kCodecFrameSize) samples that belong at loop position
+ ** 'position' into one frame. 'dst' must hold kCodecMaxFrameBytes. With
+ ** 'channels' 2, 'src' holds n / 2 interleaved pairs (n even).
+ ** Returns the frame's size in bytes, header included. */
+size_t EncodeFrame(const int16_t *src,
+                   size_t         n,
+                   uint32_t       position,
+                   uint8_t       *dst,
+                   size_t         channels = 1);
+
+/** Check a frame header read from a file. */
+bool ValidHeader(const LoopFrameHeader &hdr);
+
+/** Decode the payload of a frame into hdr.count samples (interleaved again
+ ** if it's stereo). Returns false if it's corrupt (doesn't parse, or fails
+ ** the checksum). Main loop only: stereo frames go through a scratch
+ ** buffer, as they do when encoded. */
+bool DecodeFrame(const LoopFrameHeader &hdr, const uint8_t *payload, int16_t *dst);
+} // namespace loop_codec
+
+#endif // LOOP_CODEC_H
@@ -0,0 +1,461 @@
+#ifndef LOOP_ENGINE_H
+#define LOOP_ENGINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "CallbackProfiler.h"
+#include "DiskStream.h"
+#include "Interpolation.h"
+#include "LatencyProbe.h"
+#include "LoopSample.h"
+#include "LayerManager.h"
+#include "Seqlock.h"
+#include "SpscQueue.h"
+#include "TimeStretch.h"
+#include "WaveOverview.h"
+
+class SessionJournal;
+class SnapshotGuard;
+
+/** Tracks the loop can be split into (see LoopEngine, "Tracks"). */
+static constexpr size_t kMaxTracks = 4;
+
+/** Transport state as last published by the audio callback. Positions
+ ** and lengths are in frames (a sample per channel). */
+struct LoopStatus
+{
+    bool     playing;
+    bool     recording;
+    bool     first_take;
+    bool     layers_busy; // undo/redo being applied
+    bool     streaming;   // loop lives on the SD card (DiskStream)
+    bool     loading;     // SetLoop() before the whole file was in
+    uint32_t load_stalls; // blocks the head waited for the loader
+    bool     calibrating; // latency probe running instead of the loop
+    uint32_t latency;     // overdubs are written this far behind the head
+    int32_t  probed;      // last calibration (samples, -1 = no signal back)
+    uint32_t late_punches; // timed commands applied late
+    size_t   position;    // read/write head
+    size_t   length;      // loop length (max_size while the first take runs)
+    uint32_t applied;     // commands applied so far
+    uint32_t loop_id;     // changes with every new loop (reset, recall, ...)
+    size_t   tracks;      // tracks that fit the loop (1 until the first take ends)
+    size_t   tracks_ready; // ... whose planes are cleared and can record
+    size_t   stride;      // from one track's plane to the next (samples)
+    uint8_t  armed;       // bit t: overdubs go to track t
+    uint8_t  muted;       // bit t: track t is not heard
+    uint8_t  used;        // bit t: track t has been recorded into
+    uint8_t  level[kMaxTracks]; // percent
+    size_t   channels;    // 1, or 2 with a stereo loop
+    int32_t  speed;       // head step per frame (kInterpOne = 1x, < 0: reverse)
+    Interp   interp;      // read head kernel off 1x
+    int32_t  tempo;       // kInterpOne = 100%, pitch kept
+    TimeStretch::Stats stretch;
+    LayerManager::Stats layers;
+};
+
+/** Block-based loop engine.
+ **
+ ** Replaces the old per-sample NextSamples()/WriteBuffer() path. A whole
+ ** audio callback block is processed in one pass: the block is split at the
+ ** loop wrap point into at most a couple of contiguous segments, and each
+ ** segment is handed to the overdub / mix kernels in LoopKernels.h. The
+ ** per-sample path therefore has no modulo, no length checks and no
+ ** play/rec branches; those are evaluated once per segment.
+ **
+ ** The engine does not own the loop memory; it is given the SDRAM buffer in
+ ** Init(). The buffer never needs clearing: everything past a high-water
+ ** mark counts as silence and is zeroed just ahead of the head the first
+ ** time the head reaches it, so Reset() is O(1) no matter the buffer size.
+ ** Overdub passes are recorded into an optional LayerManager for undo/redo,
+ ** and announced to an optional SnapshotGuard so a background save keeps
+ ** seeing the loop as it was when the save started. With an optional
+ ** CallbackProfiler, the record, mix and clamp stages are timed, and an
+ ** optional WaveOverview is kept up to date with what gets recorded. An
+ ** optional SessionJournal is told which parts of buf[] were written.
+ **
+ ** With an optional DiskStream the engine can also run in streaming mode
+ ** (SetStreaming()): the loop is kept on the SD card and can be as long as
+ ** the stream file. Segments then also split at stream chunk boundaries
+ ** and map into the stream's ring instead of buf[]. There is no undo/redo,
+ ** snapshot, overview or journal in that mode; a chunk that isn't loaded in
+ ** time plays dry and isn't recorded.
+ **
+ ** Loops are recalled progressively: the loader hands over the loop with
+ ** SetLoop() once the first seconds are in buf[], then keeps reading and
+ ** publishes how far it got with SetLoaded(). Until that watermark reaches
+ ** the loop length, segments are cut at it, and a head that catches up
+ ** with it holds still (dry signal only) until more is loaded. Recording
+ ** waits for the load to finish.
+ **
+ ** Punches are sample accurate: a button press is stamped with the engine's
+ ** sample clock when the main loop sees it, and the command takes effect
+ ** exactly kPunchDelay samples after the stamp, splitting the block there
+ ** if need be. The main loop's timing only adds a constant, and the first
+ ** take's length is the time between the two presses to the sample.
+ ** Overdubs are written SetLatency() samples behind the play head, so what
+ ** is played along to the loop lands where it was heard; Calibrate()
+ ** measures that round trip (see LatencyProbe.h).
+ **
+ ** Tracks: once the first take has set the length, the buffer is cut into
+ ** planes of stride samples (the length rounded up to kTrackAlign), one
+ ** per track, as many as fit up to kMaxTracks: four tracks of up to a
+ ** quarter of the buffer, or one that fills it. Track state is kept as
+ ** parallel arrays (level_[], and the armed_/muted_/used_ bit masks), the
+ ** planes are plain runs of buf[], and each segment is mixed by one
+ ** MixTracksVec() pass over all the tracks that are heard. The first take
+ ** always goes to track 1 (it sets the length); overdubs go to the armed
+ ** tracks. The planes above track 1 hold stale audio until they're
+ ** cleared, kWipePerFrame samples per frame in the callback, right after
+ ** the layout. The collaborators see plane offsets as buffer positions, so
+ ** undo, snapshots and the overview cover every track. Streamed loops have
+ ** a single track.
+ **
+ ** Stereo (SetChannels(2)): buf[] holds interleaved L/R frames, the same
+ ** layout as the callback's buffers. Positions, lengths and the latency
+ ** stay in frames; only buffer offsets are scaled by the channel count. A
+ ** segment is still one contiguous run, so the kernels see a plain stream
+ ** of 2 x seg samples and the callback's input and output are used in
+ ** place. The longest loop is max_size / channels frames, in buf[] as on
+ ** the stream. The collaborators (undo, snapshots, overview, stream) work
+ ** on buffer samples and don't know about channels. Calibration stays mono
+ ** (left in, both out).
+ **
+ ** Speed (SetSpeed()): off 1x the head is fixed point, pos_ plus a
+ ** fraction frac_, and steps by speed_ per frame, backwards for reverse.
+ ** A pass gathers the frames it will cross, every heard track mixed, into
+ ** win_[] (wrapping at the loop end, through Resolve() while an undo is in
+ ** flight), then an Interpolate() kernel renders the block from there (see
+ ** Interpolation.h). It's a playback mode: overdubs only start at 1x and
+ ** the speed can't change while recording; the first take, a loop that is
+ ** still loading and a streamed loop play at 1x whatever is set. A new
+ ** loop starts at 1x.
+ **
+ ** Tempo (SetTempo()): the loop goes by faster or slower at the same pitch,
+ ** rendered by a TimeStretch (WSOLA, see TimeStretch.h) that reads it
+ ** through Gather() like the varispeed head, and pos_ follows the grain
+ ** being played. Tempo and speed are one or the other: setting one puts
+ ** the other back to 1x. Otherwise the same rules: a playback mode, off
+ ** for the first take, a loading or streamed loop, and back to 100% with
+ ** a new loop. The stretch starts where the head is, seamlessly; coming
+ ** back to 100% jumps to the grain's source position.
+ **
+ ** Threading: only the audio callback touches the transport state. The
+ ** control methods (ToggleRecord(), Reset(), ...) post a command to a
+ ** wait-free queue and return at once; Process() applies pending commands
+ ** at the start of the next block (timed ones at their sample, between
+ ** two passes), so a pass never sees a half-updated pos/len pair. The
+ ** other direction goes through a LoopStatus snapshot published at the
+ ** end of every block (see Seqlock.h). Each command returns a ticket
+ ** that Done() reports as applied, and Sync() waits for everything
+ ** posted so far (at most one block once audio is running).
+ */
+class LoopEngine
+{
+  public:
+    /** Largest number of frames processed per internal pass. Larger callback
+     ** blocks are simply split. */
+    static constexpr size_t kMaxBlock = 64;
+
+    /** Undo/redo swap budget, in samples per processed frame. */
+    static constexpr size_t kLayerSwapPerFrame = 32;
+
+    /** Pending commands; the main loop posts a handful per block at most. */
+    static constexpr size_t kCommandQueueSize = 16;
+
+    /** From a press's stamp to its effect. Callback blocks up to this size
+     ** land on time; with larger ones a punch can come late (counted in
+     ** LoopStatus::late_punches). */
+    static constexpr uint32_t kPunchDelay = kMaxBlock;
+
+    /** Longest latency compensation (1 s at 48 kHz). */
+    static constexpr uint32_t kMaxLatency = 48000;
+
+    /** Track planes start on a whole overview leaf (and so on whole undo
+     ** and snapshot regions). */
+    static constexpr size_t kTrackAlign = kOverviewLeafSize;
+
+    /** Stale track planes zeroed per frame processed (a few seconds for
+     ** the largest layout). */
+    static constexpr size_t kWipePerFrame = 256;
+
+    /** Fastest head, either way (kInterpOne = 1x). */
+    static constexpr int32_t kMaxSpeed = 2 * kInterpOne;
+
+    void Init(loop_sample_t    *buffer,
+              size_t            max_size,
+              LayerManager     *layers   = nullptr,
+              SnapshotGuard    *guard    = nullptr,
+              CallbackProfiler *profiler = nullptr,
+              DiskStream       *stream   = nullptr,
+              WaveOverview     *overview = nullptr,
+              SessionJournal   *journal  = nullptr);
+
+    /** Process one interleaved stereo callback block (size = samples, i.e.
+     ** frames * 2). A mono loop records the left input and writes its mix to
+     ** L and R; a stereo loop records and plays both. */
+    void Process(const float *in, float *out, size_t size);
+
+    // Control commands (main loop). Each returns a ticket for Done(), or 0
+    // if the queue was full and the command was dropped.
+
+    /** Back to an empty first take. Does not touch the loop memory: old
+     ** contents are lazily zeroed as the next first take reaches them. */
+    uint32_t Reset();
+
+    /** Button2: toggle record/overdub. Closes the first take if running,
+     ** and always starts playback. Overdubs can't start while an undo/redo
+     ** is still being applied. */
+    uint32_t ToggleRecord();
+
+    /** Button1: toggle playback, stops recording. */
+    uint32_t TogglePlay();
+
+    /** ToggleRecord()/TogglePlay() for a press seen at 'stamp' (Clock()):
+     ** applied at stamp + kPunchDelay to the sample. */
+    uint32_t ToggleRecordAt(uint32_t stamp);
+    uint32_t TogglePlayAt(uint32_t stamp);
+
+    /** Adopt 'length' frames as the loop (used after loading a file) and
+     ** start playback. Only [0, watermark) has to be in the buffer yet. */
+    uint32_t SetLoop(size_t length);
+
+    /** Adopt the 'length' frames of a loop restored into buf[] as it was
+     ** laid out (see SessionJournal), stopped, with the tracks in 'used'
+     ** holding audio. The planes are taken as they are, not cleared. Set
+     ** the channels first, and SetLoaded() to the length. */
+    uint32_t Restore(size_t length, uint32_t used);
+
+    /** Loader progress: the first 'frames' of buf[] hold the file. Set it
+     ** before SetLoop(), then as the rest comes in (main loop). */
+    void SetLoaded(size_t frames)
+    {
+        loaded_.store(frames, std::memory_order_release);
+    }
+
+    /** Undo/redo the last overdub pass (see LayerManager). Ignored while
+     ** recording or while another undo/redo is being applied. */
+    uint32_t Undo();
+    uint32_t Redo();
+
+    /** Switch between a loop in buf[] and a loop streamed from the SD card
+     ** (the DiskStream must be open). Either way starts an empty loop. */
+    uint32_t SetStreaming(bool on);
+
+    /** Mono (1) or stereo (2) loop. Starts an empty loop. */
+    uint32_t SetChannels(size_t channels);
+
+    /** Round-trip latency compensation in samples (up to kMaxLatency).
+     ** Not applied to streamed loops. */
+    uint32_t SetLatency(uint32_t samples);
+
+    /** Overdubs go to the armed tracks (track 0 only for a new loop).
+     ** Tracks beyond LoopStatus::tracks can't be armed. Levels are kept
+     ** from loop to loop, arms and mutes are not. */
+    uint32_t ArmTrack(size_t track, bool on);
+
+    uint32_t MuteTrack(size_t track, bool on);
+
+    /** Track level in percent (100 at Init(), up to 100). */
+    uint32_t SetTrackLevel(size_t track, uint32_t percent);
+
+    /** Playback speed: frames per output frame, kInterpOne = 1x, negative
+     ** plays in reverse (clamped to kMaxSpeed either way). Ignored while
+     ** recording. */
+    uint32_t SetSpeed(int32_t speed);
+
+    /** Read head kernel used off 1x (HERMITE at Init()). */
+    uint32_t SetInterpolation(Interp kind);
+
+    /** Tempo without a pitch change: kInterpOne = 100%, clamped to
+     ** TimeStretch::kMinTempo..kMaxTempo. Ignored while recording. */
+    uint32_t SetTempo(int32_t tempo);
+
+    /** Measure the round trip: the loop pauses and a LatencyProbe runs in
+     ** its place for a couple of seconds. A result becomes the latency
+     ** compensation. Ignored while recording. */
+    uint32_t Calibrate();
+
+    /** Samples processed so far (wraps): the time base for stamps. */
+    inline uint32_t Clock() const
+    {
+        return clock_.load(std::memory_order_acquire);
+    }
+
+    void SetDryWet(float drywet)
+    {
+        drywet_.store(drywet, std::memory_order_relaxed);
+    }
+
+    /** True once the command behind 'ticket' has been applied. */
+    bool Done(uint32_t ticket) const
+    {
+        return static_cast<int32_t>(Status().applied - ticket) >= 0;
+    }
+
+    /** Wait until every command posted so far has been applied. Needs the
+     ** audio callback to be running. */
+    void Sync() const;
+
+    /** Consistent copy of the transport state as of the last block. */
+    inline LoopStatus Status() const { return status_.Read(); }
+
+    inline bool   IsPlaying() const { return Status().playing; }
+    inline bool   IsRecording() const { return Status().recording; }
+    inline bool   IsFirstTake() const { return Status().first_take; }
+    inline size_t Position() const { return Status().position; }
+
+    /** Current loop length in frames (the longest loop while the first take
+     ** runs). */
+    inline size_t LoopLength() const { return Status().length; }
+
+  private:
+    enum class Command : uint8_t
+    {
+        RESET,
+        TOGGLE_RECORD,
+        TOGGLE_PLAY,
+        SET_LOOP,
+        UNDO,
+        REDO,
+        STREAM,
+        SET_LATENCY,
+        CALIBRATE,
+        TRACK_ARM,   // arg: track | on << 8
+        TRACK_MUTE,  // arg: track | on << 8
+        TRACK_LEVEL, // arg: track | percent << 8
+        CHANNELS,
+        SPEED,
+        INTERP,
+        TEMPO,
+        RESTORE, // arg: length | used << kRestoreUsedShift
+    };
+
+    static constexpr int kRestoreUsedShift = 28;
+
+    struct Message
+    {
+        Command  command;
+        bool     timed; // applied at sample 'at', not at the next block
+        uint32_t arg;
+        uint32_t at;
+    };
+
+    uint32_t Post(Command command, uint32_t arg = 0);
+    uint32_t PostAt(Command command, uint32_t stamp);
+    void     Apply(const Message &msg);
+    void     ApplyDue(uint32_t now);
+    void     Publish();
+
+    // Audio-side implementations of the commands
+    void DoReset();
+    void DoToggleRecord();
+    void DoTogglePlay();
+    void DoSetLoop(size_t length);
+    void DoSetStreaming(bool on);
+    void DoSetChannels(size_t channels);
+    void DoTrack(Command command, size_t track, uint32_t value);
+    void DoSetSpeed(int32_t speed);
+    void DoSetTempo(int32_t tempo);
+    void DoRestore(size_t length, uint32_t used);
+    void LayOut();
+
+    void ProcessLoop(const float *dry, float *out, float gain, size_t n);
+    void ProcessVarispeed(const float *dry, float *out, float gain, size_t n);
+    void ProcessStretch(const float *dry, float *out, float gain, size_t n);
+    void Gather(float *win, int64_t first, size_t frames);
+    static void GatherFor(void *engine, float *win, int64_t first, size_t frames);
+    void Record(size_t base, size_t at, const float *dry, size_t n);
+    void Scrub(size_t end);
+    void Wipe(size_t budget);
+
+    /** Track 't' has a cleared plane and can be recorded into. */
+    inline bool Ready(size_t t) const
+    {
+        return t == 0 || (t + 1) * stride_ <= wiped_;
+    }
+
+    loop_sample_t    *buf_;
+    size_t            max_size_;
+    LayerManager     *layers_;   // null while streaming
+    SnapshotGuard    *guard_;    // null while streaming
+    WaveOverview     *overview_; // null while streaming
+    SessionJournal   *journal_;  // null while streaming
+    CallbackProfiler *profiler_;
+    DiskStream       *stream_;
+
+    // Restored when streaming ends
+    LayerManager   *ram_layers_;
+    SnapshotGuard  *ram_guard_;
+    WaveOverview   *ram_overview_;
+    SessionJournal *ram_journal_;
+
+    bool   first_; // still capturing initial loop length
+    bool   rec_;   // recording/overdubbing
+    bool   play_;  // playback
+    size_t pos_;   // read/write head (frames, like the lengths)
+    size_t mod_;   // loop length
+    size_t len_;   // provisional length during first take
+    size_t cap_;   // longest loop: buf[] or the stream, over ch_
+    size_t clean_; // [0, clean_) holds audio; the rest is stale, read as 0
+    size_t ch_;    // channels: samples per frame in buf[]
+    bool   streaming_;
+    bool   loading_; // play only up to loaded_
+    uint32_t load_stalls_;
+    uint32_t loop_id_; // bumped by every new loop
+
+    // Punch timing and latency compensation
+    uint32_t latency_;      // record head behind the play head (overdubs)
+    uint32_t late_punches_; // timed commands applied after their sample
+
+    LatencyProbe probe_;
+    int32_t      probed_;
+
+    // Tracks, structure of arrays: track t is buf_[t * stride_, + mod_ * ch_)
+    size_t   stride_; // 0 until the first take sets the length
+    size_t   tracks_; // planes laid out (1 until then)
+    size_t   wiped_;  // [stride_, wiped_) is cleared; the rest is stale
+    uint32_t armed_;
+    uint32_t muted_;
+    uint32_t used_;
+    float    level_[kMaxTracks];
+
+    // Varispeed read head: pos_ + frac_ / kInterpOne, speed_ per frame
+    int32_t  speed_;
+    uint32_t frac_;
+    Interp   interp_;
+
+    // Time-stretch: tempo_ per kInterpOne, stretch_ running since pos_
+    int32_t     tempo_;
+    bool        stretching_;
+    TimeStretch stretch_;
+
+    // Audio callback -> main loop: sample clock
+    std::atomic<uint32_t> clock_;
+
+    // Main loop -> audio callback: loader watermark
+    std::atomic<size_t> loaded_;
+
+    std::atomic<float> drywet_;
+
+    // Main loop -> audio callback
+    SpscQueue<Message, kCommandQueueSize> commands_;
+    uint32_t                              posted_;  // main loop only
+    uint32_t                              applied_; // audio callback only
+
+    // Audio callback -> main loop
+    Seqlock<LoopStatus> status_;
+
+    // Mono loop and calibration: the left input, and what goes to both sides
+    float dry_[kMaxBlock];
+    float wet_[kMaxBlock];
+
+    // Varispeed: the frames a pass reads (all tracks mixed), and what the
+    // head renders from them, ch_ samples per frame
+    static constexpr size_t kWindowFrames = InterpWindowFrames(kMaxBlock, kMaxSpeed);
+    float win_[kWindowFrames * 2];
+    float head_[kMaxBlock * 2];
+};
+
+#endif // LOOP_ENGINE_H
@@ -0,0 +1,350 @@
+#ifndef LOOP_KERNELS_H
+#define LOOP_KERNELS_H
+
+#include <cstddef>
+#include <cstring>
+#include "LoopSample.h"
+
+/** Block kernels used by the loop engine.
+ **
+ ** Every kernel works on contiguous runs of samples that never cross the
+ ** loop wrap point, so the inner loops have no modulo and no branches.
+ ** The clamp is expressed with fminf/fmaxf, which the Cortex-M7 FPv5 maps to
+ ** VMINNM/VMAXNM instead of compare-and-branch.
+ **
+ ** Each kernel comes in two flavours:
+ ** - *Scalar: one sample per iteration, the reference implementation.
+ ** - *Vec:    4 samples per iteration through GCC vector types. On hosts with
+ **            SIMD this becomes SSE/NEON; on the M7 (no float SIMD) it lowers
+ **            to an unrolled sequence the dual-issue FPU can overlap.
+ **
+ ** Both flavours evaluate the same expression in the same order, so the
+ ** scalar version can be used as the reference when checking the fast path.
+ **
+ ** MixTracks is Mix for several loop planes at once (multi-track): one
+ ** pass over the block, dry read and out written once whatever the number
+ ** of tracks. With a single track it computes exactly what Mix does.
+ **
+ ** Overdub, Mix and MixTracks are overloaded on the loop storage type (see
+ ** LoopSample.h). The int16_t versions keep the loop in Q15 and overdub
+ ** with saturating adds; the vector overdub packs two samples per register
+ ** and uses QADD16 on the M7.
+ */
+
+namespace loop_kernels
+{
+typedef float f32x4 __attribute__((vector_size(16)));
+
+/** Most tracks a MixTracks kernel takes. */
+static constexpr size_t kMaxMixTracks = 8;
+
+inline float Clamp1(float x)
+{
+    return __builtin_fminf(__builtin_fmaxf(x, -1.0f), 1.0f);
+}
+
+inline f32x4 Load4(const float *p)
+{
+    f32x4 v;
+    memcpy(&v, p, sizeof(v)); // loop segments are not 16-byte aligned
+    return v;
+}
+
+inline void Store4(float *p, f32x4 v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+inline f32x4 Clamp4(f32x4 x)
+{
+    const f32x4 lo = {-1.0f, -1.0f, -1.0f, -1.0f};
+    const f32x4 hi = {1.0f, 1.0f, 1.0f, 1.0f};
+    x              = x < lo ? lo : x;
+    x              = x > hi ? hi : x;
+    return x;
+}
+} // namespace loop_kernels
+
+// -----------------------------------------------------------------------------
+// Overdub: loop[i] = clamp(loop[i] + in[i])
+// -----------------------------------------------------------------------------
+inline void OverdubScalar(float *__restrict loop,
+                          const float *__restrict in,
+                          size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        loop[i] = loop_kernels::Clamp1(loop[i] + in[i]);
+    }
+}
+
+inline void OverdubVec(float *__restrict loop,
+                       const float *__restrict in,
+                       size_t n)
+{
+    using namespace loop_kernels;
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        Store4(loop + i, Clamp4(Load4(loop + i) + Load4(in + i)));
+    }
+    for(; i < n; i++)
+    {
+        loop[i] = Clamp1(loop[i] + in[i]);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Mix: out[i] = clamp(dry[i] + loop[i] * gain)
+// -----------------------------------------------------------------------------
+inline void MixScalar(float *__restrict out,
+                      const float *__restrict dry,
+                      const float *__restrict loop,
+                      float  gain,
+                      size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        out[i] = loop_kernels::Clamp1(dry[i] + loop[i] * gain);
+    }
+}
+
+inline void MixVec(float *__restrict out,
+                   const float *__restrict dry,
+                   const float *__restrict loop,
+                   float  gain,
+                   size_t n)
+{
+    using namespace loop_kernels;
+    const f32x4 g = {gain, gain, gain, gain};
+    size_t      i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        Store4(out + i, Clamp4(Load4(dry + i) + Load4(loop + i) * g));
+    }
+    for(; i < n; i++)
+    {
+        out[i] = Clamp1(dry[i] + loop[i] * gain);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// MixTracks: out[i] = clamp(dry[i] + sum over t of loops[t][i] * gains[t])
+// -----------------------------------------------------------------------------
+inline void MixTracksScalar(float *__restrict out,
+                            const float *__restrict dry,
+                            const float *const *loops,
+                            const float       *gains,
+                            size_t             tracks,
+                            size_t             n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        float acc = dry[i];
+        for(size_t t = 0; t < tracks; t++)
+            acc += loops[t][i] * gains[t];
+        out[i] = loop_kernels::Clamp1(acc);
+    }
+}
+
+inline void MixTracksVec(float *__restrict out,
+                         const float *__restrict dry,
+                         const float *const *loops,
+                         const float       *gains,
+                         size_t             tracks,
+                         size_t             n)
+{
+    using namespace loop_kernels;
+    f32x4 g[kMaxMixTracks];
+    for(size_t t = 0; t < tracks; t++)
+        g[t] = f32x4{gains[t], gains[t], gains[t], gains[t]};
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        f32x4 acc = Load4(dry + i);
+        for(size_t t = 0; t < tracks; t++)
+            acc += Load4(loops[t] + i) * g[t];
+        Store4(out + i, Clamp4(acc));
+    }
+    for(; i < n; i++)
+    {
+        float acc = dry[i];
+        for(size_t t = 0; t < tracks; t++)
+            acc += loops[t][i] * gains[t];
+        out[i] = Clamp1(acc);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Q15 storage: loop[i] = sat16(loop[i] + q15(in[i]))
+// -----------------------------------------------------------------------------
+inline void OverdubScalar(int16_t *__restrict loop,
+                          const float *__restrict in,
+                          size_t n)
+{
+    typedef SampleTraits<int16_t> S;
+    for(size_t i = 0; i < n; i++)
+    {
+        loop[i] = S::Sat16(loop[i] + S::FromFloat(in[i]));
+    }
+}
+
+inline void OverdubVec(int16_t *__restrict loop,
+                       const float *__restrict in,
+                       size_t n)
+{
+    typedef SampleTraits<int16_t> S;
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        uint32_t l[2], d[2];
+        memcpy(l, loop + i, sizeof(l));
+        d[0] = (static_cast<uint16_t>(S::FromFloat(in[i])))
+               | (static_cast<uint32_t>(static_cast<uint16_t>(
+                      S::FromFloat(in[i + 1])))
+                  << 16);
+        d[1] = (static_cast<uint16_t>(S::FromFloat(in[i + 2])))
+               | (static_cast<uint32_t>(static_cast<uint16_t>(
+                      S::FromFloat(in[i + 3])))
+                  << 16);
+        l[0] = S::QAdd16x2(l[0], d[0]);
+        l[1] = S::QAdd16x2(l[1], d[1]);
+        memcpy(loop + i, l, sizeof(l));
+    }
+    for(; i < n; i++)
+    {
+        loop[i] = S::Sat16(loop[i] + S::FromFloat(in[i]));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Q15 storage: out[i] = clamp(dry[i] + loop[i] * gain / 32767)
+// -----------------------------------------------------------------------------
+inline void MixScalar(float *__restrict out,
+                      const float *__restrict dry,
+                      const int16_t *__restrict loop,
+                      float  gain,
+                      size_t n)
+{
+    const float g = gain * SampleTraits<int16_t>::kToFloat;
+    for(size_t i = 0; i < n; i++)
+    {
+        out[i] = loop_kernels::Clamp1(dry[i] + loop[i] * g);
+    }
+}
+
+inline void MixVec(float *__restrict out,
+                   const float *__restrict dry,
+                   const int16_t *__restrict loop,
+                   float  gain,
+                   size_t n)
+{
+    using namespace loop_kernels;
+    const float s = gain * SampleTraits<int16_t>::kToFloat;
+    const f32x4 g = {s, s, s, s};
+    size_t      i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        const f32x4 l = {static_cast<float>(loop[i]),
+                         static_cast<float>(loop[i + 1]),
+                         static_cast<float>(loop[i + 2]),
+                         static_cast<float>(loop[i + 3])};
+        Store4(out + i, Clamp4(Load4(dry + i) + l * g));
+    }
+    for(; i < n; i++)
+    {
+        out[i] = Clamp1(dry[i] + loop[i] * s);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Q15 storage: out[i] = clamp(dry[i] + sum over t of loops[t][i] * gains[t] / 32767)
+// -----------------------------------------------------------------------------
+inline void MixTracksScalar(float *__restrict out,
+                            const float *__restrict dry,
+                            const int16_t *const *loops,
+                            const float         *gains,
+                            size_t               tracks,
+                            size_t               n)
+{
+    float g[loop_kernels::kMaxMixTracks];
+    for(size_t t = 0; t < tracks; t++)
+        g[t] = gains[t] * SampleTraits<int16_t>::kToFloat;
+    for(size_t i = 0; i < n; i++)
+    {
+        float acc = dry[i];
+        for(size_t t = 0; t < tracks; t++)
+            acc += loops[t][i] * g[t];
+        out[i] = loop_kernels::Clamp1(acc);
+    }
+}
+
+inline void MixTracksVec(float *__restrict out,
+                         const float *__restrict dry,
+                         const int16_t *const *loops,
+                         const float         *gains,
+                         size_t               tracks,
+                         size_t               n)
+{
+    using namespace loop_kernels;
+    float s[kMaxMixTracks];
+    f32x4 g[kMaxMixTracks];
+    for(size_t t = 0; t < tracks; t++)
+    {
+        s[t] = gains[t] * SampleTraits<int16_t>::kToFloat;
+        g[t] = f32x4{s[t], s[t], s[t], s[t]};
+    }
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        f32x4 acc = Load4(dry + i);
+        for(size_t t = 0; t < tracks; t++)
+        {
+            const int16_t *loop = loops[t] + i;
+            const f32x4    l    = {static_cast<float>(loop[0]),
+                                   static_cast<float>(loop[1]),
+                                   static_cast<float>(loop[2]),
+                                   static_cast<float>(loop[3])};
+            acc += l * g[t];
+        }
+        Store4(out + i, Clamp4(acc));
+    }
+    for(; i < n; i++)
+    {
+        float acc = dry[i];
+        for(size_t t = 0; t < tracks; t++)
+            acc += loops[t][i] * s[t];
+        out[i] = Clamp1(acc);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Clamp: out[i] = clamp(in[i]) (dry pass-through while stopped)
+// -----------------------------------------------------------------------------
+inline void ClampScalar(float *__restrict out,
+                        const float *__restrict in,
+                        size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        out[i] = loop_kernels::Clamp1(in[i]);
+    }
+}
+
+inline void ClampVec(float *__restrict out,
+                     const float *__restrict in,
+                     size_t n)
+{
+    using namespace loop_kernels;
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        Store4(out + i, Clamp4(Load4(in + i)));
+    }
+    for(; i < n; i++)
+    {
+        out[i] = Clamp1(in[i]);
+    }
+}
+
+#endif // LOOP_KERNELS_H
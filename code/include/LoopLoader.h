@@ -0,0 +1,170 @@
+#ifndef LOOP_LOADER_H
+#define LOOP_LOADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "fatfs.h"
+#include "LoopCodec.h"
+#include "LoopSample.h"
+#include "WaveOverview.h"
+#include "WavReader.h"
+
+/** Loads a loop file (.LPK, .WAV or raw 16-bit .BIN) into the loop buffer
+ ** a chunk at a time, from the start of the loop on.
+ **
+ ** Begin() opens the file and reads its header; each Step() (a background
+ ** job step, see TaskScheduler.h) then appends one chunk, about 32 KB of
+ ** the file. The loop can start playing as soon as its first seconds are
+ ** in (LoopEngine::SetLoop()) while the rest follows behind the playhead
+ ** (LoopEngine::SetLoaded(Loaded())). Everything before Loaded() is final.
+ **
+ ** An .LPK holds its frames in save order, which starts at the record
+ ** head. The header points at the frame for position 0, so the file is
+ ** read from there to the end and then from its first frame up to there:
+ ** positions come out in order either way. A damaged frame loads as
+ ** silence. An LPK1 file has no such pointer; Ordered() is false and the
+ ** loop is only complete when the whole file has been read.
+ **
+ ** The loop may be mono or stereo (interleaved in buf[], see LoopEngine.h);
+ ** a file with the other channel count is converted as it loads: stereo
+ ** mixed down, mono doubled. Lengths and positions here are in frames.
+ **
+ ** Reads go through a caller-supplied transfer buffer (the SD DMA buffer),
+ ** block-aligned so FatFs can transfer whole sectors straight into it.
+ ** The buffer is in use from Begin() until the load ends.
+ **
+ ** Main loop only. What was loaded is also written to the WaveOverview:
+ ** while a load runs the engine may play but doesn't record (see
+ ** LoopEngine.h), so this is the only writer.
+ */
+class LoopLoader
+{
+  public:
+    enum class State
+    {
+        IDLE,
+        RUNNING,
+        DONE,
+        FAILED,
+    };
+
+    enum class Result
+    {
+        OK,
+        OPEN_FAILED,
+        NOT_A_LOOP,  // .LPK with a bad header
+        UNSUPPORTED, // WAV format
+    };
+
+    /** WAV transfer chunk (bytes). */
+    static constexpr size_t kWavReadSize = 32768;
+
+    /** 'io' must hold at least kIoSize bytes, 32-byte aligned. */
+    static constexpr size_t kIoSize = 65536;
+
+    /** 'wav_rate': rate WAVs are resampled to while loading (0 = off). */
+    void Init(loop_sample_t *buf,
+              size_t         max_size,
+              WaveOverview  *overview,
+              uint8_t       *io,
+              float          wav_rate);
+
+    /** Open 'name' (type by extension) for a loop of 'channels' (1 or 2).
+     ** On OK, Length() is known. */
+    Result Begin(const char *name, size_t channels);
+
+    /** Read and convert the next chunk. */
+    State Step();
+
+    /** Stop and close the file (a new load or a reset). */
+    void Abort();
+
+    /** Clear DONE/FAILED back to IDLE once reported. */
+    void Acknowledge()
+    {
+        if(state_ != State::RUNNING)
+            state_ = State::IDLE;
+    }
+
+    inline bool   Active() const { return state_ == State::RUNNING; }
+    inline State  GetState() const { return state_; }
+    inline size_t Length() const { return length_; }
+    inline bool   Truncated() const { return truncated_; }
+
+    /** The first Loaded() frames of buf[] hold the file. */
+    inline size_t Loaded() const { return loaded_; }
+
+    /** Whether Loaded() grows from the start (false for LPK1). */
+    inline bool Ordered() const { return ordered_; }
+
+    /** Percent of the load done (of the file, when not Ordered()). */
+    int Progress() const;
+
+    /** .LPK frames that failed to decode (loaded as silence). */
+    inline int Damaged() const { return damaged_; }
+
+    /** Rate and length of a WAV, from its header. */
+    bool ProbeWav(const char *name, uint32_t *rate, uint32_t *frames);
+
+  private:
+    enum class Kind
+    {
+        PACK,
+        WAV,
+        BIN,
+    };
+
+    // Loop frames per Step() for WAV/BIN, and zeroed per Step() before an
+    // unordered .LPK
+    static constexpr size_t kChunkSamples = 16384;
+    static constexpr size_t kClearSamples = 262144;
+
+    // .LPK: block-aligned reads into the back of io_, with room in front
+    // for a frame cut off at the end of the previous block
+    static constexpr size_t kBlock = 32768;
+    static constexpr size_t kRoom  = (kCodecMaxFrameBytes + 31) & ~size_t(31);
+    static_assert(kRoom + kBlock <= kIoSize, "transfer buffer too small");
+    static_assert(kChunkSamples * 2 * sizeof(int16_t) <= kIoSize,
+                  "a .BIN chunk doubled for a stereo loop fits too");
+
+    Result BeginPack();
+    bool   StepPack();
+    bool   WholeFrame() const;
+    bool   StepBin();
+    bool   StepWav();
+    bool   ReadBlock();
+    void   Store(size_t frame, int16_t *src, size_t frames, size_t src_channels);
+    void   Silence(size_t end);
+    void   Finish(State result);
+
+    loop_sample_t *buf_;
+    size_t         max_size_;
+    WaveOverview  *overview_;
+    uint8_t       *io_;
+    float          wav_rate_;
+
+    Kind   kind_;
+    State  state_ = State::IDLE;
+    FIL    file_;
+    size_t channels_;      // of the loop
+    size_t file_channels_; // of an .LPK (a .BIN is mono)
+    size_t length_;
+    size_t loaded_;
+    bool   truncated_;
+    bool   ordered_;
+    size_t cleared_; // unordered .LPK: frames [0, cleared_) zeroed so far
+    int    damaged_;
+
+    // .LPK reading: [read_pos_, read_end_) of the file is still to come,
+    // then [wrap_pos_, wrap_end_) if set; 'have_' parsed bytes wait at 'p_'
+    FSIZE_t        read_pos_, read_end_;
+    FSIZE_t        wrap_pos_, wrap_end_;
+    const uint8_t *p_;
+    size_t         have_;
+
+    int16_t frame_[kCodecFrameSize * 2]; // room for a mono frame doubled
+
+    daisy::WavReader<kWavReadSize> wav_;
+};
+
+#endif // LOOP_LOADER_H
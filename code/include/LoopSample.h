@@ -0,0 +1,120 @@
+#ifndef LOOP_SAMPLE_H
+#define LOOP_SAMPLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__arm__)
+#include "stm32h7xx.h" // __SSAT, __QADD16
+#endif
+
+/** Loop buffer sample storage.
+ **
+ ** LOOPER_SAMPLE_INT16 selects how buf[] stores audio at compile time:
+ **  1: int16_t, Q15 fixed point. Half the SDRAM per sample, so the same
+ **     memory holds 10 minutes instead of 5, and WAV/BIN files are the
+ **     storage format (save and load are plain memcpys).
+ **  0: float, the original storage.
+ **
+ ** Override from the Makefile with e.g. CXXFLAGS += -DLOOPER_SAMPLE_INT16=0
+ **
+ ** Everything that touches buf[] goes through SampleTraits<loop_sample_t>,
+ ** so the record, play, save and load paths don't care which one is used.
+ */
+#ifndef LOOPER_SAMPLE_INT16
+#define LOOPER_SAMPLE_INT16 1
+#endif
+
+template <typename T>
+struct SampleTraits;
+
+/** float storage: samples are kept in [-1, 1]. */
+template <>
+struct SampleTraits<float>
+{
+    /** Multiply a stored sample by this to get a float in [-1, 1]. */
+    static constexpr float kToFloat = 1.0f;
+
+    static inline float ToFloat(float s) { return s; }
+    static inline float FromFloat(float x)
+    {
+        return __builtin_fminf(__builtin_fmaxf(x, -1.0f), 1.0f);
+    }
+
+    /** Rounds to nearest, so FromS16() then ToS16() gives every sample
+     ** back (-32768 aside, which comes back as -32767). */
+    static inline void ToS16(int16_t *dst, const float *src, size_t n)
+    {
+        for(size_t i = 0; i < n; i++)
+        {
+            const float v = FromFloat(src[i]) * 32767.0f;
+            dst[i]        = static_cast<int16_t>(v < 0.0f ? v - 0.5f : v + 0.5f);
+        }
+    }
+    static inline void FromS16(float *dst, const int16_t *src, size_t n)
+    {
+        for(size_t i = 0; i < n; i++)
+            dst[i] = src[i] * (1.0f / 32767.0f);
+    }
+};
+
+/** int16_t storage: Q15, full scale = 32767. Arithmetic saturates. */
+template <>
+struct SampleTraits<int16_t>
+{
+    static constexpr float kToFloat = 1.0f / 32767.0f;
+
+    static inline float   ToFloat(int16_t s) { return s * kToFloat; }
+    /** Rounds to nearest, as the float ToS16() does. */
+    static inline int16_t FromFloat(float x)
+    {
+        const float v = x * 32767.0f;
+        return Sat16(static_cast<int32_t>(v < 0.0f ? v - 0.5f : v + 0.5f));
+    }
+
+    static inline int16_t Sat16(int32_t x)
+    {
+#if defined(__arm__)
+        return static_cast<int16_t>(__SSAT(x, 16));
+#else
+        return static_cast<int16_t>(x > 32767 ? 32767
+                                              : (x < -32768 ? -32768 : x));
+#endif
+    }
+
+    /** Saturating add of two packed pairs of Q15 samples. */
+    static inline uint32_t QAdd16x2(uint32_t a, uint32_t b)
+    {
+#if defined(__arm__)
+        return __QADD16(a, b);
+#else
+        const int32_t lo = Sat16(static_cast<int16_t>(a & 0xFFFF)
+                                 + static_cast<int16_t>(b & 0xFFFF));
+        const int32_t hi = Sat16(static_cast<int16_t>(a >> 16)
+                                 + static_cast<int16_t>(b >> 16));
+        return (static_cast<uint32_t>(lo) & 0xFFFF)
+               | (static_cast<uint32_t>(hi) << 16);
+#endif
+    }
+
+    // Storage is already 16-bit PCM: no conversion at all.
+    static inline void ToS16(int16_t *dst, const int16_t *src, size_t n)
+    {
+        memcpy(dst, src, n * sizeof(int16_t));
+    }
+    static inline void FromS16(int16_t *dst, const int16_t *src, size_t n)
+    {
+        memcpy(dst, src, n * sizeof(int16_t));
+    }
+};
+
+#if LOOPER_SAMPLE_INT16
+typedef int16_t loop_sample_t;
+#else
+typedef float loop_sample_t;
+#endif
+
+typedef SampleTraits<loop_sample_t> LoopSample;
+
+#endif // LOOP_SAMPLE_H
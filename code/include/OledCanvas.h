@@ -0,0 +1,89 @@
+#ifndef OLED_CANVAS_H
+#define OLED_CANVAS_H
+
+#include <cstddef>
+#include <cstdint>
+#include "daisy_pod.h"
+#include "dev/oled_ssd130x.h"
+
+/** libDaisy's SSD1306 driver plus a write of part of one page.
+ **
+ ** Only Init() (the controller setup) is used from the base class; the
+ ** frame buffer lives in OledCanvas.
+ */
+class OledPageDriver : public daisy::SSD130x4WireSpi128x64Driver
+{
+  public:
+    /** Columns [x, x + n) of 'page' (page addressing mode). */
+    void WritePage(uint8_t page, uint8_t x, const uint8_t *data, size_t n)
+    {
+        transport_.SendCommand(0xB0 + page);
+        transport_.SendCommand(x & 0x0F);        // column, low nibble
+        transport_.SendCommand(0x10 | (x >> 4)); // column, high nibble
+        transport_.SendData(const_cast<uint8_t *>(data), n);
+    }
+};
+
+/** Retained-mode 128x64 frame buffer for the SSD1306.
+ **
+ ** Drawing only touches RAM and marks the 8-row pages it changed. Flushing
+ ** compares each dirty page with what the panel already shows and sends
+ ** just the columns that differ, so an unchanged frame costs nothing and a
+ ** new menu highlight is two short page writes instead of the whole 1 KB.
+ ** FlushPage() sends at most one page, letting the main loop spread a
+ ** frame over several iterations; Flush() sends everything now.
+ **
+ ** The buffer has the controller's layout (one byte = 8 rows of a column),
+ ** so rectangles and glyph columns are drawn as byte masks per page rather
+ ** than pixel by pixel. The API follows libDaisy's OneBitGraphicsDisplay.
+ */
+class OledCanvas
+{
+  public:
+    static constexpr size_t kWidth  = 128;
+    static constexpr size_t kHeight = 64;
+    static constexpr size_t kPages  = kHeight / 8;
+
+    using Config = OledPageDriver::Config;
+
+    /** Set up the controller and clear the panel (blocking). */
+    void Init(const Config &cfg);
+
+    void Fill(bool on);
+    void DrawPixel(int x, int y, bool on);
+    void DrawLine(int x1, int y1, int x2, int y2, bool on);
+    void DrawRect(int x1, int y1, int x2, int y2, bool on, bool fill = false);
+    void FillRect(int x1, int y1, int x2, int y2, bool on);
+
+    void SetCursor(int x, int y)
+    {
+        cursor_x_ = x;
+        cursor_y_ = y;
+    }
+
+    /** Like libDaisy: the whole cell is drawn, glyph pixels 'on' and the
+     ** background '!on'. Returns 0 if the cell doesn't fit. */
+    char WriteChar(char ch, const FontDef &font, bool on);
+    char WriteString(const char *str, const FontDef &font, bool on);
+
+    inline bool Dirty() const { return dirty_ != 0; }
+
+    /** Send the changed columns of the next dirty page. Returns false if
+     ** the panel was already up to date. */
+    bool FlushPage();
+
+    /** Send every changed page. */
+    void Flush();
+
+  private:
+    void Span(int x1, int x2, int page, uint8_t mask, bool on);
+
+    OledPageDriver driver_;
+    uint8_t        fb_[kWidth * kPages];
+    uint8_t        panel_[kWidth * kPages]; // what the controller holds
+    uint8_t        dirty_;                  // one bit per page
+    uint8_t        next_page_;
+    int            cursor_x_, cursor_y_;
+};
+
+#endif // OLED_CANVAS_H
@@ -2,29 +2,105 @@
 #define OLED_MANAGER_H
 
 #include "daisy_pod.h"
-#include "dev/oled_ssd130x.h"
-
-using MyOledDisplay = daisy::OledDisplay<daisy::SSD130x4WireSpi128x64Driver>;
+#include "CallbackProfiler.h"
+#include "OledCanvas.h"
+#include "LoopCatalog.h"
+#include "LoopEngine.h"
+#include "WaveOverview.h"
 
 // Declare external function from Looper.cpp
-extern void LoadWavFile(const char* filename);
+extern void LoadLoopFile(const char* filename);
 
+// Nothing here blocks: the screen is redrawn from state into an OledCanvas
+// and only changed pages go to the panel. ShowMessage() queues a toast that
+// covers the screen for its duration; ShowStatus()/ShowProgress() replace
+// the screen and are sent right away, so they also work from inside long
+// operations that don't return to the main loop.
 class OledManager
 {
   public:
     void Init(daisy::DaisyPod& pod);
+    void Service(); // main loop: toasts, redraw and panel writes
     void HandleMenu(int32_t inc, bool pressed);
     void UpdateOledStatus(bool play, bool rec);
     void UpdateBatteryDisplay(double batt_v);
-    void ShowMessage(const char* message, int duration_ms = 1000);
-    void ListBinaryFiles(); 
+    void ShowMessage(const char* message, int duration_ms = 1000); // toast
+    void ShowStatus(const char* message);          // until the next screen
+    void ShowProgress(const char* label, int pct); // status with a bar
+    void ShowProfile(const CallbackProfiler::Stats& st); // diagnostics page
+    // Waveform strip under the main menu: OledCanvas::kWidth peaks (nullptr
+    // hides it) and the playhead column
+    void SetOverview(const WavePeak* cols, int playhead);
+    // Recall lists the loops in the catalog, newest first
+    void SetCatalog(LoopCatalog* cat) { catalog = cat; }
+    // Track highlighted on the Tracks page, -1 when it isn't shown
+    int SelectedTrack() const
+    {
+        return in_track_page && track_row < (int)kMaxTracks ? track_row : -1;
+    }
+    // Speed (0) or tempo (1) row highlighted on the Speed page (encoder2
+    // turns it), -1 otherwise
+    int SelectedSpeedRow() const
+    {
+        return in_speed_page && speed_row < 2 ? speed_row : -1;
+    }
 
   private:
-    void DrawMenu();
-    void ListWavFiles();
-    void LoadSelectedFile(); // NEW: Calls LoadWavFile() when a file is selected
+    enum class Screen
+    {
+        MENU,
+        STATUS,
+        PROGRESS,
+        PROFILE,
+    };
+
+    // Frame cap for Service() (~30 fps)
+    static constexpr uint32_t kFrameMs = 33;
+
+    void SetScreen(Screen screen);
+    void Present();               // Render() and send it all now
+    void Render(uint32_t now);    // toasts and redraw into the canvas
+    void DrawScreen();
+    void DrawMenu();              // marks the menu for redraw
+    void DrawMenuScreen();
+    void DrawItem(int y, const char* text, bool selected);
+    void DrawProfile();
+    void DrawOverview();
+    void DrawBattery();
+    void DrawFileList();
+    void DrawTrackPage();
+    void DrawSpeedPage();
+    void LoadSelectedFile(); // Calls LoadLoopFile() (.LPK, .WAV or .BIN)
+    int SubMenuCount() const;
+    const char* const* SubMenuEntries() const;
+
+    OledCanvas display;
+
+    Screen   screen       = Screen::MENU;
+    bool     screen_dirty = true;
+    uint32_t frame_ms     = 0;
+    char     status_text[24];
+    int      progress_pct = 0;
+    CallbackProfiler::Stats profile;
+
+    // Toasts, shown in order; each one's time starts when it appears
+    static constexpr int toast_slots = 8;
+    struct Toast
+    {
+        char     text[24];
+        uint32_t duration_ms;
+    };
+    Toast    toasts[toast_slots];
+    int      toast_head    = 0;
+    int      toast_count   = 0;
+    bool     toast_visible = false;
+    uint32_t toast_shown_ms = 0;
 
-    MyOledDisplay display;
+    int battery_fill = 0; // pixels, 0 = not drawn yet
+
+    bool     overview_shown = false;
+    int      overview_head  = 0;
+    WavePeak overview_cols[OledCanvas::kWidth];
 
     // Main menu:
     static constexpr int menu_count = 3;
@@ -35,18 +111,48 @@ class OledManager
 
     // Sub-menu for Save/Recall:
     bool in_submenu = false;
-    static constexpr int sub_menu_count = 3;
+    static constexpr int sub_menu_count = 4;
     int current_submenu_index = 0;
     const char* sub_menu_entries[sub_menu_count] = {
-        "Save", "Recall", "Exit"
+        "Save", "Recall", "Rescan", "Exit"
+    };
+
+    // Sub-menu for Loop/Playback:
+    static constexpr int loop_menu_count = 8;
+    const char* loop_menu_entries[loop_menu_count] = {
+        "Undo", "Redo", "Layers", "Stream", "Tracks", "Stereo", "Speed", "Exit"
+    };
+
+    // Sub-menu for Settings:
+    static constexpr int settings_menu_count = 7;
+    const char* settings_menu_entries[settings_menu_count] = {
+        "Benchmark", "Profiler", "Save profile", "Stream stats", "SD bench", "Latency",
+        "Exit"
     };
 
+    // Profiler page (live, until the encoder is pressed)
+    bool in_profile_page = false;
+    uint32_t profile_drawn_ms = 0;
+
+    // Tracks page: a row per track, then "Back". Press cycles the track's
+    // mode, encoder2 sets its level (see main.cpp)
+    bool in_track_page = false;
+    int track_row = 0;
+    uint32_t track_drawn_ms = 0;
+
+    // Speed page: speed (press for 1x, 1/2, 2x, reverse; encoder2 turns
+    // it), tempo (press for 100%, 75%, 150%; encoder2 turns it), read head
+    // kernel (press cycles), "Back"
+    static constexpr int speed_rows = 4;
+    bool in_speed_page = false;
+    int speed_row = 0;
+    uint32_t speed_drawn_ms = 0;
+
     // File selection variables
     bool in_file_selection = false;  // NEW: Are we selecting a file?
-    static constexpr int max_files = 10; // Limit number of files displayed
-    char file_list[max_files][64];       // Store file names
-    int file_count = 0;                  // Number of found files
-    int selected_file_index = 0;         // Index of selected file
+    LoopCatalog* catalog = nullptr;  // entries are read a page at a time
+    int file_count = 0;              // Catalog entries when Recall opened
+    int selected_file_index = 0;     // Index of selected file (0 = newest)
 };
 
 #endif // OLED_MANAGER_H
@@ -0,0 +1,81 @@
+#ifndef SD_IO_H
+#define SD_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include "daisy_pod.h"
+#include "fatfs.h"
+
+/** SD card bring-up and bulk transfers.
+ **
+ ** Mount() starts at the fastest bus mode the pod can run (4-bit, 50 MHz)
+ ** and walks down to 1-bit at 400 kHz until one passes a write/read-back
+ ** of a full buffer, so a card or socket that can't take 4-bit or the high
+ ** clock still mounts, just slower.
+ **
+ ** The rest is about keeping FatFs on its fast path: a transfer that
+ ** starts on a sector boundary and covers whole sectors goes straight to
+ ** the SDMMC DMA as one multi-block command (up to a cluster at a time),
+ ** anything else is split into single sectors through FatFs's window.
+ **  - Buffer() is a 64 KB DMA buffer, 32-byte aligned so the driver's
+ **    cache maintenance doesn't touch neighbouring data. Loaders share it
+ **    (main loop only, one at a time).
+ **  - Preallocate() gives a new file one contiguous run of clusters, so
+ **    writes never stop to search the FAT and consecutive clusters can be
+ **    read back to back.
+ **
+ ** Bench() times that path for a given transfer size (Settings menu; on
+ ** the host sim it measures the file shim instead of a card).
+ */
+class SdIo
+{
+  public:
+    /** Shared transfer buffer. */
+    static constexpr size_t kBufferSize = 65536;
+
+    /** Bytes per sector, the unit of a direct transfer. */
+    static constexpr size_t kSector = 512;
+
+    struct BenchResult
+    {
+        uint32_t chunk;      // bytes per f_read/f_write
+        uint32_t write_kbps; // KB/s
+        uint32_t read_kbps;
+    };
+
+    /** Bus setup and mount. Returns false if no mode works. */
+    bool Mount(daisy::SdmmcHandler &sd, daisy::FatFSInterface &fsi);
+
+    /** "4bit 50MHz" etc. */
+    const char *ModeName() const;
+
+    inline uint8_t *Buffer() { return buffer_; }
+
+    /** Reserve 'bytes' of contiguous clusters for a file just created (size
+     ** 0). Falls back to a plain extend if the card is too fragmented. The
+     ** file pointer is left at 0. */
+    static bool Preallocate(FIL *f, FSIZE_t bytes);
+
+    /** Write then read back 'total' bytes in 'chunk'-byte transfers
+     ** (chunk <= kBufferSize) through a preallocated scratch file. */
+    bool Bench(const char *path, size_t chunk, size_t total, BenchResult *res);
+
+  private:
+    struct Mode
+    {
+        daisy::SdmmcHandler::BusWidth width;
+        daisy::SdmmcHandler::Speed    speed;
+        const char                   *name;
+    };
+
+    static const Mode kModes[];
+
+    bool Probe();
+
+    FATFS *fs_;
+    int    mode_ = -1;
+
+    uint8_t buffer_[kBufferSize] __attribute__((aligned(32)));
+};
+
+#endif // SD_IO_H
@@ -0,0 +1,58 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <cstdint>
+
+/** Single-writer sequence lock for publishing a small struct.
+ **
+ ** The audio callback Write()s a status snapshot at the end of every block
+ ** and the main loop Read()s it. The writer never waits. The sequence
+ ** counter is odd while a write is in progress; a reader that saw an odd
+ ** counter, or a different counter after copying, was interrupted by the
+ ** callback and simply copies again. Since the writer is an interrupt that
+ ** always runs to completion, a retry can only happen once per audio block.
+ **
+ ** T must be trivially copyable.
+ */
+template <typename T>
+class Seqlock
+{
+  public:
+    void Init(const T &value)
+    {
+        seq_.store(0, std::memory_order_relaxed);
+        value_ = value;
+    }
+
+    /** Writer (audio callback). */
+    void Write(const T &value)
+    {
+        const uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        value_ = value;
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    /** Reader (main loop): a consistent copy of the last Write(). */
+    T Read() const
+    {
+        T        copy;
+        uint32_t before, after;
+        do
+        {
+            before = seq_.load(std::memory_order_acquire);
+            copy   = value_;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = seq_.load(std::memory_order_relaxed);
+        } while((before & 1) != 0 || before != after);
+        return copy;
+    }
+
+  private:
+    std::atomic<uint32_t> seq_;
+    T                     value_;
+};
+
+#endif // SEQLOCK_H
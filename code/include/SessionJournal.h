@@ -0,0 +1,229 @@
+#ifndef SESSION_JOURNAL_H
+#define SESSION_JOURNAL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "fatfs.h"
+#include "LoopSample.h"
+#include "SdIo.h"
+
+/** Journal region, in buffer samples: the unit that's marked dirty and
+ ** written as one record. */
+static constexpr size_t kJournalRegionSize = 4096;
+
+/** Backing memory for a SessionJournal: a dirty bit per region. Small
+ ** enough for internal SRAM (under 1 KB for a 10-minute loop):
+ **
+ **     static SessionJournalStorage<MAX_SIZE> journal_mem;
+ */
+template <size_t loop_size>
+struct SessionJournalStorage
+{
+    static constexpr size_t kLoopSize = loop_size;
+    static constexpr size_t kRegions
+        = (loop_size + kJournalRegionSize - 1) / kJournalRegionSize;
+    static constexpr size_t kWords = (kRegions + 31) / 32;
+
+    std::atomic<uint32_t> dirty[kWords];
+};
+
+/** Crash-safe autosave: the loop memory journaled to the SD card as it
+ ** changes, and replayed at boot.
+ **
+ ** The audio path calls Touch() for what it writes to buf[] (overdubs and
+ ** the undo/redo swap), which sets a dirty bit per kJournalRegionSize
+ ** samples; planes being cleared aren't journaled, as a replay starts
+ ** from zeros. Step(), a background job, appends dirty
+ ** regions to the journal file once the record head has moved on from
+ ** them, so what's written is what changed, a region at a time, not the
+ ** loop, and syncs the file once it has caught up. A region is marked
+ ** clean before it's copied; a write that lands during the copy marks it
+ ** dirty again and it's written once more.
+ **
+ ** Records are a header sector, then the region's samples padded to whole
+ ** sectors, so every write is on FatFs's direct path (see SdIo.h). The
+ ** header carries the file's generation and a running sequence number,
+ ** and CRC-32s of itself and of the samples. Besides regions there are
+ ** META records (the loop's length, channels, track layout and mix, see
+ ** Session) and a CHECKPOINT.
+ **
+ ** A journal file starts a generation: a META record, then a base pass
+ ** over the whole loop (every used track plane), then a CHECKPOINT; only
+ ** a file with its checkpoint can be replayed. Dirty regions and META
+ ** changes (at most one per kMetaMs) follow. The file is preallocated to
+ ** twice the base pass, and once it's full the journal compacts: a new
+ ** generation goes into the other file, and the old one is deleted at the
+ ** new one's checkpoint. Until then the old one is what a boot replays,
+ ** so a crash while compacting loses the changes since it started at
+ ** worst. A new loop (reset, recall, a channel switch) starts a new
+ ** generation too, and with no loop to keep (a first take, a loop still
+ ** loading, a streamed loop) both files are deleted.
+ **
+ ** Replay() reads the newest file with a checkpoint into buf[], record by
+ ** record, up to the first one that doesn't check out (a write cut short
+ ** by the power going) or has the wrong generation or sequence number
+ ** (preallocated space holds whatever was there before). Generations
+ ** never repeat on a card: the highest one started is kept in its own
+ ** small file, which survives the journals being deleted, so records left
+ ** behind by an older journal in reused clusters are always stale. The
+ ** caller then
+ ** restores the loop's settings from the Session and calls Follow(), and
+ ** the journal carries on appending to the same file.
+ **
+ ** Samples are stored as they are in buf[]: a journal only replays into
+ ** a build with the same storage type (LOOPER_SAMPLE_INT16). A write that
+ ** fails (a full or missing card) stops the journal, and its files are
+ ** deleted rather than left behind the loop.
+ **
+ ** Touch() runs in the audio callback; everything else in the main loop.
+ */
+class SessionJournal
+{
+  public:
+    /** Most track planes a journal keeps. */
+    static constexpr size_t kMaxPlanes = 8;
+
+    /** Shortest time between two META records. */
+    static constexpr uint32_t kMetaMs = 250;
+
+    /** What the journal keeps besides the samples: the loop as the engine
+     ** has it (see LoopStatus). */
+    struct Session
+    {
+        uint32_t id;       // changes with every new loop (not journaled)
+        uint32_t length;   // frames, 0: no loop to keep
+        uint32_t channels;
+        uint32_t stride; // from one track plane to the next (samples)
+        uint32_t planes; // track planes laid out
+        uint8_t  used;   // bit t: plane t holds audio
+        uint8_t  muted;
+        uint8_t  armed;
+        uint8_t  level[kMaxPlanes]; // percent
+    };
+
+    struct Stats
+    {
+        uint32_t generation;
+        uint32_t records;     // written since boot
+        uint64_t bytes;       // ... and their size on the card
+        uint32_t compactions; // generations started on a full file
+        uint32_t failures;    // writes that failed (the journal stops)
+    };
+
+    template <typename Storage>
+    void Init(loop_sample_t *loop, Storage &mem)
+    {
+        Init(loop, Storage::kLoopSize, mem.dirty, Storage::kWords);
+    }
+
+    /** Audio path: [pos, pos + n) of buf[] was just written. */
+    inline void Touch(size_t pos, size_t n)
+    {
+        if(n == 0 || pos >= size_)
+            return;
+        const size_t last = (pos + n - 1) / kJournalRegionSize;
+        for(size_t r = pos / kJournalRegionSize; r <= last && r < regions_; r++)
+            dirty_[r / 32].fetch_or(1u << (r % 32), std::memory_order_release);
+    }
+
+    /** Main loop: one record, if there's anything to write. 'now' is the
+     ** loop as it is, 'hot' the record head's sample within a plane
+     ** (SIZE_MAX when not recording); 'ms' a millisecond clock. */
+    bool Step(const Session &now, size_t hot, uint32_t ms);
+
+    /** Boot: the newest complete journal into buf[], and its last META
+     ** into 'out'. False if there's none. */
+    bool Replay(Session *out);
+
+    /** The loop just replayed is the engine's loop 'id' now: go on
+     ** journaling it in the same file. */
+    void Follow(uint32_t id);
+
+    inline Stats GetStats() const { return stats_; }
+
+  private:
+    enum : uint32_t
+    {
+        kRecordMagic = 0x4C4E4A4C, // "LJNL"
+        kRegion      = 1,
+        kMeta        = 2,
+        kCheckpoint  = 3,
+        kGeneration  = 4, // SESSION.GEN
+    };
+
+    /** The first sector of every record. */
+    struct Record
+    {
+        uint32_t magic;
+        uint32_t type;
+        uint32_t generation;
+        uint32_t sequence; // from 0 in each file
+        uint32_t offset;       // region: first buffer sample
+        uint32_t count;        // region: samples
+        uint32_t data_crc;     // region: CRC-32 of the samples
+        uint32_t sample_bytes; // sizeof(loop_sample_t)
+        Session  session;      // META and CHECKPOINT
+        uint32_t crc;          // CRC-32 of the above
+    };
+
+    static constexpr size_t kSector      = SdIo::kSector;
+    static constexpr size_t kRegionBytes = kJournalRegionSize * sizeof(loop_sample_t);
+    static constexpr size_t kRecordBytes = kSector + kRegionBytes;
+    static constexpr size_t kMetaSlack   = 64 * 1024; // room for META records
+
+    static_assert(sizeof(Record) <= kSector, "a header is one sector");
+    static_assert(kRegionBytes % kSector == 0, "regions are whole sectors");
+
+    void Init(loop_sample_t         *loop,
+              size_t                 loop_size,
+              std::atomic<uint32_t> *dirty,
+              size_t                 words);
+
+    bool     Start(const Session &now, uint32_t ms);
+    uint32_t LoadGeneration();
+    bool     SaveGeneration(uint32_t generation);
+    bool     WriteRegion(size_t r);
+    bool     WriteRecord(uint32_t type, const Session &s, uint32_t offset, uint32_t count);
+    bool     NextDirty(uint8_t used, size_t hot, size_t *region);
+    bool     Hot(size_t r, size_t hot) const;
+    bool     Used(size_t r, uint8_t used) const;
+    bool     Fits(const Session &s) const;
+    bool     ReplayFile(int which, Session *out);
+    bool     ReadRecord(FIL *f, FSIZE_t at, bool payload);
+    bool     Fail();
+    void     Close(bool remove);
+    size_t   Extent(const Session &s) const;
+
+    static bool SameLoop(const Session &a, const Session &b);
+    static bool SameMix(const Session &a, const Session &b);
+
+    loop_sample_t         *loop_;
+    size_t                 size_;
+    std::atomic<uint32_t> *dirty_;
+    size_t                 words_;
+    size_t                 regions_;
+
+    FIL      file_;
+    bool     open_;
+    bool     synced_;  // nothing written since the last f_sync()
+    bool     cleared_; // no journal files on the card
+    bool     failed_;
+    int      which_; // file being written (0 or 1)
+    uint32_t last_;  // highest generation on the card (or in SESSION.GEN)
+    uint32_t generation_;
+    uint32_t sequence_;
+    FSIZE_t  offset_;   // where the next record goes
+    FSIZE_t  capacity_; // preallocated size
+    Session  session_;  // as of the last META record
+    uint32_t meta_ms_;
+    size_t   extent_; // buffer samples the loop spans
+    size_t   base_;   // next region of the base pass
+    bool     based_;  // checkpoint written
+    size_t   scan_;   // next word of the dirty scan
+    Stats    stats_;
+
+    uint8_t record_[kRecordBytes] __attribute__((aligned(32)));
+};
+
+#endif // SESSION_JOURNAL_H
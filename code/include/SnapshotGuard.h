@@ -0,0 +1,186 @@
+#ifndef SNAPSHOT_GUARD_H
+#define SNAPSHOT_GUARD_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "LoopSample.h"
+
+/** Region size used by the snapshot guard, in samples. */
+static constexpr size_t kSnapshotRegionSize = 512;
+
+/** Backing memory for a SnapshotGuard, meant to be placed in SDRAM. */
+template <size_t loop_size, size_t pool_slots>
+struct SnapshotStorage
+{
+    static constexpr size_t kRegions
+        = (loop_size + kSnapshotRegionSize - 1) / kSnapshotRegionSize;
+    static constexpr size_t kSlots = pool_slots;
+
+    loop_sample_t pool[pool_slots * kSnapshotRegionSize];
+    uint16_t      region_slot[kRegions];
+};
+
+/** Copy-on-write guard that keeps a point-in-time view of the loop while it
+ ** is being read out by a slow consumer (the background saver).
+ **
+ ** The consumer walks the loop region by region, in ring order starting at
+ ** Begin()'s start region, and reports its progress with MarkSaved(). Before
+ ** the audio path overwrites a range it calls Preserve(): any region in it
+ ** that the consumer has not reached yet is copied into a small pool first.
+ ** Source() then hands the consumer the preserved copy instead of the live
+ ** buffer.
+ **
+ ** Starting the walk at the record head means the consumer runs away from
+ ** it, so in practice only a handful of regions ever need copying. If the
+ ** pool still runs out (e.g. the SD card stalls for seconds while the head
+ ** catches up), the snapshot is flagged Torn() and the consumer restarts.
+ **
+ ** A multi-track loop is snapshotted as several planes of the same length
+ ** 'stride' samples apart in the buffer (see LoopEngine, "Tracks"). The
+ ** walk is over the regions of one plane; Preserve() takes buffer
+ ** positions in any plane, and Source()/Preserved() take the plane.
+ **
+ ** Preserve() runs in the audio callback, everything else in the main loop.
+ ** Begin() fills in the layout and then publishes it with a release store
+ ** of active_, which Preserve() loads with acquire; a region's pool copy
+ ** is likewise complete before its slot is stored.
+ */
+class SnapshotGuard
+{
+  public:
+    template <typename Storage>
+    void Init(const loop_sample_t *loop, Storage &mem)
+    {
+        loop_        = loop;
+        pool_        = mem.pool;
+        region_slot_ = mem.region_slot;
+        slots_       = Storage::kSlots;
+        active_.store(false, std::memory_order_relaxed);
+    }
+
+    /** Start a snapshot of the first 'length' samples of 'planes' planes
+     ** (a multiple of kSnapshotRegionSize apart), walked from
+     ** 'start_region' on. */
+    void Begin(size_t length,
+               size_t start_region,
+               size_t planes = 1,
+               size_t stride = 0)
+    {
+        active_.store(false, std::memory_order_relaxed);
+        length_  = length;
+        regions_ = (length + kSnapshotRegionSize - 1) / kSnapshotRegionSize;
+        start_   = start_region < regions_ ? start_region : 0;
+        planes_  = planes > 1 ? planes : 1;
+        step_    = planes_ > 1 ? stride / kSnapshotRegionSize : regions_;
+        saved_.store(0, std::memory_order_relaxed);
+        used_.store(0, std::memory_order_relaxed);
+        torn_.store(false, std::memory_order_relaxed);
+        for(size_t p = 0; p < planes_; p++)
+            for(size_t r = 0; r < regions_; r++)
+                region_slot_[p * step_ + r] = kNone;
+        active_.store(true, std::memory_order_release); // publish last
+    }
+
+    void End() { active_.store(false, std::memory_order_relaxed); }
+
+    /** Audio path: call before writing [pos, pos + n). */
+    void Preserve(size_t pos, size_t n)
+    {
+        if(!active_.load(std::memory_order_acquire) || n == 0)
+            return;
+
+        const size_t saved = saved_.load(std::memory_order_acquire);
+        size_t       used  = used_.load(std::memory_order_relaxed);
+
+        // a: region of the buffer, r: the same region within its plane
+        const size_t last = (pos + n - 1) / kSnapshotRegionSize;
+        for(size_t a = pos / kSnapshotRegionSize; a <= last; a++)
+        {
+            const size_t r = a % step_;
+            if(a / step_ >= planes_ || r >= regions_)
+                continue;
+            if(Ordinal(r) < saved || region_slot_[a] != kNone)
+                continue;
+            if(used == slots_)
+            {
+                torn_.store(true, std::memory_order_relaxed);
+                continue;
+            }
+            memcpy(pool_ + used * kSnapshotRegionSize,
+                   loop_ + a * kSnapshotRegionSize,
+                   RegionLength(r) * sizeof(loop_sample_t));
+            std::atomic_thread_fence(std::memory_order_release);
+            region_slot_[a] = static_cast<uint16_t>(used++);
+        }
+        used_.store(used, std::memory_order_relaxed);
+    }
+
+    /** Consumer: the first 'count' regions of the walk are on disk. */
+    void MarkSaved(size_t count) { saved_.store(count, std::memory_order_release); }
+
+    /** Region index of the i-th region of the walk. */
+    inline size_t WalkRegion(size_t i) const
+    {
+        return (start_ + i) % regions_;
+    }
+
+    /** Snapshot contents of region 'r' (of plane 'plane'). */
+    inline const loop_sample_t *Source(size_t r, size_t plane = 0) const
+    {
+        const size_t   a    = plane * step_ + r;
+        const uint16_t slot = static_cast<volatile const uint16_t *>(region_slot_)[a];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot == kNone ? loop_ + a * kSnapshotRegionSize
+                             : pool_ + slot * kSnapshotRegionSize;
+    }
+
+    /** True once the audio path has preserved region 'r' (of plane
+     ** 'plane'). A consumer that read the live buffer must re-read
+     ** Source() if this became true meanwhile. */
+    inline bool Preserved(size_t r, size_t plane = 0) const
+    {
+        return static_cast<volatile const uint16_t *>(region_slot_)[plane * step_ + r]
+               != kNone;
+    }
+
+    inline size_t RegionLength(size_t r) const
+    {
+        const size_t start = r * kSnapshotRegionSize;
+        return (length_ - start) < kSnapshotRegionSize ? (length_ - start)
+                                                       : kSnapshotRegionSize;
+    }
+
+    inline bool   Torn() const { return torn_.load(std::memory_order_relaxed); }
+    inline bool   Active() const { return active_.load(std::memory_order_relaxed); }
+    inline size_t Regions() const { return regions_; }
+    inline size_t Planes() const { return planes_; }
+    inline size_t StartRegion() const { return start_; }
+    inline size_t PreservedCount() const { return used_.load(std::memory_order_relaxed); }
+
+  private:
+    static constexpr uint16_t kNone = 0xFFFF;
+
+    inline size_t Ordinal(size_t r) const
+    {
+        return (r + regions_ - start_) % regions_;
+    }
+
+    const loop_sample_t *loop_;
+    loop_sample_t       *pool_;
+    uint16_t            *region_slot_;
+    size_t               slots_;
+
+    size_t              length_;
+    size_t              regions_;
+    size_t              planes_;
+    size_t              step_; // regions from one plane to the next
+    size_t              start_;
+    std::atomic<size_t> saved_;  // walk ordinals on disk (main loop)
+    std::atomic<size_t> used_;   // pool slots taken (audio callback)
+    std::atomic<bool>   torn_;
+    std::atomic<bool>   active_; // release-stored once the layout is set
+};
+
+#endif // SNAPSHOT_GUARD_H
@@ -0,0 +1,69 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/** Wait-free single-producer / single-consumer ring buffer.
+ **
+ ** Used to hand commands from the main loop (producer) to the audio
+ ** callback (consumer). Push() and Pop() never block, spin or mask
+ ** interrupts: each side only writes its own index, and the release/acquire
+ ** pair on that index publishes the slot contents to the other side.
+ **
+ ** 'capacity' must be a power of two. Indices are free-running 32-bit
+ ** counters, so full/empty are told apart without wasting a slot.
+ */
+template <typename T, size_t capacity>
+class SpscQueue
+{
+    static_assert((capacity & (capacity - 1)) == 0,
+                  "capacity must be a power of two");
+
+  public:
+    void Init()
+    {
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+    }
+
+    /** Producer: false if the queue is full. */
+    bool Push(const T &item)
+    {
+        const uint32_t head = head_.load(std::memory_order_relaxed);
+        if(head - tail_.load(std::memory_order_acquire) == capacity)
+            return false;
+        items_[head & (capacity - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer: the next item without taking it; false if empty. */
+    bool Peek(T &item) const
+    {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail == head_.load(std::memory_order_acquire))
+            return false;
+        item = items_[tail & (capacity - 1)];
+        return true;
+    }
+
+    /** Consumer: false if the queue is empty. */
+    bool Pop(T &item)
+    {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail == head_.load(std::memory_order_acquire))
+            return false;
+        item = items_[tail & (capacity - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+  private:
+    T                     items_[capacity];
+    std::atomic<uint32_t> head_; // next slot to write (producer)
+    std::atomic<uint32_t> tail_; // next slot to read (consumer)
+};
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,112 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/** Cooperative scheduler for the main loop: periodic tasks and background
+ ** jobs run in time slices.
+ **
+ ** The main loop used to call everything on every pass, as fast as it
+ ** could go, and the long operations (save, load, catalog scan) ran to
+ ** completion inside a menu handler with the controls frozen. Now:
+ **  - A task runs at its own rate (controls at 1 kHz, UI at 30 Hz, ...).
+ **    It's due at a fixed period from its last slot; one that fell a whole
+ **    period behind is counted late and rescheduled from now, so a long
+ **    stall doesn't turn into a burst of catch-up runs.
+ **  - A job is a resumable piece of background work. Its step function
+ **    does a bounded amount (a chunk of a file, a directory entry) and
+ **    says whether there was anything to do. A slice calls it until it
+ **    runs out of work or out of the job's budget.
+ **
+ ** Run() is one pass: every task that's due, then one job slice, taken
+ ** round-robin among the jobs with work. A control task is therefore never
+ ** held up by more than one slice (its budget plus at most one step).
+ **
+ ** Per task and job, Stats() keep runs, the longest run or step, the
+ ** total time and late runs or slices over budget. Times are taken with
+ ** ProfileTicks() (see CallbackProfiler.h).
+ **
+ ** Main loop only; nothing here is safe to call from the audio callback.
+ */
+class TaskScheduler
+{
+  public:
+    /** Periodic task body. */
+    typedef void (*TaskFn)();
+
+    /** One step of a job. Returns false if there was nothing to do. */
+    typedef bool (*JobFn)();
+
+    static constexpr size_t kMaxTasks = 8;
+    static constexpr size_t kMaxJobs  = 8;
+
+    struct Stats
+    {
+        const char *name;
+        bool        job;
+        uint32_t    runs;     // task runs, or job steps that did work
+        uint32_t    slices;   // job slices with work (0 for tasks)
+        uint32_t    late;     // task runs a period late, or slices over budget
+        uint32_t    max_us;   // longest task run or job step
+        uint32_t    slice_us; // longest job slice
+        uint64_t    total_us;
+    };
+
+    void Init();
+
+    /** Run 'fn' every 'period_us'. In order of priority (first added,
+     ** first run when several are due). */
+    bool AddTask(const char *name, TaskFn fn, uint32_t period_us);
+
+    /** Give 'fn' slices of up to 'budget_us'. */
+    bool AddJob(const char *name, JobFn fn, uint32_t budget_us);
+
+    /** One pass of the main loop at 'now_us' (System::GetUs()). */
+    void Run(uint32_t now_us);
+
+    /** Tasks, then jobs, in the order they were added. */
+    inline size_t Count() const { return task_count_ + job_count_; }
+
+    Stats GetStats(size_t index) const;
+    void  ResetStats();
+
+  private:
+    struct Counters
+    {
+        uint32_t runs;
+        uint32_t slices;
+        uint32_t late;
+        uint32_t max_ticks;
+        uint32_t slice_ticks;
+        uint64_t total_ticks;
+    };
+
+    struct Task
+    {
+        const char *name;
+        TaskFn      fn;
+        uint32_t    period_us;
+        uint32_t    due_us;
+        Counters    count;
+    };
+
+    struct Job
+    {
+        const char *name;
+        JobFn       fn;
+        uint32_t    budget_ticks;
+        Counters    count;
+    };
+
+    bool RunSlice(Job &job); // false if the job had nothing to do
+
+    Task   tasks_[kMaxTasks];
+    Job    jobs_[kMaxJobs];
+    size_t task_count_;
+    size_t job_count_;
+    size_t next_job_;
+    bool   started_;
+};
+
+#endif // TASK_SCHEDULER_H
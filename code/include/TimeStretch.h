@@ -0,0 +1,116 @@
+#ifndef TIME_STRETCH_H
+#define TIME_STRETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include "Interpolation.h"
+
+/** Tempo change at the same pitch (see LoopEngine "Tempo"): WSOLA.
+ **
+ ** The output is Hann-windowed grains of kGrain frames, overlap-added every
+ ** kHop frames (half a grain, where Hann windows sum to one). Grains are
+ ** taken from the source kHop * tempo frames apart, so the loop goes by
+ ** faster or slower, but each grain is played at its own speed and keeps
+ ** its pitch. To keep the waveform continuous where grains overlap, each
+ ** grain is moved by up to kSeek frames from its nominal place, to where
+ ** it looks most like what the previous grain would have gone on to play
+ ** (its natural continuation): the offset with the highest normalized
+ ** cross-correlation, on the mono mix.
+ **
+ ** The search runs in the time domain, decimated: first every kDecimate-th
+ ** offset over every kDecimate-th sample, then every offset around the best
+ ** of those at full resolution. It's split into kSteps pieces of about the
+ ** same cost, and Process() runs them spread over the first kPace frames
+ ** of each hop, so no block pays for a whole search: the cost per block
+ ** is bounded by a step or two plus, once per hop, the overlap-add. A
+ ** search that isn't finished when its hop starts (blocks longer than a
+ ** hop) is finished there and counted as late.
+ **
+ ** Audio callback only. The source is read through ReadFn, which wraps:
+ ** positions are frames into a loop of Start()'s 'length' frames.
+ */
+class TimeStretch
+{
+  public:
+    /** 'frames' frames of the source from frame 'first' (wrapped into the
+     ** loop) into 'dst', channels interleaved. */
+    typedef void (*ReadFn)(void *ctx, float *dst, int64_t first, size_t frames);
+
+    static constexpr size_t kGrain    = 1024; // frames, about 21 ms
+    static constexpr size_t kHop      = kGrain / 2;
+    static constexpr size_t kSeek     = 256; // furthest a grain moves, either way
+    static constexpr size_t kDecimate = 4;
+    static constexpr size_t kPace     = kHop * 3 / 4; // the search is done by then
+
+    /** Tempo in kInterpOne units: 50% to 200%. */
+    static constexpr int32_t kMinTempo = kInterpOne / 2;
+    static constexpr int32_t kMaxTempo = kInterpOne * 2;
+
+    struct Stats
+    {
+        uint32_t hops; // grains placed since Start()
+        uint32_t late; // of those, searches finished at the hop
+    };
+
+    void Init(ReadFn read, void *ctx);
+
+    /** Play from source frame 'pos' of a 'length' frame loop: the first hop
+     ** is the source as it is, so starting is seamless. */
+    void Start(size_t pos, size_t length, size_t channels, int32_t tempo);
+
+    /** Takes effect from the next grain on. */
+    void SetTempo(int32_t tempo);
+
+    /** Render 'n' frames (channels interleaved) into 'out'. */
+    void Process(float *out, size_t n);
+
+    /** Source frame playing now (at the grain being faded in). */
+    size_t Position() const;
+
+    inline Stats GetStats() const { return stats_; }
+
+  private:
+    // Source read for a search: the grain's nominal place, kSeek frames
+    // of room either way. Candidate offsets compare kHop frames each.
+    static constexpr size_t kSpan      = kGrain + 2 * kSeek;
+    static constexpr size_t kMonoSpan  = kHop + 2 * kSeek;
+    static constexpr size_t kChunk     = 128; // frames read per step
+    static constexpr size_t kOffsets   = 2 * kSeek / kDecimate + 1;
+    static constexpr size_t kPerStep   = 8; // coarse offsets per step
+    static constexpr size_t kRefine    = kDecimate - 1;
+    static constexpr size_t kReadSteps = kSpan / kChunk;
+    static constexpr size_t kCoarse    = (kOffsets + kPerStep - 1) / kPerStep;
+    static constexpr size_t kFine      = 2 * kRefine + 1;
+    static constexpr size_t kSteps     = kReadSteps + kCoarse + kFine;
+
+    static_assert(kSpan % kChunk == 0, "whole chunks");
+
+    void Step();
+    void ReadChunk(size_t k);
+    void Consider(size_t offset, size_t stride);
+    void Place();
+    void Next();
+
+    ReadFn read_;
+    void  *ctx_;
+
+    size_t  ch_;
+    int64_t length_;
+    int32_t tempo_;
+    int64_t nominal_; // next grain's place without the search, Q16 frames
+    int64_t grain_;   // where the grain being faded in came from
+    size_t  out_;     // frames of the current hop played
+    size_t  step_;    // of the next grain's search
+    size_t  best_;    // offset found (frames into src_; kSeek is none)
+    size_t  coarse_;  // best of the coarse pass
+    float   score_;
+    Stats   stats_;
+
+    float src_[kSpan * 2];
+    float mono_[kMonoSpan];
+    float ref_[kHop]; // natural continuation, mono
+    float hop_[kHop * 2];
+    float tail_[kHop * 2]; // the last grain's second half, windowed
+};
+
+#endif // TIME_STRETCH_H
@@ -0,0 +1,76 @@
+#ifndef WAV_FORMAT_BENCH_H
+#define WAV_FORMAT_BENCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include "CycleCounter.h"
+#include "WavWriter.h"
+
+/** Micro-benchmark for the WavWriter sample formats.
+ **
+ ** Times both kernels of a format over the same float input: Store() one
+ ** sample at a time, as the Sample() path does, and Convert() over whole
+ ** runs, as WriteBlock() does. Reports cycles per sample for each, so the
+ ** specializations can be compared with each other and against the SD
+ ** card's write rate.
+ **
+ ** Only depends on WavWriter.h and CycleCounter.h, so it builds on the pod
+ ** (Settings menu) and on a host. Like the kernel benchmark, it expects the
+ ** cycle counter to be running (CycleCounterInit() at boot):
+ **
+ **     static float   src[4096];
+ **     static uint8_t dst[4096 * 4];
+ **     WavFormatBenchResult r
+ **         = RunWavFormatBench<daisy::WavFormatS24>(src, dst, 4096, 100);
+ */
+struct WavFormatBenchResult
+{
+    uint16_t bits;
+    float    store_cycles;   // cycles per sample, Store() loop
+    float    convert_cycles; // cycles per sample, Convert()
+};
+
+/** 'dst' must hold samples * Format::kBits / 8 bytes. */
+template <typename Format>
+WavFormatBenchResult RunWavFormatBench(float   *src,
+                                       uint8_t *dst,
+                                       size_t   samples,
+                                       int      iterations)
+{
+    WavFormatBenchResult res = {Format::kBits, 0.0f, 0.0f};
+    if(samples == 0 || iterations <= 0)
+        return res;
+
+    static constexpr size_t kBytes = Format::kBits / 8;
+
+    // Full-scale ramp, with a few out-of-range values for the clamps
+    for(size_t i = 0; i < samples; i++)
+        src[i] = 2.5f * static_cast<float>(i % 101) / 100.0f - 1.25f;
+
+    uint64_t total = 0;
+    for(int it = 0; it < iterations; it++)
+    {
+        const uint32_t t0 = CycleCounterRead();
+        for(size_t i = 0; i < samples; i++)
+            Format::Store(dst + i * kBytes, src[i]);
+        total += static_cast<uint32_t>(CycleCounterRead() - t0);
+    }
+    res.store_cycles = static_cast<float>(total) / iterations / samples;
+
+    total = 0;
+    for(int it = 0; it < iterations; it++)
+    {
+        const uint32_t t0 = CycleCounterRead();
+        Format::Convert(dst, src, samples);
+        total += static_cast<uint32_t>(CycleCounterRead() - t0);
+    }
+    res.convert_cycles = static_cast<float>(total) / iterations / samples;
+
+    // Keep the output observable
+    volatile uint8_t sink = dst[samples * kBytes - 1];
+    (void)sink;
+
+    return res;
+}
+
+#endif // WAV_FORMAT_BENCH_H
@@ -0,0 +1,449 @@
+#pragma once
+#include <cstring>
+#include "fatfs.h"
+
+namespace daisy
+{
+/** Streaming WAV File Reader
+ **
+ ** Counterpart to WavWriter: reads a WAV file from the SD Card in large
+ ** chunks and converts it straight into a float or int16_t (Q15) destination
+ ** buffer. 16-bit files read into an int16_t buffer with as many channels
+ ** as it has are plain copies.
+ **
+ ** The RIFF structure is walked chunk by chunk, so files written by DAWs
+ ** with extra chunks (LIST, bext, fact, JUNK, ...) before or after "fmt "
+ ** load fine; unknown chunks are skipped with f_lseek.
+ **
+ ** Supported formats, mono or stereo. They're read as mono (stereo mixed
+ ** down) or, after SetChannels(2), as interleaved stereo (mono doubled):
+ **  - 16, 24 (packed) and 32-bit signed int PCM
+ **  - 32-bit IEEE float
+ **  - WAVE_FORMAT_EXTENSIBLE wrapping any of the above
+ **
+ ** Reads go through an internal 32-byte aligned transfer buffer. After the
+ ** first read the file position is kept on a 512-byte sector boundary, so
+ ** FatFS can transfer whole sectors straight into it.
+ **
+ ** Optional sample-rate conversion (linear interpolation) is enabled with
+ ** SetTargetRate(); by default samples are copied at the file's rate.
+ ** Memory use: transfer_size + 16 KB.
+ **
+ ** To use:
+ ** 1. Create a WavReader<size> object (e.g. WavReader<32768> reader)
+ ** 2. Open a file with reader.Open("FileName.wav") and check GetInfo()
+ ** 3. Call reader.Read(dst, max_frames) until it returns 0
+ ** 4. reader.Close()
+ ** */
+template <size_t transfer_size>
+class WavReader
+{
+  public:
+    WavReader() {}
+    ~WavReader() {}
+
+    /** Return values for Open */
+    enum class Result
+    {
+        OK,
+        ERROR,
+        UNSUPPORTED,
+    };
+
+    /** Format of the opened file */
+    struct Info
+    {
+        uint16_t format;        // WAVE_FORMAT_PCM or kFormatFloat
+        uint16_t channels;      // 1 or 2
+        uint32_t samplerate;    // Hz
+        uint16_t bitspersample; // 16, 24 or 32
+        uint32_t frames;        // frames in the data chunk
+    };
+
+    static constexpr uint16_t kFormatFloat      = 0x0003;
+    static constexpr uint16_t kFormatExtensible = 0xFFFE;
+
+    /** Resample to 'rate' while reading (0 = off, read at file rate). */
+    void SetTargetRate(float rate) { target_rate_ = rate; }
+
+    /** Channels Read() delivers per frame, 1 (default) or 2. Set before
+     ** Open(). */
+    void SetChannels(size_t channels) { out_channels_ = channels == 2 ? 2 : 1; }
+
+    /** Opens a file and walks its chunks up to the start of the audio data. */
+    Result Open(const char *name)
+    {
+        open_ = false;
+        if(f_open(&fp_, name, FA_READ) != FR_OK)
+            return Result::ERROR;
+
+        Result res = ParseChunks();
+        if(res != Result::OK)
+        {
+            f_close(&fp_);
+            return res;
+        }
+
+        frame_bytes_ = info_.channels * (info_.bitspersample / 8);
+        info_.frames = data_bytes_ / frame_bytes_;
+        remaining_   = info_.frames * frame_bytes_;
+        carry_       = 0;
+        ratio_       = 1.0f;
+        phase_       = 0;
+        work_len_    = 0;
+        if(target_rate_ > 0.0f
+           && static_cast<uint32_t>(target_rate_) != info_.samplerate)
+        {
+            ratio_    = info_.samplerate / target_rate_;
+            step_     = static_cast<uint64_t>(ratio_ * 4294967296.0);
+            work_[0]  = 0.0f;
+            work_[1]  = 0.0f;
+            work_len_ = 1; // frame 0 holds the previous chunk's last frame
+            phase_    = 1ull << 32;
+        }
+        open_ = true;
+        return Result::OK;
+    }
+
+    /** Info for the opened file. */
+    inline const Info &GetInfo() const { return info_; }
+
+    /** Number of frames Read() will deliver in total (after resampling). */
+    uint32_t OutputFrames() const
+    {
+        return Resampling() ? static_cast<uint32_t>(info_.frames / ratio_)
+                            : info_.frames;
+    }
+
+    /** Reads and converts up to max_frames frames into dst (float or
+     ** int16_t, SetChannels() samples each). Returns the number of frames
+     ** written, 0 at the end of the data. */
+    template <typename Out>
+    size_t Read(Out *dst, size_t max_frames)
+    {
+        if(!open_)
+            return 0;
+        return Resampling() ? ReadResampled(dst, max_frames)
+                            : ReadDirect(dst, max_frames);
+    }
+
+    void Close()
+    {
+        if(open_)
+            f_close(&fp_);
+        open_ = false;
+    }
+
+  private:
+    static constexpr size_t kPad        = 32; // room for a partial frame
+    static constexpr size_t kWorkFrames = 2048;
+    static constexpr size_t kSector     = 512;
+
+    inline bool Resampling() const { return ratio_ != 1.0f; }
+
+    static inline uint32_t Le32(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    static inline uint16_t Le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+    Result ParseChunks()
+    {
+        uint8_t hdr[12];
+        UINT    br = 0;
+        if(f_read(&fp_, hdr, 12, &br) != FR_OK || br != 12
+           || Le32(hdr) != kWavFileChunkId || Le32(hdr + 8) != kWavFileWaveId)
+            return Result::ERROR;
+
+        bool have_fmt = false;
+        for(;;)
+        {
+            uint8_t ch[8];
+            if(f_read(&fp_, ch, 8, &br) != FR_OK || br != 8)
+                return Result::ERROR; // ran out of chunks before "data"
+            const uint32_t id   = Le32(ch);
+            const uint32_t size = Le32(ch + 4);
+            const FSIZE_t  next = f_tell(&fp_) + size + (size & 1);
+
+            if(id == kWavFileSubChunk1Id) // "fmt "
+            {
+                uint8_t fmt[40];
+                UINT    n = size < sizeof(fmt) ? size : sizeof(fmt);
+                if(n < 16 || f_read(&fp_, fmt, n, &br) != FR_OK || br != n)
+                    return Result::ERROR;
+                info_.format        = Le16(fmt);
+                info_.channels      = Le16(fmt + 2);
+                info_.samplerate    = Le32(fmt + 4);
+                info_.bitspersample = Le16(fmt + 14);
+                if(info_.format == kFormatExtensible && n >= 26)
+                    info_.format = Le16(fmt + 24); // SubFormat GUID
+                have_fmt = true;
+            }
+            else if(id == kWavFileSubChunk2Id) // "data"
+            {
+                if(!have_fmt)
+                    return Result::ERROR;
+                data_bytes_ = size;
+                return CheckFormat();
+            }
+            // Everything else (LIST, fact, bext, ...) is skipped.
+            if(f_lseek(&fp_, next) != FR_OK)
+                return Result::ERROR;
+        }
+    }
+
+    Result CheckFormat()
+    {
+        if(info_.channels < 1 || info_.channels > 2)
+            return Result::UNSUPPORTED;
+        if(info_.format == WAVE_FORMAT_PCM)
+        {
+            if(info_.bitspersample == 16 || info_.bitspersample == 24
+               || info_.bitspersample == 32)
+                return Result::OK;
+        }
+        else if(info_.format == kFormatFloat && info_.bitspersample == 32)
+        {
+            return Result::OK;
+        }
+        return Result::UNSUPPORTED;
+    }
+
+    /** Reads raw data for up to max_frames frames; returns the number of
+     ** whole frames available at raw_. Keeps later reads sector aligned. */
+    size_t Fill(size_t max_frames)
+    {
+        if(remaining_ == 0 && carry_ < frame_bytes_)
+            return 0;
+
+        // Move a partial frame from the last read in front of the buffer
+        if(carry_ > 0)
+            memmove(buff_ + kPad - carry_, carry_src_, carry_);
+
+        size_t        want = transfer_size;
+        const FSIZE_t pos  = f_tell(&fp_);
+        if(pos % kSector)
+            want -= pos % kSector; // realign to sector boundaries
+        const size_t cap = max_frames * frame_bytes_;
+        if(want + carry_ > cap)
+            want = cap > carry_ ? cap - carry_ : 0;
+        if(want > remaining_)
+            want = remaining_;
+
+        UINT br = 0;
+        if(want > 0
+           && (f_read(&fp_, buff_ + kPad, want, &br) != FR_OK || br == 0))
+        {
+            remaining_ = 0;
+            br         = 0;
+        }
+        remaining_ -= br;
+
+        const size_t avail  = carry_ + br;
+        const size_t frames = avail / frame_bytes_;
+        raw_                = buff_ + kPad - carry_;
+        carry_              = avail - frames * frame_bytes_;
+        carry_src_          = raw_ + frames * frame_bytes_;
+        return frames;
+    }
+
+    // Per-format sample decoders
+    struct DecS16
+    {
+        static constexpr size_t kBytes = 2;
+        static inline float     Get(const uint8_t *p)
+        {
+            int16_t v;
+            memcpy(&v, p, 2);
+            return v * (1.0f / 32768.0f);
+        }
+    };
+    struct DecS24
+    {
+        static constexpr size_t kBytes = 3;
+        static inline float     Get(const uint8_t *p)
+        {
+            const int32_t v = (int32_t)((p[0] << 8) | (p[1] << 16)
+                                        | ((uint32_t)p[2] << 24))
+                              >> 8;
+            return v * (1.0f / 8388608.0f);
+        }
+    };
+    struct DecS32
+    {
+        static constexpr size_t kBytes = 4;
+        static inline float     Get(const uint8_t *p)
+        {
+            int32_t v;
+            memcpy(&v, p, 4);
+            return v * (1.0f / 2147483648.0f);
+        }
+    };
+    struct DecF32
+    {
+        static constexpr size_t kBytes = 4;
+        static inline float     Get(const uint8_t *p)
+        {
+            float v;
+            memcpy(&v, p, 4);
+            return v;
+        }
+    };
+
+    // Output sample stores
+    static inline void Store(float &dst, float v) { dst = v; }
+    static inline void Store(int16_t &dst, float v)
+    {
+        v   = __builtin_fminf(__builtin_fmaxf(v, -1.0f), 1.0f);
+        dst = static_cast<int16_t>(v * 32767.0f);
+    }
+
+    template <typename Dec, size_t channels, size_t out_channels, typename Out>
+    static void ConvertRun(Out *dst, const uint8_t *src, size_t frames)
+    {
+        for(size_t i = 0; i < frames; i++)
+        {
+            if(channels == 2 && out_channels == 2)
+            {
+                Store(dst[2 * i], Dec::Get(src));
+                Store(dst[2 * i + 1], Dec::Get(src + Dec::kBytes));
+            }
+            else if(channels == 2)
+                Store(dst[i],
+                      0.5f * (Dec::Get(src) + Dec::Get(src + Dec::kBytes)));
+            else if(out_channels == 2)
+            {
+                Store(dst[2 * i], Dec::Get(src));
+                dst[2 * i + 1] = dst[2 * i];
+            }
+            else
+                Store(dst[i], Dec::Get(src));
+            src += Dec::kBytes * channels;
+        }
+    }
+
+    template <typename Dec, typename Out>
+    void ConvertChannels(Out *dst, const uint8_t *src, size_t frames)
+    {
+        if(info_.channels == 2)
+        {
+            if(out_channels_ == 2)
+                ConvertRun<Dec, 2, 2>(dst, src, frames);
+            else
+                ConvertRun<Dec, 2, 1>(dst, src, frames);
+        }
+        else
+        {
+            if(out_channels_ == 2)
+                ConvertRun<Dec, 1, 2>(dst, src, frames);
+            else
+                ConvertRun<Dec, 1, 1>(dst, src, frames);
+        }
+    }
+
+    /** Chooses the kernel once per chunk, never per sample. */
+    template <typename Out>
+    void ConvertAny(Out *dst, const uint8_t *src, size_t frames)
+    {
+        if(info_.format == kFormatFloat)
+            ConvertChannels<DecF32>(dst, src, frames);
+        else if(info_.bitspersample == 16)
+            ConvertChannels<DecS16>(dst, src, frames);
+        else if(info_.bitspersample == 24)
+            ConvertChannels<DecS24>(dst, src, frames);
+        else
+            ConvertChannels<DecS32>(dst, src, frames);
+    }
+
+    void Convert(float *dst, const uint8_t *src, size_t frames)
+    {
+        ConvertAny(dst, src, frames);
+    }
+
+    /** 16-bit PCM already is the int16_t layout, if the channels match. */
+    void Convert(int16_t *dst, const uint8_t *src, size_t frames)
+    {
+        if(info_.format != kFormatFloat && info_.bitspersample == 16
+           && info_.channels == out_channels_)
+            memcpy(dst, src, frames * frame_bytes_);
+        else
+            ConvertAny(dst, src, frames);
+    }
+
+    template <typename Out>
+    size_t ReadDirect(Out *dst, size_t max_frames)
+    {
+        size_t done = 0;
+        while(done < max_frames)
+        {
+            const size_t frames = Fill(max_frames - done);
+            if(frames == 0)
+                break;
+            Convert(dst + done * out_channels_, raw_, frames);
+            done += frames;
+        }
+        return done;
+    }
+
+    template <typename Out>
+    size_t ReadResampled(Out *dst, size_t max_frames)
+    {
+        size_t done = 0;
+        while(done < max_frames)
+        {
+            // Interpolate between frames i and i + 1 of work_; the phase is
+            // 32.32 fixed point so it doesn't drift over a 5-minute file.
+            const size_t ch = out_channels_;
+            while(done < max_frames)
+            {
+                const size_t i = static_cast<size_t>(phase_ >> 32);
+                if(i + 1 >= work_len_)
+                    break;
+                const float frac = (phase_ & 0xFFFFFFFFu) * (1.0f / 4294967296.0f);
+                const float *a   = work_ + i * ch;
+                for(size_t c = 0; c < ch; c++)
+                    Store(dst[done * ch + c], a[c] + frac * (a[ch + c] - a[c]));
+                done++;
+                phase_ += step_;
+            }
+            if(done == max_frames)
+                break;
+
+            // Keep the last frame as frame 0 and refill behind it
+            for(size_t c = 0; c < ch; c++)
+                work_[c] = work_[(work_len_ - 1) * ch + c];
+            phase_ -= static_cast<uint64_t>(work_len_ - 1) << 32;
+            work_len_ = 1;
+
+            const size_t frames = Fill(kWorkFrames - 1);
+            if(frames == 0)
+                break;
+            Convert(work_ + ch, raw_, frames);
+            work_len_ += frames;
+        }
+        return done;
+    }
+
+    FIL     fp_;
+    Info    info_;
+    bool    open_;
+    size_t  frame_bytes_;
+    size_t  data_bytes_;
+    size_t  remaining_;
+
+    float    target_rate_  = 0.0f;
+    size_t   out_channels_ = 1;
+    float    ratio_;
+    uint64_t step_;
+    uint64_t phase_;
+
+    uint8_t  buff_[kPad + transfer_size] __attribute__((aligned(32)));
+    uint8_t *raw_;
+    uint8_t *carry_src_;
+    size_t   carry_;
+
+    float  work_[kWorkFrames * 2]; // frames of out_channels_
+    size_t work_len_;
+};
+
+} // namespace daisy
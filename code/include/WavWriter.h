@@ -1,41 +1,223 @@
 #pragma once
-#pragma once
+#include <cstdint>
+#include <cstring>
 #include "fatfs.h"
 
 namespace daisy
 {
+namespace wav_detail
+{
+typedef float   f32x4 __attribute__((vector_size(16)));
+typedef int32_t s32x4 __attribute__((vector_size(16)));
+
+inline f32x4 Load4(const float *p)
+{
+    f32x4 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline f32x4 Clamp4(f32x4 x)
+{
+    const f32x4 lo = {-1.0f, -1.0f, -1.0f, -1.0f};
+    const f32x4 hi = {1.0f, 1.0f, 1.0f, 1.0f};
+    x              = x < lo ? lo : x;
+    x              = x > hi ? hi : x;
+    return x;
+}
+
+inline float Clamp1(float x)
+{
+    return x <= -1.0f ? -1.0f : (x >= 1.0f ? 1.0f : x);
+}
+} // namespace wav_detail
+
+/** Sample formats for WavWriter.
+ **
+ ** Each one knows its header fields and has two kernels: Store() for one
+ ** sample (Sample() path) and Convert() for a run (WriteBlock() path, 4
+ ** samples per step, then the odd ones). Both write little-endian bytes through memcpy, so
+ ** the destination needn't be aligned.
+ */
+struct WavFormatS16
+{
+    static constexpr uint16_t kAudioFormat = WAVE_FORMAT_PCM;
+    static constexpr uint16_t kBits        = 16;
+
+    static inline void Store(uint8_t *dst, float x)
+    {
+        const int16_t s = f2s16(x);
+        memcpy(dst, &s, sizeof(s));
+    }
+
+    static void Convert(uint8_t *dst, const float *src, size_t n)
+    {
+        using namespace wav_detail;
+        const f32x4 k = {32767.0f, 32767.0f, 32767.0f, 32767.0f};
+        for(size_t left = n / 4; left > 0; left--, src += 4, dst += 8)
+        {
+            const s32x4   q    = __builtin_convertvector(Clamp4(Load4(src)) * k, s32x4);
+            const int16_t o[4] = {static_cast<int16_t>(q[0]),
+                                  static_cast<int16_t>(q[1]),
+                                  static_cast<int16_t>(q[2]),
+                                  static_cast<int16_t>(q[3])};
+            memcpy(dst, o, sizeof(o));
+        }
+        for(size_t i = 0; i < n % 4; i++)
+            Store(dst + i * 2, src[i]);
+    }
+};
+
+/** 24-bit packed PCM (3 bytes per sample). */
+struct WavFormatS24
+{
+    static constexpr uint16_t kAudioFormat = WAVE_FORMAT_PCM;
+    static constexpr uint16_t kBits        = 24;
+
+    static inline void Store(uint8_t *dst, float x)
+    {
+        const int32_t s = static_cast<int32_t>(wav_detail::Clamp1(x) * 8388607.0f);
+        dst[0]          = static_cast<uint8_t>(s);
+        dst[1]          = static_cast<uint8_t>(s >> 8);
+        dst[2]          = static_cast<uint8_t>(s >> 16);
+    }
+
+    static void Convert(uint8_t *dst, const float *src, size_t n)
+    {
+        using namespace wav_detail;
+        const f32x4 k = {8388607.0f, 8388607.0f, 8388607.0f, 8388607.0f};
+        for(size_t left = n / 4; left > 0; left--, src += 4, dst += 12)
+        {
+            const s32x4 q = __builtin_convertvector(Clamp4(Load4(src)) * k, s32x4);
+            const uint32_t a = static_cast<uint32_t>(q[0]);
+            const uint32_t b = static_cast<uint32_t>(q[1]);
+            const uint32_t c = static_cast<uint32_t>(q[2]);
+            const uint32_t d = static_cast<uint32_t>(q[3]);
+            // 4 samples -> 3 words: aaab bbcc cddd
+            const uint32_t w[3] = {(a & 0xFFFFFF) | (b << 24),
+                                   ((b >> 8) & 0xFFFF) | (c << 16),
+                                   ((c >> 16) & 0xFF) | (d << 8)};
+            memcpy(dst, w, sizeof(w));
+        }
+        for(size_t i = 0; i < n % 4; i++)
+            Store(dst + i * 3, src[i]);
+    }
+};
+
+struct WavFormatS32
+{
+    static constexpr uint16_t kAudioFormat = WAVE_FORMAT_PCM;
+    static constexpr uint16_t kBits        = 32;
+
+    static inline void Store(uint8_t *dst, float x)
+    {
+        const int32_t s = f2s32(x);
+        memcpy(dst, &s, sizeof(s));
+    }
+
+    static void Convert(uint8_t *dst, const float *src, size_t n)
+    {
+        using namespace wav_detail;
+        const f32x4 k   = {2147483647.0f, 2147483647.0f, 2147483647.0f, 2147483647.0f};
+        const s32x4 top = {INT32_MAX, INT32_MAX, INT32_MAX, INT32_MAX};
+        for(size_t left = n / 4; left > 0; left--, src += 4, dst += 16)
+        {
+            const f32x4 v = Clamp4(Load4(src)) * k;
+            // +1.0 scales to 2^31, which doesn't fit: saturate like f2s32
+            const s32x4 q = v >= k ? top : __builtin_convertvector(v, s32x4);
+            memcpy(dst, &q, sizeof(q));
+        }
+        for(size_t i = 0; i < n % 4; i++)
+            Store(dst + i * 4, src[i]);
+    }
+};
+
+/** 32-bit IEEE float (WAVE_FORMAT_IEEE_FLOAT). Written as is, without
+ ** clamping or quantization. */
+struct WavFormatF32
+{
+    static constexpr uint16_t kAudioFormat = 0x0003;
+    static constexpr uint16_t kBits        = 32;
+
+    static inline void Store(uint8_t *dst, float x)
+    {
+        memcpy(dst, &x, sizeof(x));
+    }
+
+    static void Convert(uint8_t *dst, const float *src, size_t n)
+    {
+        memcpy(dst, src, n * sizeof(float));
+    }
+};
+
+/** Bytes a format adds to the 44-byte PCM header. Anything but PCM (F32
+ ** here) has an 18-byte "fmt " chunk, ending in cbSize, and a "fact"
+ ** chunk with the frame count. */
+constexpr size_t WavFmtExtraBytes(uint16_t audio_format)
+{
+    return audio_format == WAVE_FORMAT_PCM ? 0 : 2 + 12;
+}
+
+/** Write those bytes, which follow BitPerSample: cbSize = 0, then "fact". */
+inline void WavPutFmtExtra(uint8_t *dst, uint16_t audio_format, uint32_t frames)
+{
+    static constexpr uint32_t kFactId   = 0x74636166; // "fact"
+    static constexpr uint32_t kFactSize = 4;
+    if(audio_format == WAVE_FORMAT_PCM)
+        return;
+    memset(dst, 0, 2);
+    memcpy(dst + 2, &kFactId, 4);
+    memcpy(dst + 6, &kFactSize, 4);
+    memcpy(dst + 10, &frames, 4);
+}
+
 /** Audio Recording Module
- ** 
- ** Record audio into a working buffer that is gradually written to a WAV file on an SD Card. 
  **
- ** Recordings are made with floating point input, and will be converted to the 
- ** specified bits per sample internally 
+ ** Record audio into a working buffer that is gradually written to a WAV file on an SD Card.
  **
- ** For now only 16-bit and 32-bit (signed int) formats are supported
- ** f32 and s24 formats will be added next
+ ** Recordings are made with floating point input, and will be converted to the
+ ** sample format internally. The format and channel count are template
+ ** parameters, so every combination gets its own conversion code with no
+ ** per-sample format or channel branches:
+ **  - WavFormatS16, WavFormatS24 (packed), WavFormatS32: signed int PCM
+ **  - WavFormatF32: IEEE float, lossless for float input
  **
  ** The transfer size determines the amount of internal memory used, and can have an
  ** effect on the performance of the streaming behavior of the WavWriter.
  ** Memory use can be calculated as: (2 * transfer_size) bytes
  ** Performance optimal with sizes: 16384, 32768
- ** 
+ **
+ ** Two ways to feed it:
+ **  - Sample() per frame from the audio callback, with Write() in the main
+ **    loop flushing each half of the transfer buffer as it fills.
+ **  - WriteBlock() from the main loop for audio that is already in memory:
+ **    whole runs are converted with 4-wide kernels straight into the
+ **    transfer buffer, and each full half goes out in one f_write.
+ ** SaveFile() flushes whatever is left in the buffer before it patches the
+ ** header, so the tail of the recording is never lost.
+ **
  ** To use:
- ** 1. Create a WavWriter<size> object (e.g. WavWriter<32768> writer)
- ** 2. Configure the settings as desired by creating a WavWriter<32768>::Config struct and setting the settings.
+ ** 1. Create a WavWriter<size, format, channels> object (e.g. WavWriter<32768, WavFormatF32, 1> writer)
+ ** 2. Configure the settings as desired by creating a WavWriter<...>::Config struct and setting the settings.
  ** 3. Initialize the object with the configuration struct.
  ** 4. Open a new file for writing with: writer.OpenFile("FileName.wav")
  ** 5. Write to it within your audio callback using: writer.Sample(value)
  ** 6. Fill the Wav File on the SD Card with data from your main loop by running: writer.Write()
+ **    (or skip 5/6 and call writer.WriteBlock(data, frames) from the main loop)
  ** 7. When finished with the recording finalize, and close the file with: writer.SaveFile();
- ** 
+ **
  ** */
-template <size_t transfer_size>
+template <size_t transfer_size,
+          typename Format = WavFormatS16,
+          size_t channels = 1>
 class WavWriter
 {
   public:
     WavWriter() {}
     ~WavWriter() {}
 
+    static constexpr size_t kFrameBytes = channels * Format::kBits / 8;
+
     /** Return values for write related functions */
     enum class Result
     {
@@ -47,12 +229,10 @@ class WavWriter
 	 ** */
     struct Config
     {
-        float   samplerate;
-        int32_t channels;
-        int32_t bitspersample;
+        float samplerate;
     };
 
-    /** State of the internal Writing mechanism. 
+    /** State of the internal Writing mechanism.
 	 ** When the buffer is a certain amount full one section will write its contents
 	 ** while the other is still being written to. This is performed circularly
 	 ** so that audio will be uninterrupted during writing. */
@@ -73,49 +253,40 @@ class WavWriter
         wavheader_.ChunkId       = kWavFileChunkId;     /** "RIFF" */
         wavheader_.FileFormat    = kWavFileWaveId;      /** "WAVE" */
         wavheader_.SubChunk1ID   = kWavFileSubChunk1Id; /** "fmt " */
-        wavheader_.SubChunk1Size = 16;                  // for PCM
-        wavheader_.AudioFormat   = WAVE_FORMAT_PCM;
-        wavheader_.NbrChannels   = cfg.channels;
+        wavheader_.SubChunk1Size = kPcm ? 16 : 18;      // 18 with cbSize
+        wavheader_.AudioFormat   = Format::kAudioFormat;
+        wavheader_.NbrChannels   = channels;
         wavheader_.SampleRate    = static_cast<int>(cfg.samplerate);
         wavheader_.ByteRate      = CalcByteRate();
-        wavheader_.BlockAlign    = cfg_.channels * cfg_.bitspersample / 8;
-        wavheader_.BitPerSample  = cfg_.bitspersample;
+        wavheader_.BlockAlign    = kFrameBytes;
+        wavheader_.BitPerSample  = Format::kBits;
         wavheader_.SubChunk2ID   = kWavFileSubChunk2Id; /** "data" */
         /** Also calcs SubChunk2Size */
         wavheader_.FileSize = CalcFileSize();
         // This is calculated as part of the subchunk size
+
+        wptr_      = 0;
+        bstate_    = BufferState::IDLE;
+        recording_ = false;
     }
 
     /** Records the current sample into the working buffer,
-     ** queues writes to media when necessary. 
-     ** 
+     ** queues writes to media when necessary.
+     **
      ** \param in should be a pointer to an array of samples */
     void Sample(const float *in)
     {
-        for(size_t i = 0; i < cfg_.channels; i++)
+        for(size_t i = 0; i < channels; i++)
         {
-            switch(cfg_.bitspersample)
-            {
-                case 16:
-                {
-                    int16_t *tp;
-                    tp            = (int16_t *)transfer_buff;
-                    tp[wptr_ + i] = f2s16(in[i]);
-                }
-                break;
-                case 32: transfer_buff[wptr_ + i] = f2s32(in[i]); break;
-                default: break;
-            }
+            Format::Store(&transfer_buff[wptr_], in[i]);
+            wptr_ += Format::kBits / 8;
         }
         num_samps_++;
-        wptr_ += cfg_.channels;
-        size_t cap_point
-            = cfg_.bitspersample == 16 ? kTransferSamps * 2 : kTransferSamps;
-        if(wptr_ == cap_point)
+        if(wptr_ == kHalfBytes)
         {
             bstate_ = BufferState::FLUSH0;
         }
-        if(wptr_ >= cap_point * 2)
+        if(wptr_ >= kHalfBytes * 2)
         {
             wptr_   = 0;
             bstate_ = BufferState::FLUSH1;
@@ -127,54 +298,98 @@ class WavWriter
     {
         if(bstate_ != BufferState::IDLE && IsRecording())
         {
-            uint32_t     offset;
-            unsigned int bw = 0;
-            //offset          = bstate_ == BufferState::FLUSH0 ? 0 : transfer_size;
-            offset  = bstate_ == BufferState::FLUSH0 ? 0 : kTransferSamps;
-            bstate_ = BufferState::IDLE;
-            f_write(&fp_, &transfer_buff[offset], transfer_size, &bw);
+            const size_t offset = bstate_ == BufferState::FLUSH0 ? 0 : kHalfBytes;
+            unsigned int bw     = 0;
+            bstate_             = BufferState::IDLE;
+            f_write(&fp_, &transfer_buff[offset], kHalfBytes, &bw);
+        }
+    }
+
+    /** Converts and writes 'frames' interleaved frames.
+     ** For the main loop only: a half is written as soon as it is full, so
+     ** this blocks on the SD card. Don't mix with Sample() on one file. */
+    Result WriteBlock(const float *in, size_t frames)
+    {
+        if(!IsRecording())
+            return Result::ERROR;
+
+        while(frames > 0)
+        {
+            // Fill up to the end of the current half
+            const size_t end = wptr_ < kHalfBytes ? kHalfBytes : kHalfBytes * 2;
+            size_t       n   = (end - wptr_) / kFrameBytes;
+            if(n > frames)
+                n = frames;
+
+            Format::Convert(&transfer_buff[wptr_], in, n * channels);
+            in += n * channels;
+            frames -= n;
+            num_samps_ += n;
+            wptr_ += n * kFrameBytes;
+
+            if(wptr_ == end)
+            {
+                unsigned int bw = 0;
+                if(f_write(&fp_, &transfer_buff[end - kHalfBytes], kHalfBytes, &bw)
+                       != FR_OK
+                   || bw != kHalfBytes)
+                {
+                    return Result::ERROR;
+                }
+                if(wptr_ == kHalfBytes * 2)
+                    wptr_ = 0;
+            }
         }
+        return Result::OK;
     }
 
     /** Finalizes the writing of the WAV file.
-	 ** This overwrites the WAV Header with the correct
-	 ** final size, and closes the fptr. */
-    void SaveFile()
+	 ** Flushes the rest of the transfer buffer, overwrites the WAV Header
+	 ** with the correct final size, and closes the fptr. */
+    Result SaveFile()
     {
+        if(!IsRecording())
+            return Result::ERROR;
+
+        bool ok = true;
+
+        // A half that filled up but wasn't written yet, then the partial one
+        Write();
+        const size_t start = wptr_ < kHalfBytes ? 0 : kHalfBytes;
+        if(wptr_ > start)
+        {
+            unsigned int bw = 0;
+            ok = f_write(&fp_, &transfer_buff[start], wptr_ - start, &bw) == FR_OK
+                 && bw == wptr_ - start;
+        }
+        wptr_      = 0;
+        recording_ = false;
+
         unsigned int bw = 0;
-        recording_      = false;
-        // We _should_ flush whatever's left in the transfer buff
-        // TODO: that.
-        wavheader_.FileSize = CalcFileSize();
-        f_lseek(&fp_, 0);
-        f_write(&fp_, &wavheader_, sizeof(wavheader_), &bw);
-        f_close(&fp_);
+        ok = f_lseek(&fp_, 0) == FR_OK && ok;
+        ok = f_write(&fp_, PackHeader(), kHeaderBytes, &bw) == FR_OK && ok;
+        ok = f_close(&fp_) == FR_OK && ok;
+        return ok ? Result::OK : Result::ERROR;
     }
 
     /** Opens a file for writing. Writes the initial WAV Header, and gets ready for stream-based recording. */
-   void OpenFile(const char *name)
-{
-    if(f_open(&fp_, name, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK)
+    Result OpenFile(const char *name)
     {
+        if(f_open(&fp_, name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+            return Result::ERROR;
+
         unsigned int bw = 0;
-        if(f_write(&fp_, &wavheader_, sizeof(wavheader_), &bw) == FR_OK)
+        num_samps_      = 0;
+        if(f_write(&fp_, PackHeader(), kHeaderBytes, &bw) != FR_OK)
         {
-            recording_ = true;
-            num_samps_ = 0;
-            
-        }
-        else
-        {
-          
             f_close(&fp_);
+            return Result::ERROR;
         }
+        recording_ = true;
+        wptr_      = 0;
+        bstate_    = BufferState::IDLE;
+        return Result::OK;
     }
-    else
-    {
-       
-    }
-}
-
 
     /** Returns whether recording is currently active or not. */
     inline bool IsRecording() const { return recording_; }
@@ -189,26 +404,45 @@ class WavWriter
     }
 
   private:
+    /** Each half of the transfer buffer holds whole frames only. */
+    static constexpr size_t kHalfBytes = transfer_size - transfer_size % kFrameBytes;
+
+    /** The header on disk: wavheader_ up to BitPerSample ("RIFF" and
+     ** "fmt "), the format's extra bytes, then the "data" chunk header. */
+    static constexpr bool   kPcm         = Format::kAudioFormat == WAVE_FORMAT_PCM;
+    static constexpr size_t kFmtEnd      = 36;
+    static constexpr size_t kExtraBytes  = WavFmtExtraBytes(Format::kAudioFormat);
+    static constexpr size_t kHeaderBytes = kFmtEnd + kExtraBytes + 8;
+
     /** Calculate the file size based on current recording */
     inline uint32_t CalcFileSize()
     {
-        wavheader_.SubCHunk2Size
-            = num_samps_ * cfg_.channels * cfg_.bitspersample / 8;
-        return 36 + wavheader_.SubCHunk2Size;
+        wavheader_.SubCHunk2Size = num_samps_ * kFrameBytes;
+        return kHeaderBytes - 8 + wavheader_.SubCHunk2Size;
+    }
+
+    /** Fill in header_ with the sizes so far. */
+    const uint8_t *PackHeader()
+    {
+        wavheader_.FileSize = CalcFileSize();
+        memcpy(header_, &wavheader_, kFmtEnd);
+        WavPutFmtExtra(header_ + kFmtEnd, Format::kAudioFormat, num_samps_);
+        memcpy(header_ + kFmtEnd + kExtraBytes, &wavheader_.SubChunk2ID, 8);
+        return header_;
     }
 
     /** Compute the byte rate given the user settings. */
     inline uint32_t CalcByteRate()
     {
-        return cfg_.samplerate * cfg_.channels * cfg_.bitspersample / 8;
+        return cfg_.samplerate * kFrameBytes;
     }
 
-    static constexpr int kTransferSamps = transfer_size / sizeof(int32_t);
-
     WAV_FormatTypeDef wavheader_;
-    uint32_t          num_samps_, wptr_;
+    uint8_t           header_[kHeaderBytes];
+    uint32_t          num_samps_;
+    size_t            wptr_; // write position in transfer_buff (bytes)
     Config            cfg_;
-    int32_t           transfer_buff[kTransferSamps * 2];
+    uint8_t           transfer_buff[transfer_size * 2] __attribute__((aligned(32)));
     BufferState       bstate_;
     bool              recording_;
     FIL               fp_;
@@ -0,0 +1,104 @@
+#ifndef WAVE_OVERVIEW_H
+#define WAVE_OVERVIEW_H
+
+#include <cstddef>
+#include <cstdint>
+#include "LoopSample.h"
+
+/** Loop samples per overview leaf (~21 ms at 48 kHz). */
+static constexpr size_t kOverviewLeafSize = 1024;
+
+/** Peak of a stretch of the loop, in 8 bits (the display has 64 rows). */
+struct WavePeak
+{
+    int8_t lo;
+    int8_t hi;
+};
+
+/** Backing memory for a WaveOverview. Small enough for internal SRAM
+ ** (~56 KB for a 5-minute loop), so no DSY_SDRAM_BSS:
+ **
+ **     static WaveOverviewStorage<MAX_SIZE> overview_mem;
+ */
+template <size_t loop_size>
+struct WaveOverviewStorage
+{
+    static constexpr size_t kLoopSize = loop_size;
+    static constexpr size_t kLeaves
+        = (loop_size + kOverviewLeafSize - 1) / kOverviewLeafSize;
+    static constexpr size_t kNodes = 2 * kLeaves + 32; // all levels
+
+    WavePeak nodes[kNodes];
+};
+
+/** Min/max pyramid of the loop buffer, for drawing it.
+ **
+ ** Level 0 holds one peak per leaf of kOverviewLeafSize samples, and each
+ ** level above halves the previous one, up to a single node for the whole
+ ** buffer. A peak over any range is then a handful of nodes (Query()), so
+ ** drawing 128 columns of a 5-minute loop reads a few hundred bytes
+ ** instead of 14 million samples.
+ **
+ ** It's never rebuilt. Write() is called for each run of samples the audio
+ ** path records, in order: the leaf being written gets the peak of what was
+ ** written into it so far (a leaf entered at its start is replaced, one
+ ** entered part-way is merged with its old peak), and its parents are
+ ** updated on the way up. That's a pass over samples already in cache plus
+ ** ~14 node merges per block. Loaders Write() what they read the same way,
+ ** and the undo/redo swap Refresh()es each region it exchanges.
+ **
+ ** Nothing needs clearing on reset: a new first take writes the leaves from
+ ** the start, and Query() is only asked about the part already recorded.
+ **
+ ** Threading: Write()/Refresh() run in the audio callback (or the main loop
+ ** while the engine is idle, when loading); Query()/Render() in the main
+ ** loop. A node is two bytes written at once, so a reader at worst sees a
+ ** peak one block old.
+ */
+class WaveOverview
+{
+  public:
+    template <typename Storage>
+    void Init(const loop_sample_t *loop, Storage &mem)
+    {
+        Init(loop, Storage::kLoopSize, mem.nodes);
+    }
+
+    // Writers
+
+    /** [pos, pos + n) of the loop was just written (recorded/loaded). */
+    void Write(size_t pos, size_t n);
+
+    /** Leaves overlapping [pos, pos + n) changed in place: rescan them. */
+    void Refresh(size_t pos, size_t n);
+
+    // Main loop
+
+    /** Peak over loop samples [begin, end), rounded out to whole leaves. */
+    WavePeak Query(size_t begin, size_t end) const;
+
+    /** [begin, end) split evenly into 'columns' peaks. */
+    void Render(size_t begin, size_t end, WavePeak *out, size_t columns) const;
+
+  private:
+    static constexpr size_t kMaxLevels = 32;
+
+    void Init(const loop_sample_t *loop, size_t loop_size, WavePeak *nodes);
+    void Propagate(size_t leaf);
+
+    const loop_sample_t *loop_;
+    WavePeak            *nodes_;
+    size_t               size_;
+    size_t               leaves_;
+    size_t               levels_;
+    size_t               level_off_[kMaxLevels]; // first node of each level
+    size_t               level_len_[kMaxLevels];
+
+    // Leaf being written
+    size_t   acc_leaf_;
+    size_t   acc_end_;  // next sample position that continues it
+    WavePeak acc_;      // peak written into it so far
+    WavePeak acc_base_; // its old peak (entered part-way), merged in
+};
+
+#endif // WAVE_OVERVIEW_H
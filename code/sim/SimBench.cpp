@@ -0,0 +1,67 @@
+// Host run of the pod's Settings > Benchmark (make -C code/sim bench): the
+// same KernelBench.h and WavFormatBench.h runs as RunKernelBenchmark() in
+// main.cpp, printed in BENCH.TXT's layout. "Cycles" are CycleCounterRead()
+// ticks, the TSC on x86 (see CycleCounter.h), so compare scalar with
+// vector here and take absolute numbers from the pod.
+#include <cstdio>
+#include "KernelBench.h"
+#include "LoopEngine.h"
+#include "WavFormatBench.h"
+
+using namespace daisy;
+
+static constexpr size_t kBenchSize = 65536; // as BENCH_SIZE in main.cpp
+static loop_sample_t    bench_buf[kBenchSize];
+
+int main()
+{
+    CycleCounterInit();
+
+    printf("kernels, cycles per block (%s loop)\n"
+           "frames   scalar   vector\n",
+           LOOPER_SAMPLE_INT16 ? "int16" : "float");
+    static const size_t blocks[] = {4, 16, 48};
+    for(size_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++)
+    {
+        const KernelBenchResult r = RunKernelBench(bench_buf, kBenchSize, blocks[b], 20000);
+        printf("%-8u %6d %8d\n",
+               (unsigned)r.block_frames,
+               (int)r.scalar_cycles,
+               (int)r.vector_cycles);
+    }
+
+    printf("\ntracks, cycles per 48 frames\n"
+           "tracks   fused    separate\n");
+    for(size_t t = 1; t <= kMaxTracks; t++)
+    {
+        const TrackBenchResult r = RunTrackBench(bench_buf, kBenchSize, 48, t, 20000);
+        printf("%-8u %5d %11d\n", (unsigned)r.tracks, (int)r.fused_cycles, (int)r.separate_cycles);
+    }
+
+    printf("\nread head, cycles per 48 frames\n"
+           "channels linear   hermite  sinc\n");
+    for(size_t ch = 1; ch <= 2; ch++)
+    {
+        const InterpBenchResult r = RunInterpBench(48, ch, 20000);
+        printf("%-8u %6d %9d %5d\n",
+               (unsigned)r.channels,
+               (int)r.cycles[static_cast<size_t>(Interp::LINEAR)],
+               (int)r.cycles[static_cast<size_t>(Interp::HERMITE)],
+               (int)r.cycles[static_cast<size_t>(Interp::SINC)]);
+    }
+
+    float   *src = reinterpret_cast<float *>(bench_buf);
+    uint8_t *dst = reinterpret_cast<uint8_t *>(src + 4096);
+    const WavFormatBenchResult wr[] = {
+        RunWavFormatBench<WavFormatS16>(src, dst, 4096, 50),
+        RunWavFormatBench<WavFormatS24>(src, dst, 4096, 50),
+        RunWavFormatBench<WavFormatS32>(src, dst, 4096, 50),
+        RunWavFormatBench<WavFormatF32>(src, dst, 4096, 50),
+    };
+    static const char *names[] = {"S16", "S24", "S32", "F32"};
+    printf("\nwav formats, cycles per sample\n"
+           "format   store    convert\n");
+    for(size_t f = 0; f < 4; f++)
+        printf("%-8s %5.1f %10.1f\n", names[f], wr[f].store_cycles, wr[f].convert_cycles);
+    return 0;
+}
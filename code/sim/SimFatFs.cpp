@@ -0,0 +1,260 @@
+// FatFS shim: the ff.h API on top of stdio, rooted at the sim's SD
+// directory. Only what the looper uses.
+#include "fatfs.h"
+#include "SimHal.h"
+#include "SimHostDir.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+std::string sd_root      = ".";
+int         sd_max_width = 4; // --sd-bus
+int         sd_width     = 4; // as set up by SdmmcHandler::Init()
+
+std::string HostPath(const TCHAR *path)
+{
+    // "0:/NAME", "/NAME" and "NAME" all name the same file
+    if(path[0] >= '0' && path[0] <= '9' && path[1] == ':')
+        path += 2;
+    while(*path == '/')
+        path++;
+    return *path ? sd_root + "/" + path : sd_root;
+}
+
+inline FILE *Host(FIL *fp)
+{
+    return static_cast<FILE *>(fp->host);
+}
+
+bool Exists(const std::string &p)
+{
+    struct stat st;
+    return stat(p.c_str(), &st) == 0;
+}
+} // namespace
+
+void SimSetSdRoot(const char *dir)
+{
+    sd_root = dir;
+}
+
+const char *SimSdRoot()
+{
+    return sd_root.c_str();
+}
+
+void SimSetSdMaxWidth(int bits)
+{
+    sd_max_width = bits;
+}
+
+void SimSdmmcConfig(int bits)
+{
+    sd_width = bits;
+}
+
+FRESULT f_mount(FATFS *fs, const TCHAR *path, BYTE opt)
+{
+    (void)fs;
+    (void)path;
+    (void)opt;
+    return Exists(sd_root) ? FR_OK : FR_NOT_READY;
+}
+
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode)
+{
+    const std::string p      = HostPath(path);
+    const bool        exists = Exists(p);
+    const char       *how;
+
+    fp->host = nullptr;
+    if(mode & FA_CREATE_NEW)
+    {
+        if(exists)
+            return FR_EXIST;
+        how = "w+b";
+    }
+    else if(mode & FA_CREATE_ALWAYS)
+        how = "w+b";
+    else if(mode & FA_OPEN_ALWAYS)
+        how = exists ? "r+b" : "w+b";
+    else if(!exists)
+        return FR_NO_FILE;
+    else
+        how = (mode & FA_WRITE) ? "r+b" : "rb";
+
+    FILE *f = fopen(p.c_str(), how);
+    if(!f)
+        return FR_DENIED;
+
+    fseek(f, 0, SEEK_END);
+    fp->host    = f;
+    fp->objsize = static_cast<FSIZE_t>(ftell(f));
+    fp->fptr    = 0;
+    fp->flag    = mode;
+    if((mode & FA_OPEN_APPEND) == FA_OPEN_APPEND)
+        fp->fptr = fp->objsize;
+    fseek(f, fp->fptr, SEEK_SET);
+    return FR_OK;
+}
+
+FRESULT f_close(FIL *fp)
+{
+    if(!fp->host)
+        return FR_INVALID_OBJECT;
+    fclose(Host(fp));
+    fp->host = nullptr;
+    return FR_OK;
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br)
+{
+    *br = 0;
+    if(!fp->host)
+        return FR_INVALID_OBJECT;
+    if(!(fp->flag & FA_READ))
+        return FR_DENIED;
+    fseek(Host(fp), fp->fptr, SEEK_SET);
+    *br = static_cast<UINT>(fread(buff, 1, btr, Host(fp)));
+    fp->fptr += *br;
+    if(sd_width > sd_max_width && *br > 0)
+        static_cast<uint8_t *>(buff)[*br / 2] ^= 0x10; // a stuck data line
+    return ferror(Host(fp)) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+    *bw = 0;
+    if(!fp->host)
+        return FR_INVALID_OBJECT;
+    if(!(fp->flag & FA_WRITE))
+        return FR_DENIED;
+    fseek(Host(fp), fp->fptr, SEEK_SET);
+    *bw = static_cast<UINT>(fwrite(buff, 1, btw, Host(fp)));
+    fp->fptr += *bw;
+    if(fp->fptr > fp->objsize)
+        fp->objsize = fp->fptr;
+    return *bw == btw ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs)
+{
+    if(!fp->host)
+        return FR_INVALID_OBJECT;
+    if(ofs > fp->objsize)
+    {
+        if(!(fp->flag & FA_WRITE))
+        {
+            ofs = fp->objsize; // read-only: clipped to the file size
+        }
+        else
+        {
+            // Write mode: the file is extended (contents undefined on a
+            // real card, zeros here)
+            fflush(Host(fp));
+            if(ftruncate(fileno(Host(fp)), ofs) != 0)
+                return FR_DISK_ERR;
+            fp->objsize = ofs;
+        }
+    }
+    fp->fptr = ofs;
+    return FR_OK;
+}
+
+FRESULT f_truncate(FIL *fp)
+{
+    if(!fp->host)
+        return FR_INVALID_OBJECT;
+    fflush(Host(fp));
+    if(ftruncate(fileno(Host(fp)), fp->fptr) != 0)
+        return FR_DISK_ERR;
+    fp->objsize = fp->fptr;
+    return FR_OK;
+}
+
+FRESULT f_sync(FIL *fp)
+{
+    if(!fp->host)
+        return FR_INVALID_OBJECT;
+    return fflush(Host(fp)) == 0 ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_expand(FIL *fp, FSIZE_t fsz, BYTE opt)
+{
+    if(!fp->host)
+        return FR_INVALID_OBJECT;
+    if(fsz == 0 || fp->objsize != 0 || !(fp->flag & FA_WRITE))
+        return FR_DENIED;
+    if(opt)
+    {
+        fflush(Host(fp));
+        if(ftruncate(fileno(Host(fp)), fsz) != 0)
+            return FR_DENIED;
+        fp->objsize = fsz;
+    }
+    return FR_OK;
+}
+
+FRESULT f_opendir(DIR *dp, const TCHAR *path)
+{
+    dp->host = SimHostOpenDir(HostPath(path).c_str());
+    return dp->host ? FR_OK : FR_NO_PATH;
+}
+
+FRESULT f_closedir(DIR *dp)
+{
+    SimHostCloseDir(dp->host);
+    dp->host = nullptr;
+    return FR_OK;
+}
+
+FRESULT f_readdir(DIR *dp, FILINFO *fno)
+{
+    uint64_t size;
+    bool     is_dir;
+    if(!SimHostReadDir(dp->host, sd_root.c_str(), fno->fname, sizeof(fno->fname), &size, &is_dir))
+    {
+        fno->fname[0] = 0; // end of directory
+        return FR_OK;
+    }
+    fno->fsize   = static_cast<FSIZE_t>(size);
+    fno->fattrib = is_dir ? AM_DIR : AM_ARC;
+    fno->fdate   = 0;
+    fno->ftime   = 0;
+    return FR_OK;
+}
+
+FRESULT f_stat(const TCHAR *path, FILINFO *fno)
+{
+    struct stat st;
+    if(stat(HostPath(path).c_str(), &st) != 0)
+        return FR_NO_FILE;
+    if(fno)
+    {
+        const char *name = strrchr(path, '/');
+        snprintf(fno->fname, sizeof(fno->fname), "%s", name ? name + 1 : path);
+        fno->fsize   = static_cast<FSIZE_t>(st.st_size);
+        fno->fattrib = S_ISDIR(st.st_mode) ? AM_DIR : AM_ARC;
+        fno->fdate   = 0;
+        fno->ftime   = 0;
+    }
+    return FR_OK;
+}
+
+FRESULT f_unlink(const TCHAR *path)
+{
+    return remove(HostPath(path).c_str()) == 0 ? FR_OK : FR_NO_FILE;
+}
+
+FRESULT f_rename(const TCHAR *path_old, const TCHAR *path_new)
+{
+    const std::string to = HostPath(path_new);
+    if(Exists(to))
+        return FR_EXIST;
+    return rename(HostPath(path_old).c_str(), to.c_str()) == 0 ? FR_OK
+                                                              : FR_NO_FILE;
+}
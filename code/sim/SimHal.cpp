@@ -0,0 +1,633 @@
+#include "SimHal.h"
+#include "daisy_pod.h"
+#include "WavReader.h"
+#include "WavWriter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr float kSampleRate = 48000.0f;
+constexpr int   kControls   = 4; // b1, b2, enc, enc2
+
+// Checks: the output's peak over the window before the check's time
+constexpr uint64_t kCheckWindow = static_cast<uint64_t>(kSampleRate / 10);
+constexpr float    kSilencePeak = 0.001f; // -60 dBFS
+constexpr float    kSoundPeak   = 0.01f;  // -40 dBFS
+constexpr float    kToneLevel   = 0.5f;
+constexpr float    kScriptTail  = 0.5f; // seconds run after the last event
+
+enum class EventType
+{
+    PRESS,
+    RELEASE,
+    TURN,
+};
+
+struct Event
+{
+    uint64_t  frame;
+    int       control;
+    EventType type;
+    int32_t   value;
+};
+
+// What the audio thread does at a frame: change the test tone on the
+// input, or check the output
+enum class CueType
+{
+    TONE,
+    SOUND,
+    SILENCE,
+};
+
+struct Cue
+{
+    uint64_t frame;
+    CueType  type;
+    float    value; // tone frequency, 0 = off
+    int      line;  // in the script, for the report
+};
+
+SimConfig             cfg;
+std::atomic<uint64_t> frames{0};
+std::atomic<bool>     audio_running{false};
+size_t                block_size = 4;
+SimAudioCallback      callback   = nullptr;
+
+// Lockstep: the main loop and the audio thread take turns, handed over in
+// SimYield(). The audio thread runs one block per turn.
+std::mutex              turn_mutex;
+std::condition_variable turn_cv;
+bool                    audio_turn      = false;
+thread_local bool       on_audio_thread = false;
+
+std::vector<float> input;     // stereo (a mono file on both sides), at kSampleRate
+std::vector<float> output;    // everything played, for the checks
+uint64_t           run_frames; // total frames the sim runs for
+
+std::vector<Event> events;
+size_t             next_event = 0;
+bool               held[kControls];
+
+std::vector<Cue> cues;
+size_t           next_cue   = 0;
+float            tone_hz    = 0.0f;
+double           tone_phase = 0.0;
+int              checks = 0, failed_checks = 0;
+
+uint8_t led_state[32];
+
+// SSD1306 RAM in page addressing mode
+constexpr size_t kOledWidth  = 128;
+constexpr size_t kOledHeight = 64;
+std::mutex       oled_mutex;
+uint8_t          oled_ram[kOledWidth * kOledHeight / 8];
+uint8_t          oled_page = 0, oled_col = 0;
+bool             oled_written = false; // anything ever sent
+bool             oled_changed = false; // since the last frame dump
+uint64_t         oled_dump_frame = 0;
+uint32_t         oled_frame = 0;
+
+daisy::WavWriter<16384, daisy::WavFormatF32, 2> writer;
+
+double Seconds(uint64_t f)
+{
+    return static_cast<double>(f) / kSampleRate;
+}
+
+// ---------------------------------------------------------------------------
+// Script
+// ---------------------------------------------------------------------------
+
+int ControlIndex(const char *name)
+{
+    static const char *const kNames[kControls] = {"b1", "b2", "enc", "enc2"};
+    for(int i = 0; i < kControls; i++)
+        if(strcmp(name, kNames[i]) == 0)
+            return i;
+    return -1;
+}
+
+/** One event per line: "<seconds> <control> <action> [value]", where
+ ** control is b1, b2, enc or enc2 and action is press, release, tap,
+ ** hold <seconds> or turn <steps>. Two more lines drive the audio side:
+ ** "in tone <hz>" / "in off" switch a sine on the input (added to --in),
+ ** and "expect sound" / "expect silence" check the output's peak over the
+ ** 100 ms before their time. '#' starts a comment. */
+bool LoadScript(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if(!f)
+    {
+        fprintf(stderr, "sim: can't open script %s\n", path);
+        return false;
+    }
+
+    char line[256];
+    int  line_no = 0;
+    while(fgets(line, sizeof(line), f))
+    {
+        line_no++;
+        if(char *hash = strchr(line, '#'))
+            *hash = 0;
+
+        float t, value = 0.0f;
+        char  control[16], action[16];
+        const int n = sscanf(line, "%f %15s %15s %f", &t, control, action, &value);
+        if(n <= 0)
+            continue; // blank or comment
+
+        const uint64_t at = static_cast<uint64_t>(t * kSampleRate);
+        if(n >= 3 && t >= 0.0f && strcmp(control, "in") == 0)
+        {
+            if(strcmp(action, "tone") == 0 && n == 4 && value > 0.0f)
+                cues.push_back({at, CueType::TONE, value, line_no});
+            else if(strcmp(action, "off") == 0)
+                cues.push_back({at, CueType::TONE, 0.0f, line_no});
+            else
+            {
+                fprintf(stderr, "sim: %s:%d: bad input\n", path, line_no);
+                fclose(f);
+                return false;
+            }
+            continue;
+        }
+        if(n >= 3 && t >= 0.0f && strcmp(control, "expect") == 0)
+        {
+            if(strcmp(action, "sound") == 0)
+                cues.push_back({at, CueType::SOUND, 0.0f, line_no});
+            else if(strcmp(action, "silence") == 0)
+                cues.push_back({at, CueType::SILENCE, 0.0f, line_no});
+            else
+            {
+                fprintf(stderr, "sim: %s:%d: bad check\n", path, line_no);
+                fclose(f);
+                return false;
+            }
+            continue;
+        }
+
+        const int c = n >= 3 ? ControlIndex(control) : -1;
+        if(c < 0 || t < 0.0f)
+        {
+            fprintf(stderr, "sim: %s:%d: bad event\n", path, line_no);
+            fclose(f);
+            return false;
+        }
+
+        if(strcmp(action, "press") == 0)
+            events.push_back({at, c, EventType::PRESS, 0});
+        else if(strcmp(action, "release") == 0)
+            events.push_back({at, c, EventType::RELEASE, 0});
+        else if(strcmp(action, "tap") == 0 || strcmp(action, "hold") == 0)
+        {
+            const float len = action[0] == 't' ? 0.05f : value;
+            events.push_back({at, c, EventType::PRESS, 0});
+            events.push_back({at + static_cast<uint64_t>(len * kSampleRate),
+                              c,
+                              EventType::RELEASE,
+                              0});
+        }
+        else if(strcmp(action, "turn") == 0 && n == 4)
+            events.push_back({at, c, EventType::TURN, static_cast<int32_t>(value)});
+        else
+        {
+            fprintf(stderr, "sim: %s:%d: bad action\n", path, line_no);
+            fclose(f);
+            return false;
+        }
+    }
+    fclose(f);
+
+    std::stable_sort(events.begin(),
+                     events.end(),
+                     [](const Event &a, const Event &b) {
+                         return a.frame < b.frame;
+                     });
+    std::stable_sort(cues.begin(),
+                     cues.end(),
+                     [](const Cue &a, const Cue &b) {
+                         return a.frame < b.frame;
+                     });
+    return true;
+}
+
+/** Audio thread, at the start of the block at 'pos': cues that are due. */
+void RunCues(uint64_t pos)
+{
+    static const char *const kNames[] = {"", "sound", "silence"};
+
+    for(; next_cue < cues.size() && cues[next_cue].frame <= pos; next_cue++)
+    {
+        const Cue &c = cues[next_cue];
+        if(c.type == CueType::TONE)
+        {
+            tone_hz = c.value;
+            if(cfg.verbose && c.value > 0.0f)
+                printf("[%8.3f] in tone %.0f\n", Seconds(pos), c.value);
+            else if(cfg.verbose)
+                printf("[%8.3f] in off\n", Seconds(pos));
+            continue;
+        }
+
+        const uint64_t from = pos > kCheckWindow ? pos - kCheckWindow : 0;
+        float          peak = 0.0f;
+        for(uint64_t i = 2 * from; i < 2 * pos && i < output.size(); i++)
+            peak = std::max(peak, fabsf(output[i]));
+        const bool ok = c.type == CueType::SOUND ? peak >= kSoundPeak : peak < kSilencePeak;
+        checks++;
+        if(!ok)
+            failed_checks++;
+        if(!ok || cfg.verbose)
+            printf("[%8.3f] expect %s: %s (peak %.4f, line %d)\n",
+                   Seconds(pos),
+                   kNames[static_cast<int>(c.type)],
+                   ok ? "ok" : "FAILED",
+                   peak,
+                   c.line);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Input / output
+// ---------------------------------------------------------------------------
+
+bool LoadInput(const char *name)
+{
+    static daisy::WavReader<32768> reader;
+    reader.SetTargetRate(kSampleRate);
+    reader.SetChannels(2);
+    if(reader.Open(name) != daisy::WavReader<32768>::Result::OK)
+    {
+        fprintf(stderr, "sim: can't read %s/%s\n", cfg.sd_root, name);
+        return false;
+    }
+
+    const size_t frames = reader.OutputFrames();
+    input.resize(2 * frames);
+    size_t got = 0, n;
+    while(got < frames && (n = reader.Read(input.data() + 2 * got, frames - got)) > 0)
+        got += n;
+    input.resize(2 * got);
+    reader.Close();
+    return true;
+}
+
+void WritePbm(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if(!f)
+        return;
+    fprintf(f, "P4\n%zu %zu\n", kOledWidth, kOledHeight);
+    std::vector<uint8_t> row((kOledWidth + 7) / 8);
+    for(size_t y = 0; y < kOledHeight; y++)
+    {
+        std::fill(row.begin(), row.end(), 0);
+        for(size_t x = 0; x < kOledWidth; x++)
+            if(oled_ram[x + (y / 8) * kOledWidth] & (1 << (y % 8)))
+                row[x / 8] |= 0x80 >> (x % 8);
+        fwrite(row.data(), 1, row.size(), f);
+    }
+    fclose(f);
+}
+
+// Main loop: dump a frame if the panel changed, at most every 20 ms
+void DumpOledFrame(uint64_t now)
+{
+    std::lock_guard<std::mutex> lock(oled_mutex);
+    if(!cfg.oled_dir || !cfg.oled_frames || !oled_changed
+       || now - oled_dump_frame < static_cast<uint64_t>(kSampleRate / 50))
+        return;
+    char name[64];
+    snprintf(name, sizeof(name), "/oled_%05u.pbm", oled_frame++);
+    WritePbm((std::string(cfg.oled_dir) + name).c_str());
+    oled_changed    = false;
+    oled_dump_frame = now;
+}
+
+void Finish(const std::vector<double> &cb_ns, uint64_t over_budget)
+{
+    if(cfg.output && writer.SaveFile() != decltype(writer)::Result::OK)
+        fprintf(stderr, "sim: failed to write %s\n", cfg.output);
+
+    {
+        std::lock_guard<std::mutex> lock(oled_mutex);
+        if(cfg.oled_dir && oled_written)
+            WritePbm((std::string(cfg.oled_dir) + "/oled.pbm").c_str());
+    }
+
+    if(!cb_ns.empty())
+    {
+        double sum = 0.0, max = 0.0;
+        for(double ns : cb_ns)
+        {
+            sum += ns;
+            max = std::max(max, ns);
+        }
+        const double budget_ns = 1e9 * block_size / kSampleRate;
+        printf("sim: %.2f s, %zu callbacks of %zu frames\n",
+               Seconds(frames.load()),
+               cb_ns.size(),
+               block_size);
+        printf("sim: callback mean %.0f ns, max %.0f ns (%.1f%% / %.1f%% of "
+               "%.0f ns), %llu over budget\n",
+               sum / cb_ns.size(),
+               max,
+               100.0 * sum / cb_ns.size() / budget_ns,
+               100.0 * max / budget_ns,
+               budget_ns,
+               static_cast<unsigned long long>(over_budget));
+    }
+    if(checks > 0)
+        printf("sim: %d of %d checks passed\n", checks - failed_checks, checks);
+    fflush(stdout);
+    fflush(stderr);
+    std::_Exit(failed_checks > 0 ? 1 : 0);
+}
+
+// ---------------------------------------------------------------------------
+// Audio thread: stands in for the SAI DMA interrupt
+// ---------------------------------------------------------------------------
+
+void AudioThread()
+{
+    using Clock = std::chrono::steady_clock;
+
+    on_audio_thread = true;
+
+    std::vector<double> cb_ns;
+    uint64_t            over_budget = 0;
+    const auto          wall_start  = Clock::now();
+    const uint64_t      start_frame = frames.load();
+
+    while(frames.load() < run_frames)
+    {
+        {
+            std::unique_lock<std::mutex> lock(turn_mutex);
+            turn_cv.wait(lock, [] { return audio_turn; });
+        }
+
+        const size_t   bs  = block_size;
+        const uint64_t pos = frames.load();
+
+        if(cfg.speed > 0.0f)
+        {
+            // Only the wall clock waits; the turns stay the same
+            while(true)
+            {
+                const std::chrono::duration<double> elapsed = Clock::now() - wall_start;
+                const uint64_t due = start_frame
+                                     + static_cast<uint64_t>(elapsed.count() * cfg.speed
+                                                             * kSampleRate);
+                if(pos < due)
+                    break;
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+
+        RunCues(pos);
+
+        float in[2 * 64], out[2 * 64];
+        for(size_t i = 0; i < bs; i++)
+        {
+            float tone = 0.0f;
+            if(tone_hz > 0.0f)
+            {
+                tone = kToneLevel * static_cast<float>(sin(tone_phase));
+                tone_phase += 2.0 * M_PI * tone_hz / kSampleRate;
+                if(tone_phase >= 2.0 * M_PI)
+                    tone_phase -= 2.0 * M_PI;
+            }
+            for(size_t c = 0; c < 2; c++)
+            {
+                const size_t k = 2 * (pos + i) + c;
+                in[2 * i + c]  = (k < input.size() ? input[k] : 0.0f) + tone;
+            }
+        }
+
+        const auto t0 = Clock::now();
+        callback(in, out, 2 * bs);
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+        cb_ns.push_back(ns);
+        if(ns > 1e9 * bs / kSampleRate)
+            over_budget++;
+
+        if(cfg.output)
+            writer.WriteBlock(out, bs);
+        output.insert(output.end(), out, out + 2 * bs);
+        frames.fetch_add(bs);
+
+        {
+            std::lock_guard<std::mutex> lock(turn_mutex);
+            audio_turn = false;
+        }
+        turn_cv.notify_all();
+    }
+    Finish(cb_ns, over_budget);
+}
+} // namespace
+
+bool SimInit(const SimConfig &config)
+{
+    cfg = config;
+    if(cfg.script && !LoadScript(cfg.script))
+        return false;
+    if(cfg.input && !LoadInput(cfg.input))
+        return false;
+
+    run_frames = input.size() / 2 + static_cast<uint64_t>(cfg.seconds * kSampleRate);
+
+    // Long enough for the whole script
+    uint64_t last = 0;
+    if(!events.empty())
+        last = events.back().frame;
+    if(!cues.empty())
+        last = std::max(last, cues.back().frame);
+    if(!events.empty() || !cues.empty())
+        run_frames = std::max(run_frames,
+                              last + static_cast<uint64_t>(kScriptTail * kSampleRate));
+    output.reserve(2 * run_frames);
+
+    if(cfg.output)
+    {
+        writer.Init({kSampleRate});
+        if(writer.OpenFile(cfg.output) != decltype(writer)::Result::OK)
+        {
+            fprintf(stderr, "sim: can't create %s/%s\n", cfg.sd_root, cfg.output);
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Clock
+// ---------------------------------------------------------------------------
+
+void SimYield()
+{
+    if(on_audio_thread || !audio_running.load())
+        return;
+    std::unique_lock<std::mutex> lock(turn_mutex);
+    audio_turn = true;
+    turn_cv.notify_all();
+    turn_cv.wait(lock, [] { return !audio_turn; });
+}
+
+uint32_t SimNowMs()
+{
+    SimYield();
+    return static_cast<uint32_t>(frames.load() * 1000 / static_cast<uint64_t>(kSampleRate));
+}
+
+uint32_t SimNowUs()
+{
+    SimYield();
+    return static_cast<uint32_t>(frames.load() * 1000000 / static_cast<uint64_t>(kSampleRate));
+}
+
+uint32_t SimProfileTicks()
+{
+    using namespace std::chrono;
+    if(on_audio_thread)
+        return static_cast<uint32_t>(
+            duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+    SimYield();
+    return static_cast<uint32_t>(frames.load() * 1000000000 / static_cast<uint64_t>(kSampleRate));
+}
+
+void SimDelayUs(uint32_t us)
+{
+    const uint64_t until
+        = frames.load() + static_cast<uint64_t>(us) * static_cast<uint64_t>(kSampleRate) / 1000000;
+    if(!audio_running.load())
+    {
+        // No audio thread yet: nothing else moves the clock
+        frames.store(until);
+        return;
+    }
+    do
+        SimYield();
+    while(frames.load() < until);
+}
+
+void SimDelayMs(uint32_t ms)
+{
+    SimDelayUs(ms * 1000);
+}
+
+// ---------------------------------------------------------------------------
+// Audio
+// ---------------------------------------------------------------------------
+
+void SimSetBlockSize(size_t size)
+{
+    block_size = std::min<size_t>(std::max<size_t>(size, 1), 64);
+}
+
+size_t SimBlockSize()
+{
+    return block_size;
+}
+
+float SimSampleRate()
+{
+    return kSampleRate;
+}
+
+void SimStartAudio(SimAudioCallback cb)
+{
+    if(audio_running.exchange(true))
+        return;
+    callback = cb;
+    std::thread(AudioThread).detach();
+}
+
+// ---------------------------------------------------------------------------
+// Controls, LEDs, display
+// ---------------------------------------------------------------------------
+
+void SimPollControls(daisy::DaisyPod &pod)
+{
+    static const char *const kNames[kControls] = {"b1", "b2", "enc", "enc2"};
+
+    const uint64_t now = frames.load();
+    DumpOledFrame(now);
+
+    bool           touched[kControls] = {};
+    int32_t        inc[kControls]     = {};
+
+    // Apply due events in order, but at most one per control per poll so
+    // every press/release is seen as its own edge
+    for(; next_event < events.size() && events[next_event].frame <= now; next_event++)
+    {
+        const Event &e = events[next_event];
+        if(touched[e.control])
+            break;
+        touched[e.control] = true;
+        switch(e.type)
+        {
+            case EventType::PRESS: held[e.control] = true; break;
+            case EventType::RELEASE: held[e.control] = false; break;
+            case EventType::TURN: inc[e.control] = e.value; break;
+        }
+        if(cfg.verbose)
+            printf("[%8.3f] %s %s %d\n",
+                   Seconds(now),
+                   kNames[e.control],
+                   e.type == EventType::PRESS     ? "press"
+                   : e.type == EventType::RELEASE ? "release"
+                                                  : "turn",
+                   e.value);
+    }
+
+    pod.button1.SimUpdate(held[0]);
+    pod.button2.SimUpdate(held[1]);
+    pod.encoder.SimUpdate(inc[2], held[2]);
+    pod.encoder2.SimUpdate(inc[3], held[3]);
+}
+
+void SimGpioWrite(uint8_t pin, uint8_t state)
+{
+    if(pin >= sizeof(led_state) || led_state[pin] == state)
+        return;
+    led_state[pin] = state;
+    if(cfg.verbose)
+        printf("[%8.3f] LED D%u %s\n",
+               Seconds(frames.load()),
+               pin,
+               state ? "on" : "off");
+}
+
+void SimOledCommand(uint8_t cmd)
+{
+    // Only what the page writes use; the controller setup isn't modelled
+    std::lock_guard<std::mutex> lock(oled_mutex);
+    if(cmd >= 0xB0 && cmd <= 0xB7)
+        oled_page = cmd - 0xB0;
+    else if(cmd <= 0x0F)
+        oled_col = (oled_col & 0xF0) | cmd;
+    else if(cmd <= 0x1F)
+        oled_col = (oled_col & 0x0F) | ((cmd & 0x0F) << 4);
+}
+
+void SimOledData(const uint8_t *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(oled_mutex);
+    for(size_t i = 0; i < size && oled_col < kOledWidth; i++)
+        oled_ram[oled_page * kOledWidth + oled_col++] = data[i];
+    oled_written = true;
+    oled_changed = true;
+}
+
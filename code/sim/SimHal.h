@@ -0,0 +1,95 @@
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+#include <cstddef>
+#include <cstdint>
+
+/** Host simulation of the pod.
+ **
+ ** The firmware (src/main.cpp, OledManager, the engine) is compiled
+ ** unchanged against the stand-in headers in sim/hal/. This module is what
+ ** those headers call into:
+ **
+ ** - Audio: StartAudio() starts a thread that plays the role of the audio
+ **   interrupt. It feeds an input WAV (from the SD root) through the
+ **   callback one block at a time and records the output with WavWriter.
+ **   Simulated time is derived from the frames processed, so GetNow(),
+ **   Delay() and button hold times all follow the audio clock.
+ ** - Lockstep: the two threads never run at once. The main loop hands the
+ **   audio thread one block whenever it reads the clock (GetNow(), GetUs(),
+ **   ProfileTicks()), waits (Delay(), LoopEngine::Sync()) or otherwise
+ **   calls SimYield(), and carries on when the block is done. Where the
+ **   main loop is at each block is therefore a function of the script, not
+ **   of the host's scheduling: a run gives the same event frames and the
+ **   same output every time. On the main loop ProfileTicks() is this
+ **   clock too, so job slices are as long in steps on every run; in the
+ **   callback it's the host's nanosecond clock, for the profiler.
+ ** - Controls: a script of timed button/encoder events, applied by
+ **   ProcessDigitalControls(). At most one change per control is applied per
+ **   call, so each press produces exactly one RisingEdge() like on the pod.
+ **   The script can also switch a test tone on the input and check the
+ **   output for sound or silence (see LoadScript() in SimHal.cpp); the sim
+ **   exits with status 1 if a check failed.
+ ** - LEDs: state changes are logged with a timestamp (-v).
+ ** - OLED: the SSD1306's page writes update a copy of its RAM, which is
+ **   dumped as a PBM image at the end (and every 20 ms it changed with
+ **   --oled-frames).
+ ** - SD: FatFS calls are served from a host directory (SimFatFs.cpp).
+ **
+ ** When the input (plus tail) and the script are used up, the sim writes
+ ** the output file, prints the callback timing and exits the process.
+ */
+struct SimConfig
+{
+    const char *sd_root;     // host directory standing in for the SD card
+    const char *input;       // WAV in sd_root fed to the input (or nullptr)
+    const char *output;      // WAV written to sd_root (or nullptr)
+    const char *script;      // control script on the host (or nullptr)
+    const char *oled_dir;    // host directory for PBM dumps (or nullptr)
+    float       seconds;     // run length if there's no input, else tail
+    float       speed;       // x real time; 0 = as fast as possible
+    bool        oled_frames; // dump every changed frame, not just the last
+    bool        verbose;     // log LEDs and script events
+};
+
+namespace daisy
+{
+class DaisyPod;
+}
+
+typedef void (*SimAudioCallback)(const float *in, float *out, size_t size);
+
+/** Load the script and input. Call before the firmware's main(). */
+bool SimInit(const SimConfig &cfg);
+
+// Clock. From the main loop, each of these is a turn for the audio thread.
+void     SimYield();
+uint32_t SimNowMs();
+uint32_t SimNowUs();
+uint32_t SimProfileTicks(); // ns
+void     SimDelayMs(uint32_t ms);
+void     SimDelayUs(uint32_t us);
+
+// Audio
+void   SimSetBlockSize(size_t frames);
+size_t SimBlockSize();
+float  SimSampleRate();
+void   SimStartAudio(SimAudioCallback cb);
+
+// Controls, LEDs, display
+void SimPollControls(daisy::DaisyPod &pod);
+void SimGpioWrite(uint8_t pin, uint8_t state);
+void SimOledCommand(uint8_t cmd);
+void SimOledData(const uint8_t *data, size_t size);
+
+// SD root for the FatFS shim
+void        SimSetSdRoot(const char *dir);
+const char *SimSdRoot();
+
+// SD bus: SdmmcHandler::Init() reports the width it set up. Above the
+// card's width (--sd-bus) reads come back corrupted, like a card with a
+// data line that doesn't make contact.
+void SimSetSdMaxWidth(int bits);
+void SimSdmmcConfig(int bits);
+
+#endif // SIM_HAL_H
@@ -0,0 +1,48 @@
+#include "SimHostDir.h"
+#include <dirent.h>
+#include <string>
+#include <sys/stat.h>
+
+void *SimHostOpenDir(const char *path)
+{
+    return opendir(path);
+}
+
+void SimHostCloseDir(void *dir)
+{
+    if(dir)
+        closedir(static_cast<DIR *>(dir));
+}
+
+bool SimHostReadDir(void     *dir,
+                    const char *path,
+                    char       *name,
+                    unsigned    name_size,
+                    uint64_t   *size,
+                    bool       *is_dir)
+{
+    struct dirent *e;
+    do
+    {
+        e = readdir(static_cast<DIR *>(dir));
+        if(!e)
+            return false;
+    } while(e->d_name[0] == '.'
+            && (e->d_name[1] == 0 || (e->d_name[1] == '.' && e->d_name[2] == 0)));
+
+    snprintf(name, name_size, "%s", e->d_name);
+
+    struct stat st;
+    const std::string full = std::string(path) + "/" + e->d_name;
+    if(stat(full.c_str(), &st) == 0)
+    {
+        *size   = static_cast<uint64_t>(st.st_size);
+        *is_dir = S_ISDIR(st.st_mode);
+    }
+    else
+    {
+        *size   = 0;
+        *is_dir = false;
+    }
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef SIM_HOST_DIR_H
+#define SIM_HOST_DIR_H
+
+#include <cstdint>
+
+/** Host directory iteration for the FatFS shim. Kept apart from
+ ** SimFatFs.cpp because FatFS and POSIX both define a DIR type. */
+void *SimHostOpenDir(const char *path);
+void  SimHostCloseDir(void *dir);
+
+/** Next entry (without "." and ".."); false at the end. */
+bool SimHostReadDir(void     *dir,
+                    const char *path,
+                    char       *name,
+                    unsigned    name_size,
+                    uint64_t   *size,
+                    bool       *is_dir);
+
+#endif // SIM_HOST_DIR_H
@@ -0,0 +1,66 @@
+// Entry point of the host simulation. Parses the command line, sets up
+// SimHal and runs the firmware's main() (compiled as FirmwareMain).
+#include "SimHal.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+int FirmwareMain(void);
+
+static void Usage()
+{
+    fprintf(stderr,
+            "usage: looper_sim [options]\n"
+            "  --sd DIR        directory used as the SD card (default ./sd)\n"
+            "  --in NAME       WAV in the SD directory fed to the input\n"
+            "  --out NAME      WAV written to the SD directory (stereo float)\n"
+            "  --script FILE   control script (see sim/scripts/)\n"
+            "  --seconds S     run time; with --in, extra time after it (default 2),\n"
+            "                  and at least to the end of the script\n"
+            "  --speed X       x real time, 0 = as fast as possible (default 0)\n"
+            "  --oled DIR      write the final screen to DIR/oled.pbm\n"
+            "  --oled-frames   also write every changed screen\n"
+            "  --sd-bus N      data lines the card works with, 1 or 4 (default 4)\n"
+            "  -v              log control events and LEDs\n");
+}
+
+int main(int argc, char **argv)
+{
+    SimConfig cfg = {"sd", nullptr, nullptr, nullptr, nullptr, 2.0f, 0.0f, false, false};
+
+    for(int i = 1; i < argc; i++)
+    {
+        const char *arg  = argv[i];
+        const bool  more = i + 1 < argc;
+        if(strcmp(arg, "--sd") == 0 && more)
+            cfg.sd_root = argv[++i];
+        else if(strcmp(arg, "--in") == 0 && more)
+            cfg.input = argv[++i];
+        else if(strcmp(arg, "--out") == 0 && more)
+            cfg.output = argv[++i];
+        else if(strcmp(arg, "--script") == 0 && more)
+            cfg.script = argv[++i];
+        else if(strcmp(arg, "--seconds") == 0 && more)
+            cfg.seconds = static_cast<float>(atof(argv[++i]));
+        else if(strcmp(arg, "--speed") == 0 && more)
+            cfg.speed = static_cast<float>(atof(argv[++i]));
+        else if(strcmp(arg, "--oled") == 0 && more)
+            cfg.oled_dir = argv[++i];
+        else if(strcmp(arg, "--oled-frames") == 0)
+            cfg.oled_frames = true;
+        else if(strcmp(arg, "--sd-bus") == 0 && more)
+            SimSetSdMaxWidth(atoi(argv[++i]));
+        else if(strcmp(arg, "-v") == 0)
+            cfg.verbose = true;
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+
+    SimSetSdRoot(cfg.sd_root);
+    if(!SimInit(cfg))
+        return 1;
+    return FirmwareMain();
+}
@@ -0,0 +1,35 @@
+#pragma once
+// Host stand-in for libDaisy's daisy_core.h: memory section macros and the
+// sample conversion helpers used by the looper.
+#include <cstddef>
+#include <cstdint>
+
+// No SDRAM / DMA sections on the host: plain .bss
+#define DSY_SDRAM_BSS
+#define DSY_SDRAM_DATA
+#define DSY_DMA_BUFFER_SECTOR
+
+namespace daisy
+{
+inline float s162f(int16_t x)
+{
+    return static_cast<float>(x) * (1.0f / 32767.0f);
+}
+
+inline int16_t f2s16(float x)
+{
+    x = x <= -1.0f ? -1.0f : (x >= 1.0f ? 1.0f : x);
+    return static_cast<int16_t>(x * 32767.0f);
+}
+
+inline float s322f(int32_t x)
+{
+    return static_cast<float>(x) * (1.0f / 2147483647.0f);
+}
+
+inline int32_t f2s32(float x)
+{
+    x = x <= -1.0f ? -1.0f : (x >= 1.0f ? 1.0f : x);
+    return static_cast<int32_t>(x * 2147483647.0f);
+}
+} // namespace daisy
@@ -0,0 +1,194 @@
+#pragma once
+// Host stand-in for libDaisy's daisy_pod.h (plus the bits of daisy_seed.h,
+// system.h, per/gpio.h, hid/switch.h, hid/encoder.h and audio.h the looper
+// uses). Inputs come from the sim script, outputs go to the sim log, and
+// the audio callback is driven by the sim's audio thread; see SimHal.h.
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include "daisy_core.h"
+#include "fatfs.h"
+#include "SimHal.h"
+
+namespace daisy
+{
+struct Pin
+{
+    uint8_t port;
+    uint8_t pin;
+};
+
+namespace seed
+{
+constexpr Pin D19 = {0, 19};
+constexpr Pin D20 = {0, 20};
+} // namespace seed
+
+class AudioHandle
+{
+  public:
+    typedef const float *InterleavingInputBuffer;
+    typedef float       *InterleavingOutputBuffer;
+    typedef void (*InterleavingAudioCallback)(InterleavingInputBuffer  in,
+                                              InterleavingOutputBuffer out,
+                                              size_t                   size);
+};
+
+class System
+{
+  public:
+    static uint32_t GetNow() { return SimNowMs(); }
+    static uint32_t GetUs() { return SimNowUs(); }
+    static void     Delay(uint32_t delay_ms) { SimDelayMs(delay_ms); }
+    static void     DelayUs(uint32_t delay_us) { SimDelayUs(delay_us); }
+};
+
+/** Debounced switch; its state is set by the sim once per
+ ** DaisyPod::ProcessDigitalControls(). */
+class Switch
+{
+  public:
+    inline bool  RisingEdge() const { return rising_; }
+    inline bool  FallingEdge() const { return falling_; }
+    inline bool  Pressed() const { return pressed_; }
+    inline float TimeHeldMs() const
+    {
+        return pressed_ ? static_cast<float>(SimNowMs() - press_ms_) : 0.0f;
+    }
+
+    void SimUpdate(bool pressed)
+    {
+        rising_  = pressed && !pressed_;
+        falling_ = !pressed && pressed_;
+        if(rising_)
+            press_ms_ = SimNowMs();
+        pressed_ = pressed;
+    }
+
+  private:
+    bool     pressed_  = false;
+    bool     rising_   = false;
+    bool     falling_  = false;
+    uint32_t press_ms_ = 0;
+};
+
+class Encoder
+{
+  public:
+    inline int32_t Increment() const { return inc_; }
+    inline bool    RisingEdge() const { return sw_.RisingEdge(); }
+    inline bool    FallingEdge() const { return sw_.FallingEdge(); }
+    inline bool    Pressed() const { return sw_.Pressed(); }
+    inline float   TimeHeldMs() const { return sw_.TimeHeldMs(); }
+
+    void SimUpdate(int32_t inc, bool pressed)
+    {
+        inc_ = inc;
+        sw_.SimUpdate(pressed);
+    }
+
+  private:
+    int32_t inc_ = 0;
+    Switch  sw_;
+};
+
+class DaisySeed
+{
+  public:
+    Pin GetPin(uint8_t pin_idx) const { return Pin{0, pin_idx}; }
+};
+
+class DaisyPod
+{
+  public:
+    DaisySeed seed;
+    Switch    button1, button2;
+    Encoder   encoder, encoder2;
+
+    void  Init(bool boost = false) { (void)boost; }
+    void  SetAudioBlockSize(size_t size) { SimSetBlockSize(size); }
+    size_t AudioBlockSize() const { return SimBlockSize(); }
+    float AudioSampleRate() const { return SimSampleRate(); }
+    void  StartAdc() {}
+    void  StartAudio(AudioHandle::InterleavingAudioCallback cb)
+    {
+        SimStartAudio(cb);
+    }
+    void ProcessDigitalControls() { SimPollControls(*this); }
+    void ProcessAnalogControls() {}
+    void DelayMs(size_t del) { SimDelayMs(static_cast<uint32_t>(del)); }
+};
+
+class SdmmcHandler
+{
+  public:
+    enum class Result
+    {
+        OK,
+        ERROR,
+    };
+    enum class BusWidth
+    {
+        BITS_1,
+        BITS_4,
+    };
+    enum class Speed
+    {
+        SLOW,
+        MEDIUM_SLOW,
+        STANDARD,
+        FAST,
+        VERY_FAST,
+    };
+    struct Config
+    {
+        BusWidth width;
+        Speed    speed;
+        void     Defaults()
+        {
+            width = BusWidth::BITS_4;
+            speed = Speed::FAST;
+        }
+    };
+
+    Result Init(const Config &cfg)
+    {
+        SimSdmmcConfig(cfg.width == BusWidth::BITS_4 ? 4 : 1);
+        return Result::OK;
+    }
+};
+} // namespace daisy
+
+// per/gpio.h (C API)
+typedef enum
+{
+    DSY_GPIO_MODE_INPUT,
+    DSY_GPIO_MODE_OUTPUT_PP,
+    DSY_GPIO_MODE_OUTPUT_OD,
+    DSY_GPIO_MODE_ANALOG,
+} dsy_gpio_mode;
+
+typedef enum
+{
+    DSY_GPIO_NOPULL,
+    DSY_GPIO_PULLUP,
+    DSY_GPIO_PULLDOWN,
+} dsy_gpio_pull;
+
+typedef struct
+{
+    daisy::Pin    pin;
+    dsy_gpio_mode mode;
+    dsy_gpio_pull pull;
+} dsy_gpio;
+
+inline void dsy_gpio_init(const dsy_gpio *p)
+{
+    (void)p;
+}
+
+inline void dsy_gpio_write(const dsy_gpio *p, uint8_t state)
+{
+    SimGpioWrite(p->pin.pin, state);
+}
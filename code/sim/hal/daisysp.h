@@ -0,0 +1,5 @@
+#pragma once
+// Host stand-in for DaisySP: the looper doesn't use any of its modules.
+namespace daisysp
+{
+}
@@ -0,0 +1,67 @@
+#pragma once
+// Host stand-in for libDaisy's SSD130x driver and fonts.
+//
+// The transport emulates the controller's page addressing: page/column
+// commands and data go to the sim, which keeps the panel RAM and dumps it
+// as a PBM image (see SimHal.h). Fonts have libDaisy's layout (16-bit rows,
+// leftmost pixel in the MSB) but are built from a 5x7 glyph set centred in
+// each cell, so layouts keep their real spacing even though the glyphs
+// aren't pixel-identical to the firmware fonts.
+#include <cstddef>
+#include <cstdint>
+#include "daisy_pod.h"
+
+struct FontDef
+{
+    const uint8_t   FontWidth;
+    uint8_t         FontHeight;
+    const uint16_t *data;
+};
+
+extern FontDef Font_6x8;
+extern FontDef Font_7x10;
+extern FontDef Font_11x18;
+
+/** 5x7 glyphs for ' '..'~', one byte per column, LSB at the top. */
+extern const uint8_t kSimFont5x7[95][5];
+
+namespace daisy
+{
+class SSD130x4WireSpiTransport
+{
+  public:
+    struct Config
+    {
+        struct
+        {
+            Pin dc;
+            Pin reset;
+        } pin_config;
+    };
+
+    void Init(const Config &config) { (void)config; }
+    void SendCommand(uint8_t cmd) { SimOledCommand(cmd); }
+    void SendData(uint8_t *buff, size_t size) { SimOledData(buff, size); }
+};
+
+template <size_t width, size_t height, typename Transport>
+class SSD130xDriver
+{
+  public:
+    struct Config
+    {
+        typename Transport::Config transport_config;
+    };
+
+    void Init(Config config) { transport_.Init(config.transport_config); }
+
+    size_t Width() const { return width; }
+    size_t Height() const { return height; }
+
+  protected:
+    Transport transport_;
+};
+
+using SSD130x4WireSpi128x64Driver
+    = SSD130xDriver<128, 64, SSD130x4WireSpiTransport>;
+} // namespace daisy
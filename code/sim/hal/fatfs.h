@@ -0,0 +1,141 @@
+#pragma once
+// Host stand-in for FatFS (ff.h), backed by a directory on the host.
+//
+// Only the subset the looper uses. Paths are resolved against the sim's SD
+// root (see SimSetSdRoot() in SimHal.h), so "/LOOP1.WAV" and "LOOP1.WAV"
+// are the same file. Sector-level behaviour (cluster allocation, partial
+// sector writes) is not modelled; sizes and offsets are.
+#include <cstdint>
+#include "daisy_core.h"
+#include "util/wav_format.h"
+
+typedef unsigned int UINT;
+typedef uint8_t      BYTE;
+typedef uint16_t     WORD;
+typedef uint32_t     DWORD;
+typedef DWORD        FSIZE_t;
+typedef char         TCHAR;
+
+typedef enum
+{
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM,
+    FR_MKFS_ABORTED,
+    FR_TIMEOUT,
+    FR_LOCKED,
+    FR_NOT_ENOUGH_CORE,
+    FR_TOO_MANY_OPEN_FILES,
+    FR_INVALID_PARAMETER,
+} FRESULT;
+
+#define FA_READ 0x01
+#define FA_WRITE 0x02
+#define FA_OPEN_EXISTING 0x00
+#define FA_CREATE_NEW 0x04
+#define FA_CREATE_ALWAYS 0x08
+#define FA_OPEN_ALWAYS 0x10
+#define FA_OPEN_APPEND 0x30
+
+// ffconf.h options the firmware checks (as code/Makefile sets them)
+#define FF_USE_EXPAND 1
+
+#define AM_RDO 0x01
+#define AM_HID 0x02
+#define AM_SYS 0x04
+#define AM_DIR 0x10
+#define AM_ARC 0x20
+
+typedef struct
+{
+    int dummy;
+} FATFS;
+
+typedef struct
+{
+    void   *host; // FILE*
+    FSIZE_t fptr;
+    FSIZE_t objsize;
+    BYTE    flag;
+} FIL;
+
+typedef struct
+{
+    void *host; // DIR*
+} DIR;
+
+typedef struct
+{
+    FSIZE_t fsize;
+    WORD    fdate;
+    WORD    ftime;
+    BYTE    fattrib;
+    TCHAR   fname[256];
+} FILINFO;
+
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode);
+FRESULT f_close(FIL *fp);
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br);
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw);
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs);
+FRESULT f_truncate(FIL *fp);
+FRESULT f_sync(FIL *fp);
+FRESULT f_expand(FIL *fp, FSIZE_t fsz, BYTE opt);
+FRESULT f_opendir(DIR *dp, const TCHAR *path);
+FRESULT f_closedir(DIR *dp);
+FRESULT f_readdir(DIR *dp, FILINFO *fno);
+FRESULT f_stat(const TCHAR *path, FILINFO *fno);
+FRESULT f_unlink(const TCHAR *path);
+FRESULT f_rename(const TCHAR *path_old, const TCHAR *path_new);
+FRESULT f_mount(FATFS *fs, const TCHAR *path, BYTE opt);
+
+#define f_size(fp) ((fp)->objsize)
+#define f_tell(fp) ((fp)->fptr)
+#define f_eof(fp) ((int)((fp)->fptr == (fp)->objsize))
+
+namespace daisy
+{
+/** Stand-in for libDaisy's FatFSInterface. */
+class FatFSInterface
+{
+  public:
+    enum class Result
+    {
+        OK,
+        ERR_TOO_MANY_VOLUMES,
+        ERR_NO_MEDIA_SELECTED,
+        ERR_GENERIC,
+    };
+
+    struct Config
+    {
+        enum Media : uint8_t
+        {
+            MEDIA_SD  = 0x01,
+            MEDIA_USB = 0x02,
+        };
+        uint8_t media;
+    };
+
+    Result Init(const uint8_t media)
+    {
+        (void)media;
+        return Result::OK;
+    }
+    FATFS &GetSDFileSystem() { return sd_fs_; }
+
+  private:
+    FATFS sd_fs_;
+};
+} // namespace daisy
@@ -0,0 +1,27 @@
+#pragma once
+// Host stand-in for libDaisy's util/wav_format.h.
+#include <cstdint>
+
+#define WAVE_FORMAT_PCM 0x0001
+
+constexpr uint32_t kWavFileChunkId     = 0x46464952; // "RIFF"
+constexpr uint32_t kWavFileWaveId      = 0x45564157; // "WAVE"
+constexpr uint32_t kWavFileSubChunk1Id = 0x20746d66; // "fmt "
+constexpr uint32_t kWavFileSubChunk2Id = 0x61746164; // "data"
+
+typedef struct
+{
+    uint32_t ChunkId;
+    uint32_t FileSize;
+    uint32_t FileFormat;
+    uint32_t SubChunk1ID;
+    uint32_t SubChunk1Size;
+    uint16_t AudioFormat;
+    uint16_t NbrChannels;
+    uint32_t SampleRate;
+    uint32_t ByteRate;
+    uint16_t BlockAlign;
+    uint16_t BitPerSample;
+    uint32_t SubChunk2ID;
+    uint32_t SubCHunk2Size;
+} WAV_FormatTypeDef;
@@ -0,0 +1,162 @@
+// .LPK frames (LoopCodec.h): every frame length, mono and stereo, the
+// extremes of what the encoder sees, and frames damaged on the card.
+#include "Test.h"
+#include <cstdint>
+#include <cstring>
+#include "LoopCodec.h"
+
+static int16_t in[kCodecFrameSize], out[kCodecFrameSize];
+static uint8_t frame[kCodecMaxFrameBytes];
+
+static uint32_t Next(uint32_t &seed)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return seed;
+}
+
+/** Something a guitar might play: two partials and a little noise. With
+ ** 'channels' 2, the right channel is a different mix of them. */
+static void Tone(int16_t *dst, size_t n, size_t channels, uint32_t seed)
+{
+    int32_t a = 0, b = 12000, c = 0, d = 3000; // two quadrature oscillators
+    for(size_t i = 0; i < n; i++)
+    {
+        a += b / 64;
+        b -= a / 64;
+        c += d / 9;
+        d -= c / 9;
+        const int32_t noise = static_cast<int32_t>(Next(seed) >> 28) - 8;
+        const int32_t v     = i % channels == 0 ? a + c : a / 2 - c;
+        dst[i]              = static_cast<int16_t>(v + noise);
+    }
+}
+
+/** Encode n samples, check the header, decode and compare. */
+static bool RoundTrip(const int16_t *src, size_t n, size_t channels, uint32_t position)
+{
+    const size_t bytes = loop_codec::EncodeFrame(src, n, position, frame, channels);
+    LoopFrameHeader hdr;
+    memcpy(&hdr, frame, sizeof(hdr));
+    if(bytes > kCodecMaxFrameBytes || bytes != sizeof(hdr) + hdr.bytes)
+        return false;
+    if(!loop_codec::ValidHeader(hdr) || hdr.count != n || hdr.position != position)
+        return false;
+    // Odd stereo counts can't be split into pairs, so they're coded mono
+    if(hdr.channels != (channels == 2 && n % 2 == 0 ? 2 : 0))
+        return false;
+    memset(out, 0x55, sizeof(out));
+    return loop_codec::DecodeFrame(hdr, frame + sizeof(hdr), out)
+           && memcmp(out, src, n * sizeof(int16_t)) == 0;
+}
+
+TEST(CodecEveryLengthMono)
+{
+    Tone(in, kCodecFrameSize, 1, 1);
+    for(size_t n = 1; n <= kCodecFrameSize; n++)
+        CHECK(RoundTrip(in, n, 1, static_cast<uint32_t>(n * 7)));
+}
+
+TEST(CodecEveryLengthStereo)
+{
+    Tone(in, kCodecFrameSize, 2, 2);
+    for(size_t n = 1; n <= kCodecFrameSize; n++)
+        CHECK(RoundTrip(in, n, 2, static_cast<uint32_t>(n * 2)));
+}
+
+TEST(CodecCompressesTone)
+{
+    Tone(in, kCodecFrameSize, 1, 3);
+    const size_t bytes = loop_codec::EncodeFrame(in, kCodecFrameSize, 0, frame);
+    LoopFrameHeader hdr;
+    memcpy(&hdr, frame, sizeof(hdr));
+    CHECK(hdr.order != kCodecVerbatim);
+    CHECK(bytes < kCodecFrameSize * sizeof(int16_t) / 2);
+}
+
+TEST(CodecSilence)
+{
+    memset(in, 0, sizeof(in));
+    for(size_t channels = 1; channels <= 2; channels++)
+    {
+        CHECK(RoundTrip(in, kCodecFrameSize, channels, 0));
+        CHECK(RoundTrip(in, 1, channels, 0));
+        CHECK(RoundTrip(in, 2, channels, 0));
+
+        // A bit per residual and a parameter per partition, no more
+        const size_t bytes = loop_codec::EncodeFrame(in, kCodecFrameSize, 0, frame, channels);
+        CHECK(bytes <= sizeof(LoopFrameHeader) + kCodecFrameSize / 8 + 16);
+    }
+}
+
+TEST(CodecFullScaleNoiseIsVerbatim)
+{
+    uint32_t seed = 4;
+    for(size_t i = 0; i < kCodecFrameSize; i++)
+        in[i] = static_cast<int16_t>(Next(seed) >> 16);
+    for(size_t channels = 1; channels <= 2; channels++)
+    {
+        const size_t bytes = loop_codec::EncodeFrame(in, kCodecFrameSize, 0, frame, channels);
+        LoopFrameHeader hdr;
+        memcpy(&hdr, frame, sizeof(hdr));
+        CHECK(hdr.order == kCodecVerbatim);
+        CHECK(bytes == kCodecMaxFrameBytes);
+        CHECK(RoundTrip(in, kCodecFrameSize, channels, 0));
+        CHECK(RoundTrip(in, 333, channels, 0));
+    }
+}
+
+TEST(CodecFullScaleExtremes)
+{
+    // Rails and full-scale square waves: the largest residuals there are
+    for(size_t i = 0; i < kCodecFrameSize; i++)
+        in[i] = i % 2 ? -32768 : 32767;
+    CHECK(RoundTrip(in, kCodecFrameSize, 1, 0));
+    CHECK(RoundTrip(in, kCodecFrameSize, 2, 0));
+    for(size_t i = 0; i < kCodecFrameSize; i++)
+        in[i] = (i / 3) % 2 ? -32768 : 32767;
+    CHECK(RoundTrip(in, kCodecFrameSize, 1, 0));
+    for(size_t i = 0; i < kCodecFrameSize; i++)
+        in[i] = 32767;
+    CHECK(RoundTrip(in, kCodecFrameSize, 1, 0));
+    for(size_t i = 0; i < kCodecFrameSize; i++)
+        in[i] = -32768;
+    CHECK(RoundTrip(in, kCodecFrameSize, 2, 0));
+}
+
+/** Encode, apply 'damage' to the frame, and try to decode it. */
+template <typename Damage>
+static bool DecodesDamaged(size_t channels, Damage damage)
+{
+    loop_codec::EncodeFrame(in, kCodecFrameSize, 0, frame, channels);
+    damage(frame);
+    LoopFrameHeader hdr;
+    memcpy(&hdr, frame, sizeof(hdr));
+    return loop_codec::DecodeFrame(hdr, frame + sizeof(hdr), out);
+}
+
+TEST(CodecCorruptFrameFails)
+{
+    const size_t kHdr = sizeof(LoopFrameHeader);
+    for(size_t channels = 1; channels <= 2; channels++)
+    {
+        // Rice coded: a flipped bit in the residuals, or a wrong checksum
+        Tone(in, kCodecFrameSize, channels, 5);
+        CHECK(!DecodesDamaged(channels, [=](uint8_t *f) { f[kHdr + 1000] ^= 0x08; }));
+        CHECK(!DecodesDamaged(channels, [](uint8_t *f) {
+            LoopFrameHeader h;
+            memcpy(&h, f, sizeof(h));
+            h.check++;
+            memcpy(f, &h, sizeof(h));
+        }));
+
+        // Verbatim: only the checksum can tell
+        uint32_t seed = 6;
+        for(size_t i = 0; i < kCodecFrameSize; i++)
+            in[i] = static_cast<int16_t>(Next(seed) >> 16);
+        CHECK(!DecodesDamaged(channels, [=](uint8_t *f) { f[kHdr + 4001] ^= 0x40; }));
+
+        // A bad sync word isn't a frame at all
+        CHECK(!DecodesDamaged(channels, [](uint8_t *f) { f[0] ^= 0x01; }));
+        CHECK(DecodesDamaged(channels, [](uint8_t *) {}));
+    }
+}
@@ -0,0 +1,168 @@
+// Q15 loop storage (LoopSample.h) and the int16 overdub kernels
+// (LoopKernels.h), checked against the float path they replace.
+#include "Test.h"
+#include <cstdint>
+#include <cstring>
+#include "LoopKernels.h"
+#include "LoopSample.h"
+
+typedef SampleTraits<int16_t> Q15;
+typedef SampleTraits<float>   F32;
+
+static constexpr size_t kN = 1027; // odd: the vector kernels' tails too
+
+// Deterministic noise in [-amp, amp)
+static float Noise(uint32_t &seed, float amp)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return amp * (static_cast<int32_t>(seed) / 2147483648.0f);
+}
+
+TEST(ToS16FromS16RoundTripInt16)
+{
+    static int16_t src[65536], mid[65536], back[65536];
+    for(int i = 0; i < 65536; i++)
+        src[i] = static_cast<int16_t>(i - 32768);
+    Q15::FromS16(mid, src, 65536);
+    Q15::ToS16(back, mid, 65536);
+    for(int i = 0; i < 65536; i++)
+        CHECK(back[i] == src[i]);
+}
+
+TEST(ToS16FromS16RoundTripFloat)
+{
+    static int16_t src[65536], back[65536];
+    static float   mid[65536];
+    for(int i = 0; i < 65536; i++)
+        src[i] = static_cast<int16_t>(i - 32768);
+    F32::FromS16(mid, src, 65536);
+    F32::ToS16(back, mid, 65536);
+    CHECK(back[0] == -32767); // float storage is symmetric
+    for(int i = 1; i < 65536; i++)
+        CHECK(back[i] == src[i]);
+}
+
+TEST(ToS16ClampsFloat)
+{
+    const float src[6] = {1.0f, -1.0f, 1.5f, -1.5f, 100.0f, -100.0f};
+    int16_t     dst[6];
+    F32::ToS16(dst, src, 6);
+    CHECK(dst[0] == 32767 && dst[1] == -32767);
+    CHECK(dst[2] == 32767 && dst[3] == -32767);
+    CHECK(dst[4] == 32767 && dst[5] == -32767);
+}
+
+TEST(Sat16AtFullScale)
+{
+    CHECK(Q15::Sat16(32767) == 32767);
+    CHECK(Q15::Sat16(32768) == 32767);
+    CHECK(Q15::Sat16(65534) == 32767);
+    CHECK(Q15::Sat16(-32768) == -32768);
+    CHECK(Q15::Sat16(-32769) == -32768);
+    CHECK(Q15::Sat16(-65536) == -32768);
+    CHECK(Q15::FromFloat(1.0f) == 32767);
+    CHECK(Q15::FromFloat(2.0f) == 32767);
+    CHECK(Q15::FromFloat(-2.0f) == -32768);
+}
+
+TEST(FromFloatRoundsToNearestInt16)
+{
+    const float step = 1.0f / 32767.0f;
+    CHECK(Q15::FromFloat(0.6f * step) == 1);
+    CHECK(Q15::FromFloat(-0.6f * step) == -1);
+    CHECK(Q15::FromFloat(0.4f * step) == 0);
+    CHECK(Q15::FromFloat(-0.4f * step) == 0);
+    CHECK(Q15::FromFloat(100.7f * step) == 101);
+    CHECK(Q15::FromFloat(-100.7f * step) == -101);
+    CHECK(Q15::FromFloat(-1.0f) == -32767);
+}
+
+TEST(QAdd16x2SaturatesEachHalf)
+{
+    // lo: 32767 + 1, hi: -32768 + -1; neither carries into the other
+    const uint32_t a = 0x80007FFFu, b = 0xFFFF0001u;
+    const uint32_t r = Q15::QAdd16x2(a, b);
+    CHECK(static_cast<int16_t>(r & 0xFFFF) == 32767);
+    CHECK(static_cast<int16_t>(r >> 16) == -32768);
+
+    // In range: a plain add
+    const uint32_t c = Q15::QAdd16x2(0x00020003u, 0xFFFF0004u);
+    CHECK(static_cast<int16_t>(c & 0xFFFF) == 7);
+    CHECK(static_cast<int16_t>(c >> 16) == 1);
+}
+
+TEST(OverdubInt16SaturatesAtFullScale)
+{
+    int16_t scalar[kN], vec[kN];
+    float   in[kN];
+    for(size_t i = 0; i < kN; i++)
+    {
+        // Alternate pushing past +full scale and past -full scale
+        scalar[i] = i % 2 ? -30000 : 30000;
+        in[i]     = i % 2 ? -0.5f : 0.5f;
+        if(i % 3 == 0)
+            in[i] *= 4.0f; // beyond [-1, 1] on its own
+    }
+    memcpy(vec, scalar, sizeof(vec));
+    OverdubScalar(scalar, in, kN);
+    OverdubVec(vec, in, kN);
+    for(size_t i = 0; i < kN; i++)
+    {
+        CHECK(scalar[i] == (i % 2 ? -32768 : 32767));
+        CHECK(vec[i] == scalar[i]);
+    }
+}
+
+TEST(OverdubInt16MatchesFloat)
+{
+    int16_t q_scalar[kN], q_vec[kN];
+    float   f[kN], in[kN];
+    uint32_t seed = 1;
+    for(int pass = 0; pass < 8; pass++)
+    {
+        // Louder every pass, so loop + input clips in the later ones. The
+        // input itself stays within full scale, as it does from the codec
+        const float amp = 0.125f * (pass + 1);
+        for(size_t i = 0; i < kN; i++)
+        {
+            q_scalar[i] = Q15::FromFloat(Noise(seed, 1.0f));
+            in[i]       = Noise(seed, amp);
+        }
+        memcpy(q_vec, q_scalar, sizeof(q_vec));
+        F32::FromS16(f, q_scalar, kN);
+
+        OverdubScalar(q_scalar, in, kN);
+        OverdubVec(q_vec, in, kN);
+        OverdubScalar(f, in, kN);
+        for(size_t i = 0; i < kN; i++)
+        {
+            CHECK(q_vec[i] == q_scalar[i]);
+            // FromFloat() rounds the input to the nearest step: at most
+            // half a step apart, except where Q15 reaches -32768 and
+            // float clamps at -1
+            const float diff = Q15::ToFloat(q_scalar[i]) - f[i];
+            if(q_scalar[i] == -32768)
+                CHECK(f[i] <= -1.0f + 0.5f / 32767.0f);
+            else
+                CHECK(diff <= 0.5f / 32767.0f + 1e-6f && diff >= -0.5f / 32767.0f - 1e-6f);
+        }
+    }
+}
+
+TEST(OverdubFloatClampsAtFullScale)
+{
+    float loop[kN], vec[kN], in[kN];
+    for(size_t i = 0; i < kN; i++)
+    {
+        loop[i] = i % 2 ? -0.9f : 0.9f;
+        in[i]   = i % 2 ? -0.5f : 0.5f;
+    }
+    memcpy(vec, loop, sizeof(vec));
+    OverdubScalar(loop, in, kN);
+    OverdubVec(vec, in, kN);
+    for(size_t i = 0; i < kN; i++)
+    {
+        CHECK(loop[i] == (i % 2 ? -1.0f : 1.0f));
+        CHECK(vec[i] == loop[i]);
+    }
+}
@@ -0,0 +1,250 @@
+// SessionJournal (SessionJournal.h) through the sim's FatFS shim: a loop
+// journaled and replayed into another buffer, as after a reboot, with the
+// file cut short, left over from an older journal, or mid-compaction.
+#include "Test.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "SessionJournal.h"
+#include "SimHal.h"
+
+typedef SessionJournal::Session Session;
+
+static constexpr size_t kLoop    = kJournalRegionSize * 4;
+static constexpr size_t kRecord  = SdIo::kSector + kJournalRegionSize * sizeof(loop_sample_t);
+static constexpr size_t kSamples = kJournalRegionSize;
+
+static SessionJournalStorage<kLoop> journal_mem, replay_mem;
+static SessionJournal               journal, replay;
+static loop_sample_t                loop[kLoop], replayed[kLoop];
+
+/** A card of its own for each test, cleared away at the end. */
+struct TempSd
+{
+    std::string dir;
+
+    TempSd()
+    {
+        char tmpl[] = "/tmp/looper_test.XXXXXX";
+        dir         = mkdtemp(tmpl) ? tmpl : ".";
+        SimSetSdRoot(dir.c_str());
+    }
+    ~TempSd()
+    {
+        for(const char *name : {"SESSION0.JNL", "SESSION1.JNL", "SESSION.GEN"})
+            remove(Path(name).c_str());
+        remove(dir.c_str());
+    }
+
+    std::string Path(const char *name) const { return dir + "/" + name; }
+
+    bool Exists(const char *name) const
+    {
+        FILE *f = fopen(Path(name).c_str(), "rb");
+        if(f)
+            fclose(f);
+        return f != nullptr;
+    }
+
+    std::vector<uint8_t> Read(const char *name) const
+    {
+        std::vector<uint8_t> b;
+        FILE                *f = fopen(Path(name).c_str(), "rb");
+        int                  c;
+        while(f && (c = fgetc(f)) != EOF)
+            b.push_back(static_cast<uint8_t>(c));
+        if(f)
+            fclose(f);
+        return b;
+    }
+
+    /** Write 'b' from 'at' on, over what's there (the file grows if need be). */
+    void Overwrite(const char *name, size_t at, const uint8_t *b, size_t n) const
+    {
+        FILE *f = fopen(Path(name).c_str(), "r+b");
+        if(!f)
+            return;
+        fseek(f, static_cast<long>(at), SEEK_SET);
+        fwrite(b, 1, n, f);
+        fclose(f);
+    }
+};
+
+static Session Mono(uint32_t id)
+{
+    Session s  = {};
+    s.id       = id;
+    s.length   = kLoop;
+    s.channels = 1;
+    s.stride   = kLoop;
+    s.planes   = 1;
+    s.used     = 1;
+    s.level[0] = 100;
+    return s;
+}
+
+/** 'v' in storage units of 16-bit full scale. */
+static loop_sample_t Sample(int v)
+{
+    return static_cast<loop_sample_t>(v / (LoopSample::kToFloat * 32767.0f));
+}
+
+static void Fill(loop_sample_t *x, size_t first, size_t n, int seed)
+{
+    for(size_t i = first; i < first + n; i++)
+        x[i] = Sample(static_cast<int>((i * 37 + seed * 101) % 2001) - 1000);
+}
+
+/** Overdub region 'r' the way the callback would: new samples, Touch(). */
+static void Dub(size_t r, int seed)
+{
+    Fill(loop, r * kSamples, kSamples, seed);
+    journal.Touch(r * kSamples, kSamples);
+}
+
+/** Step the journal until it has nothing left to write (and has synced). */
+static uint32_t now_ms = 0;
+
+static void CatchUp(const Session &s)
+{
+    for(int i = 0; i < 1000 && journal.Step(s, SIZE_MAX, now_ms += 10); i++)
+    {
+    }
+}
+
+/** Power cut: what FatFs wrote is on the card, as on the pod, where
+ ** sector writes go straight through. Then boot and replay. */
+static bool Reboot(Session *out)
+{
+    fflush(nullptr);
+    memset(replayed, 0x11, sizeof(replayed));
+    replay.Init(replayed, replay_mem);
+    return replay.Replay(out);
+}
+
+static bool Replayed(const loop_sample_t *expect)
+{
+    return memcmp(replayed, expect, sizeof(replayed)) == 0;
+}
+
+TEST(JournalReplaysLoop)
+{
+    TempSd sd;
+    Fill(loop, 0, kLoop, 1);
+    journal.Init(loop, journal_mem);
+    const Session s = Mono(1);
+    CatchUp(s);
+    Dub(2, 2);
+    CatchUp(s);
+
+    Session out;
+    CHECK(Reboot(&out));
+    CHECK(out.length == kLoop && out.channels == 1 && out.planes == 1);
+    CHECK(Replayed(loop));
+}
+
+TEST(JournalStopsAtTornRecord)
+{
+    TempSd sd;
+    Fill(loop, 0, kLoop, 3);
+    journal.Init(loop, journal_mem);
+    const Session s = Mono(1);
+    CatchUp(s);
+    static loop_sample_t before[kLoop];
+    memcpy(before, loop, sizeof(before));
+    Dub(1, 4);
+    CatchUp(s);
+
+    // META, the base pass, CHECKPOINT, then the one region record
+    const size_t last = SdIo::kSector + 4 * kRecord + SdIo::kSector;
+    Session      out;
+    CHECK(Reboot(&out) && Replayed(loop));
+
+    // Its payload cut short: the region as it was
+    std::vector<uint8_t> file = sd.Read("SESSION0.JNL");
+    CHECK(file.size() > last + kRecord);
+    const uint8_t junk[16] = {0xFF, 0xFF, 0xFF, 0xFF};
+    sd.Overwrite("SESSION0.JNL", last + kRecord - sizeof(junk), junk, sizeof(junk));
+    CHECK(Reboot(&out) && Replayed(before));
+
+    // Its header not written at all
+    static uint8_t zeros[SdIo::kSector];
+    sd.Overwrite("SESSION0.JNL", last, zeros, sizeof(zeros));
+    CHECK(Reboot(&out) && Replayed(before));
+
+    // The base pass cut short: no checkpoint, nothing to replay
+    sd.Overwrite("SESSION0.JNL", SdIo::kSector + kRecord, zeros, sizeof(zeros));
+    CHECK(!Reboot(&out));
+}
+
+TEST(JournalIgnoresStaleRecords)
+{
+    TempSd sd;
+    Session out;
+
+    // A journal with its checkpoint and a few changes
+    Fill(loop, 0, kLoop, 5);
+    journal.Init(loop, journal_mem);
+    CatchUp(Mono(1));
+    Dub(0, 6);
+    Dub(3, 7);
+    CatchUp(Mono(1));
+    const std::vector<uint8_t> old = sd.Read("SESSION0.JNL");
+    CHECK(old.size() > SdIo::kSector + 6 * kRecord);
+
+    // No loop to keep (a first take): the files go
+    Session none = {};
+    journal.Step(none, SIZE_MAX, now_ms += 10);
+    CHECK(!sd.Exists("SESSION0.JNL") && !sd.Exists("SESSION1.JNL"));
+
+    // Reboot and start another loop of the same size. The power goes half
+    // way through its base pass, and the file got the old one's clusters:
+    // past what was written, they still hold its records
+    Fill(loop, 0, kLoop, 8);
+    journal.Init(loop, journal_mem);
+    const Session s = Mono(2);
+    for(int i = 0; i < 3; i++)
+        journal.Step(s, SIZE_MAX, now_ms += 10);
+    fflush(nullptr);
+    const size_t written = SdIo::kSector + 2 * kRecord;
+    CHECK(sd.Read("SESSION0.JNL").size() >= old.size());
+    sd.Overwrite("SESSION0.JNL", written, &old[written], old.size() - written);
+
+    // The old records (and the old checkpoint) are another generation's
+    CHECK(!Reboot(&out));
+}
+
+TEST(JournalCompaction)
+{
+    TempSd sd;
+    Session out;
+    Fill(loop, 0, kLoop, 9);
+    journal.Init(loop, journal_mem);
+    const Session s = Mono(1);
+    CatchUp(s);
+
+    // Keep changing regions until the file is full and a new generation
+    // starts in the other one
+    static loop_sample_t written[kLoop];
+    memcpy(written, loop, sizeof(written));
+    for(int i = 0; i < 100 && journal.GetStats().compactions == 0; i++)
+    {
+        Dub(i % 4, 10 + i);
+        journal.Step(s, SIZE_MAX, now_ms += 10);
+        if(journal.GetStats().compactions == 0)
+            memcpy(written, loop, sizeof(written));
+    }
+    CHECK(journal.GetStats().compactions == 1);
+    CHECK(sd.Exists("SESSION0.JNL") && sd.Exists("SESSION1.JNL"));
+
+    // Power cut before the new file's checkpoint: the old one replays
+    CHECK(Reboot(&out) && Replayed(written));
+
+    // Once it's in, the old file is gone and the new one has it all
+    CatchUp(s);
+    CHECK(!sd.Exists("SESSION0.JNL"));
+    CHECK(journal.GetStats().generation == 2);
+    CHECK(Reboot(&out) && Replayed(loop));
+}
@@ -0,0 +1,44 @@
+#ifndef SIM_TEST_H
+#define SIM_TEST_H
+
+#include <cstdio>
+
+/** Minimal host test harness (make -C code/sim test).
+ **
+ ** TEST(name) defines a test case, which registers itself before main();
+ ** CHECK(cond) records a failure with its file and line and carries on, so
+ ** one run reports every broken case. The runner (TestMain.cpp) runs all
+ ** of them in link order and exits with status 1 if any check failed.
+ **
+ **     TEST(Sat16Clamps)
+ **     {
+ **         CHECK(SampleTraits<int16_t>::Sat16(40000) == 32767);
+ **     }
+ */
+struct TestCase
+{
+    typedef void (*Fn)();
+
+    TestCase(const char *name, Fn fn);
+
+    const char *name;
+    Fn          fn;
+    TestCase   *next;
+};
+
+/** Record a failed check (CHECK does this). */
+void TestFail(const char *file, int line, const char *expr);
+
+#define TEST(name)                                        \
+    static void     Test_##name();                        \
+    static TestCase test_case_##name(#name, Test_##name); \
+    static void     Test_##name()
+
+#define CHECK(cond)                              \
+    do                                           \
+    {                                            \
+        if(!(cond))                              \
+            TestFail(__FILE__, __LINE__, #cond); \
+    } while(0)
+
+#endif // SIM_TEST_H
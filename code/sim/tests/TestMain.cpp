@@ -0,0 +1,41 @@
+// Runner for the host unit tests (see Test.h).
+#include "Test.h"
+#include <cstdlib>
+
+static TestCase *first_case = nullptr;
+static TestCase *last_case  = nullptr;
+static int       failures   = 0;
+
+TestCase::TestCase(const char *name_, Fn fn_) : name(name_), fn(fn_), next(nullptr)
+{
+    if(last_case)
+        last_case->next = this;
+    else
+        first_case = this;
+    last_case = this;
+}
+
+void TestFail(const char *file, int line, const char *expr)
+{
+    // Only the first 20: a check in a loop could flood the log
+    if(failures++ < 20)
+        printf("%s:%d: CHECK(%s) failed\n", file, line, expr);
+}
+
+int main()
+{
+    int cases = 0, failed = 0;
+    for(TestCase *t = first_case; t; t = t->next)
+    {
+        const int before = failures;
+        t->fn();
+        cases++;
+        if(failures != before)
+        {
+            failed++;
+            printf("%s: FAILED\n", t->name);
+        }
+    }
+    printf("test: %d of %d cases passed\n", cases - failed, cases);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
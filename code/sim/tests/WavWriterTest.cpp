@@ -0,0 +1,226 @@
+// WavWriter (WavWriter.h) against reference files built here byte by
+// byte: every format, mono and stereo, both ways of feeding it, and
+// recordings that end part way into a half of the transfer buffer.
+#include "Test.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "SimHal.h"
+#include "WavWriter.h"
+
+using namespace daisy;
+
+typedef std::vector<uint8_t> Bytes;
+
+static void Put16(Bytes &b, uint32_t v)
+{
+    b.push_back(static_cast<uint8_t>(v));
+    b.push_back(static_cast<uint8_t>(v >> 8));
+}
+
+static void Put32(Bytes &b, uint32_t v)
+{
+    Put16(b, v & 0xFFFF);
+    Put16(b, v >> 16);
+}
+
+static void PutTag(Bytes &b, const char *tag)
+{
+    b.insert(b.end(), tag, tag + 4);
+}
+
+static float Clamp(float x)
+{
+    return x <= -1.0f ? -1.0f : (x >= 1.0f ? 1.0f : x);
+}
+
+/** The file WavWriter should produce: a 44-byte header (58 for float,
+ ** with cbSize and a "fact" chunk), then the samples as little-endian
+ ** 16/24/32-bit PCM (truncated) or IEEE float. */
+static Bytes Reference(uint16_t format, uint16_t bits, uint16_t channels,
+                       const float *in, size_t frames)
+{
+    const uint32_t samples = frames * channels;
+    const uint32_t data    = samples * (bits / 8);
+    const bool     pcm     = format == 1;
+    Bytes          b;
+    PutTag(b, "RIFF");
+    Put32(b, (pcm ? 36 : 50) + data);
+    PutTag(b, "WAVE");
+    PutTag(b, "fmt ");
+    Put32(b, pcm ? 16 : 18);
+    Put16(b, format);
+    Put16(b, channels);
+    Put32(b, 48000);
+    Put32(b, 48000 * channels * (bits / 8));
+    Put16(b, channels * (bits / 8));
+    Put16(b, bits);
+    if(!pcm)
+    {
+        Put16(b, 0); // cbSize
+        PutTag(b, "fact");
+        Put32(b, 4);
+        Put32(b, frames);
+    }
+    PutTag(b, "data");
+    Put32(b, data);
+    for(size_t i = 0; i < samples; i++)
+    {
+        const float x = Clamp(in[i]);
+        if(format == 3)
+        {
+            uint32_t u;
+            memcpy(&u, &in[i], sizeof(u));
+            Put32(b, u);
+        }
+        else if(bits == 16)
+        {
+            Put16(b, static_cast<uint16_t>(static_cast<int16_t>(x * 32767.0f)));
+        }
+        else if(bits == 24)
+        {
+            const uint32_t s = static_cast<uint32_t>(static_cast<int32_t>(x * 8388607.0f));
+            Put16(b, s & 0xFFFF);
+            b.push_back(static_cast<uint8_t>(s >> 16));
+        }
+        else
+        {
+            const int32_t s = x >= 1.0f ? INT32_MAX : static_cast<int32_t>(x * 2147483647.0f);
+            Put32(b, static_cast<uint32_t>(s));
+        }
+    }
+    return b;
+}
+
+/** A ramp across full scale, with values past it and exactly +-1. */
+static std::vector<float> Input(size_t samples)
+{
+    std::vector<float> in(samples);
+    for(size_t i = 0; i < samples; i++)
+        in[i] = 2.5f * static_cast<float>(i % 101) / 100.0f - 1.25f;
+    if(samples > 2)
+    {
+        in[1] = 1.0f;
+        in[2] = -1.0f;
+    }
+    return in;
+}
+
+/** Point the SD root at a fresh temporary directory; ReadBack() takes
+ ** the file and the directory away again. */
+static std::string sd_dir;
+
+static void SdDir()
+{
+    char tmpl[] = "/tmp/looper_test.XXXXXX";
+    sd_dir      = mkdtemp(tmpl) ? tmpl : ".";
+    SimSetSdRoot(sd_dir.c_str());
+}
+
+static Bytes ReadBack(const char *name)
+{
+    const std::string path = sd_dir + "/" + name;
+    Bytes             b;
+    FILE             *f = fopen(path.c_str(), "rb");
+    if(f)
+    {
+        int c;
+        while((c = fgetc(f)) != EOF)
+            b.push_back(static_cast<uint8_t>(c));
+        fclose(f);
+        remove(path.c_str());
+    }
+    remove(sd_dir.c_str());
+    return b;
+}
+
+/** Record 'frames' frames with Sample()/Write(), as the audio callback and
+ ** main loop would, and compare the file with the reference. */
+template <size_t transfer_size, typename Format, size_t channels>
+static bool SampleMatches(size_t frames)
+{
+    typedef WavWriter<transfer_size, Format, channels> Writer;
+    static Writer            writer;
+    const std::vector<float> in = Input(frames * channels);
+    SdDir();
+    writer.Init({48000.0f});
+    bool ok = writer.OpenFile("T.WAV") == Writer::Result::OK;
+    for(size_t i = 0; ok && i < frames; i++)
+    {
+        writer.Sample(&in[i * channels]);
+        writer.Write();
+    }
+    ok = ok && writer.GetLengthSamps() == frames && writer.SaveFile() == Writer::Result::OK;
+    const Bytes file = ReadBack("T.WAV");
+    return ok
+           && file == Reference(Format::kAudioFormat, Format::kBits, channels, in.data(), frames);
+}
+
+/** The same through WriteBlock(), in runs of 'run' frames (the last one
+ ** shorter). */
+template <size_t transfer_size, typename Format, size_t channels>
+static bool BlockMatches(size_t frames, size_t run)
+{
+    typedef WavWriter<transfer_size, Format, channels> Writer;
+    static Writer            writer;
+    const std::vector<float> in = Input(frames * channels);
+    SdDir();
+    writer.Init({48000.0f});
+    bool ok = writer.OpenFile("T.WAV") == Writer::Result::OK;
+    for(size_t i = 0; ok && i < frames; i += run)
+    {
+        const size_t n = frames - i < run ? frames - i : run;
+        ok             = writer.WriteBlock(&in[i * channels], n) == Writer::Result::OK;
+    }
+    ok = ok && writer.SaveFile() == Writer::Result::OK;
+    const Bytes file = ReadBack("T.WAV");
+    return ok
+           && file == Reference(Format::kAudioFormat, Format::kBits, channels, in.data(), frames);
+}
+
+TEST(WavWriterEmptyFile)
+{
+    // Header only, both sizes final
+    CHECK((SampleMatches<64, WavFormatS16, 1>(0)));
+    CHECK((BlockMatches<64, WavFormatF32, 2>(0, 1)));
+}
+
+TEST(WavWriterSampleS16)
+{
+    // 64-byte halves hold 32 mono frames: exactly full, and one into the
+    // next half, and part way into the second half
+    CHECK((SampleMatches<64, WavFormatS16, 1>(32)));
+    CHECK((SampleMatches<64, WavFormatS16, 1>(33)));
+    CHECK((SampleMatches<64, WavFormatS16, 1>(100)));
+    CHECK((SampleMatches<64, WavFormatS16, 2>(77)));
+}
+
+TEST(WavWriterSampleWideFormats)
+{
+    // Stereo 24-bit frames are 6 bytes: a 64-byte half holds 10 of them
+    CHECK((SampleMatches<64, WavFormatS24, 2>(10)));
+    CHECK((SampleMatches<64, WavFormatS24, 2>(47)));
+    CHECK((SampleMatches<64, WavFormatS24, 1>(101)));
+    CHECK((SampleMatches<64, WavFormatS32, 1>(99)));
+    CHECK((SampleMatches<64, WavFormatF32, 2>(53)));
+}
+
+TEST(WavWriterBlockFormats)
+{
+    // Runs that don't line up with the halves or with the 4-sample kernels
+    CHECK((BlockMatches<64, WavFormatS16, 1>(100, 7)));
+    CHECK((BlockMatches<64, WavFormatS16, 2>(100, 13)));
+    CHECK((BlockMatches<64, WavFormatS24, 1>(101, 5)));
+    CHECK((BlockMatches<64, WavFormatS24, 2>(47, 3)));
+    CHECK((BlockMatches<64, WavFormatS32, 2>(64, 64)));
+    CHECK((BlockMatches<64, WavFormatF32, 1>(250, 33)));
+}
+
+TEST(WavWriterBlockLargeTransfer)
+{
+    // The firmware's transfer size, with one long run and a partial half
+    CHECK((BlockMatches<16384, WavFormatS24, 2>(12345, 12345)));
+    CHECK((BlockMatches<16384, WavFormatS16, 1>(20000, 4096)));
+}
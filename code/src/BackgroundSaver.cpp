@@ -0,0 +1,408 @@
+#include "BackgroundSaver.h"
+#include <cstdio>
+#include <cstring>
+#include "WavWriter.h"
+
+/** Header fields and kernel of each WavExport format (see WavWriter.h). */
+struct WavKernel
+{
+    uint16_t audio_format;
+    uint16_t bits;
+    void (*convert)(uint8_t *dst, const float *src, size_t n);
+};
+
+template <typename Format>
+static constexpr WavKernel KernelOf()
+{
+    return {Format::kAudioFormat, Format::kBits, &Format::Convert};
+}
+
+static const WavKernel kWavKernels[] = {
+    KernelOf<daisy::WavFormatS16>(),
+    KernelOf<daisy::WavFormatS24>(),
+    KernelOf<daisy::WavFormatF32>(),
+};
+
+static inline const WavKernel &KernelFor(BackgroundSaver::WavExport format)
+{
+    return kWavKernels[static_cast<size_t>(format)];
+}
+
+void BackgroundSaver::Init(SnapshotGuard *guard, float samplerate)
+{
+    guard_      = guard;
+    samplerate_ = samplerate;
+    state_      = State::IDLE;
+    restarts_   = 0;
+}
+
+bool BackgroundSaver::Begin(const char    *pack_name,
+                            const char    *wav_name,
+                            size_t         length,
+                            size_t         head,
+                            size_t         channels,
+                            const Mixdown *mix,
+                            WavExport      format)
+{
+    if(state_ == State::RUNNING || length == 0)
+        return false;
+    if((channels != 1 && channels != 2) || length % channels != 0)
+        return false;
+    if(mix && (mix->planes == 0 || mix->planes > kMaxPlanes))
+        return false;
+
+    // Worst case: every frame verbatim, and the ring order splits up to two
+    // more chunks (at the start region and at the end of the loop)
+    const size_t  frames = (length + kCodecFrameSize - 1) / kCodecFrameSize + 2;
+    const FSIZE_t pack_max = sizeof(LoopFileHeader)
+                             + frames * sizeof(LoopFrameHeader)
+                             + static_cast<FSIZE_t>(length) * sizeof(int16_t);
+    if(f_open(&pack_, pack_name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return false;
+    if(!SdIo::Preallocate(&pack_, pack_max))
+    {
+        f_close(&pack_);
+        f_unlink(pack_name);
+        return false;
+    }
+
+    channels_ = channels;
+    format_   = format;
+    wav_open_ = wav_name != nullptr;
+    if(wav_open_ && !BeginWav(wav_name, length))
+    {
+        f_close(&pack_);
+        f_unlink(pack_name);
+        return false;
+    }
+
+    snprintf(pack_name_, sizeof(pack_name_), "%s", pack_name);
+    snprintf(wav_name_, sizeof(wav_name_), "%s", wav_open_ ? wav_name : "");
+    if(mix)
+    {
+        mix_ = *mix;
+    }
+    else
+    {
+        memset(&mix_, 0, sizeof(mix_));
+        mix_.planes   = 1;
+        mix_.level[0] = 1.0f;
+    }
+    copy_ = mix_.planes == 1 && mix_.level[0] == 1.0f;
+
+    length_    = length;
+    done_      = 0;
+    raw_bytes_ = 0;
+    peak_      = 0;
+    StartPack();
+    guard_->Begin(length, head / kSnapshotRegionSize, mix_.planes, mix_.stride);
+    state_ = State::RUNNING;
+    return true;
+}
+
+bool BackgroundSaver::BeginWav(const char *wav_name, size_t length)
+{
+    const WavKernel &kernel     = KernelFor(format_);
+    const uint16_t   bytes      = kernel.bits / 8;
+    const uint32_t   data_bytes = length * bytes;
+    if(f_open(&wav_, wav_name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return false;
+    if(!SdIo::Preallocate(&wav_, kWavHeaderSize + data_bytes))
+    {
+        f_close(&wav_);
+        f_unlink(wav_name);
+        return false;
+    }
+
+    // The format's header; sizes are final since the length is known.
+    WAV_FormatTypeDef hdr;
+    hdr.ChunkId       = kWavFileChunkId;
+    hdr.FileSize      = kWavHeaderSize - 8 + data_bytes;
+    hdr.FileFormat    = kWavFileWaveId;
+    hdr.SubChunk1ID   = kWavFileSubChunk1Id;
+    hdr.SubChunk1Size = kernel.audio_format == WAVE_FORMAT_PCM ? 16 : 18;
+    hdr.AudioFormat   = kernel.audio_format;
+    hdr.NbrChannels   = static_cast<uint16_t>(channels_);
+    hdr.SampleRate    = static_cast<uint32_t>(samplerate_);
+    hdr.ByteRate      = hdr.SampleRate * channels_ * bytes;
+    hdr.BlockAlign    = channels_ * bytes;
+    hdr.BitPerSample  = kernel.bits;
+    hdr.SubChunk2ID   = kWavFileSubChunk2Id;
+    hdr.SubCHunk2Size = data_bytes;
+
+    // RIFF + "fmt " (+ cbSize and "fact" for float), a JUNK chunk up to
+    // the end of the sector, then the "data" chunk header: the samples
+    // start on a sector boundary.
+    static constexpr size_t   kFmtEnd = 36;
+    static constexpr uint32_t kJunkId = 0x4B4E554A; // "JUNK"
+    const size_t   junk_at   = kFmtEnd + daisy::WavFmtExtraBytes(kernel.audio_format);
+    const uint32_t junk_size = kWavHeaderSize - junk_at - 16;
+    uint8_t       *out       = reinterpret_cast<uint8_t *>(staging_);
+    memset(out, 0, kWavHeaderSize);
+    memcpy(out, &hdr, kFmtEnd);
+    daisy::WavPutFmtExtra(out + kFmtEnd,
+                          kernel.audio_format,
+                          static_cast<uint32_t>(length / channels_));
+    memcpy(out + junk_at, &kJunkId, 4);
+    memcpy(out + junk_at + 4, &junk_size, 4);
+    memcpy(out + kWavHeaderSize - 8, &hdr.SubChunk2ID, 8);
+    if(!WriteAt(&wav_, 0, out, kWavHeaderSize))
+    {
+        f_close(&wav_);
+        f_unlink(wav_name);
+        return false;
+    }
+    return true;
+}
+
+BackgroundSaver::State BackgroundSaver::Step(size_t head)
+{
+    if(state_ != State::RUNNING)
+        return state_;
+
+    if(guard_->Torn())
+    {
+        // The head caught up with us and the copy pool ran out: start a
+        // fresh snapshot from where the head is now. The .LPK starts over
+        // too (its frames are in walk order).
+        guard_->Begin(length_, head / kSnapshotRegionSize, mix_.planes, mix_.stride);
+        done_      = 0;
+        raw_bytes_ = 0;
+        peak_      = 0;
+        StartPack();
+        restarts_++;
+    }
+
+    // One chunk, never crossing the end of the loop (the file offset jumps
+    // back to the start there).
+    const size_t total = guard_->Regions();
+    const size_t first = guard_->WalkRegion(done_);
+    size_t       count = total - done_;
+    if(count > kChunkRegions)
+        count = kChunkRegions;
+    if(first + count > total)
+        count = total - first;
+
+    // A 24-bit/float WAV is converted region by region from the float mix
+    // and goes out as it fills up; a 16-bit one is the chunk itself.
+    const bool   wide = wav_open_ && format_ != WavExport::S16;
+    const size_t pos  = first * kSnapshotRegionSize;
+    wav_at_   = kWavHeaderSize + static_cast<FSIZE_t>(pos) * (KernelFor(format_).bits / 8);
+    wav_fill_ = 0;
+
+    bool   ok      = true;
+    size_t samples = 0;
+    for(size_t k = 0; ok && k < count; k++)
+    {
+        const size_t r = first + k;
+        if(wide)
+        {
+            float mixed[kSnapshotRegionSize];
+            MixRegion(r, staging_ + samples, mixed);
+            ok = AddWav(mixed, guard_->RegionLength(r));
+        }
+        else if(copy_)
+        {
+            ReadRegion(r, staging_ + samples);
+        }
+        else
+        {
+            MixRegion(r, staging_ + samples, nullptr);
+        }
+        samples += guard_->RegionLength(r);
+    }
+    for(size_t s = 0; s < samples; s++)
+    {
+        const int v = staging_[s] < 0 ? -staging_[s] : staging_[s];
+        if(v > peak_)
+            peak_ = v > 32767 ? 32767 : v;
+    }
+
+    const UINT bytes = samples * sizeof(int16_t);
+    if(wide)
+        ok = ok && FlushWav();
+    else if(wav_open_)
+        ok = ok && WriteAt(&wav_, wav_at_, staging_, bytes);
+    for(size_t s = 0; ok && s < samples; s += kCodecFrameSize)
+    {
+        const size_t n = samples - s < kCodecFrameSize ? samples - s : kCodecFrameSize;
+        ok             = AddFrame(staging_ + s, n, pos + s);
+    }
+    if(!ok)
+    {
+        Finish(State::FAILED);
+        return state_;
+    }
+    raw_bytes_ += bytes;
+
+    done_ += count;
+    guard_->MarkSaved(done_);
+    if(done_ >= total)
+        Finish(EndPack() ? State::DONE : State::FAILED);
+    return state_;
+}
+
+void BackgroundSaver::ReadRegion(size_t r, int16_t *dst)
+{
+    const size_t len  = guard_->RegionLength(r);
+    const bool   live = !guard_->Preserved(r);
+    LoopSample::ToS16(dst, guard_->Source(r), len);
+    if(live && guard_->Preserved(r))
+    {
+        // Overdub reached this region while we were reading it live.
+        LoopSample::ToS16(dst, guard_->Source(r), len);
+    }
+}
+
+/** Region 'r' of every plane, summed at the mix levels. As in ReadRegion(),
+ ** a plane preserved while it was being read live is read again (from its
+ ** copy); the sum then starts over. 'wide' (if not nullptr) gets the sum
+ ** as float, for a 24-bit/float WAV. */
+void BackgroundSaver::MixRegion(size_t r, int16_t *dst, float *wide)
+{
+    const size_t len = guard_->RegionLength(r);
+    float        acc[kSnapshotRegionSize];
+    bool         torn;
+    do
+    {
+        memset(acc, 0, len * sizeof(float));
+        torn = false;
+        for(size_t p = 0; p < mix_.planes; p++)
+        {
+            const float level = mix_.level[p];
+            if(level == 0.0f)
+                continue;
+            const bool           live = !guard_->Preserved(r, p);
+            const loop_sample_t *src  = guard_->Source(r, p);
+            for(size_t i = 0; i < len; i++)
+                acc[i] += LoopSample::ToFloat(src[i]) * level;
+            if(live && guard_->Preserved(r, p))
+                torn = true;
+        }
+    } while(torn);
+    if(wide)
+        memcpy(wide, acc, len * sizeof(float));
+
+    // Round to nearest: a track at full level comes out as it was stored
+    for(size_t i = 0; i < len; i++)
+    {
+        const float v = acc[i] * 32767.0f;
+        dst[i]        = SampleTraits<int16_t>::Sat16(
+            static_cast<int32_t>(v < 0.0f ? v - 0.5f : v + 0.5f));
+    }
+}
+
+void BackgroundSaver::Abort()
+{
+    if(state_ == State::RUNNING)
+        Finish(State::FAILED);
+}
+
+int BackgroundSaver::Progress() const
+{
+    const size_t total = guard_->Regions();
+    return total == 0 ? 0 : static_cast<int>((done_ * 100) / total);
+}
+
+int BackgroundSaver::Ratio() const
+{
+    const uint64_t pack = pack_written_ + pack_fill_ - sizeof(LoopFileHeader);
+    return raw_bytes_ == 0 ? 0 : static_cast<int>((pack * 100) / raw_bytes_);
+}
+
+void BackgroundSaver::StartPack()
+{
+    // zero_offset is filled in by EndPack()
+    const LoopFileHeader hdr = PackHeader();
+    memcpy(pack_buf_, &hdr, sizeof(hdr));
+    pack_fill_    = sizeof(hdr);
+    pack_written_ = 0;
+    pack_zero_    = sizeof(hdr);
+}
+
+LoopFileHeader BackgroundSaver::PackHeader() const
+{
+    LoopFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic       = kLoopFileMagic;
+    hdr.sample_rate = static_cast<uint32_t>(samplerate_);
+    hdr.length      = length_;
+    hdr.frame_size  = kCodecFrameSize;
+    hdr.zero_offset = pack_zero_;
+    hdr.channels    = channels_;
+    return hdr;
+}
+
+bool BackgroundSaver::AddFrame(const int16_t *src, size_t n, size_t pos)
+{
+    if(pos == 0)
+        pack_zero_ = pack_written_ + pack_fill_;
+    pack_fill_ += loop_codec::EncodeFrame(src, n, pos, pack_buf_ + pack_fill_, channels_);
+    if(pack_fill_ < kPackBlock)
+        return true;
+
+    // A full block goes out; the frame that overhangs it moves to the front
+    if(!WriteAt(&pack_, pack_written_, pack_buf_, kPackBlock))
+        return false;
+    pack_written_ += kPackBlock;
+    pack_fill_ -= kPackBlock;
+    memmove(pack_buf_, pack_buf_ + kPackBlock, pack_fill_);
+    return true;
+}
+
+bool BackgroundSaver::EndPack()
+{
+    // The last partial block, then give back the unused preallocation
+    // (f_truncate cuts at the file pointer), then the header again now
+    // that zero_offset is known
+    const LoopFileHeader hdr = PackHeader();
+    if(pack_written_ == 0)
+        memcpy(pack_buf_, &hdr, sizeof(hdr));
+    return WriteAt(&pack_, pack_written_, pack_buf_, pack_fill_)
+           && f_truncate(&pack_) == FR_OK
+           && (pack_written_ == 0 || WriteAt(&pack_, 0, &hdr, sizeof(hdr)));
+}
+
+bool BackgroundSaver::AddWav(const float *src, size_t n)
+{
+    const WavKernel &kernel = KernelFor(format_);
+    kernel.convert(wav_buf_ + wav_fill_, src, n);
+    wav_fill_ += n * (kernel.bits / 8);
+    return wav_fill_ < kWavBlock || FlushWav();
+}
+
+bool BackgroundSaver::FlushWav()
+{
+    const bool ok = wav_fill_ == 0 || WriteAt(&wav_, wav_at_, wav_buf_, wav_fill_);
+    wav_at_ += wav_fill_;
+    wav_fill_ = 0;
+    return ok;
+}
+
+bool BackgroundSaver::WriteAt(FIL *f, FSIZE_t offset, const void *data, UINT bytes)
+{
+    if(f_tell(f) != offset && f_lseek(f, offset) != FR_OK)
+        return false;
+    UINT bw = 0;
+    return f_write(f, data, bytes, &bw) == FR_OK && bw == bytes;
+}
+
+void BackgroundSaver::Finish(State result)
+{
+    guard_->End();
+    f_sync(&pack_);
+    f_close(&pack_);
+    if(wav_open_)
+    {
+        f_sync(&wav_);
+        f_close(&wav_);
+    }
+    if(result == State::FAILED)
+    {
+        // Don't leave truncated loops on the card
+        f_unlink(pack_name_);
+        if(wav_open_)
+            f_unlink(wav_name_);
+    }
+    state_ = result;
+}
@@ -0,0 +1,64 @@
+#include "CallbackProfiler.h"
+#include <cstring>
+
+void CallbackProfiler::Init(float samplerate)
+{
+    CycleCounterInit();
+    ticks_per_frame_
+        = static_cast<uint32_t>(ProfileTicksPerUs() * 1e6f / samplerate);
+    start_   = 0;
+    touched_ = 0;
+    reset_.store(false, std::memory_order_relaxed);
+    Clear();
+    published_.Init(stats_);
+}
+
+void CallbackProfiler::Clear()
+{
+    memset(&stats_, 0, sizeof(stats_));
+    for(size_t s = 0; s < kStages; s++)
+        stats_.stage[s].min = UINT32_MAX;
+    stats_.ticks_per_us = ProfileTicksPerUs();
+}
+
+void CallbackProfiler::Record(size_t stage, uint32_t ticks)
+{
+    StageStats &st = stats_.stage[stage];
+    if(ticks < st.min)
+        st.min = ticks;
+    if(ticks > st.max)
+        st.max = ticks;
+    st.sum += ticks;
+    st.count++;
+
+    int b = (31 - __builtin_clz(ticks | 1)) - kFirstBucket;
+    if(b < 0)
+        b = 0;
+    if(b >= static_cast<int>(kBuckets))
+        b = kBuckets - 1;
+    st.hist[b]++;
+}
+
+void CallbackProfiler::EndBlock(size_t frames)
+{
+    const uint32_t total = ProfileTicks() - start_;
+
+    if(reset_.load(std::memory_order_relaxed))
+    {
+        reset_.store(false, std::memory_order_relaxed);
+        Clear();
+    }
+
+    for(size_t s = 0; s < kStages - 1; s++)
+        if(touched_ & (1u << s))
+            Record(s, pending_[s]);
+    Record(static_cast<size_t>(Stage::TOTAL), total);
+
+    stats_.budget = static_cast<uint32_t>(frames) * ticks_per_frame_;
+    if(total > stats_.budget)
+        stats_.overruns++;
+    stats_.blocks++;
+
+    if(stats_.blocks % kPublishBlocks == 0)
+        published_.Write(stats_);
+}
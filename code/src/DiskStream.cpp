@@ -0,0 +1,373 @@
+#include "DiskStream.h"
+#include <cstring>
+#include "CallbackProfiler.h"
+#include "SdIo.h"
+
+void DiskStream::Init(DiskStreamStorage *mem)
+{
+    mem_      = mem;
+    open_     = false;
+    capacity_ = 0;
+
+    next_seq_     = 0;
+    cur_seq_      = 0;
+    starved_seq_  = 0;
+    cur_chunk_    = kNone;
+    pinned_clean_ = 0;
+    first_take_   = true;
+    generation_   = 0;
+
+    head_seq_.store(0, std::memory_order_relaxed);
+    head_pos_.store(0, std::memory_order_relaxed);
+    in_pinned_.store(true, std::memory_order_relaxed);
+    pinned_dirty_.store(false, std::memory_order_relaxed);
+    underruns_.store(0, std::memory_order_relaxed);
+    for(size_t i = 0; i < kStreamSlots; i++)
+    {
+        dirty_[i].store(false, std::memory_order_relaxed);
+        // A sequence from before the start: never asked for
+        ready_seq_[i].store(static_cast<uint32_t>(i - kStreamSlots),
+                            std::memory_order_relaxed);
+        slot_chunk_[i] = 0;
+    }
+
+    const Layout lay = {0, 0, 0, true};
+    layout_.Init(lay);
+    main_layout_ = lay;
+    filled_      = 0;
+    flushed_     = 0;
+
+    last_head_pos_  = 0;
+    stats_          = Stats{};
+    stats_.lead_min = UINT32_MAX;
+}
+
+bool DiskStream::Open(const char *path, size_t capacity)
+{
+    capacity_ = capacity / kStreamChunkSize * kStreamChunkSize;
+    if(f_open(&file_, path, FA_READ | FA_WRITE | FA_OPEN_ALWAYS) != FR_OK)
+        return false;
+
+    // A new file gets one contiguous run of clusters; an old one that's
+    // too short is extended (seeking past the end in write mode)
+    const FSIZE_t bytes = static_cast<FSIZE_t>(capacity_) * sizeof(int16_t);
+    bool          sized = f_size(&file_) >= bytes;
+    if(f_size(&file_) == 0)
+        sized = SdIo::Preallocate(&file_, bytes);
+    else if(!sized)
+        sized = f_lseek(&file_, bytes) == FR_OK && f_tell(&file_) == bytes;
+    if(!sized)
+    {
+        f_close(&file_);
+        return false;
+    }
+
+    main_layout_ = layout_.Read();
+    filled_      = main_layout_.base;
+    flushed_     = main_layout_.base;
+
+    stats_          = Stats{};
+    stats_.lead_min = UINT32_MAX;
+    underruns_.store(0, std::memory_order_relaxed);
+    open_ = true;
+    return true;
+}
+
+void DiskStream::Close()
+{
+    if(!open_)
+        return;
+    Flush();
+    f_close(&file_);
+    open_ = false;
+}
+
+// -----------------------------------------------------------------------------
+// Audio callback side
+// -----------------------------------------------------------------------------
+void DiskStream::NewLayout(uint32_t chunks, bool first_take)
+{
+    // Main loop has loaded at most kStreamSlots sequences past the head, so
+    // from here on, nothing loaded for the old layout has a matching number.
+    cur_chunk_ = kNone;
+    next_seq_ += kStreamSlots;
+    head_seq_.store(next_seq_, std::memory_order_release);
+
+    generation_++;
+    const Layout lay = {generation_, next_seq_, chunks, first_take};
+    layout_.Write(lay);
+}
+
+void DiskStream::Restart()
+{
+    first_take_   = true;
+    pinned_clean_ = 0;
+    in_pinned_.store(true, std::memory_order_relaxed);
+    NewLayout(0, true);
+}
+
+void DiskStream::CloseTake(size_t length)
+{
+    const size_t total = (length + kStreamChunkSize - 1) / kStreamChunkSize;
+    first_take_        = false;
+    NewLayout(total > kStreamPinnedChunks ? total - kStreamPinnedChunks : 0,
+              false);
+}
+
+loop_sample_t *DiskStream::Map(size_t pos, size_t n, bool record)
+{
+    head_pos_.store(static_cast<uint32_t>(pos), std::memory_order_relaxed);
+
+    const size_t chunk = pos / kStreamChunkSize;
+    if(chunk < kStreamPinnedChunks)
+    {
+        if(cur_chunk_ != kNone)
+        {
+            // Wrapped: the last streamed chunk is released too
+            cur_chunk_ = kNone;
+            head_seq_.store(next_seq_, std::memory_order_release);
+        }
+        in_pinned_.store(true, std::memory_order_relaxed);
+
+        // First take: the old loop is zeroed as the head gets to it
+        if(first_take_ && pos + n > pinned_clean_)
+        {
+            memset(mem_->pinned + pinned_clean_,
+                   0,
+                   (pos + n - pinned_clean_) * sizeof(loop_sample_t));
+            pinned_clean_ = pos + n;
+        }
+        if(record)
+            pinned_dirty_.store(true, std::memory_order_relaxed);
+        return mem_->pinned + pos;
+    }
+
+    in_pinned_.store(false, std::memory_order_relaxed);
+    if(chunk != cur_chunk_)
+    {
+        cur_chunk_ = chunk;
+        cur_seq_   = next_seq_++;
+        head_seq_.store(cur_seq_, std::memory_order_release);
+    }
+
+    const size_t slot = cur_seq_ % kStreamSlots;
+    if(ready_seq_[slot].load(std::memory_order_acquire) != cur_seq_)
+    {
+        if(starved_seq_ != cur_seq_)
+        {
+            starved_seq_ = cur_seq_;
+            underruns_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return nullptr;
+    }
+
+    if(record)
+        dirty_[slot].store(true, std::memory_order_relaxed);
+    return mem_->ring + slot * kStreamChunkSize + (pos - chunk * kStreamChunkSize);
+}
+
+// -----------------------------------------------------------------------------
+// Main loop side
+// -----------------------------------------------------------------------------
+size_t DiskStream::ChunkOf(uint32_t seq) const
+{
+    const uint32_t k = seq - main_layout_.base;
+    return kStreamPinnedChunks
+           + (main_layout_.first_take ? k : k % main_layout_.chunks);
+}
+
+bool DiskStream::Service()
+{
+    if(!open_)
+        return false;
+
+    // One access, or as many as it takes to get the lead back
+    bool did = false;
+    for(size_t i = 0; i < kStreamSlots && Step(); i++)
+    {
+        did = true;
+        if(stats_.lead >= kUrgentLead)
+            break;
+    }
+    return did;
+}
+
+bool DiskStream::Step()
+{
+    const Layout   lay  = layout_.Read();
+    const uint32_t head = head_seq_.load(std::memory_order_acquire);
+
+    // Write-behind first: released chunks, oldest first. A slot is only
+    // refilled once what it held is back on the card.
+    while(flushed_ != filled_ && Before(flushed_, head))
+    {
+        const uint32_t seq = flushed_++;
+        if(dirty_[seq % kStreamSlots].exchange(false, std::memory_order_relaxed))
+        {
+            WriteSlot(seq);
+            return true;
+        }
+    }
+
+    // Switch layouts once the old one is written back
+    if(lay.generation != main_layout_.generation)
+    {
+        main_layout_ = lay;
+        filled_      = lay.base;
+        flushed_     = lay.base;
+    }
+
+    // The head overtook the read-ahead (underrun): skip to where it is
+    if(Before(filled_, head))
+    {
+        filled_  = head;
+        flushed_ = head;
+    }
+
+    UpdateLead(head);
+
+    // Read-ahead, never more than one pass of the loop
+    uint32_t depth = kStreamSlots;
+    if(!main_layout_.first_take && main_layout_.chunks < depth)
+        depth = main_layout_.chunks;
+    if(Before(filled_, head + depth))
+    {
+        ReadSlot(filled_++);
+        return true;
+    }
+
+    // Idle: the pinned start, while the head is away from it
+    if(!in_pinned_.load(std::memory_order_relaxed)
+       && pinned_dirty_.exchange(false, std::memory_order_relaxed))
+    {
+        WritePinned();
+        return true;
+    }
+    return false;
+}
+
+void DiskStream::UpdateLead(uint32_t head)
+{
+    if(!main_layout_.first_take && main_layout_.chunks == 0)
+    {
+        stats_.lead = UINT32_MAX; // the whole loop is pinned
+        return;
+    }
+
+    const uint32_t pos   = head_pos_.load(std::memory_order_relaxed);
+    const int32_t  ahead = static_cast<int32_t>(filled_ - head);
+    int64_t        lead  = static_cast<int64_t>(ahead) * kStreamChunkSize;
+    if(in_pinned_.load(std::memory_order_relaxed))
+        lead += kStreamPinnedChunks * kStreamChunkSize - pos;
+    else
+        lead -= pos % kStreamChunkSize;
+    stats_.lead = lead > 0 ? static_cast<uint32_t>(lead) : 0;
+
+    // Only counts while the head moves (not while stopped)
+    if(pos != last_head_pos_ && stats_.lead < stats_.lead_min)
+        stats_.lead_min = stats_.lead;
+    last_head_pos_ = pos;
+}
+
+bool DiskStream::ReadSlot(uint32_t seq)
+{
+    const size_t   slot  = seq % kStreamSlots;
+    const size_t   chunk = ChunkOf(seq);
+    loop_sample_t *dst   = mem_->ring + slot * kStreamChunkSize;
+
+    bool ok = true;
+    if(main_layout_.first_take || chunk * kStreamChunkSize >= capacity_)
+    {
+        memset(dst, 0, kStreamChunkSize * sizeof(loop_sample_t));
+    }
+    else if(!(ok = Transfer(chunk, false, dst, kStreamChunkSize)))
+    {
+        memset(dst, 0, kStreamChunkSize * sizeof(loop_sample_t));
+    }
+
+    slot_chunk_[slot] = chunk;
+    dirty_[slot].store(false, std::memory_order_relaxed);
+    ready_seq_[slot].store(seq, std::memory_order_release);
+    return ok;
+}
+
+bool DiskStream::WriteSlot(uint32_t seq)
+{
+    const size_t slot  = seq % kStreamSlots;
+    const size_t chunk = slot_chunk_[slot];
+    if(chunk * kStreamChunkSize >= capacity_)
+        return true;
+    return Transfer(chunk,
+                    true,
+                    mem_->ring + slot * kStreamChunkSize,
+                    kStreamChunkSize);
+}
+
+bool DiskStream::WritePinned()
+{
+    bool ok = true;
+    for(size_t c = 0; c < kStreamPinnedChunks; c++)
+        ok = Transfer(c, true, mem_->pinned + c * kStreamChunkSize, kStreamChunkSize)
+             && ok;
+    return ok;
+}
+
+bool DiskStream::Flush()
+{
+    if(!open_)
+        return false;
+
+    bool ok = true;
+    for(uint32_t seq = flushed_; seq != filled_; seq++)
+        if(dirty_[seq % kStreamSlots].exchange(false, std::memory_order_relaxed))
+            ok = WriteSlot(seq) && ok;
+    if(pinned_dirty_.exchange(false, std::memory_order_relaxed))
+        ok = WritePinned() && ok;
+    return f_sync(&file_) == FR_OK && ok;
+}
+
+bool DiskStream::Transfer(size_t chunk, bool write, loop_sample_t *mem, size_t n)
+{
+    const FSIZE_t  offset = static_cast<FSIZE_t>(chunk) * kStreamChunkSize
+                           * sizeof(int16_t);
+    const UINT     bytes  = n * sizeof(int16_t);
+    const uint32_t t0     = ProfileTicks();
+
+    UINT done = 0;
+    bool ok   = f_tell(&file_) == offset || f_lseek(&file_, offset) == FR_OK;
+    if(ok && write)
+    {
+        LoopSample::ToS16(staging_, mem, n);
+        ok = f_write(&file_, staging_, bytes, &done) == FR_OK && done == bytes;
+    }
+    else if(ok)
+    {
+        ok = f_read(&file_, staging_, bytes, &done) == FR_OK && done == bytes;
+        if(ok)
+            LoopSample::FromS16(mem, staging_, n);
+    }
+
+    const uint32_t us = (ProfileTicks() - t0) / ProfileTicksPerUs();
+    if(write)
+    {
+        stats_.writes++;
+        if(us > stats_.write_us_max)
+            stats_.write_us_max = us;
+    }
+    else
+    {
+        stats_.reads++;
+        if(us > stats_.read_us_max)
+            stats_.read_us_max = us;
+    }
+    if(!ok)
+        stats_.errors++;
+    return ok;
+}
+
+DiskStream::Stats DiskStream::GetStats() const
+{
+    Stats st     = stats_;
+    st.underruns = underruns_.load(std::memory_order_relaxed);
+    return st;
+}
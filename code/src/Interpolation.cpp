@@ -0,0 +1,111 @@
+#include "Interpolation.h"
+
+constexpr SincTable kSincTable = MakeSincTable();
+
+// Checked by the compiler, so the table really is a compile-time constant
+static_assert(kSincTable.c[0][kInterpBefore] == 1.0f && kSincTable.c[0][0] == 0.0f,
+              "whole frames are read as they are");
+static_assert(kSincTable.c[kSincPhases][kInterpBefore + 1] == 1.0f,
+              "the last phase is the next frame");
+static_assert(kSincTable.c[kSincPhases / 2][kInterpBefore]
+                  == kSincTable.c[kSincPhases / 2][kInterpBefore + 1],
+              "half way is symmetric");
+
+namespace
+{
+// Fixed-point head to (window frame, fraction). Positions never go below
+// kInterpBefore, so the shift is on a positive value.
+inline size_t Frame(uint32_t at)
+{
+    return at >> kInterpFracBits;
+}
+
+inline float Fraction(uint32_t at)
+{
+    return static_cast<float>(at & kInterpFracMask) * (1.0f / kInterpOne);
+}
+
+template <size_t kCh>
+void Linear(float *out, const float *win, uint32_t at, int32_t step, size_t n)
+{
+    for(size_t i = 0; i < n; i++, at += step)
+    {
+        const float *x = win + Frame(at) * kCh;
+        const float  f = Fraction(at);
+        for(size_t c = 0; c < kCh; c++)
+            out[i * kCh + c] = x[c] + (x[kCh + c] - x[c]) * f;
+    }
+}
+
+template <size_t kCh>
+void Hermite(float *out, const float *win, uint32_t at, int32_t step, size_t n)
+{
+    for(size_t i = 0; i < n; i++, at += step)
+    {
+        const float *x = win + (Frame(at) - 1) * kCh;
+        const float  f = Fraction(at);
+        for(size_t c = 0; c < kCh; c++)
+        {
+            const float xm1 = x[c];
+            const float x0  = x[c + kCh];
+            const float x1  = x[c + 2 * kCh];
+            const float x2  = x[c + 3 * kCh];
+            const float c1  = 0.5f * (x1 - xm1);
+            const float c2  = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+            const float c3  = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+            out[i * kCh + c] = ((c3 * f + c2) * f + c1) * f + x0;
+        }
+    }
+}
+
+template <size_t kCh>
+void Sinc(float *out, const float *win, uint32_t at, int32_t step, size_t n)
+{
+    // Between the two nearest of the table's phases, linearly
+    constexpr int   shift = kInterpFracBits - kSincPhaseBits;
+    constexpr float scale = 1.0f / (1 << shift);
+    for(size_t i = 0; i < n; i++, at += step)
+    {
+        const float   *x  = win + (Frame(at) - kInterpBefore) * kCh;
+        const uint32_t p  = (at & kInterpFracMask) >> shift;
+        const float    pf = static_cast<float>(at & ((1u << shift) - 1)) * scale;
+        const float   *h0 = kSincTable.c[p];
+        const float   *h1 = kSincTable.c[p + 1];
+        float          h[kSincTaps];
+        for(size_t k = 0; k < kSincTaps; k++)
+            h[k] = h0[k] + (h1[k] - h0[k]) * pf;
+        for(size_t c = 0; c < kCh; c++)
+        {
+            float acc = 0.0f;
+            for(size_t k = 0; k < kSincTaps; k++)
+                acc += x[k * kCh + c] * h[k];
+            out[i * kCh + c] = acc;
+        }
+    }
+}
+
+template <size_t kCh>
+void Run(Interp kind, float *out, const float *win, uint32_t at, int32_t step, size_t n)
+{
+    switch(kind)
+    {
+        case Interp::LINEAR: Linear<kCh>(out, win, at, step, n); break;
+        case Interp::HERMITE: Hermite<kCh>(out, win, at, step, n); break;
+        case Interp::SINC: Sinc<kCh>(out, win, at, step, n); break;
+    }
+}
+} // namespace
+
+void Interpolate(Interp       kind,
+                 float       *out,
+                 const float *win,
+                 uint32_t     phase,
+                 int32_t      step,
+                 size_t       n,
+                 size_t       channels)
+{
+    if(channels == 2)
+        Run<2>(kind, out, win, phase, step, n);
+    else
+        Run<1>(kind, out, win, phase, step, n);
+}
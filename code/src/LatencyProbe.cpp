@@ -0,0 +1,55 @@
+#include "LatencyProbe.h"
+#include <cmath>
+
+void LatencyProbe::Start()
+{
+    ping_   = 0;
+    t_      = 0;
+    heard_  = false;
+    got_    = 0;
+    result_ = -1;
+    active_ = true;
+}
+
+void LatencyProbe::Process(const float *in, float *out, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        if(!active_)
+        {
+            out[i] = 0.0f;
+            continue;
+        }
+        out[i] = t_ < kClick ? kLevel : 0.0f;
+        if(!heard_ && fabsf(in[i]) > kThreshold)
+        {
+            times_[got_++] = static_cast<uint32_t>(t_);
+            heard_         = true;
+        }
+        if(++t_ == kInterval)
+        {
+            t_     = 0;
+            heard_ = false;
+            if(++ping_ == kPings)
+                Finish();
+        }
+    }
+}
+
+void LatencyProbe::Finish()
+{
+    active_ = false;
+    if(got_ * 2 < kPings)
+        return;
+
+    // Median: a stray noise or a missed edge doesn't move it
+    for(size_t i = 1; i < got_; i++)
+    {
+        const uint32_t v = times_[i];
+        size_t         j = i;
+        for(; j > 0 && times_[j - 1] > v; j--)
+            times_[j] = times_[j - 1];
+        times_[j] = v;
+    }
+    result_ = static_cast<int32_t>(times_[got_ / 2]);
+}
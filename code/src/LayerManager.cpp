@@ -0,0 +1,281 @@
+#include "LayerManager.h"
+#include <cstring>
+#include "SessionJournal.h"
+#include "WaveOverview.h"
+
+void LayerManager::Init(loop_sample_t  *loop,
+                        size_t          loop_size,
+                        loop_sample_t  *pool,
+                        uint32_t       *slot_region,
+                        size_t          pool_slots,
+                        uint16_t       *region_stamp,
+                        uint32_t       *region_slot,
+                        size_t          regions,
+                        WaveOverview   *overview,
+                        SessionJournal *journal)
+{
+    loop_         = loop;
+    loop_size_    = loop_size;
+    pool_         = pool;
+    slot_region_  = slot_region;
+    slots_        = pool_slots;
+    region_stamp_ = region_stamp;
+    region_slot_  = region_slot;
+    regions_      = regions;
+    overview_     = overview;
+    journal_      = journal;
+    dropped_      = 0;
+    busy_         = false;
+    serial_       = 0;
+
+    for(size_t r = 0; r < regions_; r++)
+        region_slot_[r] = kNoSlot;
+    memset(region_stamp_, 0, regions_ * sizeof(uint16_t));
+
+    Clear();
+}
+
+void LayerManager::Clear()
+{
+    if(busy_)
+    {
+        for(uint32_t i = 0; i < op_layer_.count; i++)
+            region_slot_[slot_region_[(op_layer_.first_slot + i) % slots_]]
+                = kNoSlot;
+    }
+    busy_     = false;
+    open_     = false;
+    overflow_ = false;
+    head_     = 0;
+    used_     = 0;
+    base_     = 0;
+    top_      = 0;
+    total_    = 0;
+    // serial_ keeps counting, so old stamps can't match a new layer and
+    // the stamp table needn't be wiped here (Clear() runs in the callback).
+}
+
+size_t LayerManager::RegionLength(size_t region) const
+{
+    const size_t start = region * kLayerRegionSize;
+    return (loop_size_ - start) < kLayerRegionSize ? (loop_size_ - start)
+                                                   : kLayerRegionSize;
+}
+
+void LayerManager::DropOldest()
+{
+    Layer &l = LayerAt(0);
+    head_    = (head_ + l.count) % slots_;
+    used_ -= l.count;
+    base_ = (base_ + 1) % kMaxLayers;
+    top_--;
+    total_--;
+}
+
+// -----------------------------------------------------------------------------
+// Recording a pass
+// -----------------------------------------------------------------------------
+void LayerManager::OpenLayer()
+{
+    if(open_ || busy_)
+        return;
+
+    // A new pass invalidates everything that could be redone
+    while(total_ > top_)
+    {
+        used_ -= LayerAt(total_ - 1).count;
+        total_--;
+    }
+    if(total_ == kMaxLayers)
+        DropOldest();
+
+    // Stamps identify "captured by this layer"; on wrap start over.
+    if(++serial_ == 0)
+    {
+        memset(region_stamp_, 0, regions_ * sizeof(uint16_t));
+        serial_ = 1;
+    }
+
+    Layer &l     = LayerAt(total_);
+    l.first_slot = (head_ + used_) % slots_;
+    l.count      = 0;
+    top_++;
+    total_++;
+    overflow_ = false;
+    open_     = true;
+}
+
+void LayerManager::CloseLayer()
+{
+    if(!open_)
+        return;
+    open_ = false;
+
+    Layer &l = LayerAt(top_ - 1);
+    if(overflow_ || l.count == 0)
+    {
+        // Partial layers can't be undone correctly; discard them.
+        if(overflow_)
+            dropped_++;
+        used_ -= l.count;
+        top_--;
+        total_--;
+    }
+}
+
+void LayerManager::Capture(size_t pos, size_t n)
+{
+    if(!open_ || overflow_ || n == 0)
+        return;
+
+    const size_t last = (pos + n - 1) / kLayerRegionSize;
+    for(size_t r = pos / kLayerRegionSize; r <= last; r++)
+    {
+        if(region_stamp_[r] == serial_)
+            continue;
+
+        if(used_ == slots_)
+        {
+            if(total_ > 1)
+            {
+                DropOldest();
+            }
+            else
+            {
+                overflow_ = true;
+                return;
+            }
+        }
+
+        Layer       &l    = LayerAt(top_ - 1);
+        const size_t slot = (head_ + used_) % slots_;
+        memcpy(pool_ + slot * kLayerRegionSize,
+               loop_ + r * kLayerRegionSize,
+               RegionLength(r) * sizeof(loop_sample_t));
+        slot_region_[slot] = r;
+        region_stamp_[r]   = serial_;
+        l.count++;
+        used_++;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Undo / redo
+// -----------------------------------------------------------------------------
+bool LayerManager::RequestUndo()
+{
+    if(busy_ || open_ || top_ == 0)
+        return false;
+    op_undo_ = true;
+    return StartOp(top_ - 1);
+}
+
+bool LayerManager::RequestRedo()
+{
+    if(busy_ || open_ || top_ == total_)
+        return false;
+    op_undo_ = false;
+    return StartOp(top_);
+}
+
+bool LayerManager::StartOp(size_t layer_index)
+{
+    op_layer_  = LayerAt(layer_index);
+    op_cursor_ = 0;
+    for(uint32_t i = 0; i < op_layer_.count; i++)
+    {
+        const uint32_t slot             = (op_layer_.first_slot + i) % slots_;
+        region_slot_[slot_region_[slot]] = slot;
+    }
+    // Publish last: from the next audio block on, reads are redirected.
+    busy_ = true;
+    return true;
+}
+
+void LayerManager::Service(size_t budget)
+{
+    if(!busy_)
+        return;
+
+    const size_t total = op_layer_.count * kLayerRegionSize;
+    while(budget > 0 && op_cursor_ < total)
+    {
+        const size_t   idx  = op_cursor_ / kLayerRegionSize;
+        const size_t   off  = op_cursor_ % kLayerRegionSize;
+        const uint32_t slot = (op_layer_.first_slot + idx) % slots_;
+        const uint32_t r    = slot_region_[slot];
+        const size_t   rlen = RegionLength(r);
+
+        size_t n = kLayerRegionSize - off;
+        if(n > budget)
+            n = budget;
+        if(off < rlen)
+        {
+            const size_t cnt = (off + n > rlen) ? rlen - off : n;
+            loop_sample_t *a   = pool_ + slot * kLayerRegionSize + off;
+            loop_sample_t *b   = loop_ + r * kLayerRegionSize + off;
+            for(size_t i = 0; i < cnt; i++)
+            {
+                const loop_sample_t t = a[i];
+                a[i]                  = b[i];
+                b[i]                  = t;
+            }
+        }
+        op_cursor_ += n;
+        budget -= n;
+        if(off + n == kLayerRegionSize)
+        {
+            region_slot_[r] = kNoSlot;
+            if(overview_)
+                overview_->Refresh(r * kLayerRegionSize, rlen);
+            if(journal_)
+                journal_->Touch(r * kLayerRegionSize, rlen);
+        }
+    }
+
+    if(op_cursor_ >= total)
+    {
+        if(op_undo_)
+            top_--;
+        else
+            top_++;
+        busy_ = false;
+    }
+}
+
+const loop_sample_t *LayerManager::Resolve(size_t pos, size_t &n) const
+{
+    const size_t   r    = pos / kLayerRegionSize;
+    const size_t   off  = pos % kLayerRegionSize;
+    const uint32_t slot = region_slot_[r];
+
+    size_t room = kLayerRegionSize - off;
+    if(slot != kNoSlot)
+    {
+        // Part of the current region may already be swapped.
+        const size_t ord  = (slot + slots_ - op_layer_.first_slot) % slots_;
+        const size_t cur  = op_cursor_ / kLayerRegionSize;
+        const size_t done = op_cursor_ % kLayerRegionSize;
+        if(ord != cur || off >= done)
+        {
+            if(n > room)
+                n = room;
+            return pool_ + slot * kLayerRegionSize + off;
+        }
+        room = done - off;
+    }
+    if(n > room)
+        n = room;
+    return loop_ + pos;
+}
+
+LayerManager::Stats LayerManager::GetStats() const
+{
+    Stats s;
+    s.undoable       = top_;
+    s.redoable       = total_ - top_;
+    s.used_bytes     = used_ * kLayerRegionSize * sizeof(loop_sample_t);
+    s.capacity_bytes = slots_ * kLayerRegionSize * sizeof(loop_sample_t);
+    s.dropped        = dropped_;
+    return s;
+}
@@ -0,0 +1,304 @@
+#include "LoopCatalog.h"
+#include <cstdio>
+#include <cstring>
+#include "LoopCodec.h"
+
+namespace
+{
+const char *kCatalogFile = "LOOPS.CAT";
+const char *kCatalogTemp = "LOOPS.TMP";
+
+inline char Upper(char c)
+{
+    return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+}
+
+// "LOOP12.lpk" has extension "LPK"
+bool HasExt(const char *name, const char *ext)
+{
+    const char *dot = strrchr(name, '.');
+    if(dot == nullptr || strlen(dot + 1) != strlen(ext))
+        return false;
+    for(size_t i = 0; ext[i]; i++)
+        if(Upper(dot[1 + i]) != ext[i])
+            return false;
+    return true;
+}
+
+// n of "LOOPn.*", 0 for anything else
+uint32_t LoopId(const char *name)
+{
+    for(size_t i = 0; i < 4; i++)
+        if(Upper(name[i]) != "LOOP"[i])
+            return 0;
+    uint32_t id = 0;
+    const char *p = name + 4;
+    for(; *p >= '0' && *p <= '9'; p++)
+        id = id * 10 + (*p - '0');
+    return *p == '.' ? id : 0;
+}
+} // namespace
+
+bool LoopCatalog::Open(WavProbe probe, uint32_t bin_rate)
+{
+    probe_    = probe;
+    bin_rate_ = bin_rate;
+    open_     = false;
+    return OpenFile() || Rescan();
+}
+
+bool LoopCatalog::OpenFile()
+{
+    page_count_ = 0;
+    if(f_open(&file_, kCatalogFile, FA_READ | FA_WRITE) != FR_OK)
+        return false;
+
+    // A count past the end of the file means the header got written but
+    // not the directory entry: scan instead of trusting it
+    UINT n;
+    if(f_read(&file_, &hdr_, sizeof(hdr_), &n) == FR_OK && n == sizeof(hdr_)
+       && hdr_.magic == kMagic && Offset(hdr_.count) <= f_size(&file_))
+    {
+        open_ = true;
+        return true;
+    }
+    f_close(&file_);
+    return false;
+}
+
+bool LoopCatalog::Rescan()
+{
+    if(!BeginRescan())
+        return false;
+    Scan st;
+    while((st = StepRescan()) == Scan::RUNNING) {}
+    return st == Scan::DONE;
+}
+
+bool LoopCatalog::BeginRescan()
+{
+    // The new catalog is written next to the old one, which is kept open
+    // to look up what a scan can't see (peak, thumbnail)
+    old_count_  = open_ ? hdr_.count : 0;
+    old_cursor_ = 0;
+
+    memset(&scan_hdr_, 0, sizeof(scan_hdr_));
+    scan_hdr_.magic   = kMagic;
+    scan_hdr_.next_id = open_ ? hdr_.next_id : 1;
+    scan_fill_        = 0;
+
+    if(f_open(&scan_out_, kCatalogTemp, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return false;
+
+    // If this fails, the first step finishes the scan (and drops the file)
+    dir_open_ = f_lseek(&scan_out_, Offset(0)) == FR_OK
+                && f_opendir(&scan_dir_, "/") == FR_OK;
+    scan_ok_  = dir_open_;
+    scanning_ = true;
+    return true;
+}
+
+LoopCatalog::Scan LoopCatalog::StepRescan()
+{
+    if(!scanning_)
+        return Scan::FAILED;
+
+    FILINFO fno;
+    if(scan_ok_ && f_readdir(&scan_dir_, &fno) == FR_OK && fno.fname[0])
+    {
+        LoopCatalogEntry &e = batch_[scan_fill_];
+        if((fno.fattrib & AM_DIR) || !Describe(fno, &e))
+            return Scan::RUNNING;
+        FindOld(&e);
+        if(e.id >= scan_hdr_.next_id)
+            scan_hdr_.next_id = e.id + 1;
+
+        // Whole pages at sector-aligned offsets
+        if(++scan_fill_ == kPageEntries)
+        {
+            UINT bw;
+            scan_ok_ = f_write(&scan_out_, batch_, sizeof(batch_), &bw) == FR_OK
+                       && bw == sizeof(batch_);
+            scan_hdr_.count += scan_fill_;
+            scan_fill_ = 0;
+        }
+        return Scan::RUNNING;
+    }
+    return EndRescan() ? Scan::DONE : Scan::FAILED;
+}
+
+bool LoopCatalog::EndRescan()
+{
+    scanning_ = false;
+    if(dir_open_)
+        f_closedir(&scan_dir_);
+    dir_open_ = false;
+
+    UINT       bw;
+    bool       ok   = scan_ok_;
+    const UINT rest = scan_fill_ * sizeof(LoopCatalogEntry);
+    ok = ok && f_write(&scan_out_, batch_, rest, &bw) == FR_OK && bw == rest;
+    scan_hdr_.count += scan_fill_;
+    ok = ok && WriteHeader(&scan_out_, scan_hdr_);
+    ok = f_close(&scan_out_) == FR_OK && ok;
+
+    if(open_)
+        f_close(&file_);
+    open_ = false;
+    if(!ok)
+    {
+        f_unlink(kCatalogTemp);
+        return OpenFile(); // the old one, if it's still there
+    }
+    f_unlink(kCatalogFile);
+    return f_rename(kCatalogTemp, kCatalogFile) == FR_OK && OpenFile();
+}
+
+bool LoopCatalog::Read(size_t index, LoopCatalogEntry *e)
+{
+    if(index >= Count())
+        return false;
+    const LoopCatalogEntry *r = Record(hdr_.count - 1 - index);
+    if(r == nullptr)
+        return false;
+    *e = *r;
+    return true;
+}
+
+const LoopCatalogEntry *LoopCatalog::Record(size_t record)
+{
+    if(record < page_first_ || record >= page_first_ + page_count_)
+    {
+        const size_t first = record / kPageEntries * kPageEntries;
+        size_t       n     = hdr_.count - first;
+        if(n > kPageEntries)
+            n = kPageEntries;
+        const UINT bytes = n * sizeof(LoopCatalogEntry);
+        UINT       br;
+        page_count_ = 0;
+        if(f_lseek(&file_, Offset(first)) != FR_OK
+           || f_read(&file_, page_, bytes, &br) != FR_OK || br != bytes)
+            return nullptr;
+        page_first_ = first;
+        page_count_ = n;
+    }
+    return &page_[record - page_first_];
+}
+
+bool LoopCatalog::NewName(uint32_t *id, char *pack_name, char *wav_name)
+{
+    if(!open_)
+        return false;
+
+    // The counter survives reboots; the check catches files that came
+    // from elsewhere (or a catalog restored from an older copy)
+    for(uint32_t n = hdr_.next_id; n <= kMaxId; n++)
+    {
+        FILINFO fno;
+        snprintf(pack_name, 16, "LOOP%u.LPK", static_cast<unsigned>(n));
+        snprintf(wav_name, 16, "LOOP%u.WAV", static_cast<unsigned>(n));
+        if(f_stat(pack_name, &fno) == FR_OK || f_stat(wav_name, &fno) == FR_OK)
+            continue;
+        *id = n;
+        return true;
+    }
+    return false;
+}
+
+bool LoopCatalog::Add(const LoopCatalogEntry &e)
+{
+    if(!open_)
+        return false;
+
+    // Record first, header after: until the header is written the record
+    // is just past the end of the list
+    UINT bw;
+    if(f_lseek(&file_, Offset(hdr_.count)) != FR_OK
+       || f_write(&file_, &e, sizeof(e), &bw) != FR_OK || bw != sizeof(e))
+        return false;
+
+    Header hdr = hdr_;
+    hdr.count++;
+    if(e.id >= hdr.next_id)
+        hdr.next_id = e.id + 1;
+    if(!WriteHeader(&file_, hdr) || f_sync(&file_) != FR_OK)
+        return false;
+    hdr_        = hdr;
+    page_count_ = 0; // the last page grew
+    return true;
+}
+
+bool LoopCatalog::Describe(const FILINFO &fno, LoopCatalogEntry *e) const
+{
+    const bool pack = HasExt(fno.fname, "LPK");
+    const bool wav  = HasExt(fno.fname, "WAV");
+    const bool bin  = HasExt(fno.fname, "BIN");
+    if(!(pack || wav || bin) || strlen(fno.fname) >= sizeof(e->name))
+        return false;
+
+    memset(e, 0, sizeof(*e));
+    snprintf(e->name, sizeof(e->name), "%s", fno.fname);
+    e->id   = LoopId(fno.fname);
+    e->peak = kCatalogNoPeak;
+
+    if(pack)
+    {
+        FIL            f;
+        LoopFileHeader hdr;
+        UINT           br;
+        if(f_open(&f, fno.fname, FA_READ) != FR_OK)
+            return false;
+        // The fields needed here are in the LPK1 header too
+        const bool ok = f_read(&f, &hdr, kLoopFileHeaderV1, &br) == FR_OK
+                        && br == kLoopFileHeaderV1
+                        && (hdr.magic == kLoopFileMagic || hdr.magic == kLoopFileMagicV1);
+        f_close(&f);
+        e->length      = hdr.length;
+        e->sample_rate = hdr.sample_rate;
+        return ok;
+    }
+
+    // A WAV or BIN next to an .LPK of the same name is its export (or the
+    // older format of the same loop): list the loop once
+    char        pack_name[sizeof(e->name)];
+    const char *dot = strrchr(fno.fname, '.');
+    FILINFO     other;
+    snprintf(pack_name, sizeof(pack_name), "%.*s.LPK", (int)(dot - fno.fname), fno.fname);
+    if(f_stat(pack_name, &other) == FR_OK)
+        return false;
+
+    if(bin)
+    {
+        e->length      = fno.fsize / sizeof(int16_t);
+        e->sample_rate = bin_rate_;
+        return true;
+    }
+    return probe_ != nullptr && probe_(fno.fname, &e->sample_rate, &e->length);
+}
+
+void LoopCatalog::FindOld(LoopCatalogEntry *e)
+{
+    // Both lists are in directory order, so the match is usually the very
+    // next record; a full lap means the loop is new
+    for(size_t k = 0; k < old_count_; k++)
+    {
+        const size_t            r   = (old_cursor_ + k) % old_count_;
+        const LoopCatalogEntry *old = Record(r);
+        if(old == nullptr)
+            return;
+        if(strcmp(old->name, e->name) == 0)
+        {
+            e->peak = old->peak;
+            memcpy(e->thumb, old->thumb, sizeof(e->thumb));
+            old_cursor_ = r + 1;
+            return;
+        }
+    }
+}
+
+bool LoopCatalog::WriteHeader(FIL *f, const Header &hdr)
+{
+    UINT bw;
+    return f_lseek(f, 0) == FR_OK && f_write(f, &hdr, sizeof(hdr), &bw) == FR_OK
+           && bw == sizeof(hdr);
+}
@@ -0,0 +1,414 @@
+#include "LoopCodec.h"
+#include <cstring>
+
+namespace
+{
+constexpr int      kMaxOrder = 4;
+constexpr uint32_t kMaxRice  = 24; // zigzag residuals are at most 21 bits
+constexpr int      kRiceBits = 5;
+
+static_assert(kCodecFrameSize <= 0xFFFF, "count is 16 bits");
+static_assert(sizeof(LoopFrameHeader) == 16, "frame header layout");
+
+inline uint32_t ZigZag(int32_t e)
+{
+    return (static_cast<uint32_t>(e) << 1) ^ static_cast<uint32_t>(e >> 31);
+}
+
+inline int32_t UnZigZag(uint32_t u)
+{
+    return static_cast<int32_t>(u >> 1) ^ -static_cast<int32_t>(u & 1);
+}
+
+// Residual of x[i] under the fixed predictor of 'order' (i >= order)
+inline int32_t Residual(const int16_t *x, size_t i, int order)
+{
+    switch(order)
+    {
+        case 0: return x[i];
+        case 1: return x[i] - x[i - 1];
+        case 2: return x[i] - 2 * x[i - 1] + x[i - 2];
+        case 3: return x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+        default:
+            return x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+    }
+}
+
+// Prediction of x[i] from the samples before it (i >= order)
+inline int32_t Predict(const int16_t *x, size_t i, int order)
+{
+    switch(order)
+    {
+        case 0: return 0;
+        case 1: return x[i - 1];
+        case 2: return 2 * x[i - 1] - x[i - 2];
+        case 3: return 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+        default:
+            return 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4];
+    }
+}
+
+// The predictor with the smallest total |residual|. All five are the
+// running differences of the signal, so one pass computes them together.
+int ChooseOrder(const int16_t *x, size_t n)
+{
+    if(n <= static_cast<size_t>(kMaxOrder))
+        return 0;
+
+    uint64_t sum[kMaxOrder + 1] = {};
+    int32_t  d1 = x[3] - x[2];
+    int32_t  d2 = d1 - (x[2] - x[1]);
+    int32_t  d3 = d2 - ((x[2] - x[1]) - (x[1] - x[0]));
+    for(size_t i = kMaxOrder; i < n; i++)
+    {
+        const int32_t e0 = x[i];
+        const int32_t e1 = e0 - x[i - 1];
+        const int32_t e2 = e1 - d1;
+        const int32_t e3 = e2 - d2;
+        const int32_t e4 = e3 - d3;
+        sum[0] += e0 < 0 ? -e0 : e0;
+        sum[1] += e1 < 0 ? -e1 : e1;
+        sum[2] += e2 < 0 ? -e2 : e2;
+        sum[3] += e3 < 0 ? -e3 : e3;
+        sum[4] += e4 < 0 ? -e4 : e4;
+        d1 = e1;
+        d2 = e2;
+        d3 = e3;
+    }
+
+    int best = 0;
+    for(int o = 1; o <= kMaxOrder; o++)
+        if(sum[o] < sum[best])
+            best = o;
+    return best;
+}
+
+// Bits for a partition with Rice parameter k
+inline uint64_t RiceBits(const uint32_t *u, size_t n, uint32_t k)
+{
+    uint64_t bits = static_cast<uint64_t>(n) * (k + 1);
+    for(size_t i = 0; i < n; i++)
+        bits += u[i] >> k;
+    return bits;
+}
+
+// Best k for a partition: around log2 of the mean, checked exactly
+uint32_t ChooseRice(const uint32_t *u, size_t n, uint64_t *bits)
+{
+    uint64_t sum = 0;
+    for(size_t i = 0; i < n; i++)
+        sum += u[i];
+
+    uint32_t k = 0;
+    while(k < kMaxRice && (static_cast<uint64_t>(n) << (k + 1)) <= sum)
+        k++;
+
+    uint32_t best      = k;
+    uint64_t best_bits = RiceBits(u, n, k);
+    if(k > 0)
+    {
+        const uint64_t b = RiceBits(u, n, k - 1);
+        if(b < best_bits)
+        {
+            best      = k - 1;
+            best_bits = b;
+        }
+    }
+    if(k < kMaxRice)
+    {
+        const uint64_t b = RiceBits(u, n, k + 1);
+        if(b < best_bits)
+        {
+            best      = k + 1;
+            best_bits = b;
+        }
+    }
+    *bits = best_bits;
+    return best;
+}
+
+// MSB-first bit packing
+class BitWriter
+{
+  public:
+    explicit BitWriter(uint8_t *dst) : p_(dst), acc_(0), bits_(0) {}
+
+    // n <= 32
+    void Put(uint32_t v, int n)
+    {
+        acc_ = (acc_ << n) | (v & (n == 32 ? 0xFFFFFFFFu : (1u << n) - 1));
+        bits_ += n;
+        while(bits_ >= 8)
+        {
+            bits_ -= 8;
+            *p_++ = static_cast<uint8_t>(acc_ >> bits_);
+        }
+    }
+
+    void Rice(uint32_t u, uint32_t k)
+    {
+        uint32_t q = u >> k;
+        for(; q >= 32; q -= 32)
+            Put(0, 32);
+        Put(1, q + 1);
+        if(k)
+            Put(u, k);
+    }
+
+    uint8_t *Finish()
+    {
+        if(bits_)
+            Put(0, 8 - bits_);
+        return p_;
+    }
+
+  private:
+    uint8_t *p_;
+    uint64_t acc_;
+    int      bits_;
+};
+
+// MSB-first bit unpacking, never reading past 'end'
+class BitReader
+{
+  public:
+    BitReader(const uint8_t *src, const uint8_t *end)
+    : p_(src), end_(end), acc_(0), bits_(0), ok_(true)
+    {
+    }
+
+    inline bool Ok() const { return ok_; }
+
+    // n <= 32
+    uint32_t Get(int n)
+    {
+        if(n == 0)
+            return 0;
+        if(bits_ < n)
+        {
+            Refill();
+            if(bits_ < n)
+            {
+                ok_ = false;
+                return 0;
+            }
+        }
+        const uint32_t v = static_cast<uint32_t>(acc_ >> (64 - n));
+        acc_ <<= n;
+        bits_ -= n;
+        return v;
+    }
+
+    uint32_t Rice(uint32_t k)
+    {
+        // Leading zeros; bits below bits_ in acc_ are always zero
+        uint32_t q = 0;
+        while(true)
+        {
+            if(bits_ == 0)
+            {
+                Refill();
+                if(bits_ == 0 || q > (1u << 24))
+                {
+                    ok_ = false;
+                    return 0;
+                }
+            }
+            if(acc_ == 0)
+            {
+                q += bits_;
+                bits_ = 0;
+                continue;
+            }
+            const int z = __builtin_clzll(acc_);
+            q += z;
+            acc_ = z == 63 ? 0 : acc_ << (z + 1);
+            bits_ -= z + 1;
+            break;
+        }
+        return (q << k) | Get(k);
+    }
+
+  private:
+    void Refill()
+    {
+        while(bits_ <= 56 && p_ < end_)
+        {
+            acc_ |= static_cast<uint64_t>(*p_++) << (56 - bits_);
+            bits_ += 8;
+        }
+    }
+
+    const uint8_t *p_;
+    const uint8_t *end_;
+    uint64_t       acc_;
+    int            bits_;
+    bool           ok_;
+};
+
+// Stereo frames are coded left then right (see LoopCodec.h)
+int16_t planar[kCodecFrameSize];
+
+void Deinterleave(const int16_t *src, size_t n, int16_t *dst)
+{
+    const size_t half = n / 2;
+    for(size_t i = 0; i < half; i++)
+    {
+        dst[i]        = src[2 * i];
+        dst[half + i] = src[2 * i + 1];
+    }
+}
+
+void Interleave(const int16_t *src, size_t n, int16_t *dst)
+{
+    const size_t half = n / 2;
+    for(size_t i = 0; i < half; i++)
+    {
+        dst[2 * i]     = src[i];
+        dst[2 * i + 1] = src[half + i];
+    }
+}
+
+uint16_t Checksum(const int16_t *x, size_t n)
+{
+    uint16_t sum = 0;
+    for(size_t i = 0; i < n; i++)
+        sum += static_cast<uint16_t>(x[i]);
+    return sum;
+}
+// DecodeFrame() without the reordering of stereo frames
+bool DecodePlanar(const LoopFrameHeader &hdr, const uint8_t *payload, int16_t *dst)
+{
+    const size_t n = hdr.count;
+    if(hdr.order == kCodecVerbatim)
+    {
+        memcpy(dst, payload, n * sizeof(int16_t));
+        return Checksum(dst, n) == hdr.check;
+    }
+
+    const int order = hdr.order < n ? hdr.order : static_cast<int>(n);
+    BitReader br(payload, payload + hdr.bytes);
+    for(int i = 0; i < order; i++)
+        dst[i] = static_cast<int16_t>(br.Get(16));
+
+    for(size_t start = order; start < n && br.Ok();)
+    {
+        const size_t end = (start / kCodecPartition + 1) * kCodecPartition < n
+                               ? (start / kCodecPartition + 1) * kCodecPartition
+                               : n;
+        const uint32_t k = br.Get(kRiceBits);
+        if(k > kMaxRice)
+            return false;
+        for(size_t i = start; i < end; i++)
+        {
+            const int32_t x = Predict(dst, i, order) + UnZigZag(br.Rice(k));
+            if(x < -32768 || x > 32767)
+                return false;
+            dst[i] = static_cast<int16_t>(x);
+        }
+        start = end;
+    }
+    return br.Ok() && Checksum(dst, n) == hdr.check;
+}
+} // namespace
+
+namespace loop_codec
+{
+size_t EncodeFrame(const int16_t *src,
+                   size_t         n,
+                   uint32_t       position,
+                   uint8_t       *dst,
+                   size_t         channels)
+{
+    if(n > kCodecFrameSize)
+        n = kCodecFrameSize;
+
+    LoopFrameHeader hdr;
+    hdr.sync     = kLoopFrameSync;
+    hdr.channels = 0;
+    hdr.position = position;
+    hdr.count    = static_cast<uint16_t>(n);
+    hdr.check    = Checksum(src, n); // the same in either order
+    if(channels == 2 && n % 2 == 0)
+    {
+        Deinterleave(src, n, planar);
+        src          = planar;
+        hdr.channels = 2;
+    }
+
+    // Pick the parameters and add up the exact size before writing, so the
+    // output can't outgrow the verbatim frame it's checked against.
+    const int order = ChooseOrder(src, n);
+    const size_t parts = (n + kCodecPartition - 1) / kCodecPartition;
+    uint8_t      rice[kCodecFrameSize / kCodecPartition];
+    uint32_t     u[kCodecPartition];
+    uint64_t     bits = static_cast<uint64_t>(order) * 16;
+    for(size_t p = 0; p < parts; p++)
+    {
+        const size_t start = p == 0 ? order : p * kCodecPartition;
+        const size_t end
+            = (p + 1) * kCodecPartition < n ? (p + 1) * kCodecPartition : n;
+        for(size_t i = start; i < end; i++)
+            u[i - start] = ZigZag(Residual(src, i, order));
+        uint64_t part_bits;
+        rice[p] = static_cast<uint8_t>(ChooseRice(u, end - start, &part_bits));
+        bits += kRiceBits + part_bits;
+    }
+
+    uint8_t *payload = dst + sizeof(hdr);
+    if((bits + 7) / 8 >= n * sizeof(int16_t))
+    {
+        hdr.order = kCodecVerbatim;
+        hdr.bytes = n * sizeof(int16_t);
+        memcpy(payload, src, hdr.bytes);
+    }
+    else
+    {
+        BitWriter bw(payload);
+        for(int i = 0; i < order; i++)
+            bw.Put(static_cast<uint16_t>(src[i]), 16);
+        for(size_t p = 0; p < parts; p++)
+        {
+            const size_t start = p == 0 ? order : p * kCodecPartition;
+            const size_t end
+                = (p + 1) * kCodecPartition < n ? (p + 1) * kCodecPartition : n;
+            bw.Put(rice[p], kRiceBits);
+            for(size_t i = start; i < end; i++)
+                bw.Rice(ZigZag(Residual(src, i, order)), rice[p]);
+        }
+        hdr.order = static_cast<uint8_t>(order);
+        hdr.bytes = static_cast<uint32_t>(bw.Finish() - payload);
+    }
+
+    memcpy(dst, &hdr, sizeof(hdr));
+    return sizeof(hdr) + hdr.bytes;
+}
+
+bool ValidHeader(const LoopFrameHeader &hdr)
+{
+    if(hdr.sync != kLoopFrameSync || hdr.count == 0
+       || hdr.count > kCodecFrameSize || hdr.channels > 2
+       || (hdr.channels == 2 && hdr.count % 2 != 0))
+        return false;
+    if(hdr.order == kCodecVerbatim)
+        return hdr.bytes == hdr.count * sizeof(int16_t);
+    return hdr.order <= kMaxOrder
+           && hdr.bytes <= kCodecMaxFrameBytes - sizeof(LoopFrameHeader);
+}
+
+bool DecodeFrame(const LoopFrameHeader &hdr, const uint8_t *payload, int16_t *dst)
+{
+    if(!ValidHeader(hdr))
+        return false;
+
+    const size_t n = hdr.count;
+    if(hdr.channels == 2)
+    {
+        if(!DecodePlanar(hdr, payload, planar))
+            return false;
+        Interleave(planar, n, dst);
+        return true;
+    }
+    return DecodePlanar(hdr, payload, dst);
+}
+} // namespace loop_codec
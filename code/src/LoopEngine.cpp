@@ -0,0 +1,890 @@
+#include "LoopEngine.h"
+#include <cstring>
+#include "LoopKernels.h"
+#include "LayerManager.h"
+#include "SessionJournal.h"
+#include "SnapshotGuard.h"
+#if defined(LOOPER_SIM)
+#include "SimHal.h" // SimYield()
+#endif
+
+static_assert(LoopEngine::kTrackAlign % kLayerRegionSize == 0
+                  && LoopEngine::kTrackAlign % kSnapshotRegionSize == 0,
+              "track planes start on whole regions");
+static_assert(kMaxTracks <= loop_kernels::kMaxMixTracks, "MixTracksVec() takes them all");
+
+void LoopEngine::Init(loop_sample_t    *buffer,
+                      size_t            max_size,
+                      LayerManager     *layers,
+                      SnapshotGuard    *guard,
+                      CallbackProfiler *profiler,
+                      DiskStream       *stream,
+                      WaveOverview     *overview,
+                      SessionJournal   *journal)
+{
+    buf_          = buffer;
+    max_size_     = max_size;
+    layers_       = layers;
+    guard_        = guard;
+    overview_     = overview;
+    journal_      = journal;
+    profiler_     = profiler;
+    stream_       = stream;
+    ram_layers_   = layers;
+    ram_guard_    = guard;
+    ram_overview_ = overview;
+    ram_journal_  = journal;
+    cap_          = max_size;
+    ch_           = 1;
+    streaming_    = false;
+    loading_      = false;
+    load_stalls_  = 0;
+    loop_id_      = 0;
+    latency_      = 0;
+    late_punches_ = 0;
+    probed_       = -1;
+    armed_        = 1;
+    muted_        = 0;
+    for(size_t t = 0; t < kMaxTracks; t++)
+        level_[t] = 1.0f;
+    interp_ = Interp::HERMITE;
+    stretch_.Init(&LoopEngine::GatherFor, this);
+    loaded_.store(0, std::memory_order_relaxed);
+    clock_.store(0, std::memory_order_relaxed);
+    posted_   = 0;
+    applied_  = 0;
+    drywet_.store(0.0f, std::memory_order_relaxed);
+    commands_.Init();
+    DoReset();
+
+    LoopStatus st = {};
+    status_.Init(st);
+    Publish();
+}
+
+// -----------------------------------------------------------------------------
+// Commands (main loop side)
+// -----------------------------------------------------------------------------
+uint32_t LoopEngine::Post(Command command, uint32_t arg)
+{
+    Message msg = {command, false, arg, 0};
+    if(!commands_.Push(msg))
+        return 0;
+    return ++posted_;
+}
+
+uint32_t LoopEngine::PostAt(Command command, uint32_t stamp)
+{
+    Message msg = {command, true, 0, stamp + kPunchDelay};
+    if(!commands_.Push(msg))
+        return 0;
+    return ++posted_;
+}
+
+uint32_t LoopEngine::Reset()
+{
+    return Post(Command::RESET);
+}
+
+uint32_t LoopEngine::ToggleRecord()
+{
+    return Post(Command::TOGGLE_RECORD);
+}
+
+uint32_t LoopEngine::TogglePlay()
+{
+    return Post(Command::TOGGLE_PLAY);
+}
+
+uint32_t LoopEngine::ToggleRecordAt(uint32_t stamp)
+{
+    return PostAt(Command::TOGGLE_RECORD, stamp);
+}
+
+uint32_t LoopEngine::TogglePlayAt(uint32_t stamp)
+{
+    return PostAt(Command::TOGGLE_PLAY, stamp);
+}
+
+uint32_t LoopEngine::SetLoop(size_t length)
+{
+    return Post(Command::SET_LOOP, static_cast<uint32_t>(length));
+}
+
+uint32_t LoopEngine::Restore(size_t length, uint32_t used)
+{
+    if(length >= 1u << kRestoreUsedShift)
+        return 0;
+    return Post(Command::RESTORE, static_cast<uint32_t>(length) | used << kRestoreUsedShift);
+}
+
+uint32_t LoopEngine::Undo()
+{
+    return Post(Command::UNDO);
+}
+
+uint32_t LoopEngine::Redo()
+{
+    return Post(Command::REDO);
+}
+
+uint32_t LoopEngine::SetStreaming(bool on)
+{
+    return Post(Command::STREAM, on ? 1 : 0);
+}
+
+uint32_t LoopEngine::SetChannels(size_t channels)
+{
+    return Post(Command::CHANNELS, static_cast<uint32_t>(channels));
+}
+
+uint32_t LoopEngine::SetLatency(uint32_t samples)
+{
+    return Post(Command::SET_LATENCY, samples);
+}
+
+uint32_t LoopEngine::Calibrate()
+{
+    return Post(Command::CALIBRATE);
+}
+
+uint32_t LoopEngine::ArmTrack(size_t track, bool on)
+{
+    return Post(Command::TRACK_ARM, static_cast<uint32_t>(track) | (on ? 1u << 8 : 0));
+}
+
+uint32_t LoopEngine::MuteTrack(size_t track, bool on)
+{
+    return Post(Command::TRACK_MUTE, static_cast<uint32_t>(track) | (on ? 1u << 8 : 0));
+}
+
+uint32_t LoopEngine::SetTrackLevel(size_t track, uint32_t percent)
+{
+    return Post(Command::TRACK_LEVEL, static_cast<uint32_t>(track) | (percent << 8));
+}
+
+uint32_t LoopEngine::SetSpeed(int32_t speed)
+{
+    return Post(Command::SPEED, static_cast<uint32_t>(speed));
+}
+
+uint32_t LoopEngine::SetInterpolation(Interp kind)
+{
+    return Post(Command::INTERP, static_cast<uint32_t>(kind));
+}
+
+uint32_t LoopEngine::SetTempo(int32_t tempo)
+{
+    return Post(Command::TEMPO, static_cast<uint32_t>(tempo));
+}
+
+void LoopEngine::Sync() const
+{
+    const uint32_t ticket = posted_;
+    while(!Done(ticket))
+    {
+#if defined(LOOPER_SIM)
+        SimYield(); // the sim's callback only runs while the main loop waits
+#endif
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Commands (audio callback side)
+// -----------------------------------------------------------------------------
+void LoopEngine::Apply(const Message &msg)
+{
+    switch(msg.command)
+    {
+        case Command::RESET: DoReset(); break;
+        case Command::TOGGLE_RECORD: DoToggleRecord(); break;
+        case Command::TOGGLE_PLAY: DoTogglePlay(); break;
+        case Command::SET_LOOP: DoSetLoop(msg.arg); break;
+        case Command::UNDO:
+            if(layers_ && !rec_)
+                layers_->RequestUndo();
+            break;
+        case Command::REDO:
+            if(layers_ && !rec_)
+                layers_->RequestRedo();
+            break;
+        case Command::STREAM: DoSetStreaming(msg.arg != 0); break;
+        case Command::CHANNELS: DoSetChannels(msg.arg); break;
+        case Command::SET_LATENCY:
+            latency_ = msg.arg < kMaxLatency ? msg.arg : kMaxLatency;
+            break;
+        case Command::CALIBRATE:
+            if(!rec_)
+                probe_.Start();
+            break;
+        case Command::TRACK_ARM:
+        case Command::TRACK_MUTE:
+        case Command::TRACK_LEVEL:
+            DoTrack(msg.command, msg.arg & 0xFF, msg.arg >> 8);
+            break;
+        case Command::SPEED: DoSetSpeed(static_cast<int32_t>(msg.arg)); break;
+        case Command::INTERP:
+            if(msg.arg < kInterpKinds)
+                interp_ = static_cast<Interp>(msg.arg);
+            break;
+        case Command::TEMPO: DoSetTempo(static_cast<int32_t>(msg.arg)); break;
+        case Command::RESTORE:
+            DoRestore(msg.arg & ((1u << kRestoreUsedShift) - 1), msg.arg >> kRestoreUsedShift);
+            break;
+    }
+    applied_++;
+}
+
+/** Everything due by sample 'now', in order: untimed commands right away,
+ ** a timed one once its sample has come (it holds up the ones behind it,
+ ** for at most kPunchDelay samples). */
+void LoopEngine::ApplyDue(uint32_t now)
+{
+    Message msg;
+    while(commands_.Peek(msg))
+    {
+        if(msg.timed)
+        {
+            const int32_t wait = static_cast<int32_t>(msg.at - now);
+            if(wait > 0)
+                break;
+            if(wait < 0)
+                late_punches_++;
+        }
+        commands_.Pop(msg);
+        Apply(msg);
+    }
+}
+
+void LoopEngine::Publish()
+{
+    LoopStatus st;
+    st.playing      = play_;
+    st.recording    = rec_;
+    st.first_take   = first_;
+    st.layers_busy  = layers_ && layers_->Busy();
+    st.streaming    = streaming_;
+    st.loading      = loading_;
+    st.load_stalls  = load_stalls_;
+    st.calibrating  = probe_.Active();
+    st.latency      = latency_;
+    st.probed       = probed_;
+    st.late_punches = late_punches_;
+    st.position     = pos_;
+    st.length       = mod_;
+    st.applied      = applied_;
+    st.loop_id      = loop_id_;
+    st.tracks       = tracks_;
+    st.tracks_ready = 1;
+    while(st.tracks_ready < tracks_ && Ready(st.tracks_ready))
+        st.tracks_ready++;
+    st.stride = stride_;
+    st.armed  = static_cast<uint8_t>(armed_);
+    st.muted  = static_cast<uint8_t>(muted_);
+    st.used   = static_cast<uint8_t>(used_);
+    for(size_t t = 0; t < kMaxTracks; t++)
+        st.level[t] = static_cast<uint8_t>(level_[t] * 100.0f + 0.5f);
+    st.channels = ch_;
+    st.speed    = speed_;
+    st.interp   = interp_;
+    st.tempo    = tempo_;
+    st.stretch  = stretch_.GetStats();
+    if(layers_)
+        st.layers = layers_->GetStats();
+    else
+        st.layers = LayerManager::Stats{};
+    status_.Write(st);
+}
+
+void LoopEngine::DoReset()
+{
+    play_  = false;
+    rec_   = false;
+    first_ = true;
+    pos_   = 0;
+    len_   = 0;
+    mod_   = cap_;
+    clean_ = 0;
+    loading_    = false;
+    stride_     = 0;
+    tracks_     = 1;
+    wiped_      = 0;
+    used_       = 1; // track 0 holds the first take
+    armed_      = 1;
+    muted_      = 0;
+    speed_      = kInterpOne;
+    frac_       = 0;
+    tempo_      = kInterpOne;
+    stretching_ = false;
+    loop_id_++;
+    if(layers_)
+        layers_->Clear();
+    if(streaming_)
+        stream_->Restart();
+}
+
+void LoopEngine::DoToggleRecord()
+{
+    if(!rec_ && layers_ && layers_->Busy())
+        return;
+    if(loading_) // the rest of the file would land on the overdub
+        return;
+    if(!rec_ && !first_ && (speed_ != kInterpOne || tempo_ != kInterpOne)) // 1x only
+        return;
+
+    if(first_ && rec_ && len_ > 0) // finished first take
+    {
+        first_ = false;
+        mod_   = len_;
+        len_   = 0;
+        if(pos_ >= mod_)
+            pos_ = 0;
+        if(streaming_)
+            stream_->CloseTake(mod_ * ch_);
+        LayOut();
+    }
+
+    play_ = true;
+    rec_  = !rec_;
+
+    if(layers_)
+    {
+        if(rec_ && !first_)
+            layers_->OpenLayer();
+        else
+            layers_->CloseLayer();
+    }
+}
+
+void LoopEngine::DoTogglePlay()
+{
+    // Disabled before anything was recorded to avoid playing an empty loop
+    if(first_ && !rec_)
+        return;
+
+    play_ = !play_;
+    rec_  = false;
+    if(layers_)
+        layers_->CloseLayer();
+}
+
+void LoopEngine::DoSetLoop(size_t length)
+{
+    // The loader filled buf[]
+    if(streaming_)
+        DoSetStreaming(false);
+
+    if(length > cap_)
+        length = cap_;
+
+    rec_   = false;
+    first_ = length == 0;
+    mod_   = length == 0 ? cap_ : length;
+    len_   = 0;
+    pos_   = 0;
+    play_  = length > 0;
+    clean_ = length; // the loader fills [0, length)
+    load_stalls_ = 0;
+    loading_     = loaded_.load(std::memory_order_acquire) < length;
+    stride_      = 0;
+    tracks_      = 1;
+    wiped_       = 0;
+    used_        = 1;
+    armed_       = 1;
+    muted_       = 0;
+    speed_       = kInterpOne;
+    frac_        = 0;
+    tempo_       = kInterpOne;
+    stretching_  = false;
+    loop_id_++;
+    if(length > 0)
+        LayOut();
+    if(layers_)
+        layers_->Clear();
+}
+
+void LoopEngine::DoSetStreaming(bool on)
+{
+    if(on && !stream_)
+        return;
+
+    if(layers_)
+        layers_->Clear();
+    streaming_ = on;
+    layers_    = on ? nullptr : ram_layers_;
+    guard_     = on ? nullptr : ram_guard_;
+    overview_  = on ? nullptr : ram_overview_;
+    journal_   = on ? nullptr : ram_journal_;
+    cap_       = (on ? stream_->Capacity() : max_size_) / ch_;
+    DoReset();
+}
+
+void LoopEngine::DoSetChannels(size_t channels)
+{
+    if(channels != 1 && channels != 2)
+        return;
+
+    if(layers_)
+        layers_->Clear();
+    ch_  = channels;
+    cap_ = (streaming_ ? stream_->Capacity() : max_size_) / ch_;
+    DoReset();
+}
+
+void LoopEngine::DoTrack(Command command, size_t track, uint32_t value)
+{
+    if(track >= kMaxTracks)
+        return;
+    const uint32_t bit = 1u << track;
+    switch(command)
+    {
+        case Command::TRACK_ARM:
+            if(!value)
+                armed_ &= ~bit;
+            else if(track < tracks_)
+                armed_ |= bit;
+            break;
+        case Command::TRACK_MUTE: muted_ = value ? muted_ | bit : muted_ & ~bit; break;
+        default: level_[track] = (value < 100 ? value : 100) / 100.0f; break;
+    }
+}
+
+void LoopEngine::DoSetSpeed(int32_t speed)
+{
+    if(rec_)
+        return;
+    if(speed > kMaxSpeed)
+        speed = kMaxSpeed;
+    if(speed < -kMaxSpeed)
+        speed = -kMaxSpeed;
+    speed_ = speed;
+    if(speed_ == kInterpOne)
+        frac_ = 0; // back on whole frames
+    tempo_      = kInterpOne;
+    stretching_ = false;
+}
+
+void LoopEngine::DoSetTempo(int32_t tempo)
+{
+    if(rec_)
+        return;
+    if(tempo < TimeStretch::kMinTempo)
+        tempo = TimeStretch::kMinTempo;
+    if(tempo > TimeStretch::kMaxTempo)
+        tempo = TimeStretch::kMaxTempo;
+    tempo_ = tempo;
+    speed_ = kInterpOne;
+    frac_  = 0;
+    if(stretching_)
+        stretch_.SetTempo(tempo_); // from the next grain on
+}
+
+/** A loop from the journal: buf[] already holds every plane, cleared
+ ** where nothing was recorded, so there's nothing left to wipe. */
+void LoopEngine::DoRestore(size_t length, uint32_t used)
+{
+    if(length == 0)
+        return;
+    DoSetLoop(length);
+    if(streaming_ || mod_ != length)
+        return;
+    wiped_ = tracks_ * stride_;
+    used_  = (used & ((1u << tracks_) - 1)) | 1;
+    play_  = false;
+}
+
+/** The first take is over (or a loop was loaded): cut the buffer into
+ ** track planes for its length. The planes above track 0 are cleared by
+ ** Wipe() from here on. */
+void LoopEngine::LayOut()
+{
+    stride_ = (mod_ * ch_ + kTrackAlign - 1) / kTrackAlign * kTrackAlign;
+    tracks_ = streaming_ ? 1 : max_size_ / stride_;
+    if(tracks_ > kMaxTracks)
+        tracks_ = kMaxTracks;
+    if(tracks_ == 0)
+        tracks_ = 1;
+    wiped_ = stride_;
+    used_  = 1;
+
+    // Arms of tracks that don't fit are dropped; track 0 if none is left
+    armed_ &= (1u << tracks_) - 1;
+    if(armed_ == 0)
+        armed_ = 1;
+}
+
+// -----------------------------------------------------------------------------
+// Block processing
+// -----------------------------------------------------------------------------
+void LoopEngine::Process(const float *in, float *out, size_t size)
+{
+    const size_t   frames = size / 2;
+    const uint32_t start  = clock_.load(std::memory_order_relaxed);
+    size_t         done   = 0;
+
+    // Control changes land between passes, never inside one: at the start
+    // of the block, or where a timed one falls.
+    ApplyDue(start);
+
+    const float gain = drywet_.load(std::memory_order_relaxed) * 1.5f;
+
+    if(layers_)
+        layers_->Service(frames * kLayerSwapPerFrame);
+
+    if(loading_ && loaded_.load(std::memory_order_acquire) >= mod_)
+        loading_ = false;
+
+    if(wiped_ < tracks_ * stride_)
+        Wipe(frames * kWipePerFrame);
+
+    while(done < frames)
+    {
+        size_t n = frames - done;
+        if(n > kMaxBlock)
+            n = kMaxBlock;
+
+        // Cut the pass where the next timed command is due
+        Message next;
+        if(commands_.Peek(next) && next.timed)
+        {
+            const uint32_t wait = next.at - (start + done);
+            if(wait < n)
+                n = wait;
+        }
+
+        const float *src = in + done * 2;
+        float       *dst = out + done * 2;
+        if(ch_ == 2 && !probe_.Active())
+        {
+            // Stereo loop: the callback's interleaved buffers as they are
+            ProcessLoop(src, dst, gain, n);
+        }
+        else
+        {
+            for(size_t i = 0; i < n; i++)
+                dry_[i] = src[i * 2]; // left input only
+
+            if(probe_.Active())
+            {
+                // Calibration: clicks out instead of the loop, which holds
+                probe_.Process(dry_, wet_, n);
+                if(!probe_.Active())
+                {
+                    probed_ = probe_.Result();
+                    if(probed_ >= 0)
+                        latency_ = static_cast<uint32_t>(probed_);
+                }
+            }
+            else
+            {
+                ProcessLoop(dry_, wet_, gain, n);
+            }
+
+            for(size_t i = 0; i < n; i++)
+            {
+                dst[i * 2]     = wet_[i]; // L
+                dst[i * 2 + 1] = wet_[i]; // R (mono)
+            }
+        }
+        done += n;
+        ApplyDue(start + done);
+    }
+
+    clock_.store(start + static_cast<uint32_t>(frames), std::memory_order_release);
+    Publish();
+}
+
+/** 'n' frames: 'dry' in and 'out' hold ch_ interleaved samples per frame. */
+void LoopEngine::ProcessLoop(const float *dry,
+                             float       *out,
+                             float        gain,
+                             size_t       n)
+{
+    const size_t ch = ch_;
+    if(!play_)
+    {
+        ProfileScope prof(profiler_, CallbackProfiler::Stage::CLAMP);
+        ClampVec(out, dry, n * ch);
+        return;
+    }
+    if(!first_ && !streaming_ && !loading_)
+    {
+        if(tempo_ != kInterpOne)
+        {
+            ProcessStretch(dry, out, gain, n);
+            return;
+        }
+        if(speed_ != kInterpOne)
+        {
+            ProcessVarispeed(dry, out, gain, n);
+            return;
+        }
+    }
+    stretching_ = false; // starts again from pos_
+
+    const bool resolve = layers_ && layers_->Busy();
+    size_t     off     = 0;
+    while(off < n)
+    {
+        // Split at the wrap point: [pos_, mod_) is contiguous.
+        size_t seg = mod_ - pos_;
+        if(seg > n - off)
+            seg = n - off;
+
+        loop_sample_t *loop;
+        if(streaming_)
+        {
+            // Stream chunks sit in separate ring slots: don't cross one
+            const size_t end = DiskStream::ChunkEnd(pos_ * ch) / ch;
+            if(pos_ + seg > end)
+                seg = end - pos_;
+            loop = stream_->Map(pos_ * ch, seg * ch, rec_);
+        }
+        else
+        {
+            if(loading_)
+            {
+                const size_t ready = loaded_.load(std::memory_order_acquire);
+                if(pos_ >= ready)
+                {
+                    // Caught up with the loader: hold the head, dry only
+                    ProfileScope prof(profiler_, CallbackProfiler::Stage::CLAMP);
+                    ClampVec(out + off * ch, dry + off * ch, (n - off) * ch);
+                    load_stalls_++;
+                    return;
+                }
+                if(pos_ + seg > ready)
+                    seg = ready - pos_;
+            }
+            if(pos_ + seg > clean_)
+                Scrub(pos_ + seg);
+            loop = buf_ + pos_ * ch;
+        }
+
+        const float *in = dry + off * ch;
+        if(!loop)
+        {
+            // Chunk not loaded from the card in time: dry only, and
+            // nothing recorded (the first take still gets longer)
+            ProfileScope prof(profiler_, CallbackProfiler::Stage::CLAMP);
+            ClampVec(out + off * ch, in, seg * ch);
+            if(first_ && rec_)
+                len_ += seg;
+        }
+        else
+        {
+            // Undo/redo in flight is never while recording
+            if(rec_)
+            {
+                ProfileScope prof(profiler_, CallbackProfiler::Stage::RECORD);
+                if(streaming_)
+                    OverdubVec(loop, in, seg * ch); // no compensation
+                else if(first_)
+                    Record(0, pos_, in, seg);
+                else
+                {
+                    // What's coming in was played to the loop as it
+                    // sounded latency_ samples ago
+                    const size_t lag = latency_ % mod_;
+                    const size_t at  = pos_ >= lag ? pos_ - lag : pos_ + mod_ - lag;
+                    for(size_t t = 0; t < tracks_; t++)
+                    {
+                        if(!(armed_ & (1u << t)) || !Ready(t))
+                            continue;
+                        Record(t * stride_, at, in, seg);
+                        used_ |= 1u << t;
+                    }
+                }
+                if(first_)
+                    len_ += seg;
+            }
+
+            // Every track that's heard, in one pass. While an undo/redo is
+            // in flight, not-yet-swapped regions are read from the layer
+            // pool (which can shorten the segment; regions hold whole
+            // frames).
+            const loop_sample_t *src[kMaxTracks];
+            float                level[kMaxTracks];
+            size_t               heard = 0;
+            size_t               len   = seg * ch;
+            for(size_t t = 0; t < tracks_; t++)
+            {
+                const uint32_t bit = 1u << t;
+                if(!(used_ & bit) || (muted_ & bit) || level_[t] == 0.0f)
+                    continue;
+                const size_t at = t * stride_ + pos_ * ch;
+                src[heard]      = resolve ? layers_->Resolve(at, len)
+                                          : (t == 0 ? loop : buf_ + at);
+                level[heard++]  = gain * level_[t];
+            }
+            seg = len / ch;
+            ProfileScope prof(profiler_, CallbackProfiler::Stage::MIX);
+            MixTracksVec(out + off * ch, in, src, level, heard, len);
+        }
+
+        off += seg;
+        pos_ += seg;
+        if(pos_ >= mod_)
+        {
+            pos_ = 0;
+            // Finalize first take if we ran the buffer full
+            if(first_ && len_ >= cap_)
+            {
+                first_ = false;
+                mod_   = cap_;
+                len_   = 0;
+                if(streaming_)
+                    stream_->CloseTake(mod_ * ch);
+                LayOut();
+                if(rec_ && layers_)
+                    layers_->OpenLayer(); // keeps recording as an overdub
+            }
+        }
+    }
+}
+
+/** 'n' frames off 1x: the head renders the loop from win_[] and it's mixed
+ ** with 'dry' like ProcessLoop()'s tracks. Nothing is recorded. */
+void LoopEngine::ProcessVarispeed(const float *dry, float *out, float gain, size_t n)
+{
+    const int64_t one  = kInterpOne;
+    const int64_t loop = static_cast<int64_t>(mod_) * one;
+    const int64_t head = static_cast<int64_t>(pos_) * one + frac_;
+    const int64_t last = head + static_cast<int64_t>(speed_) * (static_cast<int64_t>(n) - 1);
+
+    // The whole frames the head crosses and the kernel's margins, from
+    // 'first' on: before 0 or past the end of the loop, Gather() wraps.
+    const int64_t lo     = (speed_ < 0 ? last : head) >> kInterpFracBits;
+    const int64_t hi     = (speed_ < 0 ? head : last) >> kInterpFracBits;
+    const int64_t first  = lo - static_cast<int64_t>(kInterpBefore);
+    const size_t  frames = static_cast<size_t>(hi - lo) + kInterpBefore + kInterpAfter + 1;
+    {
+        ProfileScope prof(profiler_, CallbackProfiler::Stage::MIX);
+        Gather(win_, first, frames);
+        const uint32_t phase = static_cast<uint32_t>(head - first * one);
+        Interpolate(interp_, head_, win_, phase, speed_, n, ch_);
+        MixVec(out, dry, head_, gain, n * ch_);
+    }
+
+    int64_t next = (head + static_cast<int64_t>(speed_) * static_cast<int64_t>(n)) % loop;
+    if(next < 0)
+        next += loop;
+    pos_  = static_cast<size_t>(next >> kInterpFracBits);
+    frac_ = static_cast<uint32_t>(next) & kInterpFracMask;
+}
+
+/** 'n' frames at another tempo: the stretch renders the loop and it's
+ ** mixed with 'dry' like ProcessLoop()'s tracks. Nothing is recorded. */
+void LoopEngine::ProcessStretch(const float *dry, float *out, float gain, size_t n)
+{
+    ProfileScope prof(profiler_, CallbackProfiler::Stage::STRETCH);
+    if(!stretching_)
+    {
+        stretch_.Start(pos_, mod_, ch_, tempo_);
+        stretching_ = true;
+    }
+    stretch_.Process(head_, n);
+    MixVec(out, dry, head_, gain, n * ch_);
+    pos_ = stretch_.Position();
+}
+
+/** TimeStretch's source: Gather() on 'engine'. */
+void LoopEngine::GatherFor(void *engine, float *win, int64_t first, size_t frames)
+{
+    static_cast<LoopEngine *>(engine)->Gather(win, first, frames);
+}
+
+/** 'frames' frames of the loop from frame 'first' (wrapped into the loop)
+ ** into 'win': every heard track at its level, summed without a clamp, as
+ ** MixTracksVec() adds them to the dry signal. */
+void LoopEngine::Gather(float *win, int64_t first, size_t frames)
+{
+    const size_t ch      = ch_;
+    const bool   resolve = layers_ && layers_->Busy();
+    memset(win, 0, frames * ch * sizeof(float));
+
+    int64_t start = first % static_cast<int64_t>(mod_);
+    if(start < 0)
+        start += static_cast<int64_t>(mod_);
+    size_t at = static_cast<size_t>(start);
+    while(frames > 0)
+    {
+        size_t run = mod_ - at;
+        if(run > frames)
+            run = frames;
+        for(size_t t = 0; t < tracks_; t++)
+        {
+            const uint32_t bit = 1u << t;
+            if(!(used_ & bit) || (muted_ & bit) || level_[t] == 0.0f)
+                continue;
+            const float level = level_[t] * LoopSample::kToFloat;
+            size_t      from  = t * stride_ + at * ch;
+            size_t      left  = run * ch;
+            float      *dst   = win;
+            while(left > 0)
+            {
+                size_t               len = left;
+                const loop_sample_t *src = resolve ? layers_->Resolve(from, len) : buf_ + from;
+                for(size_t i = 0; i < len; i++)
+                    dst[i] += src[i] * level;
+                from += len;
+                dst += len;
+                left -= len;
+            }
+        }
+        win += run * ch;
+        frames -= run;
+        at = 0;
+    }
+}
+
+/** Overdub 'n' input frames at loop position 'at' of the track plane at
+ ** 'base' (in buf[]), wrapping at the loop end: with latency compensation
+ ** the record head is behind the play head, so its run can wrap where the
+ ** play head's doesn't. */
+void LoopEngine::Record(size_t base, size_t at, const float *dry, size_t n)
+{
+    while(n > 0)
+    {
+        size_t seg = mod_ - at;
+        if(seg > n)
+            seg = n;
+        const size_t offset = base + at * ch_;
+        const size_t len    = seg * ch_;
+        if(!first_ && layers_)
+            layers_->Capture(offset, len);
+        if(guard_)
+            guard_->Preserve(offset, len);
+        OverdubVec(buf_ + offset, dry, len);
+        if(overview_)
+            overview_->Write(offset, len);
+        if(journal_)
+            journal_->Touch(offset, len);
+        dry += len;
+        n -= seg;
+        at += seg;
+        if(at >= mod_)
+            at = 0;
+    }
+}
+
+/** Zero the stale part of the buffer up to frame 'end'. Only the first take
+ ** ever gets here, a few frames per block as the head advances. */
+void LoopEngine::Scrub(size_t end)
+{
+    memset(buf_ + clean_ * ch_, 0, (end - clean_) * ch_ * sizeof(loop_sample_t));
+    clean_ = end;
+}
+
+/** Clear up to 'budget' samples of the stale track planes, and their
+ ** overview (it still shows whatever was there). */
+void LoopEngine::Wipe(size_t budget)
+{
+    size_t n = tracks_ * stride_ - wiped_;
+    if(n > budget)
+        n = budget;
+    memset(buf_ + wiped_, 0, n * sizeof(loop_sample_t));
+    if(overview_)
+        overview_->Refresh(wiped_, n);
+    wiped_ += n;
+}
@@ -0,0 +1,380 @@
+#include "LoopLoader.h"
+#include <cstring>
+
+using namespace daisy;
+
+namespace
+{
+constexpr size_t kSector = 512;
+
+inline bool HasExt(const char *name, const char *upper, const char *lower)
+{
+    return strstr(name, upper) != nullptr || strstr(name, lower) != nullptr;
+}
+} // namespace
+
+void LoopLoader::Init(loop_sample_t *buf,
+                      size_t         max_size,
+                      WaveOverview  *overview,
+                      uint8_t       *io,
+                      float          wav_rate)
+{
+    buf_      = buf;
+    max_size_ = max_size;
+    overview_ = overview;
+    io_       = io;
+    wav_rate_ = wav_rate;
+    state_    = State::IDLE;
+}
+
+LoopLoader::Result LoopLoader::Begin(const char *name, size_t channels)
+{
+    Abort();
+    channels_      = channels == 2 ? 2 : 1;
+    file_channels_ = 1;
+    length_    = 0;
+    loaded_    = 0;
+    truncated_ = false;
+    ordered_   = true;
+    damaged_   = 0;
+
+    Result res = Result::OK;
+    if(HasExt(name, ".WAV", ".wav"))
+    {
+        kind_ = Kind::WAV;
+        wav_.SetTargetRate(wav_rate_);
+        wav_.SetChannels(channels_);
+        switch(wav_.Open(name))
+        {
+            case WavReader<kWavReadSize>::Result::OK: break;
+            case WavReader<kWavReadSize>::Result::UNSUPPORTED:
+                return Result::UNSUPPORTED;
+            default: return Result::OPEN_FAILED;
+        }
+        length_ = wav_.OutputFrames();
+    }
+    else
+    {
+        if(f_open(&file_, name, FA_READ) != FR_OK)
+            return Result::OPEN_FAILED;
+        if(HasExt(name, ".LPK", ".lpk"))
+        {
+            kind_ = Kind::PACK;
+            res   = BeginPack();
+        }
+        else
+        {
+            kind_   = Kind::BIN;
+            length_ = f_size(&file_) / sizeof(int16_t);
+        }
+        if(res != Result::OK)
+        {
+            f_close(&file_);
+            return res;
+        }
+    }
+
+    if(length_ > max_size_ / channels_)
+    {
+        length_    = max_size_ / channels_;
+        truncated_ = true;
+    }
+    // Frames of an unordered file land anywhere; the ones that don't decode
+    // stay silent. Cleared by the first steps: the old loop may still be
+    // playing until the caller stops it.
+    cleared_ = ordered_ ? length_ : 0;
+    state_ = State::RUNNING;
+    return Result::OK;
+}
+
+LoopLoader::Result LoopLoader::BeginPack()
+{
+    // The header is read with the first block, which is then parsed on
+    UINT           br;
+    uint8_t *const block = io_ + kRoom;
+    if(f_read(&file_, block, kBlock, &br) != FR_OK || br < kLoopFileHeaderV1)
+        return Result::NOT_A_LOOP;
+
+    LoopFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(&hdr, block, br < sizeof(hdr) ? br : sizeof(hdr));
+    const FSIZE_t size = f_size(&file_);
+    FSIZE_t       first;
+    if(hdr.magic == kLoopFileMagic && br >= sizeof(hdr))
+        first = sizeof(hdr);
+    else if(hdr.magic == kLoopFileMagicV1)
+        first = kLoopFileHeaderV1;
+    else
+        return Result::NOT_A_LOOP;
+    file_channels_ = hdr.magic == kLoopFileMagic && hdr.channels == 2 ? 2 : 1;
+    length_        = hdr.length / file_channels_;
+
+    // Frames from position 0 to the end of the file, then the ones before
+    // them. Without a valid pointer, the file in order (any positions).
+    const FSIZE_t zero = hdr.zero_offset;
+    ordered_ = hdr.magic == kLoopFileMagic && zero >= first && zero <= size;
+    if(ordered_ && zero > first)
+    {
+        read_pos_ = zero;
+        read_end_ = size;
+        wrap_pos_ = first;
+        wrap_end_ = zero;
+        have_     = 0;
+        p_        = block;
+        return Result::OK;
+    }
+    read_pos_ = br;
+    read_end_ = size;
+    wrap_pos_ = wrap_end_ = 0;
+    p_        = block + first;
+    have_     = br - first;
+    return Result::OK;
+}
+
+LoopLoader::State LoopLoader::Step()
+{
+    if(state_ != State::RUNNING)
+        return state_;
+
+    if(cleared_ < length_)
+    {
+        size_t n = length_ - cleared_;
+        if(n > kClearSamples)
+            n = kClearSamples;
+        memset(buf_ + cleared_ * channels_, 0, n * channels_ * sizeof(loop_sample_t));
+        cleared_ += n;
+        return state_;
+    }
+
+    bool ok;
+    switch(kind_)
+    {
+        case Kind::PACK: ok = StepPack(); break;
+        case Kind::WAV: ok = StepWav(); break;
+        default: ok = StepBin(); break;
+    }
+    if(!ok)
+        Finish(State::FAILED);
+    else if(loaded_ >= length_)
+        Finish(State::DONE);
+    return state_;
+}
+
+int LoopLoader::Progress() const
+{
+    if(length_ == 0)
+        return 100;
+    if(ordered_ || kind_ != Kind::PACK)
+        return (int)((uint64_t)loaded_ * 100 / length_);
+    const FSIZE_t size = f_size(&file_);
+    return size ? (int)((uint64_t)(read_pos_ - have_) * 100 / size) : 100;
+}
+
+bool LoopLoader::StepBin()
+{
+    size_t n = length_ - loaded_;
+    if(n > kChunkSamples)
+        n = kChunkSamples;
+
+    // BIN is raw 16-bit mono: a memcpy into a mono loop with int16 storage
+    const UINT bytes = n * sizeof(int16_t);
+    UINT       br;
+    if(f_read(&file_, io_, bytes, &br) != FR_OK || br != bytes)
+        return false;
+    Store(loaded_, reinterpret_cast<int16_t *>(io_), n, 1);
+    loaded_ += n;
+    return true;
+}
+
+bool LoopLoader::StepWav()
+{
+    size_t n = length_ - loaded_;
+    if(n > kChunkSamples)
+        n = kChunkSamples;
+
+    // Converts straight into buf[]. Resampling may come out a few frames
+    // short of OutputFrames(): those stay silent.
+    const size_t got = wav_.Read(buf_ + loaded_ * channels_, n);
+    if(got == 0)
+    {
+        Silence(length_);
+        return true;
+    }
+    overview_->Write(loaded_ * channels_, got * channels_);
+    loaded_ += got;
+    return true;
+}
+
+bool LoopLoader::WholeFrame() const
+{
+    // A bad header counts: StepPack() gives up on the part there
+    LoopFrameHeader fh;
+    if(have_ < sizeof(fh))
+        return false;
+    memcpy(&fh, p_, sizeof(fh));
+    return !loop_codec::ValidHeader(fh) || have_ >= sizeof(fh) + fh.bytes;
+}
+
+bool LoopLoader::StepPack()
+{
+    if(!WholeFrame())
+    {
+        // The second part of the file once the first one is used up (a
+        // frame cut off at its end can't be completed)
+        if(read_pos_ == read_end_ && wrap_end_ > wrap_pos_)
+        {
+            damaged_ += have_ > 0;
+            read_pos_ = wrap_pos_;
+            read_end_ = wrap_end_;
+            wrap_pos_ = wrap_end_ = 0;
+            have_     = 0;
+        }
+        if(read_pos_ < read_end_ && !ReadBlock())
+            return false;
+    }
+
+    // Every whole frame in the buffer
+    LoopFrameHeader fh;
+    while(have_ >= sizeof(fh))
+    {
+        memcpy(&fh, p_, sizeof(fh));
+        if(!loop_codec::ValidHeader(fh))
+        {
+            // Lost sync: nothing after this in the part can be trusted
+            damaged_++;
+            have_     = 0;
+            read_pos_ = read_end_;
+            break;
+        }
+        if(have_ < sizeof(fh) + fh.bytes)
+            break;
+
+        const uint8_t *payload = p_ + sizeof(fh);
+        p_ += sizeof(fh) + fh.bytes;
+        have_ -= sizeof(fh) + fh.bytes;
+        // Positions and counts are in file samples
+        const size_t fc  = file_channels_;
+        const size_t pos = fh.position / fc;
+        if(pos >= length_ || fh.position % fc != 0 || fh.count % fc != 0)
+            continue;
+
+        size_t got = fh.count / fc;
+        if(got > length_ - pos)
+            got = length_ - pos;
+        if(ordered_ && pos > loaded_)
+            Silence(pos); // a frame went missing
+        if(!loop_codec::DecodeFrame(fh, payload, frame_))
+        {
+            memset(frame_, 0, fh.count * sizeof(int16_t));
+            damaged_++;
+        }
+        Store(pos, frame_, got, fc);
+        if(ordered_ && pos + got > loaded_)
+            loaded_ = pos + got;
+    }
+
+    // End of the file: whatever didn't come is silence
+    if(read_pos_ == read_end_ && wrap_end_ == wrap_pos_ && !WholeFrame())
+    {
+        damaged_ += have_ > 0;
+        if(ordered_)
+            Silence(length_);
+        else
+            loaded_ = length_;
+    }
+    return true;
+}
+
+bool LoopLoader::ReadBlock()
+{
+    // Block-aligned reads. The first one of a part may start mid-sector;
+    // nothing is carried over then (parts end on a frame boundary).
+    const FSIZE_t start = read_pos_ - read_pos_ % kSector;
+    const size_t  skip  = read_pos_ - start;
+    uint8_t      *dst   = io_ + kRoom;
+    FSIZE_t       want  = read_end_ - start;
+    if(want > kBlock)
+        want = kBlock;
+
+    // A frame cut off at the end of the last block moves in front of this one
+    memmove(dst + skip - have_, p_, have_);
+    p_ = dst + skip - have_;
+
+    UINT br;
+    if(f_tell(&file_) != start && f_lseek(&file_, start) != FR_OK)
+        return false;
+    if(f_read(&file_, dst, want, &br) != FR_OK || br != want)
+        return false;
+    have_ += br - skip;
+    read_pos_ = start + br;
+    return true;
+}
+
+/** 'frames' 16-bit frames of 'src_channels' into the loop at 'frame',
+ ** converted to its channels in place: 'src' must have room for them
+ ** doubled. */
+void LoopLoader::Store(size_t frame, int16_t *src, size_t frames, size_t src_channels)
+{
+    if(src_channels == 2 && channels_ == 1)
+    {
+        for(size_t i = 0; i < frames; i++)
+            src[i] = static_cast<int16_t>((src[2 * i] + src[2 * i + 1]) / 2);
+    }
+    else if(src_channels == 1 && channels_ == 2)
+    {
+        for(size_t i = frames; i-- > 0;)
+            src[2 * i] = src[2 * i + 1] = src[i];
+    }
+    const size_t at = frame * channels_;
+    const size_t n  = frames * channels_;
+    LoopSample::FromS16(buf_ + at, src, n);
+    overview_->Write(at, n);
+}
+
+void LoopLoader::Silence(size_t end)
+{
+    if(end <= loaded_)
+        return;
+    const size_t at = loaded_ * channels_;
+    const size_t n  = (end - loaded_) * channels_;
+    memset(buf_ + at, 0, n * sizeof(loop_sample_t));
+    overview_->Write(at, n);
+    loaded_ = end;
+}
+
+void LoopLoader::Abort()
+{
+    if(state_ == State::RUNNING)
+        Finish(State::IDLE);
+}
+
+void LoopLoader::Finish(State result)
+{
+    if(kind_ == Kind::WAV)
+        wav_.Close();
+    else
+        f_close(&file_);
+
+    // A failed load still leaves a whole loop: the rest is silence
+    // (unordered .LPK: the buffer was cleared up front)
+    if(result == State::FAILED)
+    {
+        if(ordered_)
+            Silence(length_);
+        else
+            loaded_ = length_;
+    }
+    state_ = result;
+}
+
+bool LoopLoader::ProbeWav(const char *name, uint32_t *rate, uint32_t *frames)
+{
+    if(Active() && kind_ == Kind::WAV)
+        return false;
+    if(wav_.Open(name) != WavReader<kWavReadSize>::Result::OK)
+        return false;
+    *rate   = wav_.GetInfo().samplerate;
+    *frames = wav_.GetInfo().frames;
+    wav_.Close();
+    return true;
+}
@@ -0,0 +1,209 @@
+#include "OledCanvas.h"
+#include <cstring>
+
+void OledCanvas::Init(const Config &cfg)
+{
+    driver_.Init(cfg);
+    cursor_x_  = 0;
+    cursor_y_  = 0;
+    next_page_ = 0;
+
+    // Panel RAM is unknown after reset: make every column differ once
+    memset(fb_, 0x00, sizeof(fb_));
+    memset(panel_, 0xFF, sizeof(panel_));
+    dirty_ = 0xFF;
+    Flush();
+}
+
+void OledCanvas::Fill(bool on)
+{
+    memset(fb_, on ? 0xFF : 0x00, sizeof(fb_));
+    dirty_ = 0xFF;
+}
+
+void OledCanvas::DrawPixel(int x, int y, bool on)
+{
+    if(x < 0 || y < 0 || x >= (int)kWidth || y >= (int)kHeight)
+        return;
+    Span(x, x, y / 8, 1 << (y % 8), on);
+}
+
+void OledCanvas::DrawLine(int x1, int y1, int x2, int y2, bool on)
+{
+    // Axis-aligned lines (all of the UI's) are single spans
+    if(x1 == x2 || y1 == y2)
+    {
+        FillRect(x1, y1, x2, y2, on);
+        return;
+    }
+
+    const int dx = x2 > x1 ? x2 - x1 : x1 - x2;
+    const int dy = y2 > y1 ? y1 - y2 : y2 - y1;
+    const int sx = x1 < x2 ? 1 : -1;
+    const int sy = y1 < y2 ? 1 : -1;
+    int       err = dx + dy;
+    while(true)
+    {
+        DrawPixel(x1, y1, on);
+        if(x1 == x2 && y1 == y2)
+            break;
+        const int e2 = 2 * err;
+        if(e2 >= dy)
+        {
+            err += dy;
+            x1 += sx;
+        }
+        if(e2 <= dx)
+        {
+            err += dx;
+            y1 += sy;
+        }
+    }
+}
+
+void OledCanvas::DrawRect(int x1, int y1, int x2, int y2, bool on, bool fill)
+{
+    if(fill)
+    {
+        FillRect(x1, y1, x2, y2, on);
+        return;
+    }
+    FillRect(x1, y1, x2, y1, on);
+    FillRect(x1, y2, x2, y2, on);
+    FillRect(x1, y1, x1, y2, on);
+    FillRect(x2, y1, x2, y2, on);
+}
+
+void OledCanvas::FillRect(int x1, int y1, int x2, int y2, bool on)
+{
+    if(x1 > x2)
+    {
+        const int t = x1;
+        x1          = x2;
+        x2          = t;
+    }
+    if(y1 > y2)
+    {
+        const int t = y1;
+        y1          = y2;
+        y2          = t;
+    }
+    if(x1 < 0)
+        x1 = 0;
+    if(y1 < 0)
+        y1 = 0;
+    if(x2 >= (int)kWidth)
+        x2 = kWidth - 1;
+    if(y2 >= (int)kHeight)
+        y2 = kHeight - 1;
+    if(x1 > x2 || y1 > y2)
+        return;
+
+    // One byte mask per page: rows [y1, y2] that fall in it
+    for(int page = y1 / 8; page <= y2 / 8; page++)
+    {
+        const int top    = page * 8 > y1 ? 0 : y1 - page * 8;
+        const int bottom = page * 8 + 7 < y2 ? 7 : y2 - page * 8;
+        const uint8_t mask
+            = static_cast<uint8_t>((0xFF << top) & (0xFF >> (7 - bottom)));
+        Span(x1, x2, page, mask, on);
+    }
+}
+
+void OledCanvas::Span(int x1, int x2, int page, uint8_t mask, bool on)
+{
+    uint8_t *p = fb_ + page * kWidth;
+    if(on)
+        for(int x = x1; x <= x2; x++)
+            p[x] |= mask;
+    else
+        for(int x = x1; x <= x2; x++)
+            p[x] &= ~mask;
+    dirty_ |= 1 << page;
+}
+
+char OledCanvas::WriteChar(char ch, const FontDef &font, bool on)
+{
+    const int w = font.FontWidth;
+    const int h = font.FontHeight;
+    if(cursor_x_ < 0 || cursor_y_ < 0 || cursor_x_ + w > (int)kWidth
+       || cursor_y_ + h > (int)kHeight)
+        return 0;
+    if(ch < ' ' || ch > '~')
+        ch = '?';
+
+    // Font rows are 16 bits, leftmost pixel in the MSB. Each column of the
+    // cell becomes one bit per row, then goes into the 1-3 pages it spans.
+    const uint16_t *rows = font.data + (ch - ' ') * h;
+    const uint64_t  cell = ((1ull << h) - 1) << cursor_y_;
+    const int       first = cursor_y_ / 8;
+    const int       last  = (cursor_y_ + h - 1) / 8;
+    for(int x = 0; x < w; x++)
+    {
+        uint64_t bits = 0;
+        for(int y = 0; y < h; y++)
+            if((rows[y] << x) & 0x8000)
+                bits |= 1ull << y;
+        bits <<= cursor_y_;
+        if(!on)
+            bits = ~bits & cell;
+
+        uint8_t *p = fb_ + cursor_x_ + x;
+        for(int page = first; page <= last; page++)
+        {
+            const uint8_t m = static_cast<uint8_t>(cell >> (page * 8));
+            const uint8_t v = static_cast<uint8_t>(bits >> (page * 8));
+            p[page * kWidth] = (p[page * kWidth] & ~m) | v;
+        }
+    }
+    for(int page = first; page <= last; page++)
+        dirty_ |= 1 << page;
+
+    cursor_x_ += w;
+    return ch;
+}
+
+char OledCanvas::WriteString(const char *str, const FontDef &font, bool on)
+{
+    while(*str)
+    {
+        if(WriteChar(*str, font, on) == 0)
+            return *str;
+        str++;
+    }
+    return *str;
+}
+
+bool OledCanvas::FlushPage()
+{
+    for(size_t i = 0; i < kPages && dirty_; i++)
+    {
+        const uint8_t page = next_page_;
+        next_page_         = (next_page_ + 1) % kPages;
+        if(!(dirty_ & (1 << page)))
+            continue;
+        dirty_ &= ~(1 << page);
+
+        // Only the columns that differ from the panel
+        const uint8_t *src = fb_ + page * kWidth;
+        uint8_t       *dst = panel_ + page * kWidth;
+        int            x1  = 0;
+        int            x2  = kWidth - 1;
+        while(x1 <= x2 && src[x1] == dst[x1])
+            x1++;
+        if(x1 > x2)
+            continue;
+        while(src[x2] == dst[x2])
+            x2--;
+
+        driver_.WritePage(page, x1, src + x1, x2 - x1 + 1);
+        memcpy(dst + x1, src + x1, x2 - x1 + 1);
+        return true;
+    }
+    return false;
+}
+
+void OledCanvas::Flush()
+{
+    while(FlushPage()) {}
+}
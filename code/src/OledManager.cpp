@@ -1,62 +1,241 @@
 #include "OledManager.h"
 #include "daisy_pod.h"
 #include "fatfs.h"
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 
 using namespace daisy;
 
 // Declare external functions (defined in Looper.cpp)
-extern void SaveBufferToWav();
-extern void LoadWavFile(const char* filename); // NEW: Function to load WAV file into buffer
-extern void SaveBufferToBinary();
-extern void LoadBinaryFile(const char* filename);
-
-
-static DaisyPod pod;
+extern void StartSave();
+extern void LoadLoopFile(const char* filename);
+extern void RunKernelBenchmark();
+extern void RunSdBenchmark();
+extern void UndoLayer();
+extern void RedoLayer();
+extern void ShowLayerStats();
+extern void ShowProfilerPage();
+extern void ResetProfiler();
+extern void SaveProfile();
+extern void ToggleStreaming();
+extern void ToggleStereo();
+extern void ShowStreamStats();
+extern void RescanLoops();
+extern void CalibrateLatency();
+extern void CycleTrack(int track);
+extern void DescribeTrack(int track, char* text, size_t size);
+extern void CycleSpeed(int row);
+extern void DescribeSpeed(int row, char* text, size_t size);
 
 void OledManager::Init(daisy::DaisyPod& pod)
 {
-    MyOledDisplay::Config disp_cfg;
-    disp_cfg.driver_config.transport_config.pin_config.dc    = pod.seed.GetPin(9);
-    disp_cfg.driver_config.transport_config.pin_config.reset = pod.seed.GetPin(30);
+    OledCanvas::Config disp_cfg;
+    disp_cfg.transport_config.pin_config.dc    = pod.seed.GetPin(9);
+    disp_cfg.transport_config.pin_config.reset = pod.seed.GetPin(30);
     display.Init(disp_cfg);
     DrawMenu();
+    Present();
+}
+
+void OledManager::Service()
+{
+    // Between frames: nothing is sent until the next one is due
+    if (!display.Dirty())
+    {
+        const uint32_t now = System::GetNow();
+        if (now - frame_ms < kFrameMs)
+            return;
+        Render(now);
+        if (!display.Dirty())
+            return;
+        frame_ms = now;
+    }
+    // One page per main-loop iteration, the rest on the next ones
+    display.FlushPage();
 }
 
-void OledManager::ListBinaryFiles()
+void OledManager::Present()
 {
-    file_count = 0; // Reset file count
-   
-    DIR dir;
-    FILINFO fno;
+    frame_ms = System::GetNow();
+    Render(frame_ms);
+    display.Flush();
+}
 
-    if (f_opendir(&dir, "/") == FR_OK)
+void OledManager::Render(uint32_t now)
+{
+    if (toast_visible && now - toast_shown_ms >= toasts[toast_head].duration_ms)
     {
-        while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0] && file_count < max_files)
-        {
-            // Look for .bin files
-            if (strstr(fno.fname, ".bin") || strstr(fno.fname, ".BIN"))
-            {
-                strncpy(file_list[file_count], fno.fname, sizeof(file_list[file_count]) - 1);
-                file_list[file_count][sizeof(file_list[file_count]) - 1] = '\0'; // Ensure null termination
-                file_count++;
-            }
-        }
-        f_closedir(&dir);
+        toast_visible = false;
+        toast_head    = (toast_head + 1) % toast_slots;
+        toast_count--;
+        screen_dirty = true; // uncover the screen (or show the next toast)
+    }
+
+    if (!toast_visible && toast_count > 0)
+    {
+        display.Fill(false);
+        display.SetCursor(0, 20);
+        display.WriteString(toasts[toast_head].text, Font_7x10, true);
+        DrawBattery();
+        toast_visible  = true;
+        toast_shown_ms = now;
+    }
+    else if (!toast_visible && screen_dirty)
+    {
+        DrawScreen();
+        DrawBattery();
+        screen_dirty = false;
     }
 }
 
-void OledManager::ShowMessage(const char* message, int duration_ms)
+void OledManager::SetScreen(Screen s)
+{
+    screen       = s;
+    screen_dirty = true;
+}
+
+void OledManager::DrawScreen()
 {
     display.Fill(false);
-    display.SetCursor(0, 20);
-    display.WriteString(message, Font_7x10, true);
-    display.Update();
-    pod.DelayMs(duration_ms);
+    switch (screen)
+    {
+        case Screen::MENU: DrawMenuScreen(); break;
+        case Screen::STATUS:
+            display.SetCursor(0, 20);
+            display.WriteString(status_text, Font_7x10, true);
+            break;
+        case Screen::PROGRESS:
+            display.SetCursor(0, 20);
+            display.WriteString(status_text, Font_7x10, true);
+            display.DrawRect(0, 36, 127, 44, true);
+            if (progress_pct > 0)
+                display.DrawRect(1, 37, 1 + (125 * progress_pct) / 100, 43, true, true);
+            break;
+        case Screen::PROFILE: DrawProfile(); break;
+    }
+}
+
+void OledManager::LoadSelectedFile()
+{
+    LoopCatalogEntry entry;
+    if (!catalog->Read(selected_file_index, &entry))
+    {
+        ShowMessage("Catalog failed", 1200);
+        return;
+    }
+    char selectedFile[sizeof(entry.name)];
+    snprintf(selectedFile, sizeof(selectedFile), "%s", entry.name);
+    LoadLoopFile(selectedFile);
+}
+
+void OledManager::ShowMessage(const char* message, int duration_ms)
+{
+    if (toast_count == toast_slots)
+        return; // a burst this long can't be read anyway
+
+    Toast& t = toasts[(toast_head + toast_count) % toast_slots];
+    snprintf(t.text, sizeof(t.text), "%s", message);
+    t.duration_ms = duration_ms > 0 ? duration_ms : 0;
+    toast_count++;
+    Present(); // visible at once, even if the caller keeps the CPU a while
+}
+
+void OledManager::ShowStatus(const char* message)
+{
+    snprintf(status_text, sizeof(status_text), "%s", message);
+    SetScreen(Screen::STATUS);
+    Present();
+}
+
+void OledManager::ShowProgress(const char* label, int pct)
+{
+    if (pct < 0) pct = 0;
+    if (pct > 100) pct = 100;
+
+    snprintf(status_text, sizeof(status_text), "%s %d%%", label, pct);
+    progress_pct = pct;
+    SetScreen(Screen::PROGRESS);
+    Present();
 }
 
 void OledManager::HandleMenu(int32_t inc, bool pressed)
 {
+    // Any input skips the toast on screen (and does nothing else)
+    if (toast_visible && (inc != 0 || pressed))
+    {
+        toast_shown_ms = System::GetNow() - toasts[toast_head].duration_ms;
+        frame_ms       = System::GetNow() - kFrameMs;
+        return;
+    }
+
+    if (in_profile_page)
+    {
+        if (pressed)
+        {
+            in_profile_page = false;
+            DrawMenu();
+            return;
+        }
+        if (inc != 0)
+            ResetProfiler(); // turn: start over
+        if (System::GetNow() - profile_drawn_ms >= 250)
+        {
+            profile_drawn_ms = System::GetNow();
+            ShowProfilerPage();
+        }
+        return;
+    }
+
+    if (in_track_page)
+    {
+        const int rows = (int)kMaxTracks + 1;
+        if (inc != 0)
+        {
+            track_row = (track_row + inc + rows) % rows;
+            DrawMenu();
+        }
+        if (pressed)
+        {
+            if (track_row == rows - 1) // "Back"
+                in_track_page = false;
+            else
+                CycleTrack(track_row);
+            DrawMenu();
+        }
+        else if (System::GetNow() - track_drawn_ms >= 100)
+        {
+            // Levels and modes change from elsewhere (encoder2, record)
+            track_drawn_ms = System::GetNow();
+            DrawMenu();
+        }
+        return;
+    }
+
+    if (in_speed_page)
+    {
+        if (inc != 0)
+        {
+            speed_row = (speed_row + inc + speed_rows) % speed_rows;
+            DrawMenu();
+        }
+        if (pressed)
+        {
+            if (speed_row == speed_rows - 1) // "Back"
+                in_speed_page = false;
+            else
+                CycleSpeed(speed_row);
+            DrawMenu();
+        }
+        else if (System::GetNow() - speed_drawn_ms >= 100)
+        {
+            // The speed also moves with encoder2
+            speed_drawn_ms = System::GetNow();
+            DrawMenu();
+        }
+        return;
+    }
+
     if (!in_submenu)
     {
         if (inc != 0)
@@ -66,35 +245,107 @@ void OledManager::HandleMenu(int32_t inc, bool pressed)
         }
         if (pressed)
         {
-            if (current_menu_index == 0) // "Save/Recall" selected
-            {
-                in_submenu = true;
-                current_submenu_index = 0;
-                DrawMenu();
-            }
+            in_submenu = true;
+            current_submenu_index = 0;
+            DrawMenu();
         }
     }
     else if (!in_file_selection)
     {
         if (inc != 0)
         {
-            current_submenu_index = (current_submenu_index + inc + sub_menu_count) % sub_menu_count;
+            current_submenu_index = (current_submenu_index + inc + SubMenuCount()) % SubMenuCount();
             DrawMenu();
         }
-        if (pressed)
+        if (pressed && current_menu_index == 1)
+        {
+            // Handle the Loop/Playback selections
+            if (current_submenu_index == 0) // "Undo"
+            {
+                UndoLayer();
+            }
+            else if (current_submenu_index == 1) // "Redo"
+            {
+                RedoLayer();
+            }
+            else if (current_submenu_index == 2) // "Layers": history/memory usage
+            {
+                ShowLayerStats();
+            }
+            else if (current_submenu_index == 3) // "Stream": loop on SD on/off
+            {
+                ToggleStreaming();
+            }
+            else if (current_submenu_index == 4) // "Tracks": modes and levels
+            {
+                in_track_page = true;
+                track_row = 0;
+            }
+            else if (current_submenu_index == 5) // "Stereo": mono/stereo loop
+            {
+                ToggleStereo();
+            }
+            else if (current_submenu_index == 6) // "Speed": varispeed, reverse
+            {
+                in_speed_page = true;
+                speed_row = 0;
+            }
+            else // "Exit"
+            {
+                in_submenu = false;
+            }
+            DrawMenu();
+        }
+        else if (pressed && current_menu_index == 2)
+        {
+            // Handle the Settings selections
+            if (current_submenu_index == 0) // "Benchmark": kernels + WAV formats, to BENCH.TXT
+            {
+                ShowMessage("Benchmarking...", 500);
+                RunKernelBenchmark();
+            }
+            else if (current_submenu_index == 1) // "Profiler": live page
+            {
+                in_profile_page = true;
+                profile_drawn_ms = System::GetNow();
+                ShowProfilerPage();
+                return;
+            }
+            else if (current_submenu_index == 2) // "Save profile": PROFILE.TXT
+            {
+                SaveProfile();
+            }
+            else if (current_submenu_index == 3) // "Stream stats": SD margin
+            {
+                ShowStreamStats();
+            }
+            else if (current_submenu_index == 4) // "SD bench": MB/s per transfer size
+            {
+                ShowMessage("SD bench...", 500);
+                RunSdBenchmark();
+            }
+            else if (current_submenu_index == 5) // "Latency": round-trip calibration
+            {
+                CalibrateLatency();
+            }
+            else // "Exit"
+            {
+                in_submenu = false;
+            }
+            DrawMenu();
+        }
+        else if (pressed)
         {
             // Handle the submenu selections
             if (current_submenu_index == 0) // "Save" selected
             {
-                ShowMessage("Saving...", 1000);
-                SaveBufferToWav();
-                SaveBufferToBinary();
-                ShowMessage("Save Complete", 1500);
+                // Runs in the background; progress is shown from the main loop
+                StartSave();
                 in_submenu = false;
             }
             else if (current_submenu_index == 1) // "Recall" selected
             {
-                ListBinaryFiles();
+                file_count = catalog != nullptr ? (int)catalog->Count() : 0;
                 if (file_count > 0)
                 {
                     in_file_selection = true;
@@ -102,11 +353,16 @@ void OledManager::HandleMenu(int32_t inc, bool pressed)
                 }
                 else
                 {
-                    ShowMessage("No Binary Files Found", 1500);
+                    ShowMessage("No Loops Found", 1500);
                     in_submenu = false;
                 }
             }
-            else if (current_submenu_index == 2) // "Exit" selected
+            else if (current_submenu_index == 2) // "Rescan": rebuild the catalog
+            {
+                RescanLoops();
+                in_submenu = false;
+            }
+            else if (current_submenu_index == 3) // "Exit" selected
             {
                 // Exit the submenu without doing anything
                 ShowMessage("Exiting Menu", 1000);
@@ -127,12 +383,8 @@ void OledManager::HandleMenu(int32_t inc, bool pressed)
             }
             if (pressed)
             {
-                ShowMessage("Loading...", 1000);
-                
-                char selectedFile[64];
-                snprintf(selectedFile, sizeof(selectedFile), "%s", file_list[selected_file_index]);
-                LoadBinaryFile(selectedFile);
-                ShowMessage("Loaded!", 1000);
+                // Returns once playback can start; the toasts say the rest
+                LoadSelectedFile();
                 in_file_selection = false;
                 in_submenu = false;
                 DrawMenu();
@@ -141,112 +393,252 @@ void OledManager::HandleMenu(int32_t inc, bool pressed)
     }
 }
 
+int OledManager::SubMenuCount() const
+{
+    if (current_menu_index == 1)
+        return loop_menu_count;
+    if (current_menu_index == 2)
+        return settings_menu_count;
+    return sub_menu_count;
+}
+
+const char* const* OledManager::SubMenuEntries() const
+{
+    if (current_menu_index == 1)
+        return loop_menu_entries;
+    if (current_menu_index == 2)
+        return settings_menu_entries;
+    return sub_menu_entries;
+}
+
 void OledManager::DrawMenu()
 {
-    display.Fill(false);  // Clear display before drawing menu
+    SetScreen(Screen::MENU);
+}
+
+// Highlighted entries are inverted over the width of the text
+void OledManager::DrawItem(int y, const char* text, bool selected)
+{
+    if (selected)
+        display.FillRect(2, y - 2, strlen(text) * 7 + 6, y + 10, true);
+    display.SetCursor(5, y);
+    display.WriteString(text, Font_7x10, !selected);
+}
 
+void OledManager::DrawMenuScreen()
+{
     if (!in_submenu)
     {
         for (int i = 0; i < menu_count; i++)
-        {
-            int y_position = 10 + i * 15;
-            int text_width = strlen(menu_entries[i]) * 7 + 6;  // Width of text + padding
-            
-            if (i == current_menu_index)
-            {
-                // ✅ Only highlight the length of the text
-                display.DrawRect(2, y_position - 2, text_width, y_position + 10, true);
-                
-                // Fill the rectangle manually to make it a full highlight
-                for (int x = 3; x < text_width; x++)
-                {
-                    for (int y = y_position - 1; y < y_position + 9; y++)
-                    {
-                        display.DrawPixel(x, y, true);
-                    }
-                }
-
-                display.SetCursor(5, y_position);
-                display.WriteString(menu_entries[i], Font_7x10, false);  // Inverted text
-            }
-            else
-            {
-                display.SetCursor(5, y_position);
-                display.WriteString(menu_entries[i], Font_7x10, true);
-            }
-        }
+            DrawItem(10 + i * 15, menu_entries[i], i == current_menu_index);
+        DrawOverview();
+    }
+    else if (in_track_page)
+    {
+        DrawTrackPage();
+    }
+    else if (in_speed_page)
+    {
+        DrawSpeedPage();
     }
     else if (!in_file_selection) // Regular sub-menu
     {
-        for (int i = 0; i < sub_menu_count; i++)
-        {
-            int y_position = 10 + i * 15;
-            int text_width = strlen(sub_menu_entries[i]) * 7 + 6;
-
-            if (i == current_submenu_index)
-            {
-                display.DrawRect(2, y_position - 2, text_width, y_position + 10, true);
-                
-                for (int x = 3; x < text_width; x++)
-                {
-                    for (int y = y_position - 1; y < y_position + 9; y++)
-                    {
-                        display.DrawPixel(x, y, true);
-                    }
-                }
-
-                display.SetCursor(5, y_position);
-                display.WriteString(sub_menu_entries[i], Font_7x10, false);
-            }
-            else
-            {
-                display.SetCursor(5, y_position);
-                display.WriteString(sub_menu_entries[i], Font_7x10, true);
-            }
-        }
+        const char* const* entries = SubMenuEntries();
+        // At most 5 rows fit in 64 px; longer menus scroll with the selection
+        const int visible = SubMenuCount() > 5 ? 5 : SubMenuCount();
+        const int spacing = visible > 4 ? 11 : visible > 3 ? 13 : 15;
+        int first = current_submenu_index - (visible - 1);
+        if (first < 0) first = 0;
+        for (int i = 0; i < visible; i++)
+            DrawItem(10 + i * spacing, entries[first + i], first + i == current_submenu_index);
     }
     else // File selection screen (Smooth Scrolling)
     {
-        const int max_visible_files = 3;
-        int scroll_start = selected_file_index - max_visible_files / 2;
-        if (scroll_start < 0) scroll_start = 0;
-        if (scroll_start > file_count - max_visible_files) scroll_start = file_count - max_visible_files;
-        if (file_count < max_visible_files) scroll_start = 0;
+        DrawFileList();
+    }
+}
 
-        for (int i = 0; i < max_visible_files; i++)
-        {
-            int file_index = scroll_start + i;
-            if (file_index >= file_count) break;
+// Same layout as a five-row sub-menu
+void OledManager::DrawTrackPage()
+{
+    char text[24];
+    for (int i = 0; i < (int)kMaxTracks; i++)
+    {
+        DescribeTrack(i, text, sizeof(text));
+        DrawItem(10 + i * 11, text, i == track_row);
+    }
+    DrawItem(10 + (int)kMaxTracks * 11, "Back", track_row == (int)kMaxTracks);
+}
 
-            int y_position = 10 + i * 12;
-            int text_width = strlen(file_list[file_index]) * 7 + 6;
+void OledManager::DrawSpeedPage()
+{
+    char text[24];
+    for (int i = 0; i < speed_rows - 1; i++)
+    {
+        DescribeSpeed(i, text, sizeof(text));
+        DrawItem(10 + i * 13, text, i == speed_row);
+    }
+    DrawItem(10 + (speed_rows - 1) * 13, "Back", speed_row == speed_rows - 1);
+}
 
-            if (file_index == selected_file_index)
-            {
-                display.DrawRect(2, y_position - 2, text_width, y_position + 10, true);
-                
-                for (int x = 3; x < text_width; x++)
-                {
-                    for (int y = y_position - 1; y < y_position + 9; y++)
-                    {
-                        display.DrawPixel(x, y, true);
-                    }
-                }
+void OledManager::SetOverview(const WavePeak* cols, int playhead)
+{
+    const bool shown = cols != nullptr;
+    if (shown == overview_shown && (!shown
+        || (playhead == overview_head
+            && memcmp(cols, overview_cols, sizeof(overview_cols)) == 0)))
+        return;
 
-                display.SetCursor(5, y_position);
-                display.WriteString(file_list[file_index], Font_7x10, false);
-            }
-            else
-            {
-                display.SetCursor(5, y_position);
-                display.WriteString(file_list[file_index], Font_7x10, true);
-            }
+    overview_shown = shown;
+    overview_head  = playhead;
+    if (shown)
+        memcpy(overview_cols, cols, sizeof(overview_cols));
+    if (screen == Screen::MENU && !in_submenu)
+        screen_dirty = true;
+}
+
+// Rows 53-63: one min/max bar per column, the playhead as a full-height line
+void OledManager::DrawOverview()
+{
+    if (!overview_shown)
+        return;
+
+    const int mid = 58;
+    for (int x = 0; x < (int)OledCanvas::kWidth; x++)
+    {
+        const WavePeak& pk = overview_cols[x];
+        display.DrawLine(x, mid - pk.hi * 5 / 128, x, mid - pk.lo * 5 / 128, true);
+    }
+    display.DrawLine(overview_head, 53, overview_head, 63, true);
+}
+
+// Three catalog rows (name, length) around the selection; under them the
+// selected loop's thumbnail and peak level. Rows come from the catalog's
+// page cache, so scrolling reads the card once per page.
+void OledManager::DrawFileList()
+{
+    const int max_visible_files = 3;
+    int scroll_start = selected_file_index - max_visible_files / 2;
+    if (scroll_start < 0) scroll_start = 0;
+    if (scroll_start > file_count - max_visible_files) scroll_start = file_count - max_visible_files;
+    if (file_count < max_visible_files) scroll_start = 0;
+
+    LoopCatalogEntry entry;
+    LoopCatalogEntry selected;
+    bool have_selected = false;
+    for (int i = 0; i < max_visible_files; i++)
+    {
+        int file_index = scroll_start + i;
+        if (file_index >= file_count) break;
+        if (!catalog->Read(file_index, &entry)) break;
+
+        const unsigned secs = entry.sample_rate ? entry.length / entry.sample_rate : 0;
+        char row[24];
+        snprintf(row, sizeof(row), "%-11.11s%2u:%02u", entry.name, secs / 60, secs % 60);
+        DrawItem(8 + i * 12, row, file_index == selected_file_index);
+        if (file_index == selected_file_index)
+        {
+            selected = entry;
+            have_selected = true;
         }
     }
+    if (!have_selected)
+        return;
+
+    // Rows 48-63: 32 min/max bars, two pixels each (a file found by a
+    // scan has none)
+    const int mid = 56;
+    for (int c = 0; c < (int)kCatalogThumbSize && selected.peak != kCatalogNoPeak; c++)
+    {
+        const WavePeak& pk = selected.thumb[c];
+        const int y0 = mid - pk.hi * 7 / 128;
+        const int y1 = mid - pk.lo * 7 / 128;
+        display.DrawLine(2 * c, y0, 2 * c, y1, true);
+        display.DrawLine(2 * c + 1, y0, 2 * c + 1, y1, true);
+    }
 
-    display.Update();
+    char level[12];
+    if (selected.peak == kCatalogNoPeak || selected.peak == 0)
+        snprintf(level, sizeof(level), "--");
+    else
+        snprintf(level, sizeof(level), "%ddB", (int)floorf(20.0f * log10f(selected.peak / 32767.0f)));
+    display.SetCursor(70, 52);
+    display.WriteString(level, Font_7x10, true);
+}
+
+// Callback load, overruns, per-stage min/mean/max (us) and the histogram of
+// whole-callback times (one bar per power-of-two bucket, budget marked)
+void OledManager::ShowProfile(const CallbackProfiler::Stats& st)
+{
+    profile = st;
+    SetScreen(Screen::PROFILE);
 }
 
+void OledManager::DrawProfile()
+{
+    const CallbackProfiler::Stats& st = profile;
+    const uint32_t tpu = st.ticks_per_us ? st.ticks_per_us : 1;
+    const CallbackProfiler::StageStats& total = st.stage[(size_t)CallbackProfiler::Stage::TOTAL];
+
+    char line[32];
+    if (st.budget > 0)
+        snprintf(line, sizeof(line), "Load %u%% pk %u%%",
+                 (unsigned)((uint64_t)CallbackProfiler::Mean(total) * 100 / st.budget),
+                 (unsigned)((uint64_t)total.max * 100 / st.budget));
+    else
+        snprintf(line, sizeof(line), "Load -");
+    display.SetCursor(0, 0);
+    display.WriteString(line, Font_6x8, true);
+
+    snprintf(line, sizeof(line), "Ovr %lu/%lu", (unsigned long)st.overruns,
+             (unsigned long)st.blocks);
+    display.SetCursor(0, 9);
+    display.WriteString(line, Font_6x8, true);
+
+    static const char* names[] = {"rec", "mix", "clp", "str"};
+    for (int s = 0; s < 4; s++)
+    {
+        const CallbackProfiler::StageStats& ss = st.stage[s];
+        uint32_t mn   = CallbackProfiler::TenthsUs(ss.count ? ss.min : 0, tpu);
+        uint32_t mean = CallbackProfiler::TenthsUs(CallbackProfiler::Mean(ss), tpu);
+        uint32_t mx   = CallbackProfiler::TenthsUs(ss.max, tpu);
+        // Held at the widest the columns take (999.9 / 9999.9 us), so a
+        // stall can't push the row off the screen
+        if (mn > 9999)
+            mn = 9999;
+        if (mean > 9999)
+            mean = 9999;
+        if (mx > 99999)
+            mx = 99999;
+        snprintf(line, sizeof(line), "%s%3u.%u%3u.%u%4u.%u", names[s],
+                 (unsigned)(mn / 10), (unsigned)(mn % 10),
+                 (unsigned)(mean / 10), (unsigned)(mean % 10),
+                 (unsigned)(mx / 10), (unsigned)(mx % 10));
+        display.SetCursor(0, 18 + s * 8);
+        display.WriteString(line, Font_6x8, true);
+    }
+
+    // Histogram: 16 bars of 8 px, up to 13 px high
+    uint32_t peak = 0;
+    for (size_t b = 0; b < CallbackProfiler::kBuckets; b++)
+        if (total.hist[b] > peak)
+            peak = total.hist[b];
+    for (size_t b = 0; b < CallbackProfiler::kBuckets && peak > 0; b++)
+    {
+        if (total.hist[b] == 0)
+            continue;
+        int h = (int)((uint64_t)total.hist[b] * 13 / peak);
+        if (h < 1)
+            h = 1; // rare outliers stay visible
+        display.DrawRect(b * 8, 63 - h + 1, b * 8 + 6, 63, true, true);
+    }
+    if (st.budget > 0)
+    {
+        int b = (31 - __builtin_clz(st.budget)) - CallbackProfiler::kFirstBucket;
+        if (b >= 0 && b < (int)CallbackProfiler::kBuckets)
+            display.DrawLine(b * 8 + 7, 51, b * 8 + 7, 63, true);
+    }
+}
 
 void OledManager::UpdateOledStatus(bool play, bool rec)
 {
@@ -262,20 +654,11 @@ void OledManager::UpdateOledStatus(bool play, bool rec)
     display.WriteString("                    ", Font_7x10, true);
     display.SetCursor(0, 50);
     display.WriteString(status, Font_7x10, true);
-    display.Update();
 }
 
+// Drawn over whatever is on screen, again after each redraw
 void OledManager::UpdateBatteryDisplay(double batt_v)
 {
-    int batt_x = 115;
-    int batt_y = 0;
-    display.DrawRect(batt_x, batt_y, batt_x + 12, batt_y + 5, true);
-    int batt_term_x = batt_x - 2;
-    int batt_term_y = batt_y + 1;
-    for (int x = batt_term_x; x < batt_term_x + 2; x++)
-        for (int y = batt_term_y; y < batt_term_y + 4; y++)
-            display.DrawPixel(x, y, true);
-    
     int fill_width = (batt_v > 8.25) ? 11 :
                      (batt_v > 7.5)  ? 10 :
                      (batt_v > 6.75) ? 9 :
@@ -284,10 +667,21 @@ void OledManager::UpdateBatteryDisplay(double batt_v)
                      (batt_v > 4.5)  ? 6 :
                      (batt_v > 3.75) ? 5 :
                      (batt_v > 3.0)  ? 4 : 3;
-    
-    for (int x = batt_x + 1; x < batt_x + 1 + fill_width; x++)
-        for (int y = batt_y + 1; y < batt_y + 5; y++)
-            display.DrawPixel(x, y, true);
+    if (fill_width == battery_fill)
+        return;
+    battery_fill = fill_width;
+    DrawBattery();
+}
+
+void OledManager::DrawBattery()
+{
+    if (battery_fill == 0)
+        return;
 
-    display.Update();
+    int batt_x = 115;
+    int batt_y = 0;
+    display.DrawRect(batt_x, batt_y, batt_x + 12, batt_y + 5, true);
+    display.FillRect(batt_x - 2, batt_y + 1, batt_x - 1, batt_y + 4, true); // terminal
+    display.FillRect(batt_x + 1, batt_y + 1, batt_x + 11, batt_y + 4, false);
+    display.FillRect(batt_x + 1, batt_y + 1, batt_x + battery_fill, batt_y + 4, true);
 }
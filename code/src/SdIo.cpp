@@ -0,0 +1,148 @@
+#include "SdIo.h"
+#include <cstring>
+#include "CallbackProfiler.h" // ProfileTicks()
+
+using namespace daisy;
+
+// Fastest first. VERY_FAST (SDR50) needs 1.8 V signalling, which the pod's
+// socket doesn't have. The last mode is the SD spec's identification clock:
+// every card runs it, so it's taken even if the probe fails there (e.g. the
+// card is write-protected).
+const SdIo::Mode SdIo::kModes[] = {
+    {SdmmcHandler::BusWidth::BITS_4, SdmmcHandler::Speed::FAST, "4bit 50MHz"},
+    {SdmmcHandler::BusWidth::BITS_4, SdmmcHandler::Speed::STANDARD, "4bit 25MHz"},
+    {SdmmcHandler::BusWidth::BITS_1, SdmmcHandler::Speed::STANDARD, "1bit 25MHz"},
+    {SdmmcHandler::BusWidth::BITS_1, SdmmcHandler::Speed::MEDIUM_SLOW, "1bit 12MHz"},
+    {SdmmcHandler::BusWidth::BITS_1, SdmmcHandler::Speed::SLOW, "1bit 400kHz"},
+};
+
+namespace
+{
+constexpr size_t kModeCount  = 5;
+constexpr size_t kProbeBytes = 32768;
+const char      *kProbeFile  = "SDPROBE.TMP";
+
+uint32_t KBps(size_t bytes, uint64_t ticks)
+{
+    const uint64_t us = ticks / ProfileTicksPerUs();
+    return us == 0 ? 0 : static_cast<uint32_t>(bytes * 1000000ull / 1024 / us);
+}
+} // namespace
+
+bool SdIo::Mount(SdmmcHandler &sd, FatFSInterface &fsi)
+{
+    static_assert(sizeof(kModes) / sizeof(kModes[0]) == kModeCount, "modes");
+
+    mode_ = -1;
+    if(fsi.Init(FatFSInterface::Config::MEDIA_SD) != FatFSInterface::Result::OK)
+        return false;
+    fs_ = &fsi.GetSDFileSystem();
+
+    for(size_t m = 0; m < kModeCount; m++)
+    {
+        SdmmcHandler::Config cfg;
+        cfg.Defaults();
+        cfg.width = kModes[m].width;
+        cfg.speed = kModes[m].speed;
+        if(sd.Init(cfg) != SdmmcHandler::Result::OK)
+            continue;
+
+        // A forced mount initializes the card with this bus setup
+        if(f_mount(fs_, "/", 1) == FR_OK && (m == kModeCount - 1 || Probe()))
+        {
+            mode_ = static_cast<int>(m);
+            return true;
+        }
+        f_mount(nullptr, "/", 0);
+    }
+    return false;
+}
+
+const char *SdIo::ModeName() const
+{
+    return mode_ < 0 ? "no card" : kModes[mode_].name;
+}
+
+bool SdIo::Probe()
+{
+    // Bit errors on one data line or at the clock edge show up as
+    // corrupted data long before the card refuses a command
+    uint8_t *out = buffer_;
+    uint8_t *in  = buffer_ + kProbeBytes;
+    for(size_t i = 0; i < kProbeBytes; i++)
+        out[i] = static_cast<uint8_t>(i * 37 + (i >> 9));
+
+    FIL  f;
+    UINT n;
+    if(f_open(&f, kProbeFile, FA_CREATE_ALWAYS | FA_WRITE | FA_READ) != FR_OK)
+        return false;
+    bool ok = f_write(&f, out, kProbeBytes, &n) == FR_OK && n == kProbeBytes
+              && f_sync(&f) == FR_OK && f_lseek(&f, 0) == FR_OK
+              && f_read(&f, in, kProbeBytes, &n) == FR_OK && n == kProbeBytes
+              && memcmp(in, out, kProbeBytes) == 0;
+    f_close(&f);
+    f_unlink(kProbeFile);
+    return ok;
+}
+
+// Without f_expand() every "contiguous" file would quietly be a cluster
+// chain wherever FatFs finds room (the Makefile sets it)
+#if !FF_USE_EXPAND
+#error "SdIo::Preallocate() needs FF_USE_EXPAND 1 (ffconf.h or code/Makefile)"
+#endif
+
+bool SdIo::Preallocate(FIL *f, FSIZE_t bytes)
+{
+    if(f_expand(f, bytes, 1) == FR_OK)
+        return f_lseek(f, 0) == FR_OK;
+    // No contiguous run that long: seeking past the end in write mode
+    // extends the file cluster by cluster
+    if(f_lseek(f, bytes) != FR_OK || f_tell(f) != bytes)
+        return false;
+    return f_lseek(f, 0) == FR_OK;
+}
+
+bool SdIo::Bench(const char *path, size_t chunk, size_t total, BenchResult *res)
+{
+    if(chunk == 0 || chunk > kBufferSize)
+        return false;
+    total = total / chunk * chunk;
+
+    FIL  f;
+    UINT n;
+    if(f_open(&f, path, FA_CREATE_ALWAYS | FA_WRITE | FA_READ) != FR_OK)
+        return false;
+    bool ok = Preallocate(&f, total);
+
+    for(size_t i = 0; i < chunk; i++)
+        buffer_[i] = static_cast<uint8_t>(i);
+
+    // Per-transfer deltas, so the tick counter can't wrap over a slow run
+    uint64_t write_ticks = 0;
+    for(size_t done = 0; ok && done < total; done += chunk)
+    {
+        const uint32_t t0 = ProfileTicks();
+        ok = f_write(&f, buffer_, chunk, &n) == FR_OK && n == chunk;
+        write_ticks += static_cast<uint32_t>(ProfileTicks() - t0);
+    }
+    const uint32_t t0 = ProfileTicks();
+    ok            = ok && f_sync(&f) == FR_OK;
+    write_ticks += static_cast<uint32_t>(ProfileTicks() - t0);
+
+    uint64_t read_ticks = 0;
+    ok                  = ok && f_lseek(&f, 0) == FR_OK;
+    for(size_t done = 0; ok && done < total; done += chunk)
+    {
+        const uint32_t t1 = ProfileTicks();
+        ok = f_read(&f, buffer_, chunk, &n) == FR_OK && n == chunk;
+        read_ticks += static_cast<uint32_t>(ProfileTicks() - t1);
+    }
+
+    f_close(&f);
+    f_unlink(path);
+
+    res->chunk      = chunk;
+    res->write_kbps = KBps(total, write_ticks);
+    res->read_kbps  = KBps(total, read_ticks);
+    return ok;
+}
@@ -0,0 +1,512 @@
+#include "SessionJournal.h"
+#include <cstring>
+
+namespace
+{
+const char *const kJournalFiles[2] = {"SESSION0.JNL", "SESSION1.JNL"};
+const char *const kGenerationFile  = "SESSION.GEN";
+
+struct CrcTable
+{
+    uint32_t t[256];
+};
+
+/** CRC-32 (IEEE 802.3, reflected), a byte at a time. */
+constexpr CrcTable MakeCrcTable()
+{
+    CrcTable table = {};
+    for(uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for(int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table.t[i] = c;
+    }
+    return table;
+}
+
+constexpr CrcTable kCrc = MakeCrcTable();
+
+static_assert(kCrc.t[1] == 0x77073096u && kCrc.t[255] == 0x2D02EF8Du, "CRC-32 table");
+
+uint32_t Crc32(const void *data, size_t bytes)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint32_t       c = 0xFFFFFFFFu;
+    for(size_t i = 0; i < bytes; i++)
+        c = kCrc.t[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+size_t PayloadBytes(uint32_t count)
+{
+    const size_t bytes = count * sizeof(loop_sample_t);
+    return (bytes + SdIo::kSector - 1) / SdIo::kSector * SdIo::kSector;
+}
+} // namespace
+
+void SessionJournal::Init(loop_sample_t         *loop,
+                          size_t                 loop_size,
+                          std::atomic<uint32_t> *dirty,
+                          size_t                 words)
+{
+    loop_    = loop;
+    size_    = loop_size;
+    dirty_   = dirty;
+    words_   = words;
+    regions_ = (loop_size + kJournalRegionSize - 1) / kJournalRegionSize;
+    for(size_t w = 0; w < words_; w++)
+        dirty_[w].store(0, std::memory_order_relaxed);
+
+    open_       = false;
+    synced_     = true;
+    cleared_    = false; // whatever the last run left, until Replay() or Step()
+    failed_     = false;
+    which_      = 1;
+    last_       = 0;
+    generation_ = 0;
+    sequence_   = 0;
+    offset_     = 0;
+    capacity_   = 0;
+    session_    = {};
+    meta_ms_    = 0;
+    extent_     = 0;
+    base_       = 0;
+    based_      = false;
+    scan_       = 0;
+    stats_      = {};
+}
+
+bool SessionJournal::Step(const Session &now, size_t hot, uint32_t ms)
+{
+    if(failed_)
+        return false;
+
+    if(now.length == 0)
+    {
+        // Nothing to keep: a journal of the last loop would bring it back
+        if(cleared_)
+            return false;
+        Close(true);
+        return true;
+    }
+    if(!Fits(now))
+        return false;
+    if(!open_ || now.id != session_.id || !SameLoop(now, session_))
+        return Start(now, ms);
+
+    // The base pass first: every region of every used plane, then the
+    // checkpoint that makes this file the one to replay
+    if(!based_)
+    {
+        const size_t end = (extent_ + kJournalRegionSize - 1) / kJournalRegionSize;
+        while(base_ < end && !Used(base_, now.used))
+            base_++;
+        if(base_ < end)
+            return WriteRegion(base_++);
+        if(!WriteRecord(kCheckpoint, now, 0, 0) || f_sync(&file_) != FR_OK)
+            return Fail();
+        session_ = now;
+        meta_ms_ = ms;
+        based_   = true;
+        f_unlink(kJournalFiles[1 - which_]);
+        return true;
+    }
+
+    if(!SameMix(now, session_) && ms - meta_ms_ >= kMetaMs)
+    {
+        if(offset_ + kSector > capacity_)
+        {
+            stats_.compactions++;
+            return Start(now, ms);
+        }
+        session_ = now;
+        meta_ms_ = ms;
+        return WriteRecord(kMeta, now, 0, 0);
+    }
+
+    // Caught up: the directory entry too, once
+    size_t r;
+    if(!NextDirty(now.used, hot, &r))
+    {
+        if(synced_)
+            return false;
+        synced_ = true;
+        return f_sync(&file_) == FR_OK || Fail();
+    }
+    if(offset_ + kRecordBytes > capacity_)
+    {
+        stats_.compactions++;
+        return Start(now, ms);
+    }
+    return WriteRegion(r);
+}
+
+bool SessionJournal::Replay(Session *out)
+{
+    // Record 0 of each file names its generation; newest first
+    uint32_t gen[2] = {0, 0};
+    for(int i = 0; i < 2; i++)
+    {
+        FIL f;
+        if(f_open(&f, kJournalFiles[i], FA_READ) != FR_OK)
+            continue;
+        if(ReadRecord(&f, 0, false))
+        {
+            const Record *rec = reinterpret_cast<const Record *>(record_);
+            if(rec->type == kMeta && rec->sequence == 0)
+                gen[i] = rec->generation;
+        }
+        f_close(&f);
+        if(gen[i] > last_)
+            last_ = gen[i];
+    }
+
+    const int first = gen[1] > gen[0] ? 1 : 0;
+    for(int k = 0; k < 2; k++)
+    {
+        const int i = k == 0 ? first : 1 - first;
+        if(gen[i] != 0 && ReplayFile(i, out))
+            return true;
+    }
+    return false;
+}
+
+void SessionJournal::Follow(uint32_t id)
+{
+    if(!open_)
+        return;
+    session_.id = id;
+    f_unlink(kJournalFiles[1 - which_]);
+}
+
+// -----------------------------------------------------------------------------
+// Writing
+// -----------------------------------------------------------------------------
+
+/** A new generation in the other file: preallocated, and its META record
+ ** written. The base pass follows. */
+bool SessionJournal::Start(const Session &now, uint32_t ms)
+{
+    if(open_)
+    {
+        f_close(&file_);
+        open_ = false;
+    }
+    // Generations only go up, across boots and deleted journals too: the
+    // new file's preallocation may hold an old journal's records, and
+    // they mustn't pass for this one's
+    const uint32_t saved = LoadGeneration();
+    if(saved > last_)
+        last_ = saved;
+    which_      = 1 - which_;
+    generation_ = ++last_;
+    sequence_   = 0;
+    offset_     = 0;
+    extent_     = Extent(now);
+    base_       = 0;
+    based_      = false;
+    scan_       = 0;
+    session_    = now;
+    meta_ms_    = ms;
+
+    // Twice the base pass: room for as many region writes again before
+    // compacting
+    const size_t regions = (extent_ + kJournalRegionSize - 1) / kJournalRegionSize;
+    capacity_            = static_cast<FSIZE_t>(2 * regions * kRecordBytes + kMetaSlack);
+
+    const char *name = kJournalFiles[which_];
+    if(!SaveGeneration(generation_) || f_open(&file_, name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return Fail();
+    if(!SdIo::Preallocate(&file_, capacity_) || f_sync(&file_) != FR_OK)
+    {
+        f_close(&file_);
+        f_unlink(name);
+        return Fail();
+    }
+    open_    = true;
+    cleared_ = false;
+    return WriteRecord(kMeta, now, 0, 0);
+}
+
+/** The highest generation started on this card (SESSION.GEN), 0 if
+ ** there's none. */
+uint32_t SessionJournal::LoadGeneration()
+{
+    FIL f;
+    if(f_open(&f, kGenerationFile, FA_READ) != FR_OK)
+        return 0;
+    const bool    ok  = ReadRecord(&f, 0, false);
+    const Record *rec = reinterpret_cast<const Record *>(record_);
+    f_close(&f);
+    return ok && rec->type == kGeneration ? rec->generation : 0;
+}
+
+/** One header sector, rewritten in place and synced before the
+ ** generation's first record goes out. It outlives the journal files. */
+bool SessionJournal::SaveGeneration(uint32_t generation)
+{
+    memset(record_, 0, kSector);
+    Record *rec       = reinterpret_cast<Record *>(record_);
+    rec->magic        = kRecordMagic;
+    rec->type         = kGeneration;
+    rec->generation   = generation;
+    rec->sample_bytes = sizeof(loop_sample_t);
+    rec->crc          = Crc32(rec, offsetof(Record, crc));
+
+    FIL  f;
+    UINT bw = 0;
+    if(f_open(&f, kGenerationFile, FA_WRITE | FA_OPEN_ALWAYS) != FR_OK)
+        return false;
+    const bool ok = f_write(&f, record_, kSector, &bw) == FR_OK && bw == kSector
+                    && f_sync(&f) == FR_OK;
+    f_close(&f);
+    return ok;
+}
+
+/** Region 'r' as it is now. Its dirty bit is cleared first: a write that
+ ** lands while it's copied sets it again. */
+bool SessionJournal::WriteRegion(size_t r)
+{
+    const size_t first = r * kJournalRegionSize;
+    size_t       count = extent_ - first;
+    if(count > kJournalRegionSize)
+        count = kJournalRegionSize;
+
+    dirty_[r / 32].fetch_and(~(1u << (r % 32)), std::memory_order_acq_rel);
+    uint8_t     *payload = record_ + kSector;
+    const size_t bytes   = count * sizeof(loop_sample_t);
+    memcpy(payload, loop_ + first, bytes);
+    memset(payload + bytes, 0, PayloadBytes(count) - bytes);
+    return WriteRecord(kRegion, session_, first, count);
+}
+
+/** Header sector plus the payload already in record_, if any, at offset_. */
+bool SessionJournal::WriteRecord(uint32_t type, const Session &s, uint32_t offset, uint32_t count)
+{
+    memset(record_, 0, kSector);
+    Record *rec       = reinterpret_cast<Record *>(record_);
+    rec->magic        = kRecordMagic;
+    rec->type         = type;
+    rec->generation   = generation_;
+    rec->sequence     = sequence_;
+    rec->offset       = offset;
+    rec->count        = count;
+    rec->data_crc     = count ? Crc32(record_ + kSector, count * sizeof(loop_sample_t)) : 0;
+    rec->sample_bytes = sizeof(loop_sample_t);
+    rec->session      = s;
+    rec->session.id   = 0;
+    rec->crc          = Crc32(rec, offsetof(Record, crc));
+
+    const UINT bytes = static_cast<UINT>(kSector + PayloadBytes(count));
+    UINT       bw    = 0;
+    if((f_tell(&file_) != offset_ && f_lseek(&file_, offset_) != FR_OK)
+       || f_write(&file_, record_, bytes, &bw) != FR_OK || bw != bytes)
+        return Fail();
+    offset_ += bytes;
+    sequence_++;
+    synced_ = false;
+    stats_.generation = generation_;
+    stats_.records++;
+    stats_.bytes += bytes;
+    return true;
+}
+
+/** The next dirty region to write, round robin from where the last scan
+ ** stopped. Regions of unused planes and past the loop are let go; the
+ ** one the record head is in waits until it has moved on. */
+bool SessionJournal::NextDirty(uint8_t used, size_t hot, size_t *region)
+{
+    const size_t end = (extent_ + kJournalRegionSize - 1) / kJournalRegionSize;
+    for(size_t k = 0; k <= words_; k++)
+    {
+        const size_t w    = (scan_ + k) % words_;
+        uint32_t     bits = dirty_[w].load(std::memory_order_acquire);
+        while(bits)
+        {
+            const uint32_t bit = bits & (~bits + 1);
+            const size_t   r   = w * 32 + __builtin_ctz(bits);
+            bits &= ~bit;
+            if(r >= end || !Used(r, used))
+            {
+                dirty_[w].fetch_and(~bit, std::memory_order_relaxed);
+                continue;
+            }
+            if(Hot(r, hot))
+                continue;
+            scan_   = w;
+            *region = r;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SessionJournal::Hot(size_t r, size_t hot) const
+{
+    if(hot == SIZE_MAX)
+        return false;
+    for(size_t p = 0; p < session_.planes; p++)
+        if((p * session_.stride + hot) / kJournalRegionSize == r)
+            return true;
+    return false;
+}
+
+/** A region is kept if any plane it overlaps holds audio (planes needn't
+ ** start on a region). */
+bool SessionJournal::Used(size_t r, uint8_t used) const
+{
+    const size_t first = r * kJournalRegionSize;
+    size_t       last  = first + kJournalRegionSize - 1;
+    if(last >= extent_)
+        last = extent_ - 1;
+    for(size_t p = first / session_.stride; p <= last / session_.stride; p++)
+        if(used & (1u << p))
+            return true;
+    return false;
+}
+
+bool SessionJournal::Fits(const Session &s) const
+{
+    return s.length > 0 && (s.channels == 1 || s.channels == 2) && s.planes > 0
+           && s.planes <= kMaxPlanes && s.stride >= s.length * s.channels
+           && Extent(s) <= size_;
+}
+
+bool SessionJournal::SameLoop(const Session &a, const Session &b)
+{
+    return a.length == b.length && a.channels == b.channels && a.stride == b.stride
+           && a.planes == b.planes;
+}
+
+bool SessionJournal::SameMix(const Session &a, const Session &b)
+{
+    return a.used == b.used && a.muted == b.muted && a.armed == b.armed
+           && memcmp(a.level, b.level, sizeof(a.level)) == 0;
+}
+
+size_t SessionJournal::Extent(const Session &s) const
+{
+    return (s.planes - 1) * s.stride + s.length * s.channels;
+}
+
+/** A write failed (the card is full or gone): the journal stops, and takes
+ ** its files with it rather than leave one that's falling behind. */
+bool SessionJournal::Fail()
+{
+    failed_ = true;
+    stats_.failures++;
+    Close(true);
+    return false;
+}
+
+void SessionJournal::Close(bool remove)
+{
+    if(open_)
+    {
+        f_close(&file_);
+        open_ = false;
+    }
+    session_ = {};
+    if(remove)
+    {
+        f_unlink(kJournalFiles[0]);
+        f_unlink(kJournalFiles[1]);
+        cleared_ = true;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Replay
+// -----------------------------------------------------------------------------
+
+/** Every record of file 'which' in order into buf[], up to the first one
+ ** that's torn or stale. Only counts if the checkpoint was among them; the
+ ** file is then kept open to go on from there. */
+bool SessionJournal::ReplayFile(int which, Session *out)
+{
+    if(f_open(&file_, kJournalFiles[which], FA_READ | FA_WRITE) != FR_OK)
+        return false;
+
+    const Record *rec        = reinterpret_cast<const Record *>(record_);
+    FSIZE_t       at         = 0;
+    uint32_t      seq        = 0;
+    uint32_t      gen        = 0;
+    bool          checkpoint = false;
+    Session       s          = {};
+    while(at + kSector <= f_size(&file_) && ReadRecord(&file_, at, false))
+    {
+        if(rec->sequence != seq || (seq > 0 && rec->generation != gen))
+            break;
+        if(seq == 0)
+        {
+            if(rec->type != kMeta || !Fits(rec->session))
+                break;
+            gen     = rec->generation;
+            s       = rec->session;
+            extent_ = Extent(s);
+            memset(loop_, 0, extent_ * sizeof(loop_sample_t));
+        }
+        else if(rec->type == kMeta || rec->type == kCheckpoint)
+        {
+            if(!SameLoop(rec->session, s))
+                break;
+            s = rec->session;
+            checkpoint |= rec->type == kCheckpoint;
+        }
+        else if(rec->type == kRegion)
+        {
+            const uint32_t offset = rec->offset;
+            const uint32_t count  = rec->count;
+            if(count == 0 || count > kJournalRegionSize || offset > extent_
+               || count > extent_ - offset || !ReadRecord(&file_, at, true))
+                break;
+            memcpy(loop_ + offset, record_ + kSector, count * sizeof(loop_sample_t));
+        }
+        else
+        {
+            break;
+        }
+        at += kSector + (rec->type == kRegion ? PayloadBytes(rec->count) : 0);
+        seq++;
+    }
+
+    if(!checkpoint)
+    {
+        f_close(&file_);
+        return false;
+    }
+
+    open_       = true;
+    synced_     = true;
+    cleared_    = false;
+    which_      = which;
+    generation_ = gen;
+    sequence_   = seq;
+    offset_     = at;
+    capacity_   = f_size(&file_);
+    session_    = s;
+    base_       = (extent_ + kJournalRegionSize - 1) / kJournalRegionSize;
+    based_      = true;
+    scan_       = 0;
+    *out        = s;
+
+    stats_.generation = gen;
+    return true;
+}
+
+/** The record at 'at': its header, checked, and with 'payload' its
+ ** samples too (region records). */
+bool SessionJournal::ReadRecord(FIL *f, FSIZE_t at, bool payload)
+{
+    const Record *rec   = reinterpret_cast<const Record *>(record_);
+    const UINT    bytes = static_cast<UINT>(payload ? kSector + PayloadBytes(rec->count) : kSector);
+    UINT          br    = 0;
+    if((f_tell(f) != at && f_lseek(f, at) != FR_OK) || f_read(f, record_, bytes, &br) != FR_OK
+       || br != bytes)
+        return false;
+    if(payload)
+        return rec->data_crc == Crc32(record_ + kSector, rec->count * sizeof(loop_sample_t));
+    return rec->magic == kRecordMagic && rec->sample_bytes == sizeof(loop_sample_t)
+           && rec->crc == Crc32(rec, offsetof(Record, crc));
+}
@@ -0,0 +1,160 @@
+#include "TaskScheduler.h"
+#include <cstring>
+#include "CallbackProfiler.h" // ProfileTicks()
+
+namespace
+{
+inline uint32_t TicksToUs(uint64_t ticks)
+{
+    return static_cast<uint32_t>(ticks / ProfileTicksPerUs());
+}
+} // namespace
+
+void TaskScheduler::Init()
+{
+    task_count_ = 0;
+    job_count_  = 0;
+    next_job_   = 0;
+    started_    = false;
+}
+
+bool TaskScheduler::AddTask(const char *name, TaskFn fn, uint32_t period_us)
+{
+    if(task_count_ == kMaxTasks)
+        return false;
+    Task &t     = tasks_[task_count_++];
+    t.name      = name;
+    t.fn        = fn;
+    t.period_us = period_us;
+    t.due_us    = 0;
+    memset(&t.count, 0, sizeof(t.count));
+    return true;
+}
+
+bool TaskScheduler::AddJob(const char *name, JobFn fn, uint32_t budget_us)
+{
+    if(job_count_ == kMaxJobs)
+        return false;
+    Job &j         = jobs_[job_count_++];
+    j.name         = name;
+    j.fn           = fn;
+    j.budget_ticks = budget_us * ProfileTicksPerUs();
+    memset(&j.count, 0, sizeof(j.count));
+    return true;
+}
+
+void TaskScheduler::Run(uint32_t now_us)
+{
+    // Everything is due on the first pass
+    if(!started_)
+    {
+        for(size_t i = 0; i < task_count_; i++)
+            tasks_[i].due_us = now_us;
+        started_ = true;
+    }
+
+    for(size_t i = 0; i < task_count_; i++)
+    {
+        Task &t = tasks_[i];
+        if(static_cast<int32_t>(now_us - t.due_us) < 0)
+            continue;
+
+        const uint32_t t0 = ProfileTicks();
+        t.fn();
+        const uint32_t dt = ProfileTicks() - t0;
+        t.count.runs++;
+        t.count.total_ticks += dt;
+        if(dt > t.count.max_ticks)
+            t.count.max_ticks = dt;
+
+        // Keep the phase, unless a whole period was missed
+        t.due_us += t.period_us;
+        if(static_cast<int32_t>(now_us - t.due_us) >= 0)
+        {
+            t.count.late++;
+            t.due_us = now_us + t.period_us;
+        }
+    }
+
+    // One slice, to the next job in turn that has work
+    for(size_t k = 0; k < job_count_; k++)
+    {
+        const size_t j = (next_job_ + k) % job_count_;
+        if(RunSlice(jobs_[j]))
+        {
+            next_job_ = j + 1;
+            break;
+        }
+    }
+}
+
+bool TaskScheduler::RunSlice(Job &job)
+{
+    const uint32_t start = ProfileTicks();
+    uint32_t       now   = start;
+    bool           did   = false;
+    while(true)
+    {
+        const uint32_t t0   = now;
+        const bool     more = job.fn();
+        now                 = ProfileTicks();
+        if(!more)
+            break;
+
+        const uint32_t dt = now - t0;
+        did               = true;
+        job.count.runs++;
+        job.count.total_ticks += dt;
+        if(dt > job.count.max_ticks)
+            job.count.max_ticks = dt;
+        if(now - start >= job.budget_ticks)
+            break;
+    }
+    if(!did)
+        return false;
+
+    const uint32_t slice = now - start;
+    job.count.slices++;
+    if(slice > job.count.slice_ticks)
+        job.count.slice_ticks = slice;
+    if(slice > job.budget_ticks)
+        job.count.late++;
+    return true;
+}
+
+TaskScheduler::Stats TaskScheduler::GetStats(size_t index) const
+{
+    Stats st;
+    memset(&st, 0, sizeof(st));
+    const Counters *c;
+    if(index < task_count_)
+    {
+        st.name = tasks_[index].name;
+        c       = &tasks_[index].count;
+    }
+    else if(index - task_count_ < job_count_)
+    {
+        st.name = jobs_[index - task_count_].name;
+        st.job  = true;
+        c       = &jobs_[index - task_count_].count;
+    }
+    else
+    {
+        return st;
+    }
+    st.runs     = c->runs;
+    st.slices   = c->slices;
+    st.late     = c->late;
+    st.max_us   = TicksToUs(c->max_ticks);
+    st.slice_us = TicksToUs(c->slice_ticks);
+    st.total_us = c->total_ticks / ProfileTicksPerUs();
+    return st;
+}
+
+void TaskScheduler::ResetStats()
+{
+    for(size_t i = 0; i < task_count_; i++)
+        memset(&tasks_[i].count, 0, sizeof(Counters));
+    for(size_t i = 0; i < job_count_; i++)
+        memset(&jobs_[i].count, 0, sizeof(Counters));
+}
@@ -0,0 +1,213 @@
+#include "TimeStretch.h"
+#include <cmath>
+#include <cstring>
+#include "ConstMath.h"
+
+namespace
+{
+struct HannTable
+{
+    float w[TimeStretch::kHop]; // the rising half; the falling half is 1 - w
+};
+
+constexpr HannTable MakeHannTable()
+{
+    HannTable table = {};
+    for(size_t i = 0; i < TimeStretch::kHop; i++)
+    {
+        // 0.5 - 0.5 cos(2 pi t), as sin^2(pi t): exactly 0 at the start
+        const double s = const_math::Sin(const_math::kPi * i / TimeStretch::kGrain);
+        table.w[i]     = static_cast<float>(s * s);
+    }
+    return table;
+}
+
+constexpr HannTable kHann = MakeHannTable();
+
+static_assert(kHann.w[0] == 0.0f && kHann.w[TimeStretch::kHop / 2] == 0.5f,
+              "periodic Hann: a grain starts at zero");
+
+constexpr float kNoScore = -1.0e30f;
+} // namespace
+
+void TimeStretch::Init(ReadFn read, void *ctx)
+{
+    read_  = read;
+    ctx_   = ctx;
+    ch_    = 1;
+    tempo_ = kInterpOne;
+    stats_ = {};
+}
+
+void TimeStretch::Start(size_t pos, size_t length, size_t channels, int32_t tempo)
+{
+    ch_     = channels;
+    length_ = static_cast<int64_t>(length);
+    stats_  = {};
+    SetTempo(tempo);
+
+    // The first hop is the source, and its second half is the grain the
+    // next one continues from
+    const size_t ch = ch_;
+    read_(ctx_, hop_, static_cast<int64_t>(pos), kHop);
+    read_(ctx_, tail_, static_cast<int64_t>(pos + kHop), kHop);
+    for(size_t i = 0; i < kHop; i++)
+    {
+        const float w = 1.0f - kHann.w[i];
+        float      *x = tail_ + i * ch;
+        ref_[i]       = ch == 2 ? x[0] + x[1] : x[0];
+        for(size_t c = 0; c < ch; c++)
+            x[c] *= w;
+    }
+    nominal_ = static_cast<int64_t>(pos) << kInterpFracBits;
+    grain_   = static_cast<int64_t>(pos);
+    out_     = 0;
+    Next();
+}
+
+void TimeStretch::SetTempo(int32_t tempo)
+{
+    if(tempo < kMinTempo)
+        tempo = kMinTempo;
+    if(tempo > kMaxTempo)
+        tempo = kMaxTempo;
+    tempo_ = tempo;
+}
+
+void TimeStretch::Process(float *out, size_t n)
+{
+    const size_t ch = ch_;
+    while(n > 0)
+    {
+        if(out_ == kHop)
+        {
+            if(step_ < kSteps)
+            {
+                stats_.late++;
+                while(step_ < kSteps)
+                    Step();
+            }
+            Place();
+        }
+        size_t run = kHop - out_;
+        if(run > n)
+            run = n;
+
+        // By frame kPace of the hop, the whole search has been run
+        size_t due = (kSteps * (out_ + run) + kPace - 1) / kPace;
+        if(due > kSteps)
+            due = kSteps;
+        while(step_ < due)
+            Step();
+
+        memcpy(out, hop_ + out_ * ch, run * ch * sizeof(float));
+        out += run * ch;
+        out_ += run;
+        n -= run;
+    }
+}
+
+size_t TimeStretch::Position() const
+{
+    return static_cast<size_t>((grain_ + static_cast<int64_t>(out_)) % length_);
+}
+
+/** One piece of the search: a chunk of the source read, kPerStep coarse
+ ** offsets, or one fine offset. */
+void TimeStretch::Step()
+{
+    if(step_ < kReadSteps)
+        ReadChunk(step_);
+    else if(step_ < kReadSteps + kCoarse)
+    {
+        const size_t first = (step_ - kReadSteps) * kPerStep;
+        for(size_t c = first; c < first + kPerStep && c < kOffsets; c++)
+            Consider(c * kDecimate, kDecimate);
+    }
+    else
+    {
+        // Around the coarse best, every offset; the scores start over as
+        // they're over more samples
+        const size_t k = step_ - kReadSteps - kCoarse;
+        if(k == 0)
+        {
+            coarse_ = best_;
+            score_  = kNoScore;
+        }
+        if(coarse_ + k >= kRefine && coarse_ + k - kRefine <= 2 * kSeek)
+            Consider(coarse_ + k - kRefine, 1);
+    }
+    step_++;
+}
+
+void TimeStretch::ReadChunk(size_t k)
+{
+    const size_t  ch    = ch_;
+    const int64_t first = (nominal_ >> kInterpFracBits) - static_cast<int64_t>(kSeek);
+    float        *dst   = src_ + k * kChunk * ch;
+    read_(ctx_, dst, first + static_cast<int64_t>(k * kChunk), kChunk);
+    for(size_t i = k * kChunk; i < (k + 1) * kChunk && i < kMonoSpan; i++, dst += ch)
+        mono_[i] = ch == 2 ? dst[0] + dst[1] : dst[0];
+}
+
+/** Score the grain 'offset' frames into src_ against the natural
+ ** continuation, every 'stride'-th sample: normalized cross-correlation,
+ ** squared with its sign kept so there's no square root. */
+void TimeStretch::Consider(size_t offset, size_t stride)
+{
+    const float *x      = mono_ + offset;
+    float        corr   = 0.0f;
+    float        energy = 1.0e-9f;
+    for(size_t j = 0; j < kHop; j += stride)
+    {
+        corr += x[j] * ref_[j];
+        energy += x[j] * x[j];
+    }
+    const float score = corr * fabsf(corr) / energy;
+    if(score > score_)
+    {
+        score_ = score;
+        best_  = offset;
+    }
+}
+
+/** Overlap-add the grain found: its first half completes the hop about to
+ ** play, its second half is kept for the next. */
+void TimeStretch::Place()
+{
+    const size_t ch = ch_;
+    const float *g  = src_ + best_ * ch;
+    for(size_t i = 0; i < kHop; i++)
+    {
+        const float w = kHann.w[i];
+        for(size_t c = 0; c < ch; c++)
+            hop_[i * ch + c] = tail_[i * ch + c] + g[i * ch + c] * w;
+    }
+    g += kHop * ch;
+    for(size_t i = 0; i < kHop; i++)
+    {
+        const float  w = 1.0f - kHann.w[i];
+        const float *x = g + i * ch;
+        ref_[i]        = ch == 2 ? x[0] + x[1] : x[0];
+        for(size_t c = 0; c < ch; c++)
+            tail_[i * ch + c] = x[c] * w;
+    }
+
+    grain_ = ((nominal_ >> kInterpFracBits) - static_cast<int64_t>(kSeek)
+              + static_cast<int64_t>(best_))
+             % length_;
+    if(grain_ < 0)
+        grain_ += length_;
+    out_ = 0;
+    stats_.hops++;
+    Next();
+}
+
+/** The next grain's nominal place, kHop * tempo on, and a new search. */
+void TimeStretch::Next()
+{
+    nominal_ = (nominal_ + static_cast<int64_t>(kHop) * tempo_) % (length_ << kInterpFracBits);
+    step_    = 0;
+    best_    = kSeek;
+    score_   = kNoScore;
+}
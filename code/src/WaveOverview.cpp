@@ -0,0 +1,164 @@
+#include "WaveOverview.h"
+
+namespace
+{
+constexpr WavePeak kEmpty = {127, -128};
+
+inline WavePeak Merge(WavePeak a, WavePeak b)
+{
+    return {a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi};
+}
+
+// Peak of a run, in the storage type's own range, then to 8 bits
+inline WavePeak Scan(const int16_t *p, size_t n, WavePeak pk)
+{
+    int lo = 32767, hi = -32768;
+    for(size_t i = 0; i < n; i++)
+    {
+        lo = p[i] < lo ? p[i] : lo;
+        hi = p[i] > hi ? p[i] : hi;
+    }
+    if(n == 0)
+        return pk;
+    return Merge(pk, {static_cast<int8_t>(lo >> 8), static_cast<int8_t>(hi >> 8)});
+}
+
+inline WavePeak Scan(const float *p, size_t n, WavePeak pk)
+{
+    float lo = 1.0f, hi = -1.0f;
+    for(size_t i = 0; i < n; i++)
+    {
+        lo = __builtin_fminf(lo, p[i]);
+        hi = __builtin_fmaxf(hi, p[i]);
+    }
+    if(n == 0)
+        return pk;
+    // Loop samples are clamped to [-1, 1]
+    return Merge(pk,
+                 {static_cast<int8_t>(__builtin_floorf(lo * 127.0f)),
+                  static_cast<int8_t>(__builtin_ceilf(hi * 127.0f))});
+}
+} // namespace
+
+void WaveOverview::Init(const loop_sample_t *loop, size_t loop_size, WavePeak *nodes)
+{
+    loop_   = loop;
+    nodes_  = nodes;
+    size_   = loop_size;
+    leaves_ = (loop_size + kOverviewLeafSize - 1) / kOverviewLeafSize;
+
+    size_t off = 0, len = leaves_;
+    levels_    = 0;
+    while(levels_ < kMaxLevels)
+    {
+        level_off_[levels_] = off;
+        level_len_[levels_] = len;
+        levels_++;
+        off += len;
+        if(len <= 1)
+            break;
+        len = (len + 1) / 2;
+    }
+    for(size_t i = 0; i < off; i++)
+        nodes_[i] = {0, 0};
+
+    acc_leaf_ = 0;
+    acc_end_  = SIZE_MAX;
+}
+
+void WaveOverview::Write(size_t pos, size_t n)
+{
+    while(n > 0)
+    {
+        if(pos >= size_)
+            return;
+        const size_t leaf = pos / kOverviewLeafSize;
+        size_t run = (leaf + 1) * kOverviewLeafSize - pos;
+        if(run > n)
+            run = n;
+
+        if(leaf != acc_leaf_ || pos != acc_end_)
+        {
+            // Entering a leaf: from its start the old peak is void
+            acc_leaf_ = leaf;
+            acc_      = kEmpty;
+            acc_base_ = pos % kOverviewLeafSize == 0 ? kEmpty : nodes_[leaf];
+        }
+        acc_     = Scan(loop_ + pos, run, acc_);
+        acc_end_ = pos + run;
+
+        nodes_[leaf] = Merge(acc_base_, acc_);
+        Propagate(leaf);
+
+        pos += run;
+        n -= run;
+    }
+}
+
+void WaveOverview::Refresh(size_t pos, size_t n)
+{
+    if(n == 0)
+        return;
+    size_t       leaf = pos / kOverviewLeafSize;
+    const size_t last = (pos + n - 1) / kOverviewLeafSize;
+    for(; leaf <= last && leaf < leaves_; leaf++)
+    {
+        const size_t start = leaf * kOverviewLeafSize;
+        const size_t count
+            = size_ - start < kOverviewLeafSize ? size_ - start : kOverviewLeafSize;
+        nodes_[leaf] = Scan(loop_ + start, count, kEmpty);
+        Propagate(leaf);
+        if(leaf == acc_leaf_)
+            acc_end_ = SIZE_MAX; // a write in progress starts over
+    }
+}
+
+void WaveOverview::Propagate(size_t leaf)
+{
+    size_t i = leaf;
+    for(size_t lv = 1; lv < levels_; lv++)
+    {
+        i >>= 1;
+        const WavePeak *child = nodes_ + level_off_[lv - 1];
+        const size_t    l     = 2 * i;
+        WavePeak        pk    = child[l];
+        if(l + 1 < level_len_[lv - 1])
+            pk = Merge(pk, child[l + 1]);
+        nodes_[level_off_[lv] + i] = pk;
+    }
+}
+
+WavePeak WaveOverview::Query(size_t begin, size_t end) const
+{
+    size_t l = begin / kOverviewLeafSize;
+    size_t r = (end + kOverviewLeafSize - 1) / kOverviewLeafSize;
+    if(r > leaves_)
+        r = leaves_;
+
+    // Bottom-up: take the odd ends at each level, move up with the rest
+    WavePeak pk = kEmpty;
+    for(size_t lv = 0; l < r && lv < levels_; lv++)
+    {
+        const WavePeak *level = nodes_ + level_off_[lv];
+        if(l & 1)
+            pk = Merge(pk, level[l++]);
+        if(r & 1)
+            pk = Merge(pk, level[--r]);
+        l >>= 1;
+        r >>= 1;
+    }
+    return pk.lo > pk.hi ? WavePeak{0, 0} : pk;
+}
+
+void WaveOverview::Render(size_t begin, size_t end, WavePeak *out, size_t columns) const
+{
+    const uint64_t span = end > begin ? end - begin : 0;
+    for(size_t c = 0; c < columns; c++)
+    {
+        size_t a = begin + static_cast<size_t>(span * c / columns);
+        size_t b = begin + static_cast<size_t>(span * (c + 1) / columns);
+        if(b <= a)
+            b = a + 1;
+        out[c] = Query(a, b);
+    }
+}
@@ -1,10 +1,18 @@
 // Guitar Looper – Daisy Pod / libDaisy
 // ------------------------------------
-// - 5 min mono loop @ 48 kHz (float buffer in SDRAM)
-// - Overdub, play/stop, save to WAV/BIN on SD (FatFS)
+// - 10 min mono loop @ 48 kHz (16-bit buffer in SDRAM, 5 min as float),
+//   or half as long in stereo
+// - Overdub, play/stop, save to LPK (lossless compressed) + WAV on SD (FatFS)
+// - Recall plays after a short prebuffer while the rest of the file loads
 // - Encoder2 controls dry/wet mix
 // - Button1: Play/Pause   |  Button2: Record/Overdub
 // - Hold B1+B2 (>=1s): Reset loop
+// - Loop/Playback > Stream: loops up to an hour, streamed from SD
+// - Loop/Playback > Tracks: up to 4 tracks on the first take's length
+// - Loop/Playback > Stereo: records and plays both inputs
+// - Loop/Playback > Speed: varispeed, half/double speed and reverse
+// - Autosave: the loop is journaled to SD as it changes and comes back
+//   (stopped) after a power cut
 //
 // NOTE: Requires your OledManager.h/.cpp (handles OLED + small UI)
 
@@ -12,7 +20,21 @@
 #include "daisy_pod.h"
 #include "OledManager.h"
 #include "fatfs.h"
-#include "WavWriter.h"
+#include "LoopEngine.h"
+#include "LayerManager.h"
+#include "SnapshotGuard.h"
+#include "BackgroundSaver.h"
+#include "LoopCodec.h"
+#include "LoopCatalog.h"
+#include "LoopLoader.h"
+#include "CallbackProfiler.h"
+#include "DiskStream.h"
+#include "SdIo.h"
+#include "SessionJournal.h"
+#include "TaskScheduler.h"
+#include "WaveOverview.h"
+#include "KernelBench.h"
+#include "WavFormatBench.h"
 #include "dev/oled_ssd130x.h"
 
 using namespace daisy;
@@ -22,18 +44,52 @@ using namespace daisysp;
 // Build-time config
 // -----------------------------------------------------------------------------
 #define SAMPLE_RATE       48000.0f
-#define MAX_SIZE          (48000 * 60 * 5) // 5 minutes of floats @ 48 kHz
-#define WAV_TRANSFER_SIZE 8192             // Writer buffer chunk
+#if LOOPER_SAMPLE_INT16
+#define LOOP_MINUTES      10               // int16 buffer: ~55 MB of SDRAM
+#else
+#define LOOP_MINUTES      5                // float buffer: ~55 MB of SDRAM
+#endif
+#define MAX_SIZE          (48000 * 60 * LOOP_MINUTES) // loop samples @ 48 kHz
+#define BENCH_SIZE        65536            // Kernel benchmark scratch (samples)
+// 4 MB of undo history, in 512-sample slots
+#define UNDO_POOL_SLOTS   ((4 * 1024 * 1024) / (512 * sizeof(loop_sample_t)))
+#define SNAPSHOT_SLOTS    64               // x 512 samples, copy-on-write during save
+#define WAV_LOAD_RESAMPLE 1                // Resample WAVs not at SAMPLE_RATE
+#define LOAD_PREBUFFER    (48000 * 2)      // Recall: samples loaded before play
+#define STREAM_MINUTES    60               // Streamed loops: ~330 MB on SD
+#define STREAM_SIZE       (48000 * 60 * STREAM_MINUTES)
+#define STREAM_FILE       "STREAM.RAW"
+#define CONTROL_US        1000             // buttons/encoders/LEDs: 1 kHz
+#define UI_US             33333            // menu and OLED: 30 Hz
+#define OVERVIEW_US       100000           // waveform strip refresh (10 fps)
+#define BATTERY_US        1000000          // battery gauge: 1 Hz
+#define JOB_SLICE_US      2000             // background job time slice
+#define SAVE_WAV          1                // Save also exports a WAV...
+#define SAVE_WAV_FORMAT   S16              // ... as S16, S24 or F32 (float)
+#define STEREO            0                // Boot with a stereo loop (half as long)
+#define LATENCY_FILE      "LATENCY.TXT"    // measured round trip (Settings > Latency)
+#define AUTOSAVE          1                // journal the loop to SD, restore it at boot
 
 // -----------------------------------------------------------------------------
 // Globals / hardware
 // -----------------------------------------------------------------------------
 static DaisyPod                       pod;
-static WavWriter<WAV_TRANSFER_SIZE>   wav_writer;
 static OledManager                    oledManager;
+static LoopEngine                     looper;
+static LayerManager                   layers;
+static SnapshotGuard                  snapshot;
+static BackgroundSaver                saver;
+static CallbackProfiler               profiler;
+static DiskStream                     stream;
+static WaveOverview                   overview;
+static LoopLoader                     loader;
+static LoopCatalog                    catalog;
+static TaskScheduler                  scheduler;
+static SessionJournal                 journal;
 
 SdmmcHandler   sd;
 FatFSInterface fsi;
+static SdIo    sdio;
 
 constexpr Pin LED_PLAY_PIN = seed::D19;
 constexpr Pin LED_REC_PIN  = seed::D20;
@@ -43,40 +99,99 @@ dsy_gpio play_led, rec_led;
 // -----------------------------------------------------------------------------
 // Looper state
 // -----------------------------------------------------------------------------
-bool  first       = true;   // still capturing initial loop length
-bool  rec         = false;  // recording/overdubbing
-bool  play        = false;  // playback
-int   pos         = 0;      // read/write head
-int   mod         = MAX_SIZE; // loop length modulo
-int   len         = 0;      // provisional length during first take
-float DSY_SDRAM_BSS buf[MAX_SIZE];
+// Transport state (play/rec/first take, read head, loop length) lives in
+// LoopEngine; the buffer itself stays here in SDRAM.
+// Storage type is picked by LOOPER_SAMPLE_INT16 (see LoopSample.h).
+loop_sample_t DSY_SDRAM_BSS buf[MAX_SIZE];
+loop_sample_t DSY_SDRAM_BSS bench_buf[BENCH_SIZE] __attribute__((aligned(32)));
+
+// Overdub undo/redo history (sparse region copies, see LayerManager.h)
+static LayerStorage<MAX_SIZE, UNDO_POOL_SLOTS> DSY_SDRAM_BSS undo_mem;
+
+// Copy-on-write regions for background saves (see SnapshotGuard.h)
+static SnapshotStorage<MAX_SIZE, SNAPSHOT_SLOTS> DSY_SDRAM_BSS snapshot_mem;
+
+// Read-ahead/write-behind ring for streamed loops (see DiskStream.h)
+static DiskStreamStorage DSY_SDRAM_BSS stream_mem;
+
+// Min/max pyramid of buf[] for the waveform strip (internal SRAM, see
+// WaveOverview.h)
+static WaveOverviewStorage<MAX_SIZE> overview_mem;
+
+// Dirty regions of buf[] for the autosave journal (internal SRAM, see
+// SessionJournal.h)
+static SessionJournalStorage<MAX_SIZE> journal_mem;
 
-float drywet      = 0.0f;   // 0 = fully dry, 1 = fully wet
 bool  armed_reset = false;  // helper for reset gesture
 
-int   file_counter  = 1;    // WAV index
-int   file_counterb = 1;    // BIN index
+bool     reset_flash       = false; // reset LED animation running
+uint32_t reset_flash_start = 0;     // ms
+
+// Catalog record of the save in progress (added when it's done)
+static LoopCatalogEntry save_entry;
+
+// Recall: samples to load before the engine gets the loop, 0 once it has
+static size_t load_prebuffer = 0;
 
-// Binary save/load temp
-FIL       binary_file;
-bool      binary_recording = false;
-uint32_t  binary_wptr      = 0;
-static int16_t binary_buffer[32768];
+// Encoder input for the menu, gathered at the control rate
+static int32_t menu_move  = 0;
+static bool    menu_press = false;
+
+static double battery_voltage = 9.0; // placeholder for your battery code
+
+// Settings > Latency: a calibration is running (its result is reported once)
+static bool calibrating = false;
+
+// Track levels in percent (encoder2 on the Tracks page)
+static int32_t track_level[kMaxTracks];
+static_assert(kMaxTracks <= BackgroundSaver::kMaxPlanes, "saves mix every track");
+static_assert(kMaxTracks <= SessionJournal::kMaxPlanes, "the journal keeps every track");
 
 // -----------------------------------------------------------------------------
 // Forward decls
 // -----------------------------------------------------------------------------
 static void ResetBuffer();
 static void UpdateButtons();
+static void UpdateLeds();
 static void Controls();
-static void SaveBufferToWav();
-static void SaveBufferToBinary();
-static void LoadBinaryFile(const char* filename);
-
-static void WriteBuffer(AudioHandle::InterleavingInputBuffer in, size_t i);
-static void NextSamples(float& output,
-                        AudioHandle::InterleavingInputBuffer in,
-                        size_t i);
+static void UpdateUi();
+static void UpdateBattery();
+void        StartSave();
+static bool SaveJob();
+static void UpdateOverview();
+void        LoadLoopFile(const char* filename);
+static bool LoadJob();
+static bool ProbeWav(const char* name, uint32_t* rate, uint32_t* frames);
+void        RescanLoops();
+static bool ScanJob();
+static bool StreamJob();
+static void RestoreSession();
+static bool JournalJob();
+
+void        RunKernelBenchmark();
+void        RunSdBenchmark();
+void        UndoLayer();
+void        RedoLayer();
+void        ShowLayerStats();
+void        ShowProfilerPage();
+void        ResetProfiler();
+void        SaveProfile();
+void        ToggleStreaming();
+void        ToggleStereo();
+static void StopStreaming();
+void        ShowStreamStats();
+void        CalibrateLatency();
+static void CheckCalibration();
+static void LoadLatency();
+void        CycleTrack(int track);
+void        DescribeTrack(int track, char* text, size_t size);
+static void NudgeTrackLevel(int track, int32_t inc);
+void        CycleSpeed(int row);
+void        DescribeSpeed(int row, char* text, size_t size);
+static void NudgeSpeed(int32_t inc);
+static void NudgeTempo(int32_t inc);
+static void RenderTracks(const LoopStatus& st, size_t len, WavePeak* out, size_t columns);
+
 static void AudioCallback(AudioHandle::InterleavingInputBuffer  in,
                           AudioHandle::InterleavingOutputBuffer out,
                           size_t                                size);
@@ -88,13 +203,9 @@ static void AudioCallback(AudioHandle::InterleavingInputBuffer  in,
                           AudioHandle::InterleavingOutputBuffer out,
                           size_t                                size)
 {
-    float output = 0.0f;
-    for(size_t i = 0; i < size; i += 2)
-    {
-        NextSamples(output, in, i);
-        out[i]     = output; // L
-        out[i + 1] = output; // R (mono)
-    }
+    profiler.BeginBlock();
+    looper.Process(in, out, size);
+    profiler.EndBlock(size / 2);
 }
 
 // -----------------------------------------------------------------------------
@@ -117,53 +228,66 @@ int main(void)
     // OLED/UI
     oledManager.Init(pod);
 
-    // SD / FatFS
-    SdmmcHandler::Config sd_cfg;
-    sd_cfg.Defaults();
-    sd_cfg.width = SdmmcHandler::BusWidth::BITS_1;
-    sd_cfg.speed = SdmmcHandler::Speed::SLOW;
-
-    if(sd.Init(sd_cfg) != SdmmcHandler::Result::OK)
-    {
-        oledManager.ShowMessage("SD init failed", 1500);
-        while(1) {}
-    }
-    if(fsi.Init(FatFSInterface::Config::MEDIA_SD) != FatFSInterface::Result::OK)
-    {
-        oledManager.ShowMessage("FS init failed", 1500);
-        while(1) {}
-    }
-    if(f_mount(&fsi.GetSDFileSystem(), "/", 1) != FR_OK)
+    // SD / FatFS: fastest bus mode the card passes (see SdIo.h)
+    if(!sdio.Mount(sd, fsi))
     {
         oledManager.ShowMessage("Mount failed", 1500);
         while(1) {}
     }
-
-    // WAV writer
-    WavWriter<WAV_TRANSFER_SIZE>::Config wav_cfg;
-    wav_cfg.samplerate    = SAMPLE_RATE;
-    wav_cfg.channels      = 1;
-    wav_cfg.bitspersample = 16;
-    wav_writer.Init(wav_cfg);
-
-    ResetBuffer();
+    char sd_msg[24];
+    snprintf(sd_msg, sizeof(sd_msg), "SD %s", sdio.ModeName());
+    oledManager.ShowMessage(sd_msg, 800);
+
+    // Loop catalog: the header only, unless it has to be built
+    if(!catalog.Open(ProbeWav, (uint32_t)SAMPLE_RATE))
+        oledManager.ShowMessage("Catalog failed", 1200);
+    oledManager.SetCatalog(&catalog);
+
+    // Background saver (WAV + BIN)
+    snapshot.Init(buf, snapshot_mem);
+    saver.Init(&snapshot, SAMPLE_RATE);
+
+    overview.Init(buf, overview_mem);
+    journal.Init(buf, journal_mem);
+    SessionJournal* autosave = AUTOSAVE ? &journal : nullptr;
+    layers.Init(buf, MAX_SIZE, undo_mem, &overview, autosave);
+    profiler.Init(SAMPLE_RATE);
+    stream.Init(&stream_mem);
+    looper.Init(buf, MAX_SIZE, &layers, &snapshot, &profiler, &stream, &overview, autosave);
+    for(size_t t = 0; t < kMaxTracks; t++)
+        track_level[t] = 100;
+    if(STEREO)
+        looper.SetChannels(2);
+    loader.Init(buf, MAX_SIZE, &overview, sdio.Buffer(),
+                WAV_LOAD_RESAMPLE ? SAMPLE_RATE : 0.0f);
 
     pod.StartAdc();
     pod.StartAudio(AudioCallback);
 
-    double battery_voltage = 9.0; // placeholder for your battery code
+    // Needs the callback running: the reset goes through its command queue
+    ResetBuffer();
+    LoadLatency();
+    if(AUTOSAVE)
+        RestoreSession();
+
+    // Main loop (see TaskScheduler.h). Tasks in priority order; the jobs
+    // share the time left in slices, so the controls stay within a slice
+    // of their rate while the card is busy.
+    scheduler.Init();
+    scheduler.AddTask("ctrl", Controls, CONTROL_US);
+    scheduler.AddTask("ui", UpdateUi, UI_US);
+    scheduler.AddTask("wave", UpdateOverview, OVERVIEW_US);
+    scheduler.AddTask("batt", UpdateBattery, BATTERY_US);
+    scheduler.AddJob("stream", StreamJob, JOB_SLICE_US);
+    scheduler.AddJob("save", SaveJob, JOB_SLICE_US);
+    scheduler.AddJob("load", LoadJob, JOB_SLICE_US);
+    scheduler.AddJob("scan", ScanJob, JOB_SLICE_US);
+    if(AUTOSAVE)
+        scheduler.AddJob("jrnl", JournalJob, JOB_SLICE_US);
 
     while(1)
     {
-        Controls();
-
-        // Simple on-screen menu hook
-        int32_t enc_move  = pod.encoder.Increment();
-        bool    enc_press = pod.encoder.RisingEdge();
-        oledManager.HandleMenu(enc_move, enc_press);
-
-        // Optional status
-        oledManager.UpdateBatteryDisplay(battery_voltage);
+        scheduler.Run(System::GetUs());
     }
     return 0;
 }
@@ -171,312 +295,1310 @@ int main(void)
 // -----------------------------------------------------------------------------
 // Reset loop buffer and signal LEDs
 // -----------------------------------------------------------------------------
+// Constant time: buf[] is not cleared here, the engine zeroes stale audio
+// lazily as the next first take reaches it (see LoopEngine.h).
 static void ResetBuffer()
 {
-    play  = false;
-    rec   = false;
-    first = true;
-    pos   = 0;
-    len   = 0;
-    mod   = MAX_SIZE;
+    saver.Abort();
+    looper.Reset();
+    looper.Sync(); // callback has stopped reading/writing buf[]
 
-    for(int i = 0; i < mod; i++) buf[i] = 0.0f;
+    // Flash LEDs: alternate REC / PLAY three times (runs in UpdateLeds)
+    reset_flash_start = System::GetNow();
+    reset_flash       = true;
+}
 
-    // Flash LEDs: alternate REC / PLAY three times
-    for(int i = 0; i < 3; i++)
+// -----------------------------------------------------------------------------
+// Buttons (play/rec/reset)
+// -----------------------------------------------------------------------------
+// Presses are stamped with the engine's sample clock as they're read, so
+// a punch lands on the sample it was made on (plus the engine's fixed
+// delay), not on whichever block boundary the command reaches first.
+static void UpdateButtons()
+{
+    const LoopStatus st    = looper.Status();
+    const uint32_t   stamp = looper.Clock();
+
+    // Button2: toggle REC/OD; auto-start PLAY on first press
+    if(pod.button2.RisingEdge())
+    {
+        if(st.loading || loader.Active())
+            oledManager.ShowMessage("Still loading", 800);
+        else if(st.calibrating)
+            oledManager.ShowMessage("Calibrating", 800);
+        else if(!st.first_take && !st.recording && st.armed == 0)
+            oledManager.ShowMessage("No track armed", 800);
+        else if(!st.first_take && !st.recording
+                && (st.speed != kInterpOne || st.tempo != kInterpOne))
+            oledManager.ShowMessage("Overdub at 1x", 800);
+        else
+            looper.ToggleRecordAt(stamp);
+    }
+
+    // Hold both buttons (>= 1s) to reset loop
+    if(pod.button1.TimeHeldMs() >= 1000
+       && pod.button2.TimeHeldMs() >= 1000
+       && st.playing) // require we were in a session
     {
-        dsy_gpio_write(&rec_led, 1);
-        dsy_gpio_write(&play_led, 0);
-        System::Delay(200);
+        loader.Abort();
+        ResetBuffer();
+    }
 
-        dsy_gpio_write(&rec_led, 0);
-        dsy_gpio_write(&play_led, 1);
-        System::Delay(200);
+    // Button1: Play/Pause (disabled if first && !rec to avoid empty play)
+    if(pod.button1.RisingEdge() && !(st.first_take && !st.recording))
+    {
+        looper.TogglePlayAt(stamp);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// LEDs follow the state published by the audio callback
+// -----------------------------------------------------------------------------
+static void UpdateLeds()
+{
+    if(reset_flash)
+    {
+        const uint32_t step = (System::GetNow() - reset_flash_start) / 200;
+        if(step < 6)
+        {
+            dsy_gpio_write(&rec_led, (step & 1) ? 0 : 1);
+            dsy_gpio_write(&play_led, (step & 1) ? 1 : 0);
+            return;
+        }
+        reset_flash = false;
     }
-    dsy_gpio_write(&rec_led, 0);
-    dsy_gpio_write(&play_led, 0);
+
+    const LoopStatus st = looper.Status();
+
+    dsy_gpio_write(&rec_led, st.recording ? 1 : 0);
+    dsy_gpio_write(&play_led, st.playing ? 1 : 0);
 }
 
 // -----------------------------------------------------------------------------
-// Record (overdub) into buffer
+// Controls (encoder2 -> dry/wet, encoder -> menu)
 // -----------------------------------------------------------------------------
-static void WriteBuffer(AudioHandle::InterleavingInputBuffer in, size_t i)
+static void Controls()
 {
-    buf[pos] += in[i];
-    if(buf[pos] > 1.0f)  buf[pos] = 1.0f;
-    if(buf[pos] < -1.0f) buf[pos] = -1.0f;
+    pod.ProcessDigitalControls();
+
+    // Encoder2: dry/wet, or on the Tracks page the selected track's level,
+    // or on the Speed page the speed or the tempo
+    static int32_t enc_accum = 0;
+    const int32_t  inc2      = pod.encoder2.Increment();
+    const int      track     = oledManager.SelectedTrack();
+    const int      speed_row = oledManager.SelectedSpeedRow();
+    if(track >= 0)
+        NudgeTrackLevel(track, inc2);
+    else if(speed_row == 0)
+        NudgeSpeed(inc2);
+    else if(speed_row == 1)
+        NudgeTempo(inc2);
+    else
+        enc_accum += inc2;
+    if(enc_accum < 0)   enc_accum = 0;
+    if(enc_accum > 100) enc_accum = 100;
+
+    looper.SetDryWet(enc_accum / 100.0f);
 
-    if(first) { len++; }
+    // Edges only last one update: kept for the slower UI task
+    menu_move += pod.encoder.Increment();
+    if(pod.encoder.RisingEdge())
+        menu_press = true;
+
+    UpdateButtons();
+    UpdateLeds();
 }
 
 // -----------------------------------------------------------------------------
-// Per-sample processing
+// Menu and OLED (30 Hz), battery gauge (1 Hz)
 // -----------------------------------------------------------------------------
-static void NextSamples(float& output,
-                        AudioHandle::InterleavingInputBuffer in,
-                        size_t i)
+static void UpdateUi()
 {
-    if(rec) { WriteBuffer(in, i); }
+    const int32_t move  = menu_move;
+    const bool    press = menu_press;
+    menu_move  = 0;
+    menu_press = false;
+    oledManager.HandleMenu(move, press);
+    CheckCalibration();
+
+    // Toasts, redraws and panel writes (changed pages only)
+    oledManager.Service();
+}
 
-    const float dry_signal  = in[i];
-    const float loop_signal = play ? buf[pos] * (drywet * 1.5f) : 0.0f;
+static void UpdateBattery()
+{
+    oledManager.UpdateBatteryDisplay(battery_voltage);
+}
 
-    output = dry_signal + loop_signal;
+// -----------------------------------------------------------------------------
+// Save loop to LPK (+ WAV) on SD (background, see BackgroundSaver.h)
+// -----------------------------------------------------------------------------
+void StartSave()
+{
+    if(saver.Active())
+    {
+        oledManager.ShowMessage("Save running", 1000);
+        return;
+    }
+    const LoopStatus st  = looper.Status();
+    const size_t     mod = st.length;
+    if(st.streaming)
+    {
+        // Already on the card: just bring the file up to date
+        oledManager.ShowMessage(stream.Flush() ? "Stream synced" : "Sync failed", 1000);
+        return;
+    }
+    if(st.first_take || mod == 0)
+    {
+        oledManager.ShowMessage("No data", 1000);
+        return;
+    }
+    if(st.layers_busy)
+    {
+        oledManager.ShowMessage("Undo running", 1000);
+        return;
+    }
+    if(loader.Active())
+    {
+        oledManager.ShowMessage("Still loading", 1000);
+        return;
+    }
+    if(catalog.Scanning())
+    {
+        oledManager.ShowMessage("Scan running", 1000);
+        return;
+    }
 
-    if(output > 1.0f)  output = 1.0f;
-    if(output < -1.0f) output = -1.0f;
+    uint32_t id;
+    char     wav_name[16], pack_name[16];
+    if(!catalog.NewName(&id, pack_name, wav_name))
+    {
+        oledManager.ShowMessage("Catalog full", 1500);
+        return;
+    }
 
-    // Finalize first take if we ever ran the buffer full
-    if(len >= MAX_SIZE)
+    // Tracks are saved as they're heard: the used ones that aren't muted,
+    // at their levels
+    BackgroundSaver::Mixdown mix;
+    memset(&mix, 0, sizeof(mix));
+    mix.stride = st.stride;
+    for(size_t t = 0; t < st.tracks; t++)
     {
-        first = false;
-        mod   = MAX_SIZE;
-        len   = 0;
+        if(!(st.used & (1u << t)))
+            continue;
+        mix.planes = t + 1;
+        if(!(st.muted & (1u << t)))
+            mix.level[t] = st.level[t] / 100.0f;
     }
 
-    if(play)
+    // The saver counts buffer samples (a stereo frame is two)
+    if(!saver.Begin(pack_name,
+                    SAVE_WAV ? wav_name : nullptr,
+                    mod * st.channels,
+                    st.position * st.channels,
+                    st.channels,
+                    &mix,
+                    BackgroundSaver::WavExport::SAVE_WAV_FORMAT))
     {
-        pos++;
-        pos %= mod;
+        oledManager.ShowMessage("Create failed", 1200);
+        return;
     }
+
+    // The thumbnail is taken now, from the loop as the snapshot starts
+    memset(&save_entry, 0, sizeof(save_entry));
+    save_entry.id          = id;
+    save_entry.length      = mod;
+    save_entry.sample_rate = (uint32_t)SAMPLE_RATE;
+    snprintf(save_entry.name, sizeof(save_entry.name), "%s", pack_name);
+    RenderTracks(st, mod, save_entry.thumb, kCatalogThumbSize);
+    oledManager.ShowProgress("Saving", 0);
 }
 
-// -----------------------------------------------------------------------------
-// Buttons (play/rec/reset)
-// -----------------------------------------------------------------------------
-static void UpdateButtons()
+// One chunk per step
+static bool SaveJob()
 {
-    // Button2: toggle REC/OD; auto-start PLAY on first press
-    if(pod.button2.RisingEdge())
+    static int last_pct = -1;
+
+    if(saver.Active())
     {
-        if(first && rec) // finished first take
+        const LoopStatus st = looper.Status();
+        saver.Step(st.position * st.channels);
+        const int pct = saver.Progress();
+        if(saver.Active() && pct != last_pct)
         {
-            first = false;
-            mod   = len;
-            len   = 0;
+            oledManager.ShowProgress("Saving", pct);
+            last_pct = pct;
         }
-
-        play = true;
-        rec  = !rec;
-
-        dsy_gpio_write(&rec_led, rec ? 1 : 0);
-        dsy_gpio_write(&play_led, 1);
     }
-
-    // Hold both buttons (>= 1s) to reset loop
-    if(pod.button1.TimeHeldMs() >= 1000
-       && pod.button2.TimeHeldMs() >= 1000
-       && play) // require we were in a session
+    else if(saver.GetState() == BackgroundSaver::State::IDLE)
     {
-        ResetBuffer();
+        return false;
     }
 
-    // Button1: Play/Pause (disabled if first && !rec to avoid empty play)
-    if(pod.button1.RisingEdge() && !(first && !rec))
+    switch(saver.GetState())
     {
-        play = !play;
-        rec  = false;
-        dsy_gpio_write(&rec_led, 0);
-        dsy_gpio_write(&play_led, play ? 1 : 0);
+        case BackgroundSaver::State::DONE:
+        {
+            char ok[24];
+            snprintf(ok, sizeof(ok), "Saved LOOP%u %d%%", (unsigned)save_entry.id, saver.Ratio());
+            oledManager.ShowStatus(ok);
+            save_entry.peak = saver.Peak();
+            if(!catalog.Add(save_entry))
+                oledManager.ShowMessage("Catalog failed", 1200);
+            saver.Acknowledge();
+            last_pct = -1;
+        }
+        break;
+        case BackgroundSaver::State::FAILED:
+            oledManager.ShowStatus("Save failed");
+            saver.Acknowledge();
+            last_pct = -1;
+            break;
+        default: break;
     }
+    return true;
 }
 
 // -----------------------------------------------------------------------------
-// Controls (encoder2 -> dry/wet)
+// Waveform strip: 128 columns of the loop's peaks and the playhead
 // -----------------------------------------------------------------------------
-static void Controls()
+static void UpdateOverview()
 {
-    pod.ProcessDigitalControls();
-
-    static int32_t enc_accum = 0;
-    enc_accum += pod.encoder2.Increment();
-    if(enc_accum < 0)   enc_accum = 0;
-    if(enc_accum > 100) enc_accum = 100;
+    // The first take is drawn as far as it got
+    const LoopStatus st  = looper.Status();
+    const size_t     len = st.first_take ? st.position : st.length;
+    if(st.streaming || len == 0)
+    {
+        oledManager.SetOverview(nullptr, 0);
+        return;
+    }
 
-    drywet = enc_accum / 100.0f;
+    static WavePeak cols[OledCanvas::kWidth];
+    RenderTracks(st, len, cols, OledCanvas::kWidth);
 
-    UpdateButtons();
+    // A recall still loading: only what's in so far
+    if(st.loading)
+    {
+        const size_t in = (size_t)((uint64_t)loader.Loaded() * OledCanvas::kWidth / len);
+        for(size_t c = in; c < OledCanvas::kWidth; c++)
+            cols[c].lo = cols[c].hi = 0;
+    }
+    oledManager.SetOverview(cols, (int)((uint64_t)st.position * OledCanvas::kWidth / len));
 }
 
 // -----------------------------------------------------------------------------
-// Save loop to WAV on SD
+// Recall a loop file (.LPK, .WAV or .BIN, see LoopLoader.h)
 // -----------------------------------------------------------------------------
-static void SaveBufferToWav()
+// Opens the file; LoadJob() reads it. Playback starts once the first
+// LOAD_PREBUFFER samples are in and the rest comes in behind it; the engine
+// holds the head if it ever catches up (see LoopEngine::SetLoaded()).
+void LoadLoopFile(const char* filename)
 {
-    if(file_counter > 10)
+    // A scan probes WAVs with the loader's reader
+    if(catalog.Scanning())
     {
-        oledManager.ShowMessage("Max files (10)", 1500);
+        oledManager.ShowMessage("Scan running", 1000);
         return;
     }
-    if(mod <= 0)
+
+    // Into a loop like the current one: a file with the other channel
+    // count is converted
+    switch(loader.Begin(filename, looper.Status().channels))
     {
-        oledManager.ShowMessage("No data", 1000);
-        return;
+        case LoopLoader::Result::OK: break;
+        case LoopLoader::Result::NOT_A_LOOP:
+            oledManager.ShowMessage("Not a loop file", 1200);
+            return;
+        case LoopLoader::Result::UNSUPPORTED:
+            oledManager.ShowMessage("Unsupported WAV", 1200);
+            return;
+        default: oledManager.ShowMessage("Open failed", 1200); return;
     }
 
-    char file_name[16];
-    snprintf(file_name, sizeof(file_name), "LOOP%d.WAV", file_counter);
-    oledManager.ShowMessage("Creating WAV...", 800);
+    if(looper.Status().streaming)
+        StopStreaming();
+    if(loader.Truncated())
+        oledManager.ShowMessage("Truncated", 800);
 
-    wav_writer.OpenFile(file_name);
-    oledManager.ShowMessage("Writing...", 500);
+    ResetBuffer();
 
-    for(int i = 0; i < mod; i++)
+    // An LPK1 file fills the loop out of order: all of it first
+    const size_t length = loader.Length();
+    load_prebuffer      = loader.Ordered() && length > LOAD_PREBUFFER
+                              ? LOAD_PREBUFFER
+                              : length;
+    looper.SetLoaded(0);
+    oledManager.ShowProgress("Load", 0);
+}
+
+// One chunk per step: the prebuffer (with a progress bar), the handover to
+// the engine, then the rest behind the playhead
+static bool LoadJob()
+{
+    static int last_pct = -1;
+
+    if(loader.Active())
     {
-        float s = buf[i];
-        if(i % (WAV_TRANSFER_SIZE / sizeof(float)) == 0)
+        loader.Step();
+        if(load_prebuffer == 0)
         {
-            wav_writer.Write();
+            looper.SetLoaded(loader.Loaded());
         }
-        wav_writer.Sample(&s);
+        else if(loader.Loaded() >= load_prebuffer || !loader.Active())
+        {
+            looper.SetLoaded(loader.Loaded());
+            looper.SetLoop(loader.Length());
+            load_prebuffer = 0;
+            last_pct       = -1;
+            if(loader.Active())
+                oledManager.ShowMessage("Playing, loading", 1000);
+        }
+        else
+        {
+            const int pct = loader.Ordered()
+                                ? (int)((uint64_t)loader.Loaded() * 100 / load_prebuffer)
+                                : loader.Progress();
+            if(pct != last_pct)
+            {
+                oledManager.ShowProgress("Load", pct);
+                last_pct = pct;
+            }
+        }
+    }
 
-        if(i % 4096 == 0)
+    char msg[24];
+    switch(loader.GetState())
+    {
+        case LoopLoader::State::DONE:
         {
-            char progress[24];
-            int  pct = (i * 100) / mod;
-            snprintf(progress, sizeof(progress), "Writing: %d%%", pct);
-            oledManager.ShowMessage(progress, 30);
+            // Stalls: audio blocks the playhead waited for the card
+            const uint32_t stalls = looper.Status().load_stalls;
+            if(loader.Damaged())
+                snprintf(msg, sizeof(msg), "%d bad frames", loader.Damaged());
+            else if(stalls)
+                snprintf(msg, sizeof(msg), "Load stalled %lu", (unsigned long)stalls);
+            else
+                snprintf(msg, sizeof(msg), "Loaded %d smp", (int)loader.Length());
+            oledManager.ShowMessage(msg, 1500);
+            loader.Acknowledge();
         }
+        break;
+        case LoopLoader::State::FAILED:
+            oledManager.ShowMessage("Load failed", 1200);
+            loader.Acknowledge();
+            break;
+        case LoopLoader::State::IDLE: return false;
+        default: break;
     }
-    wav_writer.Write();
-    oledManager.ShowMessage("Finalizing...", 800);
-    wav_writer.SaveFile();
+    return true;
+}
 
-    char ok[24];
-    snprintf(ok, sizeof(ok), "Saved %s", file_name);
-    oledManager.ShowMessage(ok, 1500);
-    file_counter++;
+// -----------------------------------------------------------------------------
+// Loop catalog (see LoopCatalog.h)
+// -----------------------------------------------------------------------------
+// Rate and length of a WAV found by a catalog scan: the header is all
+// that's read
+static bool ProbeWav(const char* name, uint32_t* rate, uint32_t* frames)
+{
+    return loader.ProbeWav(name, rate, frames);
+}
+
+// Save/Recall > Rescan: rebuild the catalog after files were copied to or
+// deleted from the card on a PC
+void RescanLoops()
+{
+    if(saver.Active())
+    {
+        oledManager.ShowMessage("Save running", 1000);
+        return;
+    }
+    if(loader.Active())
+    {
+        oledManager.ShowMessage("Still loading", 1000);
+        return;
+    }
+    if(catalog.Scanning())
+    {
+        oledManager.ShowMessage("Scan running", 1000);
+        return;
+    }
+    if(!catalog.BeginRescan())
+    {
+        oledManager.ShowMessage("Scan failed", 1200);
+        return;
+    }
+    oledManager.ShowMessage("Scanning SD...", 800);
+}
+
+// One directory entry per step
+static bool ScanJob()
+{
+    if(!catalog.Scanning())
+        return false;
+
+    char msg[24];
+    switch(catalog.StepRescan())
+    {
+        case LoopCatalog::Scan::DONE:
+            snprintf(msg, sizeof(msg), "%u loops", (unsigned)catalog.Count());
+            oledManager.ShowMessage(msg, 1200);
+            break;
+        case LoopCatalog::Scan::FAILED:
+            oledManager.ShowMessage("Scan failed", 1200);
+            break;
+        default: break;
+    }
+    return true;
 }
 
 // -----------------------------------------------------------------------------
-// Save loop to raw 16-bit PCM (.BIN)
+// Overdub undo/redo (Loop/Playback menu)
 // -----------------------------------------------------------------------------
-static void SaveBufferToBinary()
+void UndoLayer()
 {
-    if(file_counterb > 10)
+    if(saver.Active())
     {
-        oledManager.ShowMessage("Max files (10)", 1500);
+        oledManager.ShowMessage("Save running", 1000);
         return;
     }
-    if(mod <= 0)
+    const LoopStatus st = looper.Status();
+    if(st.recording)
     {
-        oledManager.ShowMessage("No data", 1000);
+        oledManager.ShowMessage("Stop rec first", 1000);
+        return;
+    }
+    if(st.layers_busy || st.layers.undoable == 0)
+    {
+        oledManager.ShowMessage("Nothing to undo", 800);
         return;
     }
+    looper.Undo();
+    oledManager.ShowMessage("Undo", 800);
+}
+
+void RedoLayer()
+{
+    if(saver.Active())
+    {
+        oledManager.ShowMessage("Save running", 1000);
+        return;
+    }
+    const LoopStatus st = looper.Status();
+    if(st.recording)
+    {
+        oledManager.ShowMessage("Stop rec first", 1000);
+        return;
+    }
+    if(st.layers_busy || st.layers.redoable == 0)
+    {
+        oledManager.ShowMessage("Nothing to redo", 800);
+        return;
+    }
+    looper.Redo();
+    oledManager.ShowMessage("Redo", 800);
+}
 
-    char file_name[16];
-    snprintf(file_name, sizeof(file_name), "LOOP%d.BIN", file_counterb);
-    oledManager.ShowMessage("Creating BIN...", 800);
+void ShowLayerStats()
+{
+    LayerManager::Stats st = looper.Status().layers;
 
-    if(f_open(&binary_file, file_name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+    char msg[24];
+    snprintf(msg, sizeof(msg), "U%u R%u L%u", (unsigned)st.undoable,
+             (unsigned)st.redoable, (unsigned)LayerManager::kMaxLayers);
+    oledManager.ShowMessage(msg, 1500);
+    snprintf(msg, sizeof(msg), "Mem %uk/%uk",
+             (unsigned)(st.used_bytes / 1024),
+             (unsigned)(st.capacity_bytes / 1024));
+    oledManager.ShowMessage(msg, 1500);
+    if(st.dropped > 0)
+    {
+        snprintf(msg, sizeof(msg), "Dropped %u", (unsigned)st.dropped);
+        oledManager.ShowMessage(msg, 1500);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Kernel benchmark (Settings menu): scalar vs vector cycles per block, the
+// track mix, the varispeed read head, then WAV export formats. More results
+// than the toast queue holds: they're written to BENCH.TXT, and only the
+// engine's own block size is shown.
+// -----------------------------------------------------------------------------
+void RunKernelBenchmark()
+{
+    FIL  file;
+    UINT bw;
+    if(f_open(&file, "BENCH.TXT", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
     {
         oledManager.ShowMessage("Create failed", 1200);
         return;
     }
 
-    const int CHUNK = 1024;
-    for(int i = 0; i < mod; i += CHUNK)
+    char line[96];
+    int  len   = snprintf(line, sizeof(line), "kernels, cycles per block\r\n"
+                                              "frames   scalar   vector\r\n");
+    bool saved = f_write(&file, line, len, &bw) == FR_OK;
+
+    static const size_t blocks[] = {4, 16, 48};
+    KernelBenchResult   engine_block = {};
+    for(size_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++)
     {
-        int n = (i + CHUNK <= mod) ? CHUNK : (mod - i);
-        for(int j = 0; j < n; j++)
-        {
-            float s = buf[i + j];
-            if(s > 1.0f)  s = 1.0f;
-            if(s < -1.0f) s = -1.0f;
-            binary_buffer[j] = (int16_t)(s * 32767.0f);
-        }
+        KernelBenchResult r = RunKernelBench(bench_buf, BENCH_SIZE, blocks[b], 20000);
+        if(r.block_frames == pod.AudioBlockSize())
+            engine_block = r;
+
+        len   = snprintf(line,
+                         sizeof(line),
+                         "%-8u %6d %8d\r\n",
+                         (unsigned)r.block_frames,
+                         (int)r.scalar_cycles,
+                         (int)r.vector_cycles);
+        saved = saved && f_write(&file, line, len, &bw) == FR_OK;
+    }
 
-        UINT written = 0;
-        FRESULT r = f_write(&binary_file, binary_buffer, n * sizeof(int16_t), &written);
-        if(r != FR_OK)
+    // Tracks: mix cycles per 48-frame block as tracks are added, fused
+    // (the engine's) and a pass per track
+    len   = snprintf(line, sizeof(line), "\r\ntracks, cycles per 48 frames\r\n"
+                                         "tracks   fused    separate\r\n");
+    saved = saved && f_write(&file, line, len, &bw) == FR_OK;
+    float one = 0.0f;
+    for(size_t t = 1; t <= kMaxTracks; t++)
+    {
+        const TrackBenchResult r = RunTrackBench(bench_buf, BENCH_SIZE, 48, t, 20000);
+        if(t == 1)
+            one = r.fused_cycles;
+
+        len   = snprintf(line,
+                         sizeof(line),
+                         "%-8u %5d %11d\r\n",
+                         (unsigned)r.tracks,
+                         (int)r.fused_cycles,
+                         (int)r.separate_cycles);
+        saved = saved && f_write(&file, line, len, &bw) == FR_OK;
+        if(t == kMaxTracks && t > 1)
         {
-            f_close(&binary_file);
-            oledManager.ShowMessage("Write error", 1200);
-            return;
+            len   = snprintf(line,
+                             sizeof(line),
+                             "+%d per track\r\n",
+                             (int)((r.fused_cycles - one) / (t - 1)));
+            saved = saved && f_write(&file, line, len, &bw) == FR_OK;
         }
+    }
 
-        char progress[24];
-        int  pct = ((i + n) * 100) / mod;
-        snprintf(progress, sizeof(progress), "Writing: %d%%", pct);
-        oledManager.ShowMessage(progress, 30);
+    // Varispeed read head: cycles per 48-frame block for each kernel
+    // (Linear, Hermite, Sinc), mono then stereo
+    len   = snprintf(line, sizeof(line), "\r\nread head, cycles per 48 frames\r\n"
+                                         "channels linear   hermite  sinc\r\n");
+    saved = saved && f_write(&file, line, len, &bw) == FR_OK;
+    for(size_t ch = 1; ch <= 2; ch++)
+    {
+        const InterpBenchResult r = RunInterpBench(48, ch, 20000);
+
+        len   = snprintf(line,
+                         sizeof(line),
+                         "%-8u %6d %9d %5d\r\n",
+                         (unsigned)r.channels,
+                         (int)r.cycles[static_cast<size_t>(Interp::LINEAR)],
+                         (int)r.cycles[static_cast<size_t>(Interp::HERMITE)],
+                         (int)r.cycles[static_cast<size_t>(Interp::SINC)]);
+        saved = saved && f_write(&file, line, len, &bw) == FR_OK;
     }
-    f_sync(&binary_file);
-    f_close(&binary_file);
 
-    char ok[24];
-    snprintf(ok, sizeof(ok), "Saved %s", file_name);
-    oledManager.ShowMessage(ok, 1500);
-    file_counterb++;
+    // WavWriter formats: cycles per sample, Store() / Convert(). Scratch
+    // comes out of bench_buf: 4096 floats in, up to 16 KB out.
+    float*   src = reinterpret_cast<float*>(bench_buf);
+    uint8_t* dst = reinterpret_cast<uint8_t*>(src + 4096);
+    const WavFormatBenchResult wr[] = {
+        RunWavFormatBench<WavFormatS16>(src, dst, 4096, 50),
+        RunWavFormatBench<WavFormatS24>(src, dst, 4096, 50),
+        RunWavFormatBench<WavFormatS32>(src, dst, 4096, 50),
+        RunWavFormatBench<WavFormatF32>(src, dst, 4096, 50),
+    };
+    static const char* names[] = {"S16", "S24", "S32", "F32"};
+    len   = snprintf(line, sizeof(line), "\r\nwav formats, cycles per sample\r\n"
+                                         "format   store    convert\r\n");
+    saved = saved && f_write(&file, line, len, &bw) == FR_OK;
+    for(size_t f = 0; f < 4; f++)
+    {
+        len   = snprintf(line,
+                         sizeof(line),
+                         "%-8s %3d.%d %8d.%d\r\n",
+                         names[f],
+                         (int)wr[f].store_cycles,
+                         (int)(wr[f].store_cycles * 10) % 10,
+                         (int)wr[f].convert_cycles,
+                         (int)(wr[f].convert_cycles * 10) % 10);
+        saved = saved && f_write(&file, line, len, &bw) == FR_OK;
+    }
+    saved = f_close(&file) == FR_OK && saved;
+
+    char msg[24];
+    snprintf(msg,
+             sizeof(msg),
+             "B%u S%d V%d",
+             (unsigned)engine_block.block_frames,
+             (int)engine_block.scalar_cycles,
+             (int)engine_block.vector_cycles);
+    oledManager.ShowMessage(msg, 2000);
+    oledManager.ShowMessage(saved ? "BENCH.TXT" : "Write failed", 1200);
 }
 
 // -----------------------------------------------------------------------------
-// Load raw 16-bit PCM (.BIN) into loop buffer
+// SD throughput per transfer size (Settings menu), also written to SDBENCH.TXT
 // -----------------------------------------------------------------------------
-static void LoadBinaryFile(const char* filename)
+// MB/s with one decimal, as "12.3"
+static int FormatMBps(char* dst, size_t n, uint32_t kbps)
 {
-    FIL     file;
-    UINT    bytesRead;
-    FRESULT result;
+    const uint32_t tenths = kbps * 10 / 1024;
+    return snprintf(dst, n, "%u.%u", (unsigned)(tenths / 10), (unsigned)(tenths % 10));
+}
 
-    if(f_open(&file, filename, FA_READ) != FR_OK)
+void RunSdBenchmark()
+{
+    if(saver.Active() || loader.Active() || looper.Status().streaming)
     {
-        oledManager.ShowMessage("Open failed", 1200);
+        oledManager.ShowMessage("SD busy", 1000);
         return;
     }
 
-    FSIZE_t file_size = f_size(&file);
-    int     sample_count = file_size / (FSIZE_t)sizeof(int16_t);
-    if(sample_count > MAX_SIZE)
+    static const size_t chunks[] = {512, 4096, 16384, 32768, 65536};
+    static const size_t kTotal   = 512 * 1024; // per size and direction
+
+    SdIo::BenchResult res[sizeof(chunks) / sizeof(chunks[0])];
+    size_t            count = 0;
+    for(size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++)
     {
-        sample_count = MAX_SIZE;
-        oledManager.ShowMessage("Truncated", 800);
+        oledManager.ShowProgress("SD bench", (int)(c * 100 / (sizeof(chunks) / sizeof(chunks[0]))));
+        if(!sdio.Bench("SDBENCH.TMP", chunks[c], kTotal, &res[count]))
+        {
+            oledManager.ShowMessage("Bench failed", 1200);
+            break;
+        }
+        count++;
     }
+    oledManager.ShowMessage(sdio.ModeName(), 1500);
+
+    FIL        file;
+    UINT       bw;
+    const bool opened = f_open(&file, "SDBENCH.TXT", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK;
+    bool       saved  = opened;
+    char       line[64];
+    int  len = snprintf(line, sizeof(line), "bus %s\r\nchunk   write MB/s  read MB/s\r\n", sdio.ModeName());
+    saved    = saved && f_write(&file, line, len, &bw) == FR_OK;
+    for(size_t c = 0; c < count; c++)
+    {
+        char w[12], r[12];
+        FormatMBps(w, sizeof(w), res[c].write_kbps);
+        FormatMBps(r, sizeof(r), res[c].read_kbps);
+
+        char msg[40];
+        if(res[c].chunk >= 1024)
+            snprintf(msg, sizeof(msg), "%uK W%s R%s", (unsigned)(res[c].chunk / 1024), w, r);
+        else
+            snprintf(msg, sizeof(msg), "%uB W%s R%s", (unsigned)res[c].chunk, w, r);
+        oledManager.ShowMessage(msg, 2000);
+
+        len   = snprintf(line, sizeof(line), "%-7u %10s %10s\r\n", (unsigned)res[c].chunk, w, r);
+        saved = saved && f_write(&file, line, len, &bw) == FR_OK;
+    }
+    if(opened)
+        f_close(&file);
+    if(!saved)
+        oledManager.ShowMessage("Write failed", 1200);
+}
 
-    ResetBuffer();
+// -----------------------------------------------------------------------------
+// Callback profiler (Settings menu): live page and a text dump on SD
+// -----------------------------------------------------------------------------
+void ShowProfilerPage()
+{
+    oledManager.ShowProfile(profiler.Read());
+}
 
-    static int16_t read_buffer[2048];
-    int total_read = 0;
+void ResetProfiler()
+{
+    profiler.Reset();
+    scheduler.ResetStats();
+}
 
-    while(total_read < sample_count)
+// Tenths of a microsecond, as "12.3"
+static int FormatUs(char* dst, size_t n, uint32_t ticks, uint32_t ticks_per_us)
+{
+    const uint32_t tenths = CallbackProfiler::TenthsUs(ticks, ticks_per_us);
+    return snprintf(dst, n, "%u.%u", (unsigned)(tenths / 10), (unsigned)(tenths % 10));
+}
+
+void SaveProfile()
+{
+    const CallbackProfiler::Stats st = profiler.Read();
+    static const char* names[] = {"record", "mix", "clamp", "stretch", "total"};
+
+    FIL  file;
+    UINT bw;
+    if(f_open(&file, "PROFILE.TXT", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
     {
-        int to_read       = (sample_count - total_read);
-        if(to_read > 256) to_read = 256;
+        oledManager.ShowMessage("Create failed", 1200);
+        return;
+    }
+
+    char line[128];
+    char budget[16];
+    FormatUs(budget, sizeof(budget), st.budget, st.ticks_per_us);
+    int len = snprintf(line,
+                       sizeof(line),
+                       "blocks %lu, overruns %lu, budget %s us\r\n"
+                       "stage    runs      min    mean     max (us)\r\n",
+                       (unsigned long)st.blocks,
+                       (unsigned long)st.overruns,
+                       budget);
+    FRESULT res = f_write(&file, line, len, &bw);
+
+    for(size_t s = 0; s < CallbackProfiler::kStages && res == FR_OK; s++)
+    {
+        const CallbackProfiler::StageStats& ss = st.stage[s];
+        char mn[16], mean[16], mx[16];
+        FormatUs(mn, sizeof(mn), ss.count ? ss.min : 0, st.ticks_per_us);
+        FormatUs(mean, sizeof(mean), CallbackProfiler::Mean(ss), st.ticks_per_us);
+        FormatUs(mx, sizeof(mx), ss.max, st.ticks_per_us);
+        len = snprintf(line,
+                       sizeof(line),
+                       "%-7s %6lu %8s %7s %7s\r\n",
+                       names[s],
+                       (unsigned long)ss.count,
+                       mn,
+                       mean,
+                       mx);
+        res = f_write(&file, line, len, &bw);
+    }
 
-        result = f_read(&file,
-                        read_buffer,
-                        to_read * (int)sizeof(int16_t),
-                        &bytesRead);
-        if(result != FR_OK) { break; }
-        if(bytesRead == 0)  { break; }
+    // Histograms: blocks per power-of-two bucket of ticks
+    len = snprintf(line, sizeof(line), "\r\nhistogram (ticks >= 2^n)\r\nstage  ");
+    for(size_t b = 0; b < CallbackProfiler::kBuckets; b++)
+        len += snprintf(line + len, sizeof(line) - len, " %d", (int)b + CallbackProfiler::kFirstBucket);
+    len += snprintf(line + len, sizeof(line) - len, "\r\n");
+    if(res == FR_OK)
+        res = f_write(&file, line, len, &bw);
 
-        int got = bytesRead / (int)sizeof(int16_t);
-        for(int i = 0; i < got && (total_read + i) < MAX_SIZE; i++)
+    for(size_t s = 0; s < CallbackProfiler::kStages && res == FR_OK; s++)
+    {
+        len = snprintf(line, sizeof(line), "%-7s", names[s]);
+        res = f_write(&file, line, len, &bw);
+        for(size_t b = 0; b < CallbackProfiler::kBuckets && res == FR_OK; b++)
         {
-            buf[total_read + i] = (float)read_buffer[i] / 32767.0f;
+            len = snprintf(line, sizeof(line), " %lu", (unsigned long)st.stage[s].hist[b]);
+            res = f_write(&file, line, len, &bw);
         }
-        total_read += got;
+        if(res == FR_OK)
+            res = f_write(&file, "\r\n", 2, &bw);
+    }
+
+    // Time-stretch: searches that weren't done by their hop
+    const LoopStatus ls = looper.Status();
+    len = snprintf(line,
+                   sizeof(line),
+                   "\r\nstretch hops %lu, late %lu\r\n",
+                   (unsigned long)ls.stretch.hops,
+                   (unsigned long)ls.stretch.late);
+    if(res == FR_OK)
+        res = f_write(&file, line, len, &bw);
+
+    // Autosave: what the journal wrote since boot (see SessionJournal.h)
+    const SessionJournal::Stats js = journal.GetStats();
+    len = snprintf(line,
+                   sizeof(line),
+                   "journal gen %lu, records %lu, %lu KB, compactions %lu, failed %lu\r\n",
+                   (unsigned long)js.generation,
+                   (unsigned long)js.records,
+                   (unsigned long)(js.bytes / 1024),
+                   (unsigned long)js.compactions,
+                   (unsigned long)js.failures);
+    if(res == FR_OK)
+        res = f_write(&file, line, len, &bw);
+
+    // Main loop: tasks (late = a period behind) and jobs (late = slices
+    // over budget)
+    len = snprintf(line,
+                   sizeof(line),
+                   "\r\ntask      runs    slices    max us  slice us   mean us   late\r\n");
+    if(res == FR_OK)
+        res = f_write(&file, line, len, &bw);
+    for(size_t i = 0; i < scheduler.Count() && res == FR_OK; i++)
+    {
+        const TaskScheduler::Stats ts = scheduler.GetStats(i);
+        len = snprintf(line,
+                       sizeof(line),
+                       "%-6s %7lu %9lu %9lu %9lu %9lu %6lu\r\n",
+                       ts.name,
+                       (unsigned long)ts.runs,
+                       (unsigned long)ts.slices,
+                       (unsigned long)ts.max_us,
+                       (unsigned long)ts.slice_us,
+                       (unsigned long)(ts.runs ? ts.total_us / ts.runs : 0),
+                       (unsigned long)ts.late);
+        res = f_write(&file, line, len, &bw);
+    }
+    f_close(&file);
+
+    oledManager.ShowMessage(res == FR_OK ? "Saved PROFILE" : "Write failed", 1200);
+}
+
+// -----------------------------------------------------------------------------
+// Autosave (see SessionJournal.h)
+// -----------------------------------------------------------------------------
+// Boot: the loop from the journal, stopped, with its tracks as they were
+static void RestoreSession()
+{
+    SessionJournal::Session s;
+    if(!journal.Replay(&s))
+        return;
+
+    if(looper.Status().channels != s.channels)
+    {
+        looper.SetChannels(s.channels);
+        looper.Sync();
+    }
+    looper.SetLoaded(s.length);
+    looper.Restore(s.length, s.used);
+    looper.Sync();
+
+    // A build with another buffer size lays the tracks out differently
+    const LoopStatus st = looper.Status();
+    if(st.length != s.length || st.stride != s.stride || st.tracks != s.planes)
+    {
+        ResetBuffer();
+        oledManager.ShowMessage("Restore failed", 1200);
+        return;
+    }
+    for(size_t t = 0; t < st.tracks; t++)
+    {
+        track_level[t] = s.level[t];
+        looper.SetTrackLevel(t, s.level[t]);
+        looper.MuteTrack(t, (s.muted >> t) & 1);
+        looper.ArmTrack(t, (s.armed >> t) & 1);
+    }
+    looper.Sync();
+
+    overview.Refresh(0, st.tracks * st.stride);
+    journal.Follow(st.loop_id);
+    oledManager.ShowMessage("Session restored", 1200);
+}
+
+// One record per step. Nothing is kept of a first take, a loop still
+// loading or a streamed loop; the record head's region waits until it
+// has moved on.
+static bool JournalJob()
+{
+    const LoopStatus        st = looper.Status();
+    SessionJournal::Session s  = {};
+    s.id                       = st.loop_id;
+
+    size_t hot = SIZE_MAX;
+    if(!st.first_take && !st.streaming && !st.loading && !loader.Active())
+    {
+        s.length   = st.length;
+        s.channels = st.channels;
+        s.stride   = st.stride;
+        s.planes   = st.tracks;
+        s.used     = st.used;
+        s.muted    = st.muted;
+        s.armed    = st.armed;
+        for(size_t t = 0; t < kMaxTracks; t++)
+            s.level[t] = st.level[t];
+        if(st.recording)
+            hot = (st.position + st.length - st.latency % st.length) % st.length * st.channels;
+    }
+    return journal.Step(s, hot, System::GetNow());
+}
+
+// -----------------------------------------------------------------------------
+// Round-trip latency (Settings > Latency, see LatencyProbe.h)
+// -----------------------------------------------------------------------------
+// Overdubs are written this many samples behind the play head. Measured
+// with the output patched back to the input, kept on the card.
+void CalibrateLatency()
+{
+    const LoopStatus st = looper.Status();
+    if(st.recording)
+    {
+        oledManager.ShowMessage("Stop rec first", 1000);
+        return;
+    }
+    if(st.streaming)
+    {
+        oledManager.ShowMessage("Stream is on", 1000);
+        return;
+    }
+    if(st.loading || loader.Active())
+    {
+        oledManager.ShowMessage("Still loading", 1000);
+        return;
+    }
+    if(calibrating)
+        return;
+
+    oledManager.ShowMessage("Patch out to in", 1200);
+    looper.Calibrate();
+    looper.Sync(); // the probe is running, Status() says so from here on
+    calibrating = true;
+}
+
+static void SaveLatency(uint32_t samples)
+{
+    FIL  file;
+    UINT bw;
+    if(f_open(&file, LATENCY_FILE, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+        return;
+    char      line[16];
+    const int len = snprintf(line, sizeof(line), "%lu\r\n", (unsigned long)samples);
+    f_write(&file, line, len, &bw);
+    f_close(&file);
+}
+
+// Boot: the last calibration, if there was one
+static void LoadLatency()
+{
+    FIL  file;
+    UINT br = 0;
+    if(f_open(&file, LATENCY_FILE, FA_READ) != FR_OK)
+        return;
+    char line[16];
+    const FRESULT res = f_read(&file, line, sizeof(line) - 1, &br);
+    f_close(&file);
+    if(res != FR_OK || br == 0)
+        return;
+    line[br] = 0;
+    looper.SetLatency(strtoul(line, nullptr, 10));
+}
+
+// UI rate: report a calibration once it's over
+static void CheckCalibration()
+{
+    if(!calibrating)
+        return;
+    const LoopStatus st = looper.Status();
+    if(st.calibrating)
+        return;
+    calibrating = false;
+
+    if(st.probed < 0)
+    {
+        oledManager.ShowMessage("No signal back", 1500);
+        return;
+    }
+    SaveLatency(st.latency);
+
+    char msg[24];
+    snprintf(msg, sizeof(msg), "Latency %lu smp", (unsigned long)st.latency);
+    oledManager.ShowMessage(msg, 1500);
+    const unsigned tenths = (unsigned)((uint64_t)st.latency * 10000 / (uint32_t)SAMPLE_RATE);
+    snprintf(msg, sizeof(msg), "= %u.%u ms", tenths / 10, tenths % 10);
+    oledManager.ShowMessage(msg, 1500);
+}
+
+// -----------------------------------------------------------------------------
+// Tracks (Loop/Playback > Tracks, see LoopEngine.h)
+// -----------------------------------------------------------------------------
+// Press on a track: play -> armed (overdubs go to it) -> muted -> play
+void CycleTrack(int track)
+{
+    const LoopStatus st  = looper.Status();
+    const uint32_t   bit = 1u << track;
+    if(st.armed & bit)
+    {
+        looper.ArmTrack(track, false);
+        looper.MuteTrack(track, true);
+    }
+    else if(st.muted & bit)
+    {
+        looper.MuteTrack(track, false);
+    }
+    else if(st.first_take && track > 0)
+    {
+        oledManager.ShowMessage("Record track 1", 1000);
+    }
+    else if((size_t)track >= st.tracks)
+    {
+        oledManager.ShowMessage("Loop too long", 1000);
+    }
+    else if((size_t)track >= st.tracks_ready)
+    {
+        oledManager.ShowMessage("Clearing track", 1000);
+    }
+    else
+    {
+        looper.ArmTrack(track, true);
+    }
+    looper.Sync(); // the page shows the new state at once
+}
+
+// One row of the Tracks page, e.g. "2 ARM   80%"
+void DescribeTrack(int track, char* text, size_t size)
+{
+    const LoopStatus st  = looper.Status();
+    const uint32_t   bit = 1u << track;
+    const char*      mode;
+    if((size_t)track >= st.tracks)
+        mode = "--";
+    else if((size_t)track >= st.tracks_ready)
+        mode = "clear";
+    else if(st.armed & bit)
+        mode = "ARM";
+    else if(st.muted & bit)
+        mode = "MUTE";
+    else if(!(st.used & bit))
+        mode = "empty";
+    else
+        mode = "play";
+    snprintf(text, size, "%d %-5s %3d%%", track + 1, mode, (int)st.level[track]);
+}
+
+static void NudgeTrackLevel(int track, int32_t inc)
+{
+    if(inc == 0)
+        return;
+    int32_t level = track_level[track] + inc * 5;
+    if(level < 0)   level = 0;
+    if(level > 100) level = 100;
+    if(level != track_level[track])
+    {
+        track_level[track] = level;
+        looper.SetTrackLevel(track, level);
+    }
+}
 
-        if((total_read % 1024) == 0 || total_read >= (int)(0.9f * sample_count))
+// Waveform of the tracks that are heard, drawn over each other ('len' frames)
+static void RenderTracks(const LoopStatus& st, size_t len, WavePeak* out, size_t columns)
+{
+    WavePeak cols[OledCanvas::kWidth];
+    for(size_t c = 0; c < columns; c++)
+        out[c].lo = out[c].hi = 0;
+    for(size_t t = 0; t < st.tracks; t++)
+    {
+        if(!(st.used & (1u << t)) || (st.muted & (1u << t)))
+            continue;
+        const size_t at = t * st.stride;
+        overview.Render(at, at + len * st.channels, cols, columns);
+        for(size_t c = 0; c < columns; c++)
         {
-            char progress[24];
-            int  pct = (total_read * 100) / sample_count;
-            snprintf(progress, sizeof(progress), "Load: %d%%", pct);
-            oledManager.ShowMessage(progress, 10);
+            if(cols[c].lo < out[c].lo) out[c].lo = cols[c].lo;
+            if(cols[c].hi > out[c].hi) out[c].hi = cols[c].hi;
         }
     }
-    f_close(&file);
+}
 
-    first = false;
-    mod   = total_read;
-    len   = 0;
+// -----------------------------------------------------------------------------
+// Streamed loops (Loop/Playback > Stream): the loop lives in STREAM.RAW
+// -----------------------------------------------------------------------------
+static void StopStreaming()
+{
+    looper.SetStreaming(false);
+    looper.Sync();
+    stream.Close();
+}
+
+// Read-ahead/write-behind on the card
+static bool StreamJob()
+{
+    return stream.Service();
+}
+
+void ToggleStreaming()
+{
+    if(looper.Status().streaming)
+    {
+        StopStreaming();
+        oledManager.ShowMessage("Stream off", 1000);
+        return;
+    }
+    if(saver.Active())
+    {
+        oledManager.ShowMessage("Save running", 1000);
+        return;
+    }
+    if(loader.Active())
+    {
+        oledManager.ShowMessage("Still loading", 1000);
+        return;
+    }
+
+    // First time on a card this allocates the whole file
+    oledManager.ShowStatus("Preparing SD...");
+    if(!stream.IsOpen() && !stream.Open(STREAM_FILE, STREAM_SIZE))
+    {
+        oledManager.ShowMessage("Stream failed", 1500);
+        return;
+    }
+    looper.SetStreaming(true);
+    looper.Sync();
+
+    // A stereo loop takes twice the file per minute
+    char msg[24];
+    snprintf(msg, sizeof(msg), "Stream %d min",
+             STREAM_MINUTES / (int)looper.Status().channels);
+    oledManager.ShowMessage(msg, 1000);
+}
+
+void ShowStreamStats()
+{
+    const DiskStream::Stats st = stream.GetStats();
+    const unsigned          ms = SAMPLE_RATE / 1000 * looper.Status().channels;
 
     char msg[32];
-    snprintf(msg, sizeof(msg), "Loaded %d smp", total_read);
+    snprintf(msg, sizeof(msg), "Under %u Err %u", (unsigned)st.underruns,
+             (unsigned)st.errors);
+    oledManager.ShowMessage(msg, 1500);
+    if(st.lead_min != UINT32_MAX)
+    {
+        // SD latency margin: audio loaded ahead of the head, lowest seen
+        // (stream samples: 'ms' counts both channels of a stereo loop)
+        snprintf(msg, sizeof(msg), "Lead min %ums", (unsigned)(st.lead_min / ms));
+        oledManager.ShowMessage(msg, 1500);
+    }
+    snprintf(msg, sizeof(msg), "Rd %ums Wr %ums", (unsigned)(st.read_us_max / 1000),
+             (unsigned)(st.write_us_max / 1000));
     oledManager.ShowMessage(msg, 1500);
+}
 
-    if(total_read > 0)
+// -----------------------------------------------------------------------------
+// Stereo loops (Loop/Playback > Stereo): interleaved in buf[], see LoopEngine.h
+// -----------------------------------------------------------------------------
+void ToggleStereo()
+{
+    if(saver.Active())
+    {
+        oledManager.ShowMessage("Save running", 1000);
+        return;
+    }
+    if(loader.Active())
     {
-        play = true;
-        dsy_gpio_write(&play_led, 1);
+        oledManager.ShowMessage("Still loading", 1000);
+        return;
     }
+
+    // Starts an empty loop, in buf[] or on the stream
+    const bool stereo = looper.Status().channels == 1;
+    looper.SetChannels(stereo ? 2 : 1);
+    looper.Sync();
+    oledManager.ShowMessage(stereo ? "Stereo" : "Mono", 1000);
+}
+
+// -----------------------------------------------------------------------------
+// Playback speed and tempo (Loop/Playback > Speed): see LoopEngine.h,
+// "Speed" and "Tempo"
+// -----------------------------------------------------------------------------
+static const char* const interp_names[kInterpKinds] = {"Linear", "Hermite", "Sinc"};
+
+// Speed in hundredths of 1x, as the page shows it
+static int32_t SpeedPercent(int32_t speed)
+{
+    const int32_t half = speed < 0 ? -kInterpOne / 2 : kInterpOne / 2;
+    return (speed * 100 + half) / kInterpOne;
+}
+
+static void SetSpeedPercent(int32_t percent)
+{
+    const LoopStatus st = looper.Status();
+    if(st.recording)
+    {
+        oledManager.ShowMessage("Recording", 800);
+        return;
+    }
+    looper.SetSpeed(percent * kInterpOne / 100);
+}
+
+// Tempo in percent, as the page shows it
+static int32_t TempoPercent(int32_t tempo)
+{
+    return (tempo * 100 + kInterpOne / 2) / kInterpOne;
+}
+
+static void SetTempoPercent(int32_t percent)
+{
+    const LoopStatus st = looper.Status();
+    if(st.recording)
+    {
+        oledManager.ShowMessage("Recording", 800);
+        return;
+    }
+    looper.SetTempo(percent * kInterpOne / 100);
+}
+
+// The preset after 'now' in 'presets' (the first from anywhere else)
+static int32_t NextPreset(const int32_t* presets, size_t count, int32_t now)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        if(presets[i] == now)
+            return presets[(i + 1) % count];
+    }
+    return presets[0];
+}
+
+// Press on the speed: 1x -> 1/2 -> 2x -> reverse -> 1x (from anywhere else,
+// back to 1x). Press on the tempo: 100% -> 75% -> 150% -> 100%. Press on
+// the kernel: the next one.
+void CycleSpeed(int row)
+{
+    const LoopStatus st = looper.Status();
+    if(row == 0)
+    {
+        static const int32_t presets[] = {100, 50, 200, -100};
+        SetSpeedPercent(NextPreset(presets, 4, SpeedPercent(st.speed)));
+    }
+    else if(row == 1)
+    {
+        static const int32_t presets[] = {100, 75, 150};
+        SetTempoPercent(NextPreset(presets, 3, TempoPercent(st.tempo)));
+    }
+    else
+    {
+        const size_t kind = (static_cast<size_t>(st.interp) + 1) % kInterpKinds;
+        looper.SetInterpolation(static_cast<Interp>(kind));
+    }
+    looper.Sync(); // the page shows the new state at once
+}
+
+// A row of the Speed page: "Speed -0.50x", "Tempo 150%", "Interp Hermite"
+void DescribeSpeed(int row, char* text, size_t size)
+{
+    const LoopStatus st = looper.Status();
+    if(row == 0)
+    {
+        const int32_t pct = SpeedPercent(st.speed);
+        const int32_t mag = pct < 0 ? -pct : pct;
+        snprintf(text, size, "Speed %c%d.%02dx", pct < 0 ? '-' : '+',
+                 (int)(mag / 100), (int)(mag % 100));
+    }
+    else if(row == 1)
+    {
+        snprintf(text, size, "Tempo %d%%", (int)TempoPercent(st.tempo));
+    }
+    else
+    {
+        snprintf(text, size, "Interp %s", interp_names[static_cast<size_t>(st.interp)]);
+    }
+}
+
+// Encoder2 on the Speed page: 1% per detent, through 0 into reverse
+static void NudgeSpeed(int32_t inc)
+{
+    if(inc == 0)
+        return;
+    const int32_t max = LoopEngine::kMaxSpeed * 100 / kInterpOne;
+    int32_t       pct = SpeedPercent(looper.Status().speed) + inc;
+    if(pct < -max) pct = -max;
+    if(pct > max)  pct = max;
+    SetSpeedPercent(pct);
+}
+
+// Encoder2 on the tempo: 1% per detent, 50% to 200%
+static void NudgeTempo(int32_t inc)
+{
+    if(inc == 0)
+        return;
+    const int32_t lo  = TimeStretch::kMinTempo * 100 / kInterpOne;
+    const int32_t hi  = TimeStretch::kMaxTempo * 100 / kInterpOne;
+    int32_t       pct = TempoPercent(looper.Status().tempo) + inc;
+    if(pct < lo) pct = lo;
+    if(pct > hi) pct = hi;
+    SetTempoPercent(pct);
 }